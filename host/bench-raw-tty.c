@@ -0,0 +1,179 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* benchmark, on real hardware: loopback throughput and round trip latency
+ * through the serial port tty of the firmware, against its vendor specific
+ * interface through usbfs (usbraw.h); the firmware must be built with
+ * USB_CDCACM_VENDOR_INTERFACE=1
+ *
+ * usage: bench-raw-tty [tty device, default /dev/ttyACM0]
+ *
+ * the serial port echo has ">>>" markers inserted after each chunk, which are
+ * skipped; the data sent never contains '>' or '!' */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "usbraw.h"
+
+enum
+{
+	STREAM_BYTES	= 1 << 20,
+	MESSAGES	= 1000,
+	MESSAGE_SIZE	= 32,
+	TIMEOUT_MS	= 1000,
+	DEPTH		= 8,
+	URB_SIZE	= 4096,
+};
+
+static uint8_t stream[STREAM_BYTES];
+
+struct check
+{
+	size_t		received, len;
+	bool		is_marked;
+};
+
+/* checks echoed data against the stream; returns 1 when all of it is in, -1
+ * on bad data */
+static int check_echo(void * context, const uint8_t * data, unsigned len)
+{
+	struct check * c = context;
+	unsigned i;
+
+	for (i = 0; i < len; i ++)
+		if (c->is_marked && data[i] == '>')
+			continue;
+		else if (c->received == c->len || data[i] != stream[c->received ++])
+			return -1;
+	return c->received == c->len;
+}
+
+static double now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, & t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/* streams 'len' bytes through the tty, writing and reading as the tty lets it */
+static int tty_stream(int fd, size_t len)
+{
+	struct check c = { .len = len, .is_marked = true, };
+	struct pollfd p = { .fd = fd, };
+	uint8_t buf[4096];
+	size_t written = 0;
+	ssize_t n;
+	int done = 0;
+
+	while (!done)
+	{
+		p.events = POLLIN | (written < len ? POLLOUT : 0);
+		if (poll(& p, 1, TIMEOUT_MS) <= 0)
+			return -ETIMEDOUT;
+		if ((p.revents & POLLOUT) && (n = write(fd, stream + written, len - written)) > 0)
+			written += n;
+		if ((p.revents & POLLIN) && (n = read(fd, buf, sizeof buf)) > 0)
+			if ((done = check_echo(& c, buf, n)) < 0)
+				return -EIO;
+	}
+	return 0;
+}
+
+static void report(const char * path, const char * what, double seconds, double bytes_or_messages)
+{
+	if (!strcmp(what, "throughput"))
+		printf("%-8s %-12s %12.0f bytes/s\n", path, what, bytes_or_messages / seconds);
+	else
+		printf("%-8s %-12s %12.1f us\n", path, what, 1e6 * seconds / bytes_or_messages);
+}
+
+int main(int argc, char ** argv)
+{
+	const char * tty = argc > 1 ? argv[1] : "/dev/ttyACM0";
+	struct termios t;
+	struct usbraw r;
+	struct check c;
+	double start;
+	int fd, i, result;
+	size_t j;
+
+	for (j = 0; j < sizeof stream; j ++)
+		stream[j] = 'a' + j % 26;
+
+	if ((fd = open(tty, O_RDWR | O_NOCTTY | O_NONBLOCK)) < 0 || tcgetattr(fd, & t))
+	{
+		perror(tty);
+		return EXIT_FAILURE;
+	}
+	cfmakeraw(& t);
+	tcsetattr(fd, TCSANOW, & t);
+	tcflush(fd, TCIOFLUSH);
+	start = now();
+	if ((result = tty_stream(fd, STREAM_BYTES)))
+		goto tty_failed;
+	report("tty", "throughput", now() - start, STREAM_BYTES);
+	start = now();
+	for (i = 0; i < MESSAGES; i ++)
+		if ((result = tty_stream(fd, MESSAGE_SIZE)))
+			goto tty_failed;
+	report("tty", "round trip", now() - start, MESSAGES);
+	close(fd);
+
+	if ((result = usbraw_open_usbfs(& r, DEPTH, URB_SIZE)))
+	{
+		fprintf(stderr, "usbfs: %s\n", strerror(-result));
+		return EXIT_FAILURE;
+	}
+	start = now();
+	c = (struct check) { .len = STREAM_BYTES, };
+	if ((result = usbraw_stream(& r, stream, STREAM_BYTES, check_echo, & c, TIMEOUT_MS)))
+		goto usbfs_failed;
+	report("usbfs", "throughput", now() - start, STREAM_BYTES);
+	start = now();
+	for (i = 0; i < MESSAGES; i ++)
+	{
+		c = (struct check) { .len = MESSAGE_SIZE, };
+		if ((result = usbraw_stream(& r, stream, MESSAGE_SIZE, check_echo, & c, TIMEOUT_MS)))
+			goto usbfs_failed;
+	}
+	report("usbfs", "round trip", now() - start, MESSAGES);
+	usbraw_close(& r);
+	return EXIT_SUCCESS;
+
+tty_failed:
+	fprintf(stderr, "%s: %s\n", tty, strerror(-result));
+	return EXIT_FAILURE;
+usbfs_failed:
+	fprintf(stderr, "usbfs: %s\n", strerror(-result));
+	usbraw_close(& r);
+	return EXIT_FAILURE;
+}
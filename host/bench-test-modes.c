@@ -0,0 +1,166 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* benchmark, on real hardware: the throughput of each direction of a serial
+ * port on its own, with the firmware test modes (see usb-cdc-acm.c), which
+ * are selected through the baud rate; the PRBS mode streams a PRBS-31
+ * sequence both ways, and the sequence received is checked here - the one
+ * sent is checked by the firmware, whose error count is in its statistics
+ *
+ * usage: bench-test-modes [tty device, default /dev/ttyACM0] */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "prbs.h"
+
+enum
+{
+	STREAM_BYTES	= 16 << 20,
+	TIMEOUT_MS	= 1000,
+};
+
+static const struct mode
+{
+	const char	* name;
+	speed_t		speed;
+	bool		is_out, is_in;
+}
+modes[] =
+{
+	/* the baud rates the firmware test modes are selected with */
+	{ "prbs", B110, true, true, },
+	{ "sink", B75, true, false, },
+	{ "source", B50, false, true, },
+};
+
+static double now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, & t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static int set_speed(int fd, speed_t speed)
+{
+	struct termios t;
+
+	if (tcgetattr(fd, & t))
+		return -errno;
+	cfmakeraw(& t);
+	cfsetspeed(& t, speed);
+	if (tcsetattr(fd, TCSANOW, & t))
+		return -errno;
+	return 0;
+}
+
+/* runs a mode, writing and reading as the tty lets it; the data written is
+ * the PRBS sequence, for the sink as well; returns 0, or a negative error
+ * code */
+static int run(int fd, const struct mode * m, double * out_seconds, double * in_seconds, unsigned * errors)
+{
+	struct pollfd p = { .fd = fd, };
+	struct prbs_checker checker;
+	uint8_t out[4096], in[4096];
+	size_t out_len = 0, out_offset = 0;
+	size_t written = m->is_out ? 0 : STREAM_BYTES, received = m->is_in ? 0 : STREAM_BYTES;
+	uint32_t prbs = PRBS_SEED;
+	double start = now();
+	ssize_t n;
+
+	prbs_checker_reset(& checker);
+	* errors = 0;
+	while (written < STREAM_BYTES || received < STREAM_BYTES)
+	{
+		p.events = (received < STREAM_BYTES ? POLLIN : 0) | (written < STREAM_BYTES ? POLLOUT : 0);
+		if (poll(& p, 1, TIMEOUT_MS) <= 0)
+			return -ETIMEDOUT;
+		if (p.revents & POLLOUT)
+		{
+			if (out_offset == out_len)
+			{
+				prbs_generate(& prbs, out, sizeof out);
+				out_len = sizeof out;
+				out_offset = 0;
+			}
+			if ((n = write(fd, out + out_offset, out_len - out_offset)) > 0)
+			{
+				out_offset += n;
+				if ((written += n) >= STREAM_BYTES)
+					* out_seconds = now() - start;
+			}
+		}
+		if ((p.revents & POLLIN) && (n = read(fd, in, sizeof in)) > 0)
+		{
+			if (m->speed == B110)
+				* errors += prbs_check(& checker, in, n);
+			if ((received += n) >= STREAM_BYTES)
+				* in_seconds = now() - start;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char ** argv)
+{
+	const char * tty = argc > 1 ? argv[1] : "/dev/ttyACM0";
+	int fd, i, result;
+
+	if ((fd = open(tty, O_RDWR | O_NOCTTY | O_NONBLOCK)) < 0)
+	{
+		perror(tty);
+		return EXIT_FAILURE;
+	}
+	printf("%-8s %14s %14s %12s\n", "mode", "out bytes/s", "in bytes/s", "in errors");
+	for (i = 0; i < (int) (sizeof modes / sizeof * modes); i ++)
+	{
+		const struct mode * m = modes + i;
+		double out_seconds = 0, in_seconds = 0;
+		unsigned errors;
+
+		if (!(result = set_speed(fd, m->speed)))
+		{
+			tcflush(fd, TCIOFLUSH);
+			result = run(fd, m, & out_seconds, & in_seconds, & errors);
+		}
+		if (result)
+		{
+			fprintf(stderr, "%s: %s: %s\n", tty, m->name, strerror(-result));
+			return EXIT_FAILURE;
+		}
+		printf("%-8s %14.0f %14.0f %12u\n", m->name, m->is_out ? STREAM_BYTES / out_seconds : 0,
+				m->is_in ? STREAM_BYTES / in_seconds : 0, errors);
+	}
+	/* back to the loopback */
+	set_speed(fd, B9600);
+	close(fd);
+	return EXIT_SUCCESS;
+}
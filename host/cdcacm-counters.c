@@ -0,0 +1,171 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* reads the performance counters of the firmware (see cdcacm-counters.h) at
+ * a fixed rate, with a vendor request on the default control endpoint - so
+ * the serial ports can be in use meanwhile - and prints the rates of the
+ * counts over each interval, and the high-water marks and maxima of the
+ * interval; vendor requests are passed to the device by usbfs even with the
+ * interfaces bound to the kernel serial driver
+ *
+ * usage: cdcacm-counters [interval in milliseconds, default 1000] */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <linux/usb/ch9.h>
+#include <linux/usbdevice_fs.h>
+
+#include "usbraw.h"
+#include "cdcacm-counters.h"
+#include "cdcacm-requests.h"
+
+enum
+{
+	TIMEOUT_MS	= 1000,
+};
+
+/* the first communications class interface - the control interface of the
+ * first serial port - that the request is addressed to */
+static int find_control_interface(const uint8_t * d, int len)
+{
+	int i;
+
+	for (i = 0; i + 1 < len && d[i] >= 2; i += d[i])
+		if (d[i + 1] == USB_DT_INTERFACE && i + USB_DT_INTERFACE_SIZE <= len && d[i + 5] == USB_CLASS_COMM)
+			return d[i + 2];
+	return -1;
+}
+
+static int read_counters(int fd, unsigned interface, struct cdcacm_counters * c)
+{
+	struct usbdevfs_ctrltransfer req =
+	{
+		.bRequestType	= USB_DIR_IN | USB_TYPE_VENDOR | USB_RECIP_INTERFACE,
+		.bRequest	= CDCACM_REQ_GET_COUNTERS,
+		.wValue		= 0,
+		.wIndex		= interface,
+		.wLength	= sizeof * c,
+		.timeout	= TIMEOUT_MS,
+		.data		= c,
+	};
+	int len = ioctl(fd, USBDEVFS_CONTROL, & req);
+
+	if (len < 0)
+		return -errno;
+	return len == sizeof * c ? 0 : -EPROTO;
+}
+
+static double us(uint32_t cycles, uint32_t cpu_hz)
+{
+	return cpu_hz ? 1e6 * cycles / cpu_hz : 0;
+}
+
+static void print_interval(const struct cdcacm_counters * a, const struct cdcacm_counters * b, double seconds)
+{
+	unsigned i, dir;
+
+	printf("%-10s %14s %14s %10s\n", "endpoint", "packets/s", "bytes/s", "naks/s");
+	for (i = 1; i < CDCACM_COUNTERS_ENDPOINTS; i ++)
+		for (dir = 0; dir < 2; dir ++)
+		{
+			const struct cdcacm_endpoint_counters * x = & a->endpoints[i][dir], * y = & b->endpoints[i][dir];
+
+			/* the differences of the counts, which wrap around */
+			if (y->packets == x->packets && y->naks == x->naks)
+				continue;
+			printf("%-2u %-7s %14.0f %14.0f %10.0f\n", i, dir ? "in" : "out",
+					(uint32_t) (y->packets - x->packets) / seconds,
+					(uint32_t) (y->bytes - x->bytes) / seconds,
+					(uint32_t) (y->naks - x->naks) / seconds);
+		}
+	printf("%-10s %14s %14s\n", "port", "rx high", "tx high");
+	for (i = 0; i < CDCACM_COUNTERS_PORTS; i ++)
+		if (b->rx_high_water[i] || b->tx_high_water[i])
+			printf("%-10u %14u %14u\n", i, (unsigned) b->rx_high_water[i], (unsigned) b->tx_high_water[i]);
+	printf("main loop %.0f/s, services %.0f/s, longest service %.1f us, longest service latency %.1f us\n\n",
+			(uint32_t) (b->main_loop_iterations - a->main_loop_iterations) / seconds,
+			(uint32_t) (b->services - a->services) / seconds,
+			us(b->max_service_cycles, b->cpu_hz), us(b->max_service_latency, b->cpu_hz));
+	fflush(stdout);
+}
+
+static void timespec_add_ms(struct timespec * t, unsigned ms)
+{
+	t->tv_nsec += (long) (ms % 1000) * 1000000;
+	t->tv_sec += ms / 1000 + t->tv_nsec / 1000000000;
+	t->tv_nsec %= 1000000000;
+}
+
+static double timespec_diff(const struct timespec * a, const struct timespec * b)
+{
+	return (b->tv_sec - a->tv_sec) + (b->tv_nsec - a->tv_nsec) / 1e9;
+}
+
+int main(int argc, char ** argv)
+{
+	unsigned interval_ms = argc > 1 ? strtoul(argv[1], 0, 0) : 1000;
+	struct cdcacm_counters counters[2];
+	struct timespec times[2], due;
+	uint8_t descriptors[1024];
+	int fd, len, interface, result;
+	unsigned n;
+
+	if (!interval_ms)
+	{
+		fprintf(stderr, "usage: %s [interval in milliseconds]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	if ((fd = usbraw_usbfs_open_device(descriptors, sizeof descriptors, & len)) < 0)
+	{
+		fprintf(stderr, "opening the device failed: %s\n", strerror(-fd));
+		return EXIT_FAILURE;
+	}
+	if ((interface = find_control_interface(descriptors, len)) < 0)
+	{
+		fprintf(stderr, "the device has no serial port\n");
+		return EXIT_FAILURE;
+	}
+	/* the first reading only resets the high-water marks and the maxima */
+	clock_gettime(CLOCK_MONOTONIC, & due);
+	for (n = 0;; n ++)
+	{
+		struct cdcacm_counters * c = counters + n % 2;
+		struct timespec * t = times + n % 2;
+
+		if ((result = read_counters(fd, interface, c)))
+		{
+			fprintf(stderr, "reading the counters failed: %s\n", strerror(-result));
+			return EXIT_FAILURE;
+		}
+		clock_gettime(CLOCK_MONOTONIC, t);
+		if (n)
+			print_interval(counters + (n - 1) % 2, c, timespec_diff(times + (n - 1) % 2, t));
+		/* at a fixed rate, however long the printing takes */
+		timespec_add_ms(& due, interval_ms);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, & due, 0) == EINTR)
+			;
+	}
+}
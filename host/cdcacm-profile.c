@@ -0,0 +1,187 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* runs the sampling profiler of the firmware (see src/profiler.h) for a
+ * while, draining its samples with vendor requests on the default control
+ * endpoint - so the serial ports can be in use meanwhile - and prints a flat
+ * profile of them, symbolized against the firmware elf file; the firmware
+ * must be built with 'make PROFILER=1'
+ *
+ * usage: cdcacm-profile [-r rate in Hz] [-s seconds] [-n lines] [usb-cdc-acm.elf]
+ *
+ * the profile is only as right as the elf file is - it must be the one the
+ * device runs */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/usb/ch9.h>
+#include <linux/usbdevice_fs.h>
+
+#include "usbraw.h"
+#include "flat-profile.h"
+#include "profiler.h"
+#include "cdcacm-requests.h"
+
+enum
+{
+	TIMEOUT_MS	= 1000,
+	/* the samples are drained every this many milliseconds; the device
+	 * holds a few hundred of them */
+	DRAIN_MS	= 10,
+	READ_SIZE	= 4096,
+};
+
+static int fd;
+static unsigned interface;
+
+/* the requests go to the first serial port, whichever it is */
+static int find_control_interface(const uint8_t * d, int len)
+{
+	int i;
+
+	for (i = 0; i + 1 < len && d[i] >= 2; i += d[i])
+		if (d[i + 1] == USB_DT_INTERFACE && i + USB_DT_INTERFACE_SIZE <= len && d[i + 5] == USB_CLASS_COMM)
+			return d[i + 2];
+	return -1;
+}
+
+static int vendor_request(uint8_t request, uint16_t value, void * data, uint16_t len)
+{
+	struct usbdevfs_ctrltransfer req =
+	{
+		.bRequestType	= (len ? USB_DIR_IN : USB_DIR_OUT) | USB_TYPE_VENDOR | USB_RECIP_INTERFACE,
+		.bRequest	= request,
+		.wValue		= value,
+		.wIndex		= interface,
+		.wLength	= len,
+		.timeout	= TIMEOUT_MS,
+		.data		= data,
+	};
+	int result = ioctl(fd, USBDEVFS_CONTROL, & req);
+
+	return result < 0 ? -errno : result;
+}
+
+/* reads samples until there are none left, adding them to the profile if
+ * there is one; returns the header of the last read, or null on an error */
+static const struct profiler_header * drain(struct flat_profile * p)
+{
+	static uint32_t buf[READ_SIZE / sizeof(uint32_t)];
+	const struct profiler_header * h = (const struct profiler_header *) buf;
+	const uint32_t * samples = (const uint32_t *) (h + 1);
+	int len, i, n;
+
+	do
+	{
+		if ((len = vendor_request(CDCACM_REQ_READ_PROFILE, 0, buf, sizeof buf)) < (int) sizeof * h)
+		{
+			fprintf(stderr, "reading the samples failed: %s\n", len < 0 ? strerror(-len) : "short read");
+			return 0;
+		}
+		n = (len - sizeof * h) / sizeof * samples;
+		for (i = 0; p && i < n; i ++)
+			flat_profile_add(p, samples[i]);
+	}
+	while (n);
+	return h;
+}
+
+int main(int argc, char ** argv)
+{
+	unsigned rate = 1000, seconds = 5, lines = 20;
+	const char * elf = "../src/usb-cdc-acm.elf";
+	const struct profiler_header * h;
+	struct flat_profile profile;
+	struct timespec now, end;
+	uint8_t descriptors[1024];
+	uint32_t dropped;
+	int len, result, opt;
+
+	while ((opt = getopt(argc, argv, "r:s:n:")) != -1)
+		switch (opt)
+		{
+		case 'r': rate = strtoul(optarg, 0, 0); break;
+		case 's': seconds = strtoul(optarg, 0, 0); break;
+		case 'n': lines = strtoul(optarg, 0, 0); break;
+		default: optind = argc + 1; break;
+		}
+	if (optind < argc)
+		elf = argv[optind ++];
+	if (optind != argc || !rate || rate > 0xffff)
+	{
+		fprintf(stderr, "usage: %s [-r rate in Hz] [-s seconds] [-n lines] [usb-cdc-acm.elf]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	if ((result = flat_profile_init(& profile, elf)))
+	{
+		fprintf(stderr, "%s: %s\n", elf, strerror(-result));
+		return EXIT_FAILURE;
+	}
+	if ((fd = usbraw_usbfs_open_device(descriptors, sizeof descriptors, & len)) < 0)
+	{
+		fprintf(stderr, "opening the device failed: %s\n", strerror(-fd));
+		return EXIT_FAILURE;
+	}
+	if ((result = find_control_interface(descriptors, len)) < 0)
+	{
+		fprintf(stderr, "the device has no serial port\n");
+		return EXIT_FAILURE;
+	}
+	interface = result;
+	/* throw away what an earlier run left behind */
+	if ((result = vendor_request(CDCACM_REQ_SET_PROFILER, 0, 0, 0)) < 0)
+	{
+		fprintf(stderr, "the firmware has no profiler: %s\n", strerror(-result));
+		return EXIT_FAILURE;
+	}
+	if (!(h = drain(0)))
+		return EXIT_FAILURE;
+	dropped = h->dropped;
+	if ((result = vendor_request(CDCACM_REQ_SET_PROFILER, rate, 0, 0)) < 0)
+	{
+		fprintf(stderr, "the firmware can not sample at %u Hz: %s\n", rate, strerror(-result));
+		return EXIT_FAILURE;
+	}
+	clock_gettime(CLOCK_MONOTONIC, & end);
+	end.tv_sec += seconds;
+	do
+	{
+		if (!drain(& profile))
+			return EXIT_FAILURE;
+		usleep(DRAIN_MS * 1000);
+		clock_gettime(CLOCK_MONOTONIC, & now);
+	}
+	while (now.tv_sec < end.tv_sec || (now.tv_sec == end.tv_sec && now.tv_nsec < end.tv_nsec));
+	vendor_request(CDCACM_REQ_SET_PROFILER, 0, 0, 0);
+	if (!(h = drain(& profile)))
+		return EXIT_FAILURE;
+	flat_profile_print(& profile, stdout, lines);
+	if (h->dropped != dropped)
+		fprintf(stderr, "%u samples were dropped, the device ring was full\n", (unsigned) (h->dropped - dropped));
+	flat_profile_free(& profile);
+	return EXIT_SUCCESS;
+}
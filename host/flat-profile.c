@@ -0,0 +1,297 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* a flat profile of program counter samples; see flat-profile.h */
+
+#include <elf.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flat-profile.h"
+
+/* the whole file, and a bounds checked view of it */
+struct elf_file
+{
+	uint8_t		* data;
+	size_t		size;
+	int		is_64;
+};
+
+static int read_file(struct elf_file * e, const char * path)
+{
+	FILE * f = fopen(path, "rb");
+	size_t n;
+
+	if (!f)
+		return -errno;
+	do
+	{
+		uint8_t * data = realloc(e->data, e->size + 65536);
+
+		if (!data)
+		{
+			free(e->data);
+			fclose(f);
+			return -ENOMEM;
+		}
+		e->data = data;
+		e->size += n = fread(e->data + e->size, 1, 65536, f);
+	}
+	while (n == 65536);
+	if (ferror(f))
+	{
+		free(e->data);
+		fclose(f);
+		return -EIO;
+	}
+	fclose(f);
+	return 0;
+}
+
+static int in_file(const struct elf_file * e, uint64_t offset, uint64_t size)
+{
+	return offset <= e->size && size <= e->size - offset;
+}
+
+/* the fields of a section header, or a symbol, that are used here, from
+ * either elf class */
+struct section
+{
+	uint32_t	type, link;
+	uint64_t	offset, size, entsize;
+};
+
+struct symbol
+{
+	uint32_t	name;
+	uint8_t		info;
+	uint16_t	shndx;
+	uint64_t	value, size;
+};
+
+static struct section section_header(const struct elf_file * e, uint64_t offset)
+{
+	struct section s;
+
+	if (e->is_64)
+	{
+		Elf64_Shdr h;
+
+		memcpy(& h, e->data + offset, sizeof h);
+		s = (struct section) { h.sh_type, h.sh_link, h.sh_offset, h.sh_size, h.sh_entsize, };
+	}
+	else
+	{
+		Elf32_Shdr h;
+
+		memcpy(& h, e->data + offset, sizeof h);
+		s = (struct section) { h.sh_type, h.sh_link, h.sh_offset, h.sh_size, h.sh_entsize, };
+	}
+	return s;
+}
+
+static struct symbol symbol(const struct elf_file * e, uint64_t offset)
+{
+	struct symbol s;
+
+	if (e->is_64)
+	{
+		Elf64_Sym y;
+
+		memcpy(& y, e->data + offset, sizeof y);
+		s = (struct symbol) { y.st_name, y.st_info, y.st_shndx, y.st_value, y.st_size, };
+	}
+	else
+	{
+		Elf32_Sym y;
+
+		memcpy(& y, e->data + offset, sizeof y);
+		s = (struct symbol) { y.st_name, y.st_info, y.st_shndx, y.st_value, y.st_size, };
+	}
+	return s;
+}
+
+static int compare_address(const void * a, const void * b)
+{
+	const struct flat_profile_symbol * x = a, * y = b;
+
+	return x->address < y->address ? -1 : x->address > y->address;
+}
+
+/* the symbol table, and its string table; the static symbol table if there
+ * is one, the dynamic one otherwise */
+static int load_symbols(struct flat_profile * p, const struct elf_file * e)
+{
+	uint64_t shoff, shentsize, shnum, i;
+	struct section symtab = { 0 }, strtab;
+	int is_arm;
+
+	if (e->is_64)
+	{
+		Elf64_Ehdr h;
+
+		if (!in_file(e, 0, sizeof h))
+			return -ENOEXEC;
+		memcpy(& h, e->data, sizeof h);
+		shoff = h.e_shoff, shentsize = h.e_shentsize, shnum = h.e_shnum, is_arm = h.e_machine == EM_ARM;
+		if (shentsize < sizeof(Elf64_Shdr))
+			return -ENOEXEC;
+	}
+	else
+	{
+		Elf32_Ehdr h;
+
+		if (!in_file(e, 0, sizeof h))
+			return -ENOEXEC;
+		memcpy(& h, e->data, sizeof h);
+		shoff = h.e_shoff, shentsize = h.e_shentsize, shnum = h.e_shnum, is_arm = h.e_machine == EM_ARM;
+		if (shentsize < sizeof(Elf32_Shdr))
+			return -ENOEXEC;
+	}
+	if (!in_file(e, shoff, shentsize * shnum))
+		return -ENOEXEC;
+	for (i = 0; i < shnum; i ++)
+	{
+		struct section s = section_header(e, shoff + i * shentsize);
+
+		if (s.type == SHT_SYMTAB || (s.type == SHT_DYNSYM && symtab.type != SHT_SYMTAB))
+			symtab = s;
+	}
+	if (!symtab.type || symtab.entsize < (e->is_64 ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym))
+			|| symtab.link >= shnum || !in_file(e, symtab.offset, symtab.size))
+		return -ENOEXEC;
+	strtab = section_header(e, shoff + symtab.link * shentsize);
+	if (!strtab.size || !in_file(e, strtab.offset, strtab.size))
+		return -ENOEXEC;
+
+	/* the names are kept in a copy of the string table, terminated in
+	 * case the last one is not */
+	if (!(p->strings = malloc(strtab.size + 1))
+			|| !(p->symbols = calloc(symtab.size / symtab.entsize, sizeof * p->symbols)))
+		return -ENOMEM;
+	memcpy(p->strings, e->data + strtab.offset, strtab.size);
+	p->strings[strtab.size] = 0;
+	for (i = 0; i < symtab.size / symtab.entsize; i ++)
+	{
+		struct symbol y = symbol(e, symtab.offset + i * symtab.entsize);
+
+		if ((y.info & 0xf) != STT_FUNC || y.shndx == SHN_UNDEF || y.name >= strtab.size)
+			continue;
+		p->symbols[p->count ++] = (struct flat_profile_symbol)
+			{ .address = is_arm ? y.value & ~ (uint64_t) 1 : y.value, .size = y.size, .name = p->strings + y.name, };
+	}
+	qsort(p->symbols, p->count, sizeof * p->symbols, compare_address);
+	return 0;
+}
+
+int flat_profile_init(struct flat_profile * p, const char * path)
+{
+	struct elf_file e = { 0 };
+	int result;
+
+	memset(p, 0, sizeof * p);
+	if ((result = read_file(& e, path)))
+		return result;
+	if (e.size < EI_NIDENT || memcmp(e.data, ELFMAG, SELFMAG) || e.data[EI_DATA] != ELFDATA2LSB
+			|| (e.data[EI_CLASS] != ELFCLASS32 && e.data[EI_CLASS] != ELFCLASS64))
+		result = -ENOEXEC;
+	else
+	{
+		e.is_64 = e.data[EI_CLASS] == ELFCLASS64;
+		result = load_symbols(p, & e);
+	}
+	free(e.data);
+	if (result)
+		flat_profile_free(p);
+	return result;
+}
+
+void flat_profile_free(struct flat_profile * p)
+{
+	free(p->symbols);
+	free(p->strings);
+	memset(p, 0, sizeof * p);
+}
+
+/* the last function starting at or below 'pc' - 'pc' must be within its
+ * size, if the symbol has one */
+const struct flat_profile_symbol * flat_profile_add(struct flat_profile * p, uint64_t pc)
+{
+	unsigned low = 0, high = p->count;
+	struct flat_profile_symbol * s;
+
+	p->total ++;
+	while (low < high)
+	{
+		unsigned middle = low + (high - low) / 2;
+
+		if (p->symbols[middle].address <= pc)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	s = low ? p->symbols + low - 1 : 0;
+	if (!s || (s->size && pc - s->address >= s->size))
+	{
+		p->unknown ++;
+		return 0;
+	}
+	s->samples ++;
+	return s;
+}
+
+static int compare_samples(const void * a, const void * b)
+{
+	const struct flat_profile_symbol * x = * (const struct flat_profile_symbol * const *) a;
+	const struct flat_profile_symbol * y = * (const struct flat_profile_symbol * const *) b;
+
+	if (x->samples != y->samples)
+		return x->samples > y->samples ? -1 : 1;
+	return strcmp(x->name, y->name);
+}
+
+void flat_profile_print(const struct flat_profile * p, FILE * f, unsigned lines)
+{
+	const struct flat_profile_symbol ** sorted = malloc((p->count + 1) * sizeof * sorted);
+	struct flat_profile_symbol unknown = { .name = "(unknown)", .samples = p->unknown, };
+	unsigned i, n = 0;
+	uint64_t cumulative = 0;
+
+	if (!sorted)
+		return;
+	for (i = 0; i < p->count; i ++)
+		if (p->symbols[i].samples)
+			sorted[n ++] = p->symbols + i;
+	if (unknown.samples)
+		sorted[n ++] = & unknown;
+	qsort(sorted, n, sizeof * sorted, compare_samples);
+	fprintf(f, "%10s %7s %7s  %s\n", "samples", "%", "cum %", "function");
+	for (i = 0; i < n && (!lines || i < lines); i ++)
+	{
+		cumulative += sorted[i]->samples;
+		fprintf(f, "%10llu %7.2f %7.2f  %s\n", (unsigned long long) sorted[i]->samples,
+				100. * sorted[i]->samples / p->total, 100. * cumulative / p->total, sorted[i]->name);
+	}
+	fprintf(f, "%10llu samples in total\n", (unsigned long long) p->total);
+	free(sorted);
+}
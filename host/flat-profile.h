@@ -0,0 +1,67 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* a flat profile of program counter samples - those of the firmware's
+ * sampling profiler (see src/profiler.h) - symbolized against the function
+ * symbols of an elf file; the firmware's own arm elf file, or, for the
+ * simulator build, a host executable - 32 and 64 bit little endian elf files
+ * are read, and the thumb bit of arm function addresses is ignored
+ *
+ * each sample is counted against the function it falls in, and the profile
+ * lists the functions by their sample counts */
+
+#ifndef FLAT_PROFILE_H
+#define FLAT_PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+struct flat_profile_symbol
+{
+	uint64_t	address, size;
+	const char	* name;
+	uint64_t	samples;
+};
+
+struct flat_profile
+{
+	/* the function symbols, sorted by address */
+	struct flat_profile_symbol	* symbols;
+	unsigned			count;
+	/* the string table the symbol names point into */
+	char				* strings;
+	/* the samples outside of any function, and all of them */
+	uint64_t			unknown, total;
+};
+
+/* reads the function symbols of the elf file at 'path'; returns 0, or a
+ * negative errno value - -ENOEXEC if the file is not an elf file that can be
+ * read, or has no symbol table */
+int flat_profile_init(struct flat_profile * p, const char * path);
+void flat_profile_free(struct flat_profile * p);
+/* counts a sample; returns the function it falls in, or 0 */
+const struct flat_profile_symbol * flat_profile_add(struct flat_profile * p, uint64_t pc);
+/* prints the functions with samples, the ones with the most samples first,
+ * at most 'lines' of them (all of them if zero) */
+void flat_profile_print(const struct flat_profile * p, FILE * f, unsigned lines);
+
+#endif /* FLAT_PROFILE_H */
@@ -0,0 +1,204 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* captures the usb event trace of the firmware (see src/usb-trace.h) for a
+ * while, draining it with vendor requests on the default control endpoint -
+ * so the serial ports can be in use meanwhile - and writes it to a pcap file
+ * with the usbmon link type (see usbmon-pcap.h); with '-v', all events are
+ * also listed on the standard output, including the start of frame and poll
+ * events, which the pcap file leaves out
+ *
+ * usage: usb-trace-pcap [-v] [-m trace mask] [-s seconds] file.pcap
+ *
+ * the trace mask has bit (1 << USB_TRACE_xxx) set for each event type to
+ * record; the default leaves out the poll events, which a polled build
+ * records at the main loop rate */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/usb/ch9.h>
+#include <linux/usbdevice_fs.h>
+
+#include "usbraw.h"
+#include "usbmon-pcap.h"
+#include "cdcacm-requests.h"
+
+enum
+{
+	TIMEOUT_MS	= 1000,
+	/* the trace is drained every this many milliseconds; a device
+	 * streaming at full speed records some 30 events per millisecond,
+	 * and its trace holds a few hundred */
+	DRAIN_MS	= 2,
+	READ_SIZE	= 4096,
+	DEFAULT_MASK	= ((1 << USB_TRACE_TYPES) - 1)
+			& ~(1 << USB_TRACE_POLL_ENTER | 1 << USB_TRACE_POLL_EXIT),
+};
+
+static const char * const event_names[USB_TRACE_TYPES] =
+{
+	[USB_TRACE_RESET]	= "reset",
+	[USB_TRACE_SOF]		= "sof",
+	[USB_TRACE_CTR]		= "ctr",
+	[USB_TRACE_PACKET]	= "packet",
+	[USB_TRACE_NAK]		= "nak",
+	[USB_TRACE_POLL_ENTER]	= "poll enter",
+	[USB_TRACE_POLL_EXIT]	= "poll exit",
+};
+
+static int fd;
+static unsigned interface;
+
+/* the requests go to the first serial port, whichever it is */
+static int find_control_interface(const uint8_t * d, int len)
+{
+	int i;
+
+	for (i = 0; i + 1 < len && d[i] >= 2; i += d[i])
+		if (d[i + 1] == USB_DT_INTERFACE && i + USB_DT_INTERFACE_SIZE <= len && d[i + 5] == USB_CLASS_COMM)
+			return d[i + 2];
+	return -1;
+}
+
+static int vendor_request(uint8_t request, uint16_t value, void * data, uint16_t len)
+{
+	struct usbdevfs_ctrltransfer req =
+	{
+		.bRequestType	= (len ? USB_DIR_IN : USB_DIR_OUT) | USB_TYPE_VENDOR | USB_RECIP_INTERFACE,
+		.bRequest	= request,
+		.wValue		= value,
+		.wIndex		= interface,
+		.wLength	= len,
+		.timeout	= TIMEOUT_MS,
+		.data		= data,
+	};
+	int result = ioctl(fd, USBDEVFS_CONTROL, & req);
+
+	return result < 0 ? -errno : result;
+}
+
+/* reads events until a read does not fill the buffer - new events keep
+ * coming meanwhile - passing them to the converter if there is one; returns
+ * the header of the last read, or null on an error */
+static const struct usb_trace_header * drain(struct usbmon_pcap * p, int is_verbose)
+{
+	static uint32_t buf[READ_SIZE / sizeof(uint32_t)];
+	const struct usb_trace_header * h = (const struct usb_trace_header *) buf;
+	const struct usb_trace_event * e = (const struct usb_trace_event *) (h + 1);
+	int len, i, n;
+
+	do
+	{
+		if ((len = vendor_request(CDCACM_REQ_READ_TRACE, 0, buf, sizeof buf)) < (int) sizeof * h)
+		{
+			fprintf(stderr, "reading the trace failed: %s\n", len < 0 ? strerror(-len) : "short read");
+			return 0;
+		}
+		n = (len - sizeof * h) / sizeof * e;
+		for (i = 0; p && i < n; i ++)
+		{
+			if (usbmon_pcap_event(p, e + i, h->cpu_hz) < 0)
+			{
+				fprintf(stderr, "writing the pcap file failed: %s\n", strerror(errno));
+				return 0;
+			}
+			if (is_verbose && e[i].type < USB_TRACE_TYPES)
+				printf("%14.6f %-10s %02x %u\n", (double) p->cycles / h->cpu_hz,
+						event_names[e[i].type], e[i].ep, e[i].value);
+		}
+	}
+	while (len == sizeof buf);
+	return h;
+}
+
+int main(int argc, char ** argv)
+{
+	unsigned mask = DEFAULT_MASK, seconds = 5;
+	struct usbmon_pcap pcap;
+	const struct usb_trace_header * h;
+	struct usbdevfs_connectinfo info;
+	struct timespec now, end;
+	uint8_t descriptors[1024];
+	uint32_t dropped;
+	int len, result, opt, is_verbose = 0;
+	FILE * f;
+
+	while ((opt = getopt(argc, argv, "vm:s:")) != -1)
+		switch (opt)
+		{
+		case 'v': is_verbose = 1; break;
+		case 'm': mask = strtoul(optarg, 0, 0); break;
+		case 's': seconds = strtoul(optarg, 0, 0); break;
+		default: optind = argc; break;
+		}
+	if (optind != argc - 1)
+	{
+		fprintf(stderr, "usage: %s [-v] [-m trace mask] [-s seconds] file.pcap\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	if ((fd = usbraw_usbfs_open_device(descriptors, sizeof descriptors, & len)) < 0)
+	{
+		fprintf(stderr, "opening the device failed: %s\n", strerror(-fd));
+		return EXIT_FAILURE;
+	}
+	if ((result = find_control_interface(descriptors, len)) < 0 || ioctl(fd, USBDEVFS_CONNECTINFO, & info))
+	{
+		fprintf(stderr, "the device has no serial port\n");
+		return EXIT_FAILURE;
+	}
+	interface = result;
+	if (!(f = fopen(argv[optind], "wb")))
+	{
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+		return EXIT_FAILURE;
+	}
+	/* throw away what an earlier capture left behind */
+	vendor_request(CDCACM_REQ_SET_TRACE_MASK, 0, 0, 0);
+	if (!(h = drain(0, 0)))
+		return EXIT_FAILURE;
+	dropped = h->dropped;
+	clock_gettime(CLOCK_REALTIME, & now);
+	usbmon_pcap_init(& pcap, f, descriptors, len, 0, info.devnum,
+			(uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000);
+	vendor_request(CDCACM_REQ_SET_TRACE_MASK, mask, 0, 0);
+	clock_gettime(CLOCK_MONOTONIC, & end);
+	end.tv_sec += seconds;
+	do
+	{
+		if (!drain(& pcap, is_verbose))
+			return EXIT_FAILURE;
+		usleep(DRAIN_MS * 1000);
+		clock_gettime(CLOCK_MONOTONIC, & now);
+	}
+	while (now.tv_sec < end.tv_sec || (now.tv_sec == end.tv_sec && now.tv_nsec < end.tv_nsec));
+	vendor_request(CDCACM_REQ_SET_TRACE_MASK, 0, 0, 0);
+	if (!(h = drain(& pcap, is_verbose)) || fclose(f))
+		return EXIT_FAILURE;
+	if (h->dropped != dropped)
+		fprintf(stderr, "%u events were dropped, the trace was full\n", (unsigned) (h->dropped - dropped));
+	return EXIT_SUCCESS;
+}
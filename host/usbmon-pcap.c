@@ -0,0 +1,191 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* usb event trace to usbmon pcap conversion; see usbmon-pcap.h, and the
+ * linux kernel documentation, Documentation/usb/usbmon.rst, for the usbmon
+ * binary packet format */
+
+#include <errno.h>
+#include <string.h>
+
+#include "usbmon-pcap.h"
+
+enum
+{
+	PCAP_MAGIC		= 0xa1b2c3d4,
+	/* LINKTYPE_USB_LINUX, the 48 byte usbmon header */
+	PCAP_LINKTYPE_USB_LINUX	= 189,
+	PCAP_SNAPLEN		= 65535,
+	/* the usbmon transfer types */
+	USBMON_ISOCHRONOUS	= 0,
+	USBMON_INTERRUPT	= 1,
+	USBMON_CONTROL		= 2,
+	USBMON_BULK		= 3,
+	/* the endpoint descriptor type, and size */
+	DT_ENDPOINT		= 5,
+	DT_ENDPOINT_SIZE	= 7,
+};
+
+struct pcap_header
+{
+	uint32_t	magic;
+	uint16_t	version_major, version_minor;
+	int32_t		thiszone;
+	uint32_t	sigfigs;
+	uint32_t	snaplen;
+	uint32_t	network;
+};
+
+struct pcap_record
+{
+	uint32_t	ts_sec, ts_usec;
+	uint32_t	incl_len, orig_len;
+};
+
+struct usbmon_packet
+{
+	uint64_t	id;
+	uint8_t		type;
+	uint8_t		xfer_type;
+	uint8_t		epnum;
+	uint8_t		devnum;
+	uint16_t	busnum;
+	int8_t		flag_setup;
+	int8_t		flag_data;
+	int64_t		ts_sec;
+	int32_t		ts_usec;
+	int32_t		status;
+	uint32_t	length;
+	uint32_t	len_cap;
+	uint8_t		setup[8];
+};
+
+_Static_assert(sizeof(struct usbmon_packet) == 48, "bad struct usbmon_packet layout");
+
+/* usb transfer types (bmAttributes) to usbmon transfer types */
+static const uint8_t usbmon_types[] = { USBMON_CONTROL, USBMON_ISOCHRONOUS, USBMON_BULK, USBMON_INTERRUPT, };
+
+void usbmon_pcap_init(struct usbmon_pcap * p, FILE * f, const uint8_t * d, int len,
+		uint16_t busnum, uint8_t devnum, uint64_t start_us)
+{
+	struct pcap_header h =
+	{
+		.magic		= PCAP_MAGIC,
+		.version_major	= 2,
+		.version_minor	= 4,
+		.snaplen	= PCAP_SNAPLEN,
+		.network	= PCAP_LINKTYPE_USB_LINUX,
+	};
+	int i;
+
+	memset(p, 0, sizeof * p);
+	p->f = f;
+	p->busnum = busnum;
+	p->devnum = devnum;
+	p->start_us = start_us;
+	for (i = 0; i + 1 < len && d[i] >= 2; i += d[i])
+		if (d[i + 1] == DT_ENDPOINT && i + DT_ENDPOINT_SIZE <= len && (d[i + 2] & 0x7f) < USBMON_PCAP_ENDPOINTS)
+			p->types[d[i + 2] & 0x7f][d[i + 2] >> 7] = d[i + 3] & 3;
+	fwrite(& h, sizeof h, 1, f);
+}
+
+/* writes a record; 'type' is 'S', 'C' or 'E' */
+static int usbmon_pcap_write(struct usbmon_pcap * p, char type, uint8_t ep, uint32_t id,
+		int32_t status, uint32_t length, uint32_t cpu_hz)
+{
+	uint64_t us = p->start_us + p->cycles * 1000000 / cpu_hz;
+	struct pcap_record r =
+	{
+		.ts_sec		= us / 1000000,
+		.ts_usec	= us % 1000000,
+		.incl_len	= sizeof(struct usbmon_packet),
+		.orig_len	= sizeof(struct usbmon_packet),
+	};
+	struct usbmon_packet u =
+	{
+		.id		= (uint64_t) ep << 32 | id,
+		.type		= type,
+		.xfer_type	= usbmon_types[p->types[ep & 0x7f][ep >> 7]],
+		.epnum		= ep,
+		.devnum		= p->devnum,
+		.busnum		= p->busnum,
+		/* no setup packet, and no data captured - '<' and '>' are
+		 * the flags of urbs without data in that direction */
+		.flag_setup	= '-',
+		.flag_data	= ep & 0x80 ? '<' : '>',
+		.ts_sec		= r.ts_sec,
+		.ts_usec	= r.ts_usec,
+		.status		= status,
+		.length		= length,
+	};
+
+	if (fwrite(& r, sizeof r, 1, p->f) != 1 || fwrite(& u, sizeof u, 1, p->f) != 1)
+		return -1;
+	return 1;
+}
+
+int usbmon_pcap_event(struct usbmon_pcap * p, const struct usb_trace_event * e, uint32_t cpu_hz)
+{
+	uint8_t ep = e->ep & 0x7f, in = e->ep >> 7;
+	uint16_t * queue = p->lengths[ep];
+	uint32_t n;
+
+	if (p->has_time)
+		p->cycles += (uint32_t) (e->time - p->last_time);
+	p->last_time = e->time;
+	p->has_time = 1;
+	if (ep >= USBMON_PCAP_ENDPOINTS)
+		return 0;
+	switch (e->type)
+	{
+	case USB_TRACE_RESET:
+		return usbmon_pcap_write(p, 'E', 0, 0, -ECONNRESET, 0, cpu_hz);
+	case USB_TRACE_NAK:
+		return e->value ? usbmon_pcap_write(p, 'E', e->ep, p->completed[ep][in], -EAGAIN, 0, cpu_hz) : 0;
+	case USB_TRACE_CTR:
+		if (!in)
+			return e->value && p->submitted[ep][in] == p->completed[ep][in]
+				? usbmon_pcap_write(p, 'S', e->ep, p->submitted[ep][in] ++, -EINPROGRESS, 0, cpu_hz) : 0;
+		/* the oldest packet queued has been sent */
+		if (p->completed[ep][in] == p->submitted[ep][in])
+			return 0;
+		n = p->completed[ep][in] ++;
+		return usbmon_pcap_write(p, 'C', e->ep, n, 0, queue[n % USBMON_PCAP_QUEUE], cpu_hz);
+	case USB_TRACE_PACKET:
+		if (!in)
+		{
+			if (p->completed[ep][in] == p->submitted[ep][in]
+					&& usbmon_pcap_write(p, 'S', e->ep, p->submitted[ep][in] ++, -EINPROGRESS, 0, cpu_hz) < 0)
+				return -1;
+			return usbmon_pcap_write(p, 'C', e->ep, p->completed[ep][in] ++, 0, e->value, cpu_hz);
+		}
+		/* an endpoint holds at most two packets, so the queue does
+		 * not overflow unless events are dropped */
+		n = p->submitted[ep][in] ++;
+		if (n - p->completed[ep][in] >= USBMON_PCAP_QUEUE)
+			p->completed[ep][in] = n - USBMON_PCAP_QUEUE + 1;
+		queue[n % USBMON_PCAP_QUEUE] = e->value;
+		return usbmon_pcap_write(p, 'S', e->ep, n, -EINPROGRESS, e->value, cpu_hz);
+	default:
+		return 0;
+	}
+}
@@ -0,0 +1,88 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* conversion of the firmware's usb event trace (see src/usb-trace.h) to a
+ * pcap file with the linux usbmon link type, for wireshark and the other
+ * standard tools; the device sees packets rather than transfer requests, so
+ * each packet becomes an urb, submitted and completed as the device sees it:
+ * on an OUT endpoint, the packet arrival (the CTR event) is the submission,
+ * and the driver reading the packet the completion - the time between them
+ * is the time the device held the packet, and a packet read without a CTR
+ * event of its own is submitted and completed at once - and on an IN
+ * endpoint, the driver passing the packet to the endpoint is the
+ * submission, and its CTR event the completion - the time the host took to
+ * collect it; the driver holding data back, and so naking the host, is an
+ * error event (-EAGAIN) on the endpoint, and a bus reset one (-ECONNRESET)
+ * on the control endpoint; start of frame and poll events have no usbmon
+ * counterpart, and are left out
+ *
+ * no packet data is captured, only the lengths */
+
+#ifndef USBMON_PCAP_H
+#define USBMON_PCAP_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "usb-trace-events.h"
+
+enum
+{
+	/* the usb transfer types of the endpoints (USB_ENDPOINT_ATTR_xxx)
+	 * and the queued IN packets are kept for endpoint numbers up to */
+	USBMON_PCAP_ENDPOINTS	= 16,
+	USBMON_PCAP_QUEUE	= 4,
+};
+
+struct usbmon_pcap
+{
+	FILE		* f;
+	uint16_t	busnum;
+	uint8_t		devnum;
+	/* the usb transfer types, indexed by the endpoint number and the
+	 * direction (1 for IN), from the endpoint descriptors */
+	uint8_t		types[USBMON_PCAP_ENDPOINTS][2];
+	/* the trace time, the cycle counter unwrapped, and the time that
+	 * corresponds to its start, in microseconds since the epoch */
+	uint64_t	cycles;
+	uint32_t	last_time;
+	int		has_time;
+	uint64_t	start_us;
+	/* the urbs submitted and completed on each endpoint, for the urb
+	 * ids, and the lengths of the packets queued on IN endpoints */
+	uint32_t	submitted[USBMON_PCAP_ENDPOINTS][2];
+	uint32_t	completed[USBMON_PCAP_ENDPOINTS][2];
+	uint16_t	lengths[USBMON_PCAP_ENDPOINTS][USBMON_PCAP_QUEUE];
+};
+
+/* starts a pcap file; 'descriptors' are the device descriptor followed by
+ * the configuration descriptors, as usbfs returns them, for the endpoint
+ * transfer types; the trace time starts at 'start_us' */
+void usbmon_pcap_init(struct usbmon_pcap * p, FILE * f, const uint8_t * descriptors, int len,
+		uint16_t busnum, uint8_t devnum, uint64_t start_us);
+/* converts an event, with the cycle counter running at 'cpu_hz'; events must
+ * be passed in order, and no more than a cycle counter period (about a
+ * minute at 72 mhz) apart; returns the pcap records written, or -1 on a
+ * write error */
+int usbmon_pcap_event(struct usbmon_pcap * p, const struct usb_trace_event * e, uint32_t cpu_hz);
+
+#endif /* USBMON_PCAP_H */
@@ -0,0 +1,185 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* the linux usbfs transport of the raw bulk streams; the device is looked up
+ * by its vendor and product ids in /dev/bus/usb, its vendor specific
+ * interface is claimed from the kernel, and urbs are submitted and reaped
+ * with the usbfs ioctls, so that many of them can be queued at once */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <linux/usb/ch9.h>
+#include <linux/usbdevice_fs.h>
+
+#include "usbraw.h"
+
+struct usbfs
+{
+	int			fd;
+	unsigned		interface;
+	/* the usbfs urbs of the stream urbs, at the same indices */
+	struct usbdevfs_urb	urbs[2 * USBRAW_MAX_DEPTH];
+};
+
+static int usbfs_submit(struct usbraw * r, struct usbraw_urb * urb)
+{
+	struct usbfs * u = r->transport_data;
+	struct usbdevfs_urb * uu = u->urbs + (urb - r->urbs);
+
+	* uu = (struct usbdevfs_urb)
+	{
+		.type		= USBDEVFS_URB_TYPE_BULK,
+		.endpoint	= urb->ep,
+		.buffer		= urb->buf,
+		.buffer_length	= urb->len,
+		.usercontext	= urb,
+	};
+	return ioctl(u->fd, USBDEVFS_SUBMITURB, uu) ? -errno : 0;
+}
+
+static struct usbraw_urb * usbfs_reap(struct usbraw * r, int timeout_ms)
+{
+	struct usbfs * u = r->transport_data;
+	struct pollfd p = { .fd = u->fd, .events = POLLOUT, };
+	struct usbdevfs_urb * uu;
+	struct usbraw_urb * urb;
+
+	/* usbfs signals completed urbs as the device file being writable */
+	while (ioctl(u->fd, USBDEVFS_REAPURBNDELAY, & uu))
+		if (errno != EAGAIN || poll(& p, 1, timeout_ms) <= 0)
+			return 0;
+	urb = uu->usercontext;
+	urb->actual = uu->actual_length;
+	urb->status = uu->status;
+	return urb;
+}
+
+static void usbfs_discard(struct usbraw * r, struct usbraw_urb * urb)
+{
+	struct usbfs * u = r->transport_data;
+
+	/* fails harmlessly for urbs that are not queued */
+	ioctl(u->fd, USBDEVFS_DISCARDURB, u->urbs + (urb - r->urbs));
+}
+
+static void usbfs_close(struct usbraw * r)
+{
+	struct usbfs * u = r->transport_data;
+
+	ioctl(u->fd, USBDEVFS_RELEASEINTERFACE, & u->interface);
+	close(u->fd);
+	free(u);
+}
+
+static const struct usbraw_transport usbfs_transport =
+{
+	.submit		= usbfs_submit,
+	.reap		= usbfs_reap,
+	.discard	= usbfs_discard,
+	.close		= usbfs_close,
+};
+
+/* looks for the vendor specific interface, and its bulk endpoints, in the
+ * descriptors that usbfs returns when the device file is read - the device
+ * descriptor, followed by the configuration descriptors */
+static int usbfs_find_interface(const uint8_t * d, int len, unsigned * interface, uint8_t * ep_in, uint8_t * ep_out)
+{
+	int i, found = -1;
+
+	if (len < USB_DT_DEVICE_SIZE)
+		return -1;
+	for (i = 0; i + 1 < len && d[i] >= 2; i += d[i])
+		if (d[i + 1] == USB_DT_INTERFACE && i + USB_DT_INTERFACE_SIZE <= len)
+			found = d[i + 5] == USB_CLASS_VENDOR_SPEC ? (int) (* interface = d[i + 2]) : -1;
+		else if (d[i + 1] == USB_DT_ENDPOINT && found >= 0 && i + USB_DT_ENDPOINT_SIZE <= len
+				&& (d[i + 3] & USB_ENDPOINT_XFERTYPE_MASK) == USB_ENDPOINT_XFER_BULK)
+			* (d[i + 2] & USB_DIR_IN ? ep_in : ep_out) = d[i + 2];
+	return * ep_in && * ep_out ? 0 : -1;
+}
+
+int usbraw_usbfs_open_device(uint8_t * descriptors, unsigned size, int * len)
+{
+	char path[16 + 2 * sizeof ((struct dirent *) 0)->d_name];
+	struct dirent * bus, * dev;
+	DIR * buses, * devs;
+	int fd = -1;
+
+	if (!(buses = opendir("/dev/bus/usb")))
+		return -errno;
+	while (fd < 0 && (bus = readdir(buses)))
+	{
+		if (bus->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof path, "/dev/bus/usb/%s", bus->d_name);
+		if (!(devs = opendir(path)))
+			continue;
+		while (fd < 0 && (dev = readdir(devs)))
+		{
+			if (dev->d_name[0] == '.')
+				continue;
+			snprintf(path, sizeof path, "/dev/bus/usb/%s/%s", bus->d_name, dev->d_name);
+			if ((fd = open(path, O_RDWR)) < 0)
+				continue;
+			* len = read(fd, descriptors, size);
+			if (* len < USB_DT_DEVICE_SIZE
+					|| (descriptors[8] | descriptors[9] << 8) != USBRAW_VENDOR_ID
+					|| (descriptors[10] | descriptors[11] << 8) != USBRAW_PRODUCT_ID)
+				close(fd), fd = -1;
+		}
+		closedir(devs);
+	}
+	closedir(buses);
+	return fd < 0 ? -ENODEV : fd;
+}
+
+int usbraw_open_usbfs(struct usbraw * r, unsigned depth, unsigned urb_size)
+{
+	uint8_t descriptors[1024];
+	uint8_t ep_in = 0, ep_out = 0;
+	struct usbfs * u;
+	int fd, len, result;
+
+	if (!(u = calloc(1, sizeof * u)))
+		return -ENOMEM;
+	if ((fd = usbraw_usbfs_open_device(descriptors, sizeof descriptors, & len)) < 0)
+		return free(u), fd;
+	if (usbfs_find_interface(descriptors, len, & u->interface, & ep_in, & ep_out))
+		return close(fd), free(u), -ENODEV;
+	u->fd = fd;
+	if (ioctl(fd, USBDEVFS_CLAIMINTERFACE, & u->interface))
+	{
+		result = -errno;
+		close(fd);
+		free(u);
+		return result;
+	}
+	if ((result = usbraw_init(r, & usbfs_transport, u, ep_in, ep_out, depth, urb_size)))
+		usbfs_close(& (struct usbraw) { .transport_data = u, });
+	return result;
+}
@@ -0,0 +1,132 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* urb pipelining for raw bulk streams, independent of the transport; see
+ * usbraw.h */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "usbraw.h"
+
+int usbraw_init(struct usbraw * r, const struct usbraw_transport * transport, void * transport_data,
+		uint8_t ep_in, uint8_t ep_out, unsigned depth, unsigned urb_size)
+{
+	unsigned i;
+
+	if (!depth || depth > USBRAW_MAX_DEPTH || !urb_size || urb_size % USBRAW_PACKET_SIZE)
+		return -EINVAL;
+	* r = (struct usbraw)
+	{
+		.transport	= transport,
+		.transport_data	= transport_data,
+		.ep_in		= ep_in,
+		.ep_out		= ep_out,
+		.depth		= depth,
+		.urb_size	= urb_size,
+	};
+	if (!(r->in_buffers = malloc(depth * urb_size)))
+		return -ENOMEM;
+	for (i = 0; i < depth; i ++)
+	{
+		r->urbs[i].ep = ep_out;
+		r->urbs[depth + i].ep = ep_in;
+		r->urbs[depth + i].buf = r->in_buffers + i * urb_size;
+		r->urbs[depth + i].len = urb_size;
+	}
+	return 0;
+}
+
+void usbraw_close(struct usbraw * r)
+{
+	r->transport->close(r);
+	free(r->in_buffers);
+	r->in_buffers = 0;
+}
+
+int usbraw_stream(struct usbraw * r, const void * out, size_t out_len,
+		int (* consume)(void * context, const uint8_t * data, unsigned len), void * context,
+		int timeout_ms)
+{
+	struct usbraw_urb * urb, * free_out[USBRAW_MAX_DEPTH];
+	unsigned free_outs = r->depth, outs = 0, ins = 0, i;
+	size_t queued = 0;
+	bool is_consumed = !consume;
+	int result = 0, done;
+
+	for (i = 0; i < r->depth; i ++)
+		free_out[i] = r->urbs + i;
+	for (i = 0; consume && i < r->depth && !result; i ++)
+		if (!(result = r->transport->submit(r, r->urbs + r->depth + i)))
+			ins ++;
+	while (!result && (queued < out_len || outs || !is_consumed))
+	{
+		/* keep the OUT endpoint busy */
+		while (!result && queued < out_len && free_outs)
+		{
+			urb = free_out[-- free_outs];
+			urb->buf = (uint8_t *) out + queued;
+			urb->len = out_len - queued < r->urb_size ? out_len - queued : r->urb_size;
+			if (!(result = r->transport->submit(r, urb)))
+				outs ++, queued += urb->len;
+		}
+		if (result)
+			break;
+		if (!(urb = r->transport->reap(r, timeout_ms)))
+		{
+			result = -ETIMEDOUT;
+			break;
+		}
+		if (urb->ep == r->ep_out)
+		{
+			outs --;
+			free_out[free_outs ++] = urb;
+			if (urb->status)
+				result = urb->status;
+			continue;
+		}
+		ins --;
+		if (urb->status)
+			result = urb->status;
+		else if ((done = consume(context, urb->buf, urb->actual)) < 0)
+			result = -EIO;
+		else if (done)
+			is_consumed = true;
+		else if (!(result = r->transport->submit(r, urb)))
+			ins ++;
+	}
+	/* the urbs still queued - IN urbs that were not needed, or urbs left
+	 * over after an error - are cancelled, and must be waited for */
+	for (i = 0; i < 2 * r->depth; i ++)
+		r->transport->discard(r, r->urbs + i);
+	while (outs + ins)
+	{
+		if (!(urb = r->transport->reap(r, timeout_ms)))
+			return -EIO;
+		if (urb->ep == r->ep_out)
+			outs --;
+		else
+			ins --;
+	}
+	return result;
+}
@@ -0,0 +1,114 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* raw bulk access to the vendor specific interface of the firmware (see
+ * USB_CDCACM_VENDOR_INTERFACE in src/usb-cdc-acm.c) from a host program,
+ * bypassing the serial port driver and the tty layer of the host
+ *
+ * data is streamed in bulk transfer requests (urbs) of up to 'urb_size'
+ * bytes, with up to 'depth' of them queued in each direction, so that the
+ * host controller always has a transfer to work on, and the time the host
+ * takes to handle a completed urb and queue the next one is hidden; the urbs
+ * are passed to a transport, which is usbfs on linux (usbraw-usbfs.c), or the
+ * host simulator (sim/usbraw-sim.c) - which can also drive the data interface
+ * of a serial port, for comparison */
+
+#ifndef USBRAW_H
+#define USBRAW_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+enum
+{
+	USBRAW_MAX_DEPTH	= 32,
+	USBRAW_PACKET_SIZE	= 64,
+	/* the firmware's usb vendor and product ids */
+	USBRAW_VENDOR_ID	= 0x1ad4,
+	USBRAW_PRODUCT_ID	= 0xb000,
+};
+
+struct usbraw_urb
+{
+	uint8_t		ep;
+	uint8_t		* buf;
+	unsigned	len;
+	/* set on completion; the bytes transferred, and zero, or a negative
+	 * errno value - -ENOENT for a discarded urb */
+	unsigned	actual;
+	int		status;
+};
+
+struct usbraw;
+
+struct usbraw_transport
+{
+	/* queues a urb on its endpoint, behind the urbs queued there before;
+	 * returns zero, or a negative errno value */
+	int			(* submit)(struct usbraw * r, struct usbraw_urb * urb);
+	/* waits up to 'timeout_ms' milliseconds for a queued urb to complete,
+	 * and returns it, or null on a timeout or an error; the urbs of an
+	 * endpoint complete in the order they were queued */
+	struct usbraw_urb *	(* reap)(struct usbraw * r, int timeout_ms);
+	/* cancels a urb, if it is queued; it is still returned by 'reap()' */
+	void			(* discard)(struct usbraw * r, struct usbraw_urb * urb);
+	void			(* close)(struct usbraw * r);
+};
+
+struct usbraw
+{
+	const struct usbraw_transport	* transport;
+	void				* transport_data;
+	uint8_t				ep_in, ep_out;
+	unsigned			depth, urb_size;
+	/* the OUT urbs, then the IN urbs, and the buffers of the IN urbs */
+	struct usbraw_urb		urbs[2 * USBRAW_MAX_DEPTH];
+	uint8_t				* in_buffers;
+};
+
+/* called by the transports to set up a stream over a pair of bulk endpoints;
+ * 'urb_size' must be a multiple of the packet size; returns zero, or a
+ * negative errno value */
+int usbraw_init(struct usbraw * r, const struct usbraw_transport * transport, void * transport_data,
+		uint8_t ep_in, uint8_t ep_out, unsigned depth, unsigned urb_size);
+void usbraw_close(struct usbraw * r);
+
+/* finds the firmware's vendor interface on usbfs, and claims it; returns
+ * zero, or a negative errno value */
+int usbraw_open_usbfs(struct usbraw * r, unsigned depth, unsigned urb_size);
+/* opens the usbfs device file of the firmware, and reads its descriptors -
+ * the device descriptor, followed by the configuration descriptors - into
+ * 'descriptors', and their length into 'len'; returns the file descriptor,
+ * or a negative errno value */
+int usbraw_usbfs_open_device(uint8_t * descriptors, unsigned size, int * len);
+
+/* writes the 'out_len' bytes of 'out' to the OUT endpoint, while reading the
+ * IN endpoint and passing the data read to 'consume()', until all data is
+ * written and 'consume()' returns nonzero - or returns a negative value, which
+ * is an error; with no 'consume()', the IN endpoint is not read; returns zero,
+ * or a negative errno value - -ETIMEDOUT if no urb completes in 'timeout_ms'
+ * milliseconds */
+int usbraw_stream(struct usbraw * r, const void * out, size_t out_len,
+		int (* consume)(void * context, const uint8_t * data, unsigned len), void * context,
+		int timeout_ms);
+
+#endif /* USBRAW_H */
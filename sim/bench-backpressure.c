@@ -0,0 +1,160 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* benchmark: rx buffer flow control; the host streams full size packets to
+ * the data OUT endpoint and reads the data IN endpoint as fast as the device
+ * lets it, while the application in the firmware main loop gets slower - so
+ * that the rx buffer fills up, and the data OUT endpoint is throttled at its
+ * high watermark; all data must come back intact
+ *
+ * the host also polls the notification endpoint, where each throttling is
+ * reported as an overrun in a SERIAL_STATE notification - the overruns that
+ * follow in quick succession are coalesced into a single notification */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libopencm3/usb/cdc.h>
+#include "usbsim.h"
+#include "cdcacm-stats.h"
+
+enum
+{
+	PACKET_SIZE	= 64,
+	PACKETS		= 2000,
+	TIMEOUT_FRAMES	= 100,
+};
+
+/* the data streamed through the loopback, which must not contain '>' */
+static uint8_t stream_byte(unsigned offset)
+{
+	return 'a' + offset % 26;
+}
+
+static const uint32_t main_loop_loads[] = { 0, 20000, 100000, 500000, };
+
+/* SERIAL_STATE notifications received that report an overrun, and the
+ * interrupt transfers that did not carry exactly one notification */
+static unsigned overrun_notifications, bad_notifications;
+
+static void notification_received(uint8_t ep, const void * data, int len)
+{
+	const struct usb_cdc_notification * n = data;
+	uint16_t state;
+
+	(void) ep;
+	/* host drivers only look at the first notification of a transfer */
+	if (len < (int) sizeof * n || len != (int) (sizeof * n + n->wLength))
+	{
+		bad_notifications ++;
+		return;
+	}
+	if (len != sizeof * n + sizeof state || n->bNotification != USB_CDC_NOTIFY_SERIAL_STATE)
+		return;
+	memcpy(& state, n + 1, sizeof state);
+	/* bOverRun */
+	if (state & (1 << 6))
+		overrun_notifications ++;
+}
+
+int main(void)
+{
+	int data_in, data_out, i;
+
+	usbsim_start(usbsim_firmware_main);
+	if (usbsim_host_enumerate())
+	{
+		fprintf(stderr, "enumeration failed\n");
+		return EXIT_FAILURE;
+	}
+	data_in = usbsim_host_find_endpoint(USB_CLASS_DATA, USB_ENDPOINT_ATTR_BULK, true);
+	data_out = usbsim_host_find_endpoint(USB_CLASS_DATA, USB_ENDPOINT_ATTR_BULK, false);
+	usbsim_host_poll_periodic(usbsim_host_find_endpoint(USB_CLASS_CDC, USB_ENDPOINT_ATTR_INTERRUPT, true),
+			1, notification_received);
+
+	printf("%10s %12s %10s %10s %12s %12s %10s\n", "load/iter", "bytes/s", "out naks",
+			"throttles", "throttled ms", "longest ms", "overruns");
+	for (i = 0; i < (int) (sizeof main_loop_loads / sizeof * main_loop_loads); i ++)
+	{
+		unsigned sent = 0, received = 0, markers = 0;
+		struct cdcacm_stats stats = cdcacm_stats[0];
+		uint64_t start;
+		uint32_t timeout;
+		unsigned overruns = overrun_notifications;
+
+		usbsim_cost.main_loop_load = main_loop_loads[i];
+		cdcacm_stats[0].rx_max_throttled_frames = 0;
+		usbsim_reset_stats();
+		start = usbsim_bus_cycles();
+		timeout = usbsim_host_frame_number() + TIMEOUT_FRAMES;
+		/* as in bench-throughput.c, the ">>>" markers in the echoed data
+		 * are skipped */
+		while (received < PACKETS * PACKET_SIZE || markers != 3)
+		{
+			uint8_t packet[PACKET_SIZE];
+			int len, j;
+
+			if (sent < PACKETS)
+			{
+				for (j = 0; j < PACKET_SIZE; j ++)
+					packet[j] = stream_byte(sent * PACKET_SIZE + j);
+				if (usbsim_host_out(data_out, packet, sizeof packet) == USBSIM_ACK)
+					sent ++;
+			}
+			len = usbsim_host_in(data_in, packet, sizeof packet);
+			for (j = 0; j < len; j ++)
+				if (packet[j] == '>')
+					markers ++;
+				else if (packet[j] == stream_byte(received))
+					received ++, markers = 0;
+				else
+					break;
+			if (j < len)
+				break;
+			if (len > 0)
+				timeout = usbsim_host_frame_number() + TIMEOUT_FRAMES;
+			if ((int32_t) (usbsim_host_frame_number() - timeout) > 0)
+				break;
+		}
+		if (received != PACKETS * PACKET_SIZE || markers != 3)
+		{
+			fprintf(stderr, "loopback failed after %u bytes\n", received);
+			return EXIT_FAILURE;
+		}
+		/* the last notification is sent on the next frame */
+		usbsim_host_idle_frames(2);
+		if (bad_notifications)
+		{
+			fprintf(stderr, "%u bad notification transfers\n", bad_notifications);
+			return EXIT_FAILURE;
+		}
+		printf("%10u %12.0f %10llu %10u %12u %12u %10u\n", (unsigned) main_loop_loads[i],
+				(double) PACKETS * PACKET_SIZE * USBSIM_CPU_HZ / (usbsim_bus_cycles() - start),
+				(unsigned long long) usbsim_stats.out_nak,
+				(unsigned) (cdcacm_stats[0].rx_throttles - stats.rx_throttles),
+				(unsigned) (cdcacm_stats[0].rx_throttled_frames - stats.rx_throttled_frames),
+				(unsigned) cdcacm_stats[0].rx_max_throttled_frames,
+				overrun_notifications - overruns);
+	}
+	return EXIT_SUCCESS;
+}
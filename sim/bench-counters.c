@@ -0,0 +1,167 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* benchmark: the performance counters of the firmware, read by the host with
+ * a vendor request at a fixed rate while it streams data through the
+ * loopback, with the firmware built for polled and for interrupt driven
+ * operation, at increasing main loop loads; the device counts of the data
+ * packets and bytes are checked against those of the host, and the rates,
+ * the buffer high-water marks and the service maxima are reported - the
+ * largest of the readings, for the high-water marks and maxima
+ *
+ * the program is linked once against each firmware build, the first argument
+ * names the build in the report */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libopencm3/usb/cdc.h>
+#include "usbsim.h"
+#include "cdcacm-counters.h"
+#include "cdcacm-requests.h"
+
+enum
+{
+	PACKET_SIZE	= 64,
+	STREAM_FRAMES	= 200,
+	/* the counters are read every this many frames */
+	READ_FRAMES	= 10,
+	/* the echo has drained once nothing is received for this long */
+	DRAIN_FRAMES	= 20,
+};
+
+static int control_interface;
+
+static int read_counters(struct cdcacm_counters * c)
+{
+	return usbsim_host_vendor_request(control_interface, CDCACM_REQ_GET_COUNTERS, 0, c, sizeof * c) == sizeof * c ? 0 : -1;
+}
+
+static uint32_t max(uint32_t a, uint32_t b)
+{
+	return a > b ? a : b;
+}
+
+/* the host side counts */
+struct host_counts
+{
+	uint32_t	out_packets, out_bytes, in_packets, in_bytes;
+};
+
+int main(int argc, char ** argv)
+{
+	const char * mode = argc > 1 ? argv[1] : "firmware";
+	int data_in, data_out;
+	unsigned i;
+
+	usbsim_start(usbsim_firmware_main);
+	if (usbsim_host_enumerate())
+	{
+		fprintf(stderr, "enumeration failed\n");
+		return EXIT_FAILURE;
+	}
+	data_in = usbsim_host_find_endpoint(USB_CLASS_DATA, USB_ENDPOINT_ATTR_BULK, true);
+	data_out = usbsim_host_find_endpoint(USB_CLASS_DATA, USB_ENDPOINT_ATTR_BULK, false);
+	control_interface = usbsim_host_find_interface(USB_CLASS_CDC);
+
+	printf("%-10s %8s %10s %10s %9s %8s %8s %12s %12s %13s %13s\n", "mode", "load", "out pkt/s", "in bytes/s",
+			"out naks", "rx high", "tx high", "loops/ms", "services/ms", "max service", "max latency");
+	for (i = 0; i < sizeof usbsim_main_loop_loads / sizeof * usbsim_main_loop_loads; i ++)
+	{
+		struct cdcacm_counters first, last, c;
+		struct cdcacm_endpoint_counters * out, * in;
+		struct host_counts host = { 0, };
+		uint32_t rx_high = 0, tx_high = 0, max_service = 0, max_latency = 0, end, idle;
+		uint64_t start;
+		double seconds;
+
+		usbsim_cost.main_loop_load = usbsim_main_loop_loads[i];
+		if (read_counters(& first))
+		{
+			fprintf(stderr, "reading the counters failed\n");
+			return EXIT_FAILURE;
+		}
+		start = usbsim_bus_cycles();
+		end = idle = usbsim_host_frame_number() + STREAM_FRAMES;
+		/* stream, and then let the echo drain */
+		while ((int32_t) (usbsim_host_frame_number() - idle - DRAIN_FRAMES) < 0)
+		{
+			uint8_t packet[PACKET_SIZE];
+			uint32_t frame = usbsim_host_frame_number();
+			int len;
+
+			memset(packet, 'a' + frame % 26, sizeof packet);
+			if ((int32_t) (frame - end) < 0 && usbsim_host_out(data_out, packet, sizeof packet) == USBSIM_ACK)
+				host.out_packets ++, host.out_bytes += sizeof packet;
+			if ((len = usbsim_host_in(data_in, packet, sizeof packet)) >= 0)
+			{
+				host.in_packets ++, host.in_bytes += len;
+				if ((int32_t) (frame - idle) > 0)
+					idle = frame;
+			}
+			if (frame % READ_FRAMES || frame == usbsim_host_frame_number())
+				continue;
+			/* a new frame has started; read the counters once every
+			 * 'READ_FRAMES' frames */
+			if (read_counters(& c))
+			{
+				fprintf(stderr, "reading the counters failed\n");
+				return EXIT_FAILURE;
+			}
+			rx_high = max(rx_high, c.rx_high_water[0]);
+			tx_high = max(tx_high, c.tx_high_water[0]);
+			max_service = max(max_service, c.max_service_cycles);
+			max_latency = max(max_latency, c.max_service_latency);
+		}
+		if (read_counters(& last))
+		{
+			fprintf(stderr, "reading the counters failed\n");
+			return EXIT_FAILURE;
+		}
+		seconds = (double) (usbsim_bus_cycles() - start) / USBSIM_CPU_HZ;
+		out = & last.endpoints[data_out & 0x7f][0];
+		in = & last.endpoints[data_in & 0x7f][1];
+		if (out->packets - first.endpoints[data_out & 0x7f][0].packets != host.out_packets
+				|| out->bytes - first.endpoints[data_out & 0x7f][0].bytes != host.out_bytes
+				|| in->packets - first.endpoints[data_in & 0x7f][1].packets != host.in_packets
+				|| in->bytes - first.endpoints[data_in & 0x7f][1].bytes != host.in_bytes)
+		{
+			fprintf(stderr, "device counts %u/%u out, %u/%u in, host counts %u/%u out, %u/%u in\n",
+					(unsigned) (out->packets - first.endpoints[data_out & 0x7f][0].packets),
+					(unsigned) (out->bytes - first.endpoints[data_out & 0x7f][0].bytes),
+					(unsigned) (in->packets - first.endpoints[data_in & 0x7f][1].packets),
+					(unsigned) (in->bytes - first.endpoints[data_in & 0x7f][1].bytes),
+					host.out_packets, host.out_bytes, host.in_packets, host.in_bytes);
+			return EXIT_FAILURE;
+		}
+		printf("%-10s %8u %10.0f %10.0f %9u %8u %8u %12.1f %12.1f %13u %13u\n", mode, (unsigned) usbsim_main_loop_loads[i],
+				host.out_packets / seconds, host.in_bytes / seconds,
+				(unsigned) (out->naks - first.endpoints[data_out & 0x7f][0].naks),
+				(unsigned) max(rx_high, last.rx_high_water[0]), (unsigned) max(tx_high, last.tx_high_water[0]),
+				(last.main_loop_iterations - first.main_loop_iterations) / seconds / 1000,
+				(last.services - first.services) / seconds / 1000,
+				(unsigned) max(max_service, last.max_service_cycles),
+				(unsigned) max(max_latency, last.max_service_latency));
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,111 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* benchmark: the cpu cycles the firmware spends on the usb traffic, per
+ * packet and per usbd_poll() call, as modelled by the simulator; the host
+ * streams packets of a few sizes through the loopback, with the firmware
+ * built for polled and for interrupt driven operation, and the report shows
+ * the busy cycles per packet on the bus - all cycles the cpu is not asleep,
+ * so a polled build, which never sleeps, spends all of them - and the average
+ * and the largest cycles of a poll, callbacks included
+ *
+ * the cycles are those of the cost model of the simulator, not of the real
+ * core; they show how a change moves the firmware cost, not the cost on the
+ * board
+ *
+ * the program is linked once against each firmware build, the first argument
+ * names the build in the report */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libopencm3/usb/cdc.h>
+#include "usbsim.h"
+
+enum
+{
+	STREAM_FRAMES	= 200,
+	/* the echo has drained once nothing is received for this long */
+	DRAIN_FRAMES	= 20,
+	MAX_PACKET_SIZE	= 64,
+};
+
+static const unsigned packet_sizes[] = { 64, 16, 1, };
+
+int main(int argc, char ** argv)
+{
+	const char * mode = argc > 1 ? argv[1] : "firmware";
+	int data_in, data_out;
+	unsigned i;
+
+	usbsim_start(usbsim_firmware_main);
+	if (usbsim_host_enumerate())
+	{
+		fprintf(stderr, "enumeration failed\n");
+		return EXIT_FAILURE;
+	}
+	data_in = usbsim_host_find_endpoint(USB_CLASS_DATA, USB_ENDPOINT_ATTR_BULK, true);
+	data_out = usbsim_host_find_endpoint(USB_CLASS_DATA, USB_ENDPOINT_ATTR_BULK, false);
+
+	printf("%-10s %6s %10s %10s %12s %10s %10s %10s\n", "mode", "size", "out pkts", "in bytes",
+			"busy/packet", "polls", "poll avg", "poll max");
+	for (i = 0; i < sizeof packet_sizes / sizeof * packet_sizes; i ++)
+	{
+		unsigned out_packets = 0, in_bytes = 0;
+		uint32_t end, idle;
+		uint64_t packets;
+
+		usbsim_reset_stats();
+		end = idle = usbsim_host_frame_number() + STREAM_FRAMES;
+		/* stream, and then let the echo drain */
+		while ((int32_t) (usbsim_host_frame_number() - idle - DRAIN_FRAMES) < 0)
+		{
+			uint8_t packet[MAX_PACKET_SIZE];
+			uint32_t frame = usbsim_host_frame_number();
+			int len;
+
+			memset(packet, 'a' + frame % 26, packet_sizes[i]);
+			if ((int32_t) (frame - end) < 0 && usbsim_host_out(data_out, packet, packet_sizes[i]) == USBSIM_ACK)
+				out_packets ++;
+			if ((len = usbsim_host_in(data_in, packet, sizeof packet)) >= 0)
+			{
+				in_bytes += len;
+				if ((int32_t) (frame - idle) > 0)
+					idle = frame;
+			}
+		}
+		/* the echo holds the data sent, and the markers of the loopback */
+		if (in_bytes < out_packets * packet_sizes[i])
+		{
+			fprintf(stderr, "%u bytes sent, %u echoed\n", out_packets * packet_sizes[i], in_bytes);
+			return EXIT_FAILURE;
+		}
+		packets = usbsim_stats.in_ack + usbsim_stats.out_ack;
+		printf("%-10s %6u %10u %10u %12llu %10llu %10llu %10llu\n", mode, packet_sizes[i], out_packets, in_bytes,
+				(unsigned long long) (usbsim_busy_cycles() / packets),
+				(unsigned long long) usbsim_stats.polls,
+				(unsigned long long) (usbsim_stats.poll_cycles / usbsim_stats.polls),
+				(unsigned long long) usbsim_stats.max_poll_cycles);
+	}
+	return EXIT_SUCCESS;
+}
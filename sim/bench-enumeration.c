@@ -0,0 +1,99 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* benchmark: enumeration time with each control endpoint size; the time from
+ * the bus reset that starts enumeration proper - the second one of the linux
+ * sequence (see usbsim_host_enumerate()) - until the device is configured,
+ * the number of control endpoint transactions it takes, the bus time they
+ * take - retries of nak'd transactions included - and the time a full read
+ * of the configuration descriptor takes afterwards
+ *
+ * the reset and address recovery times the host waits take most of the
+ * enumeration time, the control transfers the rest; the control endpoint
+ * size only makes a difference in the control transfers, and it adds up for
+ * a rig that enumerates many devices at once, on a shared bus
+ *
+ * the program is linked once against each firmware build, the first argument
+ * names the build in the report */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "usbsim.h"
+
+/* the control endpoint transactions since the last bus reset */
+static uint64_t last_reset, control_cycles, transactions, naks;
+
+static void count_transaction(const struct usbsim_transaction * t)
+{
+	if (t->type == USBSIM_TRANSACTION_RESET)
+		last_reset = t->start, control_cycles = transactions = naks = 0;
+	else if (!t->ep)
+	{
+		/* the hook is called at the end of the transaction */
+		control_cycles += usbsim_bus_cycles() - t->start;
+		transactions ++;
+		naks += t->result == USBSIM_NAK;
+	}
+}
+
+int main(int argc, char ** argv)
+{
+	const char * mode = argc > 1 ? argv[1] : "firmware";
+	struct usb_setup_data req =
+	{
+		.bmRequestType	= USB_REQ_TYPE_IN,
+		.bRequest	= USB_REQ_GET_DESCRIPTOR,
+		.wValue		= USB_DT_CONFIGURATION << 8,
+		.wIndex		= 0,
+		.wLength	= 512,
+	};
+	uint8_t config[512];
+	uint64_t configured, start;
+	int config_length;
+
+	usbsim_transaction_hook = count_transaction;
+	usbsim_start(usbsim_firmware_main);
+	if (usbsim_host_enumerate())
+	{
+		fprintf(stderr, "enumeration failed\n");
+		return EXIT_FAILURE;
+	}
+	configured = usbsim_bus_cycles();
+	usbsim_transaction_hook = 0;
+
+	start = usbsim_bus_cycles();
+	if ((config_length = usbsim_host_control(& req, config)) < 0)
+	{
+		fprintf(stderr, "reading the configuration descriptor failed\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("%-10s %10s %14s %12s %10s %12s %14s\n", "mode", "ep0 size", "configured in", "transactions",
+			"ep0 naks", "control time", "config read");
+	printf("%-10s %10u %11.3f ms %12llu %10llu %9.1f us %8.1f us/%u\n", mode, usbsim_host_ep0_size(),
+			(double) (configured - last_reset) * 1000 / USBSIM_CPU_HZ,
+			(unsigned long long) transactions, (unsigned long long) naks,
+			(double) control_cycles * 1e6 / USBSIM_CPU_HZ,
+			(double) (usbsim_bus_cycles() - start) * 1e6 / USBSIM_CPU_HZ, config_length);
+	return EXIT_SUCCESS;
+}
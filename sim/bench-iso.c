@@ -0,0 +1,191 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* benchmark: isochronous streaming against bulk transfers, for data that is
+ * sampled at a fixed rate; the firmware test source produces time stamped
+ * samples while the host streams from the isochronous alternate setting of
+ * the data interface, and the host measures the latency from the oldest
+ * sample of each packet being due to the packet arriving; alongside, the host sends a time stamp
+ * through the bulk loopback in every frame, and measures the latency until
+ * its echo arrives - with other devices on the bus taking more and more of
+ * each frame, which squeezes the bulk transfers, but not the isochronous
+ * ones, whose bus time is reserved */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libopencm3/usb/cdc.h>
+#include "usbsim.h"
+#include "cdcacm-stats.h"
+
+enum
+{
+	PACKET_SIZE	= 64,
+	ISO_PACKET_SIZE	= 64,
+	FRAMES		= 2000,
+	/* the bulk time stamp message, 8 hex digits and a newline */
+	MESSAGE_SIZE	= 9,
+};
+
+static const unsigned foreign_loads[] = { 0, 6000, 10000, 11000, };
+
+struct latency
+{
+	uint64_t	count, total;
+	uint32_t	min, max;
+};
+
+static struct latency iso_latency, bulk_latency;
+
+static void latency_add(struct latency * l, uint32_t cycles)
+{
+	if (!l->count || cycles < l->min)
+		l->min = cycles;
+	if (cycles > l->max)
+		l->max = cycles;
+	l->count ++;
+	l->total += cycles;
+}
+
+/* the samples are the values of the firmware cycle counter at the time they
+ * were due; the firmware cpu clock runs in step with the bus clock; the short
+ * packets of underruns - as at the start of the stream - are counted by the
+ * firmware, and left out here */
+static void iso_packet(uint8_t ep, const void * data, int len)
+{
+	uint32_t sample;
+
+	(void) ep;
+	if (len != ISO_PACKET_SIZE)
+		return;
+	memcpy(& sample, data, sizeof sample);
+	latency_add(& iso_latency, (uint32_t) usbsim_bus_cycles() - sample);
+}
+
+static int select_alternate_setting(int interface, int alternate)
+{
+	struct usb_setup_data req = { .bmRequestType = USB_REQ_TYPE_INTERFACE, .bRequest = USB_REQ_SET_INTERFACE,
+		.wValue = alternate, .wIndex = interface, .wLength = 0, };
+
+	return usbsim_host_control(& req, 0);
+}
+
+static void print_latency(const struct latency * l)
+{
+	if (!l->count)
+		printf(" %8s %8s %8s %8s", "-", "-", "-", "-");
+	else
+		printf(" %8.1f %8.1f %8.1f %8.1f", usbsim_cycles_to_us(l->min), usbsim_cycles_to_us(l->total / l->count),
+				usbsim_cycles_to_us(l->max), usbsim_cycles_to_us(l->max - l->min));
+}
+
+int main(void)
+{
+	int data_in, data_out, iso_in, data_interface, i;
+
+	usbsim_start(usbsim_firmware_main);
+	if (usbsim_host_enumerate())
+	{
+		fprintf(stderr, "enumeration failed\n");
+		return EXIT_FAILURE;
+	}
+	data_in = usbsim_host_find_endpoint(USB_CLASS_DATA, USB_ENDPOINT_ATTR_BULK, true);
+	data_out = usbsim_host_find_endpoint(USB_CLASS_DATA, USB_ENDPOINT_ATTR_BULK, false);
+	iso_in = usbsim_host_find_endpoint(USB_CLASS_DATA, USB_ENDPOINT_ATTR_ISOCHRONOUS, true);
+	data_interface = usbsim_host_find_interface(USB_CLASS_DATA);
+	if (iso_in == -1)
+	{
+		fprintf(stderr, "no isochronous endpoint\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("latencies in microseconds: min, avg, max, and jitter (max - min)\n");
+	printf("%12s %-35s %s\n", "", "isochronous packets", "bulk echoes");
+	printf("%12s %8s %8s %8s %8s %8s %8s %8s %8s %10s %10s %10s\n", "foreign bits",
+			"min", "avg", "max", "jitter", "min", "avg", "max", "jitter", "messages", "underruns", "missed");
+	for (i = 0; i < (int) (sizeof foreign_loads / sizeof * foreign_loads); i ++)
+	{
+		struct cdcacm_stats stats = cdcacm_stats[0];
+		uint32_t frame, end, last_sent;
+		char line[16];
+		unsigned line_length = 0;
+		bool is_message_pending = false;
+		uint8_t message[MESSAGE_SIZE + 1];
+
+		memset(& iso_latency, 0, sizeof iso_latency);
+		memset(& bulk_latency, 0, sizeof bulk_latency);
+		usbsim_host_set_foreign_load(foreign_loads[i]);
+		if (select_alternate_setting(data_interface, 1) < 0)
+		{
+			fprintf(stderr, "selecting the isochronous alternate setting failed\n");
+			return EXIT_FAILURE;
+		}
+		usbsim_host_poll_isochronous(iso_in, ISO_PACKET_SIZE, iso_packet);
+		last_sent = usbsim_host_frame_number();
+		end = last_sent + FRAMES;
+		while ((int32_t) ((frame = usbsim_host_frame_number()) - end) < 0)
+		{
+			uint8_t packet[PACKET_SIZE];
+			int len, j;
+
+			/* a new time stamp in every frame, once the one before
+			 * has been sent */
+			if (!is_message_pending && frame != last_sent)
+			{
+				snprintf((char *) message, sizeof message, "%08x\n", (unsigned) usbsim_bus_cycles());
+				is_message_pending = true;
+				last_sent = frame;
+			}
+			if (is_message_pending && usbsim_host_out(data_out, message, MESSAGE_SIZE) == USBSIM_ACK)
+				is_message_pending = false;
+			/* the loopback inserts '>' markers, which are skipped */
+			len = usbsim_host_in(data_in, packet, sizeof packet);
+			for (j = 0; j < len; j ++)
+				if (packet[j] == '\n')
+				{
+					line[line_length] = 0;
+					latency_add(& bulk_latency, (uint32_t) usbsim_bus_cycles() - strtoul(line, 0, 16));
+					line_length = 0;
+				}
+				else if (packet[j] != '>' && line_length < sizeof line - 1)
+					line[line_length ++] = packet[j];
+		}
+		usbsim_host_stop_polling(iso_in);
+		if (select_alternate_setting(data_interface, 0) < 0)
+		{
+			fprintf(stderr, "selecting the default alternate setting failed\n");
+			return EXIT_FAILURE;
+		}
+		/* let the echoes still under way drain */
+		usbsim_host_set_foreign_load(0);
+		usbsim_host_bulk_read_stream(data_in, (uint8_t [PACKET_SIZE * 8]) {}, PACKET_SIZE * 8, PACKET_SIZE, 10);
+
+		printf("%12u", foreign_loads[i]);
+		print_latency(& iso_latency);
+		print_latency(& bulk_latency);
+		printf(" %10llu %10llu %10llu\n", (unsigned long long) bulk_latency.count,
+				(unsigned long long) (cdcacm_stats[0].iso_underruns - stats.iso_underruns),
+				(unsigned long long) (cdcacm_stats[0].iso_missed_frames - stats.iso_missed_frames));
+	}
+	return EXIT_SUCCESS;
+}
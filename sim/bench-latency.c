@@ -0,0 +1,168 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* benchmark: request/response latency with the latency probe test mode of
+ * the firmware; the host sends requests of a few sizes, each once the answer
+ * to the one before is in, at random points of the frame, and measures the
+ * end to end latency, from sending a request to receiving all of its echo;
+ * the firmware measures the time it takes to answer each packet received,
+ * which the host then reads with a vendor request; the percentiles of both
+ * are compared, at increasing main loop loads
+ *
+ * the device side percentiles are the upper bounds of the histogram buckets
+ * they fall in */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libopencm3/usb/cdc.h>
+#include "usbsim.h"
+#include "latency-histogram.h"
+#include "cdcacm-requests.h"
+
+enum
+{
+	PACKET_SIZE	= 64,
+	REQUESTS	= 500,
+	MAX_REQUEST	= 256,
+	TIMEOUT_FRAMES	= 100,
+	/* the baud rate the latency probe test mode is selected with */
+	LATENCY_BAUD_RATE	= 134,
+};
+
+static const unsigned request_sizes[] = { 8, 64, 256, };
+
+static int compare_cycles(const void * a, const void * b)
+{
+	uint64_t x = * (const uint64_t *) a, y = * (const uint64_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* the latency that a 'fraction' of the counts in a histogram does not
+ * exceed */
+static uint32_t histogram_percentile(const struct latency_histogram * h, double fraction)
+{
+	uint64_t count = 0;
+	unsigned i;
+
+	for (i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i ++)
+		if ((count += h->buckets[i]) >= fraction * h->count)
+			break;
+	if (i >= LATENCY_HISTOGRAM_BUCKETS - 1 || latency_histogram_bucket_start(i + 1) > h->max)
+		return h->max;
+	return latency_histogram_bucket_start(i + 1);
+}
+
+/* sends a request, and reads its echo; returns the end to end latency in bus
+ * cycles, or 0 on failure */
+static uint64_t request(int data_in, int data_out, const uint8_t * data, unsigned len)
+{
+	uint8_t echo[MAX_REQUEST + PACKET_SIZE];
+	uint64_t start = usbsim_bus_cycles();
+	unsigned sent = 0, received = 0;
+	uint32_t timeout = usbsim_host_frame_number() + TIMEOUT_FRAMES;
+
+	/* the firmware answers whatever it has received right away, so a
+	 * request that ends on a packet boundary needs no zero length packet */
+	while (received < len)
+	{
+		int n;
+
+		if (sent < len)
+		{
+			n = len - sent < PACKET_SIZE ? len - sent : PACKET_SIZE;
+			if (usbsim_host_out(data_out, data + sent, n) == USBSIM_ACK)
+				sent += n;
+		}
+		if ((n = usbsim_host_in(data_in, echo + received, PACKET_SIZE)) > 0)
+			received += n;
+		if ((int32_t) (usbsim_host_frame_number() - timeout) > 0 || received > len)
+			return 0;
+	}
+	return memcmp(echo, data, len) ? 0 : usbsim_bus_cycles() - start;
+}
+
+int main(void)
+{
+	static uint64_t latencies[REQUESTS];
+	uint8_t data[MAX_REQUEST];
+	int data_in, data_out, control_interface, i, j, k;
+	uint32_t seed = 1;
+
+	usbsim_start(usbsim_firmware_main);
+	if (usbsim_host_enumerate())
+	{
+		fprintf(stderr, "enumeration failed\n");
+		return EXIT_FAILURE;
+	}
+	data_in = usbsim_host_find_endpoint(USB_CLASS_DATA, USB_ENDPOINT_ATTR_BULK, true);
+	data_out = usbsim_host_find_endpoint(USB_CLASS_DATA, USB_ENDPOINT_ATTR_BULK, false);
+	control_interface = usbsim_host_find_interface(USB_CLASS_CDC);
+	if (usbsim_host_set_line_coding(control_interface, LATENCY_BAUD_RATE) < 0)
+	{
+		fprintf(stderr, "selecting the latency probe mode failed\n");
+		return EXIT_FAILURE;
+	}
+	for (k = 0; k < MAX_REQUEST; k ++)
+		data[k] = 'a' + k % 26;
+
+	printf("%-10s %6s %31s %31s\n", "", "", "end to end, us", "in device, us");
+	printf("%-10s %6s %10s %10s %10s %10s %10s %10s\n", "load/iter", "size", "p50", "p99", "max", "p50", "p99", "max");
+	for (i = 0; i < (int) (sizeof usbsim_main_loop_loads / sizeof * usbsim_main_loop_loads); i ++)
+		for (j = 0; j < (int) (sizeof request_sizes / sizeof * request_sizes); j ++)
+		{
+			struct latency_histogram h;
+
+			usbsim_cost.main_loop_load = usbsim_main_loop_loads[i];
+			if (usbsim_host_vendor_request(control_interface, CDCACM_REQ_CLEAR_LATENCY_HISTOGRAM, 0, 0, 0) < 0)
+			{
+				fprintf(stderr, "clearing the histogram failed\n");
+				return EXIT_FAILURE;
+			}
+			for (k = 0; k < REQUESTS; k ++)
+			{
+				/* start at a random point of the frame */
+				seed = seed * 1103515245 + 12345;
+				usbsim_host_idle(seed % USBSIM_CYCLES_PER_FRAME);
+				if (!(latencies[k] = request(data_in, data_out, data, request_sizes[j])))
+				{
+					fprintf(stderr, "request %d of %u bytes failed\n", k, request_sizes[j]);
+					return EXIT_FAILURE;
+				}
+			}
+			if (usbsim_host_vendor_request(control_interface, CDCACM_REQ_GET_LATENCY_HISTOGRAM, 0, & h, sizeof h) != sizeof h)
+			{
+				fprintf(stderr, "reading the histogram failed\n");
+				return EXIT_FAILURE;
+			}
+			qsort(latencies, REQUESTS, sizeof * latencies, compare_cycles);
+			printf("%10u %6u %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+					(unsigned) usbsim_main_loop_loads[i], request_sizes[j],
+					usbsim_cycles_to_us(latencies[REQUESTS / 2]), usbsim_cycles_to_us(latencies[REQUESTS * 99 / 100]),
+					usbsim_cycles_to_us(latencies[REQUESTS - 1]),
+					usbsim_cycles_to_us(histogram_percentile(& h, .5)),
+					usbsim_cycles_to_us(histogram_percentile(& h, .99)), usbsim_cycles_to_us(h.max));
+		}
+	return EXIT_SUCCESS;
+}
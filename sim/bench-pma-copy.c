@@ -0,0 +1,65 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* benchmark: cycles per full speed packet of the packet memory copy kernels
+ * (src/pma.c), from the firmware benchmark (src/pma-bench.c) run against the
+ * simulator cost model; on target, the same figures come from the dwt cycle
+ * counter */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "usbsim.h"
+#include "pma-bench.h"
+
+enum
+{
+	TIMEOUT_FRAMES	= 100,
+};
+
+int main(void)
+{
+	unsigned i;
+	int status = EXIT_SUCCESS;
+
+	usbsim_start(usbsim_firmware_main);
+	for (i = 0; !pma_bench_result_count && i < TIMEOUT_FRAMES; i ++)
+		usbsim_host_idle_frames(1);
+	if (!pma_bench_result_count)
+	{
+		fprintf(stderr, "the benchmark did not complete\n");
+		return EXIT_FAILURE;
+	}
+	printf("pma copy, cycles per %d byte packet\n", PMA_BENCH_PACKET_SIZE);
+	printf("%-10s %-10s %8s %8s\n", "kernel", "buffer", "write", "read");
+	for (i = 0; i < pma_bench_result_count; i ++)
+	{
+		const struct pma_bench_result * r = & pma_bench_results[i];
+
+		printf("%-10s %-10s %8u %8u%s\n", r->kernel, r->buffer,
+				(unsigned) r->write_cycles, (unsigned) r->read_cycles,
+				r->is_correct ? "" : "  DATA MISMATCH");
+		if (!r->is_correct)
+			status = EXIT_FAILURE;
+	}
+	return status;
+}
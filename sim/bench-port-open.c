@@ -0,0 +1,208 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* benchmark: serial port open time; the host opens the port the way host
+ * serial port drivers do - raising DTR and RTS, reading the line coding,
+ * setting the line coding it wants and reading it back - and closes it again,
+ * dropping DTR and RTS, with a different line coding each time; a request
+ * that fails is retried after a delay, as host drivers do, so that requests
+ * the device does not handle show in the open time
+ *
+ * the device reports DCD and DSR following DTR in SERIAL_STATE notifications,
+ * which are checked after each open and close */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libopencm3/usb/cdc.h>
+#include "usbsim.h"
+
+enum
+{
+	OPENS			= 200,
+	/* the retries of a failed request, and the delay before each */
+	RETRIES			= 3,
+	RETRY_FRAMES		= 10,
+	CONTROL_LINE_DTR_RTS	= 3,
+	SERIAL_STATE_DCD_DSR	= 3,
+};
+
+enum request
+{
+	SET_CONTROL_LINE_STATE,
+	GET_LINE_CODING,
+	SET_LINE_CODING,
+	REQUESTS,
+};
+
+static const char * request_names[REQUESTS] =
+{
+	[SET_CONTROL_LINE_STATE]	= "SET_CONTROL_LINE_STATE",
+	[GET_LINE_CODING]		= "GET_LINE_CODING",
+	[SET_LINE_CODING]		= "SET_LINE_CODING",
+};
+
+static const uint32_t rates[] = { 9600, 19200, 57600, 115200, 230400, 460800, 921600, };
+
+static struct
+{
+	uint64_t	cycles, max_cycles;
+	unsigned	count, failures;
+}
+request_stats[REQUESTS];
+
+static uint8_t control_interface;
+
+/* the line state in the last SERIAL_STATE notification, and the interrupt
+ * transfers that did not carry exactly one notification */
+static uint16_t serial_state;
+static unsigned bad_notifications;
+
+static void notification_received(uint8_t ep, const void * data, int len)
+{
+	const struct usb_cdc_notification * n = data;
+
+	(void) ep;
+	/* host drivers only look at the first notification of a transfer */
+	if (len < (int) sizeof * n || len != (int) (sizeof * n + n->wLength))
+		bad_notifications ++;
+	else if (len == sizeof * n + sizeof serial_state && n->bNotification == USB_CDC_NOTIFY_SERIAL_STATE)
+		memcpy(& serial_state, n + 1, sizeof serial_state);
+}
+
+static int class_request(enum request request, uint16_t wValue, void * data)
+{
+	static const uint8_t codes[REQUESTS] =
+	{
+		[SET_CONTROL_LINE_STATE]	= USB_CDC_REQ_SET_CONTROL_LINE_STATE,
+		[GET_LINE_CODING]		= USB_CDC_REQ_GET_LINE_CODING,
+		[SET_LINE_CODING]		= USB_CDC_REQ_SET_LINE_CODING,
+	};
+	struct usb_setup_data req =
+	{
+		.bmRequestType	= (request == GET_LINE_CODING ? USB_REQ_TYPE_IN : 0)
+				| USB_REQ_TYPE_CLASS | USB_REQ_TYPE_INTERFACE,
+		.bRequest	= codes[request],
+		.wValue		= wValue,
+		.wIndex		= control_interface,
+		.wLength	= request == SET_CONTROL_LINE_STATE ? 0 : sizeof(struct usb_cdc_line_coding),
+	};
+	uint64_t start = usbsim_bus_cycles(), cycles;
+	int result, retries = 0;
+
+	while ((result = usbsim_host_control(& req, data)) < 0 && retries ++ < RETRIES)
+	{
+		request_stats[request].failures ++;
+		usbsim_host_idle_frames(RETRY_FRAMES);
+	}
+	if (result < 0)
+		request_stats[request].failures ++;
+	cycles = usbsim_bus_cycles() - start;
+	request_stats[request].cycles += cycles;
+	request_stats[request].count ++;
+	if (cycles > request_stats[request].max_cycles)
+		request_stats[request].max_cycles = cycles;
+	return result;
+}
+
+int main(void)
+{
+	uint64_t open_cycles = 0, max_open_cycles = 0;
+	struct usb_cdc_line_coding line_coding;
+	int i;
+
+	usbsim_start(usbsim_firmware_main);
+	if (usbsim_host_enumerate())
+	{
+		fprintf(stderr, "enumeration failed\n");
+		return EXIT_FAILURE;
+	}
+	control_interface = usbsim_host_find_interface(USB_CLASS_CDC);
+	usbsim_host_poll_periodic(usbsim_host_find_endpoint(USB_CLASS_CDC, USB_ENDPOINT_ATTR_INTERRUPT, true),
+			1, notification_received);
+
+	for (i = 0; i < OPENS; i ++)
+	{
+		struct usb_cdc_line_coding wanted =
+		{
+			.dwDTERate	= rates[i % (sizeof rates / sizeof * rates)],
+			.bCharFormat	= i & 1 ? USB_CDC_2_STOP_BITS : USB_CDC_1_STOP_BITS,
+			.bParityType	= i % 3 ? USB_CDC_EVEN_PARITY : USB_CDC_NO_PARITY,
+			.bDataBits	= i & 2 ? 7 : 8,
+		};
+		uint64_t start = usbsim_bus_cycles(), cycles;
+
+		class_request(SET_CONTROL_LINE_STATE, CONTROL_LINE_DTR_RTS, 0);
+		class_request(GET_LINE_CODING, 0, & line_coding);
+		class_request(SET_LINE_CODING, 0, & wanted);
+		if (class_request(GET_LINE_CODING, 0, & line_coding) != sizeof line_coding
+				|| memcmp(& line_coding, & wanted, sizeof line_coding))
+		{
+			fprintf(stderr, "line coding not set\n");
+			return EXIT_FAILURE;
+		}
+		cycles = usbsim_bus_cycles() - start;
+		open_cycles += cycles;
+		if (cycles > max_open_cycles)
+			max_open_cycles = cycles;
+		/* the notification is sent on the next frame */
+		usbsim_host_idle_frames(2);
+		if ((serial_state & SERIAL_STATE_DCD_DSR) != SERIAL_STATE_DCD_DSR)
+		{
+			fprintf(stderr, "no DCD and DSR on open\n");
+			return EXIT_FAILURE;
+		}
+		class_request(SET_CONTROL_LINE_STATE, 0, 0);
+		usbsim_host_idle_frames(2);
+		if (serial_state & SERIAL_STATE_DCD_DSR)
+		{
+			fprintf(stderr, "DCD and DSR after close\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (bad_notifications)
+	{
+		fprintf(stderr, "%u bad notification transfers\n", bad_notifications);
+		return EXIT_FAILURE;
+	}
+
+	printf("%-24s %12s %12s %10s\n", "request", "avg", "max", "failures");
+	for (i = 0; i < REQUESTS; i ++)
+		printf("%-24s %9.1f us %9.1f us %10u\n", request_names[i],
+				usbsim_cycles_to_us(request_stats[i].cycles / request_stats[i].count),
+				usbsim_cycles_to_us(request_stats[i].max_cycles), request_stats[i].failures);
+	printf("%-24s %9.1f us %9.1f us\n", "port open",
+			usbsim_cycles_to_us(open_cycles / OPENS), usbsim_cycles_to_us(max_open_cycles));
+
+	/* a malformed line coding must be rejected right away */
+	line_coding.bDataBits = 9;
+	if (usbsim_host_control(& (struct usb_setup_data) { .bmRequestType = USB_REQ_TYPE_CLASS | USB_REQ_TYPE_INTERFACE,
+			.bRequest = USB_CDC_REQ_SET_LINE_CODING, .wIndex = control_interface,
+			.wLength = sizeof line_coding, }, & line_coding) != USBSIM_STALL)
+	{
+		fprintf(stderr, "bad line coding accepted\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,216 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* benchmark: a composite device with two serial ports; the host streams data
+ * through the loopback of one port alone, of both ports at once - issuing
+ * transactions to the endpoints of the two ports in turn - and of one port
+ * while the other port is stalled, its host side never reading what it is
+ * sent, so that the device buffers of that port fill up; the ports are
+ * independent if the data of each comes back on its own port only, and a
+ * stalled port does not hold up the other one - which only loses the bus time
+ * of the naked transactions the host keeps issuing to the stalled port
+ *
+ * the line codings of the ports are also set to different values, and read
+ * back */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libopencm3/usb/cdc.h>
+#include "usbsim.h"
+#include "cdcacm-stats.h"
+
+enum
+{
+	PORTS		= 2,
+	PACKET_SIZE	= 64,
+	PACKETS		= 2000,
+	TIMEOUT_FRAMES	= 100,
+};
+
+/* a loopback stream through a port; the data of each port is different, and
+ * never contains '>' (the firmware's chunk marker) or '!' (its urgent
+ * request) */
+struct stream
+{
+	int		data_in, data_out;
+	char		first;
+	unsigned	sent, received, markers;
+};
+
+static uint8_t stream_byte(const struct stream * s, unsigned offset)
+{
+	return s->first + offset % 26;
+}
+
+static void stream_init(struct stream * s, unsigned port)
+{
+	* s = (struct stream)
+	{
+		.data_in	= usbsim_host_find_endpoint_nth(USB_CLASS_DATA, port, USB_ENDPOINT_ATTR_BULK, true),
+		.data_out	= usbsim_host_find_endpoint_nth(USB_CLASS_DATA, port, USB_ENDPOINT_ATTR_BULK, false),
+		.first		= port ? 'A' : 'a',
+	};
+}
+
+static bool stream_is_done(const struct stream * s)
+{
+	return s->received == PACKETS * PACKET_SIZE && s->markers == 3;
+}
+
+/* an OUT transaction, and an IN transaction - if 'is_read' is true; returns
+ * the number of bytes received, or -1 if they are not the stream data */
+static int stream_step(struct stream * s, bool is_read)
+{
+	uint8_t packet[PACKET_SIZE];
+	int len = 0, i;
+
+	if (s->sent < PACKETS)
+	{
+		for (i = 0; i < PACKET_SIZE; i ++)
+			packet[i] = stream_byte(s, s->sent * PACKET_SIZE + i);
+		if (usbsim_host_out(s->data_out, packet, sizeof packet) == USBSIM_ACK)
+			s->sent ++;
+	}
+	/* a nak counts as no data */
+	if (is_read && (len = usbsim_host_in(s->data_in, packet, sizeof packet)) < 0)
+		len = 0;
+	for (i = 0; i < len; i ++)
+		if (packet[i] == '>')
+			s->markers ++;
+		else if (packet[i] == stream_byte(s, s->received))
+			s->received ++, s->markers = 0;
+		else
+			return -1;
+	return len;
+}
+
+/* streams data through the ports in 'ports' (a bit mask), reading back only
+ * the ports in 'read'; returns the loopback rate of port 0, in bytes per
+ * second, or a negative value on failure, and stores the combined rate of
+ * the ports read back in 'total' */
+static double run(unsigned ports, unsigned read, double * total)
+{
+	struct stream streams[PORTS];
+	uint64_t start = usbsim_bus_cycles();
+	uint32_t timeout = usbsim_host_frame_number() + TIMEOUT_FRAMES;
+	unsigned received = 0;
+	uint64_t cycles;
+	int i, len;
+
+	for (i = 0; i < PORTS; i ++)
+		stream_init(streams + i, i);
+	while (!stream_is_done(streams))
+	{
+		for (i = 0; i < PORTS; i ++)
+			if (ports & (1 << i))
+			{
+				if ((len = stream_step(streams + i, read & (1 << i))) < 0)
+				{
+					fprintf(stderr, "port %i: bad data after %u bytes\n", i, streams[i].received);
+					return -1;
+				}
+				if (len > 0 && !i)
+					timeout = usbsim_host_frame_number() + TIMEOUT_FRAMES;
+			}
+		if ((int32_t) (usbsim_host_frame_number() - timeout) > 0)
+		{
+			fprintf(stderr, "port 0: loopback stalled after %u bytes\n", streams[0].received);
+			return -1;
+		}
+	}
+	for (i = 1; i < PORTS; i ++)
+		if (ports & read & (1 << i))
+			/* the rest of the echo of the other ports */
+			while (!stream_is_done(streams + i))
+				if (stream_step(streams + i, true) < 0 || (int32_t) (usbsim_host_frame_number() - timeout) > 0)
+				{
+					fprintf(stderr, "port %i: loopback failed after %u bytes\n", i, streams[i].received);
+					return -1;
+				}
+	cycles = usbsim_bus_cycles() - start;
+	for (i = 0; i < PORTS; i ++)
+		if (ports & read & (1 << i))
+			received += streams[i].received;
+	* total = (double) received * USBSIM_CPU_HZ / cycles;
+	return (double) PACKETS * PACKET_SIZE * USBSIM_CPU_HZ / cycles;
+}
+
+int main(void)
+{
+	static const struct
+	{
+		const char	* name;
+		unsigned	ports, read;
+	}
+	runs[] =
+	{
+		{ "port 0 alone", 1, 1, },
+		{ "both ports", 3, 3, },
+		{ "port 1 stalled", 3, 1, },
+	};
+	struct usb_cdc_line_coding line_coding;
+	int i;
+
+	usbsim_start(usbsim_firmware_main);
+	if (usbsim_host_enumerate())
+	{
+		fprintf(stderr, "enumeration failed\n");
+		return EXIT_FAILURE;
+	}
+	if (usbsim_host_count_descriptors(USB_DT_INTERFACE_ASSOCIATION) != PORTS
+			|| usbsim_host_find_interface_nth(USB_CLASS_CDC, PORTS - 1) < 0)
+	{
+		fprintf(stderr, "not a composite device with %i ports\n", PORTS);
+		return EXIT_FAILURE;
+	}
+
+	printf("%-16s %16s %16s %10s %18s\n", "run", "port 0 bytes/s", "total bytes/s", "out naks", "port 1 throttles");
+	for (i = 0; i < (int) (sizeof runs / sizeof * runs); i ++)
+	{
+		uint32_t throttles = cdcacm_stats[1].rx_throttles;
+		double rate, total;
+
+		usbsim_reset_stats();
+		if ((rate = run(runs[i].ports, runs[i].read, & total)) < 0)
+			return EXIT_FAILURE;
+		printf("%-16s %16.0f %16.0f %10llu %18u\n", runs[i].name, rate, total,
+				(unsigned long long) usbsim_stats.out_nak, (unsigned) (cdcacm_stats[1].rx_throttles - throttles));
+	}
+
+	/* each port keeps its own line coding */
+	for (i = 0; i < PORTS; i ++)
+		if (usbsim_host_set_line_coding(usbsim_host_find_interface_nth(USB_CLASS_CDC, i), 9600 << i) < 0)
+		{
+			fprintf(stderr, "port %i: line coding not set\n", i);
+			return EXIT_FAILURE;
+		}
+	for (i = 0; i < PORTS; i ++)
+		if (usbsim_host_get_line_coding(usbsim_host_find_interface_nth(USB_CLASS_CDC, i), & line_coding)
+				!= sizeof line_coding || line_coding.dwDTERate != 9600u << i)
+		{
+			fprintf(stderr, "port %i: wrong line coding\n", i);
+			return EXIT_FAILURE;
+		}
+	return EXIT_SUCCESS;
+}
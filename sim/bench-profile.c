@@ -0,0 +1,181 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* benchmark: where the firmware spends its cycles, by its own sampling
+ * profiler; an interrupt driven build with the profiler samples at 10 khz
+ * while the host idles, streams data through the loopback, and streams with
+ * application work in the main loop, and drains the samples with a vendor
+ * request every few frames - as host/cdcacm-profile does with a real device -
+ * and the samples of each run are symbolized against this executable, which
+ * the firmware is linked into, and listed as a flat profile
+ *
+ * the program counters the simulator samples are those of the places that
+ * charge modelled cpu time - the firmware instrumentation hooks, register
+ * accesses, the stand-ins of the libopencm3 driver, and the 'wfi' of an idle
+ * main loop - so the profile is as fine grained as the cost model is; the
+ * program is linked as a position dependent executable, for 32 bit program
+ * counters
+ *
+ * the samples taken, and dropped, are checked against the sampling period */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libopencm3/usb/cdc.h>
+#include "usbsim.h"
+#include "profiler.h"
+#include "flat-profile.h"
+#include "cdcacm-requests.h"
+
+enum
+{
+	PACKET_SIZE	= 64,
+	RUN_FRAMES	= 500,
+	RATE_HZ		= 10000,
+	/* the samples are read every this many frames */
+	READ_FRAMES	= 5,
+	READ_SIZE	= 512,
+	PROFILE_LINES	= 8,
+};
+
+static const struct run
+{
+	const char	* name;
+	uint32_t	main_loop_load;
+	int		is_streaming;
+}
+runs[] =
+{
+	{ "idle", 0, 0, },
+	{ "streaming", 0, 1, },
+	{ "streaming, loaded main loop", 5000, 1, },
+};
+
+static int control_interface, data_in, data_out;
+
+/* reads samples until there are none left, adding them to the profile if
+ * there is one; returns the samples dropped so far, or -1 on failure */
+static int64_t drain(struct flat_profile * p, uint32_t * samples)
+{
+	uint32_t buf[READ_SIZE / sizeof(uint32_t)];
+	const struct profiler_header * h = (const struct profiler_header *) buf;
+	int len, i, n;
+
+	do
+	{
+		if ((len = usbsim_host_vendor_request(control_interface, CDCACM_REQ_READ_PROFILE, 0, buf, sizeof buf)) < (int) sizeof * h)
+			return -1;
+		n = (len - sizeof * h) / sizeof(uint32_t);
+		for (i = 0; p && i < n; i ++)
+			flat_profile_add(p, buf[sizeof * h / sizeof(uint32_t) + i]);
+		* samples += n;
+	}
+	while (n);
+	return h->dropped;
+}
+
+int main(void)
+{
+	uint8_t packet[PACKET_SIZE];
+	unsigned i;
+
+	usbsim_start(usbsim_firmware_main);
+	if (usbsim_host_enumerate())
+	{
+		fprintf(stderr, "enumeration failed\n");
+		return EXIT_FAILURE;
+	}
+	data_in = usbsim_host_find_endpoint(USB_CLASS_DATA, USB_ENDPOINT_ATTR_BULK, true);
+	data_out = usbsim_host_find_endpoint(USB_CLASS_DATA, USB_ENDPOINT_ATTR_BULK, false);
+	control_interface = usbsim_host_find_interface(USB_CLASS_CDC);
+	memset(packet, 'p', sizeof packet);
+
+	for (i = 0; i < sizeof runs / sizeof * runs; i ++)
+	{
+		const struct run * r = runs + i;
+		struct flat_profile profile;
+		uint32_t samples = 0, expected, frame, end;
+		int64_t dropped, result;
+		uint64_t start;
+
+		if ((result = flat_profile_init(& profile, "/proc/self/exe")))
+		{
+			fprintf(stderr, "reading the symbols failed: %s\n", strerror(-result));
+			return EXIT_FAILURE;
+		}
+		usbsim_cost.main_loop_load = r->main_loop_load;
+		/* start with no samples */
+		if (usbsim_host_vendor_request(control_interface, CDCACM_REQ_SET_PROFILER, 0, 0, 0) < 0 || (dropped = drain(0, & samples)) < 0)
+		{
+			fprintf(stderr, "profiler requests failed\n");
+			return EXIT_FAILURE;
+		}
+		samples = 0;
+		start = usbsim_bus_cycles();
+		if (usbsim_host_vendor_request(control_interface, CDCACM_REQ_SET_PROFILER, RATE_HZ, 0, 0) < 0)
+		{
+			fprintf(stderr, "profiler requests failed\n");
+			return EXIT_FAILURE;
+		}
+		frame = usbsim_host_frame_number();
+		end = frame + RUN_FRAMES;
+		while ((int32_t) (usbsim_host_frame_number() - end) < 0)
+		{
+			if (frame != usbsim_host_frame_number() && (frame = usbsim_host_frame_number()) % READ_FRAMES == 0
+					&& drain(& profile, & samples) < 0)
+			{
+				fprintf(stderr, "reading the samples failed\n");
+				return EXIT_FAILURE;
+			}
+			if (!r->is_streaming)
+			{
+				usbsim_host_idle_frames(1);
+				continue;
+			}
+			usbsim_host_out(data_out, packet, sizeof packet);
+			usbsim_host_in(data_in, packet, sizeof packet);
+		}
+		/* the samples up to the stop request, and the requests on the
+		 * way, are all taken */
+		if (usbsim_host_vendor_request(control_interface, CDCACM_REQ_SET_PROFILER, 0, 0, 0) < 0
+				|| (dropped = drain(& profile, & samples) - dropped) < 0)
+		{
+			fprintf(stderr, "reading the samples failed\n");
+			return EXIT_FAILURE;
+		}
+		expected = (usbsim_bus_cycles() - start) / (USBSIM_CPU_HZ / RATE_HZ);
+		printf("%s: %u samples, %u dropped, in %.1f ms\n", r->name, (unsigned) samples, (unsigned) dropped,
+				(double) (usbsim_bus_cycles() - start) * 1000 / USBSIM_CPU_HZ);
+		flat_profile_print(& profile, stdout, PROFILE_LINES);
+		printf("\n");
+		flat_profile_free(& profile);
+		/* some of the last period passes after the stop request */
+		if (samples + dropped > expected || samples + dropped + expected / 100 + 1 < expected)
+		{
+			fprintf(stderr, "%s: %u samples taken, %u expected\n", r->name,
+					(unsigned) (samples + dropped), (unsigned) expected);
+			return EXIT_FAILURE;
+		}
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,101 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* benchmark: replays of recorded host sessions (session-sim.h), e.g. the
+ * corpus in traces/; each trace is replayed by a child process of its own,
+ * on a freshly started simulator, and its metrics - the data rate over the
+ * replay, the naks, the largest service latency and the transactions with
+ * an outcome different from the recorded one - are reported on a line of
+ * their own, for tracking over time
+ *
+ * the program is linked once against each firmware build, the first argument
+ * names the build in the report
+ *
+ * usage: bench-replay <build> <trace>... */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "usbsim.h"
+#include "session-sim.h"
+
+static int replay(const char * mode, const char * path)
+{
+	struct usbsim_session_replay_stats stats;
+	const char * name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+	unsigned line;
+	FILE * f;
+	int result;
+
+	if (!(f = fopen(path, "r")))
+	{
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return EXIT_FAILURE;
+	}
+	usbsim_start(usbsim_firmware_main);
+	if ((result = usbsim_session_replay(f, & stats, & line)))
+	{
+		fprintf(stderr, "%s:%u: %s\n", path, line, result == -EINVAL ? "malformed trace" : strerror(- result));
+		return EXIT_FAILURE;
+	}
+	fclose(f);
+	printf("%-8s %-24s %12llu %10llu %12.0f %8llu %8llu %12llu\n", mode, name,
+			(unsigned long long) stats.transactions, (unsigned long long) stats.divergent,
+			stats.end > stats.start ? (double) (usbsim_stats.bytes_in + usbsim_stats.bytes_out)
+				* USBSIM_CPU_HZ / (stats.end - stats.start) : 0.,
+			(unsigned long long) usbsim_stats.in_nak, (unsigned long long) usbsim_stats.out_nak,
+			(unsigned long long) usbsim_stats.max_service_latency);
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char ** argv)
+{
+	int i, status, result = EXIT_SUCCESS;
+
+	if (argc < 3)
+	{
+		fprintf(stderr, "usage: %s <build> <trace>...\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	printf("%-8s %-24s %12s %10s %12s %8s %8s %12s\n", "mode", "trace", "transactions", "divergent",
+			"bytes/s", "in naks", "out naks", "max latency");
+	fflush(stdout);
+	for (i = 2; i < argc; i ++)
+	{
+		pid_t pid = fork();
+
+		if (pid < 0)
+		{
+			perror("fork");
+			return EXIT_FAILURE;
+		}
+		if (!pid)
+			exit(replay(argv[1], argv[i]));
+		if (waitpid(pid, & status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+			result = EXIT_FAILURE;
+	}
+	return result;
+}
@@ -0,0 +1,90 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+/* benchmark: worst-case usb packet service latency with the firmware built
+ * for polled (usbd_poll() from the main loop) and for interrupt driven
+ * operation, while the main loop carries an increasing amount of application
+ * work per iteration; the loopback test provides the usb traffic
+ *
+ * the program is linked once against each firmware build, the first argument
+ * names the build in the report */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libopencm3/usb/cdc.h>
+#include "usbsim.h"
+
+enum
+{
+	PACKET_SIZE	= 64,
+	TRANSFERS	= 500,
+	TIMEOUT_FRAMES	= 100,
+};
+
+static const uint32_t main_loop_loads[] = { 0, 500, 2000, 10000, 50000, };
+
+int main(int argc, char ** argv)
+{
+	const char * mode = argc > 1 ? argv[1] : "firmware";
+	int data_in, data_out, i, j;
+
+	usbsim_start(usbsim_firmware_main);
+	if (usbsim_host_enumerate())
+	{
+		fprintf(stderr, "enumeration failed\n");
+		return EXIT_FAILURE;
+	}
+	data_in = usbsim_host_find_endpoint(USB_CLASS_DATA, USB_ENDPOINT_ATTR_BULK, true);
+	data_out = usbsim_host_find_endpoint(USB_CLASS_DATA, USB_ENDPOINT_ATTR_BULK, false);
+
+	printf("%-10s %12s %14s %14s %14s\n", "mode", "load/iter", "avg latency", "max latency", "transfers/s");
+	for (i = 0; i < (int) (sizeof main_loop_loads / sizeof * main_loop_loads); i ++)
+	{
+		uint64_t start;
+
+		usbsim_cost.main_loop_load = main_loop_loads[i];
+		usbsim_reset_stats();
+		start = usbsim_bus_cycles();
+		for (j = 0; j < TRANSFERS; j ++)
+		{
+			uint8_t out[PACKET_SIZE], in[PACKET_SIZE + 3];
+			int len = 1 + j % PACKET_SIZE;
+
+			memset(out, j, len);
+			if (usbsim_host_bulk_write(data_out, out, len, PACKET_SIZE, TIMEOUT_FRAMES) != len
+					|| usbsim_host_bulk_read_stream(data_in, in, len + 3, PACKET_SIZE, TIMEOUT_FRAMES) != len + 3
+					|| memcmp(in, out, len))
+			{
+				fprintf(stderr, "loopback failed\n");
+				return EXIT_FAILURE;
+			}
+		}
+		printf("%-10s %12u %10.2f us %10.2f us %14.1f\n", mode, (unsigned) main_loop_loads[i],
+				usbsim_cycles_to_us(usbsim_stats.total_service_latency) / usbsim_stats.serviced_transfers,
+				usbsim_cycles_to_us(usbsim_stats.max_service_latency),
+				(double) TRANSFERS * USBSIM_CPU_HZ / (usbsim_bus_cycles() - start));
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,156 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* benchmark: the throughput of each direction on its own, with the firmware
+ * test modes; the host selects a mode of the serial port through the baud
+ * rate, and
+ *	- in the PRBS mode, streams a PRBS-31 sequence to the data OUT
+ *	endpoint, with a single bit error in it, while checking the PRBS
+ *	sequence the firmware sends on the data IN endpoint
+ *	- in the OUT sink mode, streams data to the data OUT endpoint only
+ *	- in the IN source mode, reads the data IN endpoint only
+ * as fast as the device lets it; the bytes in error found by the host, and by
+ * the firmware checker, are reported along with the rates */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libopencm3/usb/cdc.h>
+#include "usbsim.h"
+#include "cdcacm-stats.h"
+#include "prbs.h"
+
+enum
+{
+	PACKET_SIZE	= 64,
+	BYTES		= 256 * 1024,
+	/* the OUT stream byte, and the bit of it, in error */
+	ERROR_OFFSET	= BYTES / 2 + 5,
+	ERROR_BIT	= 1 << 3,
+	TIMEOUT_FRAMES	= 100,
+};
+
+static const struct mode
+{
+	const char	* name;
+	uint32_t	baud_rate;
+	bool		is_out, is_in;
+}
+modes[] =
+{
+	/* the baud rates the firmware test modes are selected with */
+	{ "prbs", 110, true, true, },
+	{ "sink", 75, true, false, },
+	{ "source", 50, false, true, },
+};
+
+static double rate(uint64_t bytes, uint64_t cycles)
+{
+	return cycles ? (double) bytes * USBSIM_CPU_HZ / cycles : 0;
+}
+
+int main(void)
+{
+	int data_in, data_out, control_interface, i;
+
+	usbsim_start(usbsim_firmware_main);
+	if (usbsim_host_enumerate())
+	{
+		fprintf(stderr, "enumeration failed\n");
+		return EXIT_FAILURE;
+	}
+	data_in = usbsim_host_find_endpoint(USB_CLASS_DATA, USB_ENDPOINT_ATTR_BULK, true);
+	data_out = usbsim_host_find_endpoint(USB_CLASS_DATA, USB_ENDPOINT_ATTR_BULK, false);
+	control_interface = usbsim_host_find_interface(USB_CLASS_CDC);
+
+	printf("%-8s %14s %14s %10s %10s %12s %12s\n", "mode", "out bytes/s", "in bytes/s", "out naks", "in naks",
+			"host errors", "device errors");
+	for (i = 0; i < (int) (sizeof modes / sizeof * modes); i ++)
+	{
+		const struct mode * m = modes + i;
+		struct cdcacm_stats stats = cdcacm_stats[0];
+		struct prbs_checker checker;
+		uint32_t prbs = PRBS_SEED, timeout, host_errors = 0;
+		unsigned sent = m->is_out ? 0 : BYTES, received = m->is_in ? 0 : BYTES;
+		uint64_t start, out_cycles = 0, in_cycles = 0;
+
+		prbs_checker_reset(& checker);
+		if (usbsim_host_set_line_coding(control_interface, m->baud_rate) < 0)
+		{
+			fprintf(stderr, "%s: selecting the mode failed\n", m->name);
+			return EXIT_FAILURE;
+		}
+		usbsim_reset_stats();
+		start = usbsim_bus_cycles();
+		timeout = usbsim_host_frame_number() + TIMEOUT_FRAMES;
+		/* an OUT and an IN transaction in turn, for the directions the
+		 * mode uses */
+		while (sent < BYTES || received < BYTES)
+		{
+			uint8_t packet[PACKET_SIZE];
+			int len;
+
+			if (sent < BYTES)
+			{
+				uint32_t state = prbs;
+
+				prbs_generate(& state, packet, sizeof packet);
+				if (sent <= ERROR_OFFSET && ERROR_OFFSET < sent + sizeof packet)
+					packet[ERROR_OFFSET - sent] ^= ERROR_BIT;
+				if (usbsim_host_out(data_out, packet, sizeof packet) == USBSIM_ACK)
+				{
+					prbs = state;
+					if ((sent += sizeof packet) == BYTES)
+						out_cycles = usbsim_bus_cycles() - start;
+					timeout = usbsim_host_frame_number() + TIMEOUT_FRAMES;
+				}
+			}
+			if (received < BYTES && (len = usbsim_host_in(data_in, packet, sizeof packet)) > 0)
+			{
+				if (m->baud_rate == modes[0].baud_rate)
+					host_errors += prbs_check(& checker, packet, len);
+				if ((received += len) >= BYTES)
+					in_cycles = usbsim_bus_cycles() - start;
+				timeout = usbsim_host_frame_number() + TIMEOUT_FRAMES;
+			}
+			if ((int32_t) (usbsim_host_frame_number() - timeout) > 0)
+			{
+				fprintf(stderr, "%s: timed out after %u bytes out, %u bytes in\n", m->name, sent, received);
+				return EXIT_FAILURE;
+			}
+		}
+		/* let the firmware take in the last packets */
+		usbsim_host_idle_frames(2);
+		if (m->is_out && cdcacm_stats[0].test_rx_bytes - stats.test_rx_bytes != BYTES)
+		{
+			fprintf(stderr, "%s: the firmware received %llu bytes\n", m->name,
+					(unsigned long long) (cdcacm_stats[0].test_rx_bytes - stats.test_rx_bytes));
+			return EXIT_FAILURE;
+		}
+		printf("%-8s %14.0f %14.0f %10llu %10llu %12u %12u\n", m->name, rate(m->is_out ? BYTES : 0, out_cycles),
+				rate(m->is_in ? received : 0, in_cycles),
+				(unsigned long long) usbsim_stats.out_nak, (unsigned long long) usbsim_stats.in_nak,
+				(unsigned) host_errors, (unsigned) (cdcacm_stats[0].prbs_errors - stats.prbs_errors));
+	}
+	return EXIT_SUCCESS;
+}
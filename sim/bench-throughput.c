@@ -0,0 +1,125 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* benchmark: sustained loopback throughput with single and double buffered
+ * data endpoints; the host streams full size packets to the data OUT endpoint
+ * and reads the data IN endpoint as fast as the device lets it - issuing an
+ * OUT and an IN transaction in turn, the way a host controller interleaves
+ * two busy bulk pipes - and the per packet driver overhead is increased to
+ * model slower packet processing
+ *
+ * the program is linked once against each firmware build, the first argument
+ * names the build in the report */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libopencm3/usb/cdc.h>
+#include "usbsim.h"
+#include "cdcacm-stats.h"
+
+enum
+{
+	PACKET_SIZE	= 64,
+	PACKETS		= 4000,
+	TIMEOUT_FRAMES	= 100,
+};
+
+/* the data streamed through the loopback, which must not contain '>' */
+static uint8_t stream_byte(unsigned offset)
+{
+	return 'a' + offset % 26;
+}
+
+static const uint32_t packet_overheads[] = { 30, 2000, 5000, 10000, };
+
+int main(int argc, char ** argv)
+{
+	const char * mode = argc > 1 ? argv[1] : "firmware";
+	int data_in, data_out, i;
+
+	usbsim_start(usbsim_firmware_main);
+	if (usbsim_host_enumerate())
+	{
+		fprintf(stderr, "enumeration failed\n");
+		return EXIT_FAILURE;
+	}
+	data_in = usbsim_host_find_endpoint(USB_CLASS_DATA, USB_ENDPOINT_ATTR_BULK, true);
+	data_out = usbsim_host_find_endpoint(USB_CLASS_DATA, USB_ENDPOINT_ATTR_BULK, false);
+
+	printf("%-8s %14s %14s %10s %10s %12s\n", "mode", "cycles/packet", "bytes/s", "out naks", "in naks", "bytes/in");
+	for (i = 0; i < (int) (sizeof packet_overheads / sizeof * packet_overheads); i ++)
+	{
+		unsigned sent = 0, received = 0, markers = 0;
+		struct tx_coalesce_stats tx = cdcacm_stats[0].tx;
+		uint64_t start;
+		uint32_t timeout;
+
+		usbsim_cost.packet_overhead = packet_overheads[i];
+		usbsim_reset_stats();
+		start = usbsim_bus_cycles();
+		timeout = usbsim_host_frame_number() + TIMEOUT_FRAMES;
+		/* the echoed data is a byte stream with ">>>" markers inserted
+		 * after each chunk the firmware has processed; the data sent
+		 * never contains '>', so the markers are simply skipped, and the
+		 * stream is complete once all data and the marker after it have
+		 * been received */
+		while (received < PACKETS * PACKET_SIZE || markers != 3)
+		{
+			uint8_t packet[PACKET_SIZE];
+			int len, j;
+
+			if (sent < PACKETS)
+			{
+				for (j = 0; j < PACKET_SIZE; j ++)
+					packet[j] = stream_byte(sent * PACKET_SIZE + j);
+				if (usbsim_host_out(data_out, packet, sizeof packet) == USBSIM_ACK)
+					sent ++;
+			}
+			len = usbsim_host_in(data_in, packet, sizeof packet);
+			for (j = 0; j < len; j ++)
+				if (packet[j] == '>')
+					markers ++;
+				else if (packet[j] == stream_byte(received))
+					received ++, markers = 0;
+				else
+					break;
+			if (j < len)
+				break;
+			if (len > 0)
+				timeout = usbsim_host_frame_number() + TIMEOUT_FRAMES;
+			if ((int32_t) (usbsim_host_frame_number() - timeout) > 0)
+				break;
+		}
+		if (received != PACKETS * PACKET_SIZE || markers != 3)
+		{
+			fprintf(stderr, "loopback failed after %u bytes\n", received);
+			return EXIT_FAILURE;
+		}
+		printf("%-8s %14u %14.0f %10llu %10llu %12.1f\n", mode, (unsigned) packet_overheads[i],
+				(double) PACKETS * PACKET_SIZE * USBSIM_CPU_HZ / (usbsim_bus_cycles() - start),
+				(unsigned long long) usbsim_stats.out_nak, (unsigned long long) usbsim_stats.in_nak,
+				(double) (cdcacm_stats[0].tx.bytes - tx.bytes) / (cdcacm_stats[0].tx.packets - tx.packets));
+	}
+	return EXIT_SUCCESS;
+}
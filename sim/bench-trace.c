@@ -0,0 +1,322 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* benchmark: what the usb event trace of the firmware shows of a throughput
+ * drop; the host streams data through the loopback of a polled build - with
+ * double or single buffered data endpoints - and
+ * drains the trace with a vendor request every few frames, in three runs - with
+ * nothing in the way, with the host pausing the stream now and then, and
+ * with the firmware main loop stalling the polls - and the trace tells them
+ * apart: the time received packets wait in the device, the time packets
+ * queued for the host wait for it to collect them, the intervals the device
+ * holds data back (naks), and the longest gap between polls
+ *
+ * the trace reads take bus time, and a control transfer takes several polls
+ * of a stalling main loop, so the throughput is lower than without tracing
+ *
+ * the packets traced are checked against those the host transferred, and
+ * each packet the host collected against a transfer completion traced by the
+ * data IN endpoint callback - a stalling main loop may see two completions
+ * as one; the first argument names the build, with a file
+ * name as the second, the trace of the last run is also written to it, as a
+ * usbmon pcap file */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libopencm3/usb/cdc.h>
+#include "usbsim.h"
+#include "usb-trace-events.h"
+#include "usbmon-pcap.h"
+#include "cdcacm-requests.h"
+
+enum
+{
+	PACKET_SIZE	= 64,
+	STREAM_FRAMES	= 200,
+	/* the echo has drained once nothing is received for this long */
+	IDLE_FRAMES	= 50,
+	/* the trace is read every this many frames */
+	READ_FRAMES	= 5,
+	READ_SIZE	= 512,
+	/* the host pause run stops the stream for 'PAUSE_FRAMES' out of every
+	 * 'PAUSE_PERIOD' frames */
+	PAUSE_PERIOD	= 20,
+	PAUSE_FRAMES	= 5,
+	ALL_EVENTS	= (1 << USB_TRACE_TYPES) - 1,
+	/* the poll events of an idle polled main loop would fill the trace
+	 * faster than it is drained */
+	NO_POLL_EVENTS	= ALL_EVENTS & ~(1 << USB_TRACE_POLL_ENTER | 1 << USB_TRACE_POLL_EXIT),
+};
+
+static const struct run
+{
+	const char	* name;
+	uint32_t	main_loop_load;
+	int		is_pausing;
+	uint32_t	mask;
+}
+runs[] =
+{
+	{ "clear", 0, 0, NO_POLL_EVENTS, },
+	{ "host pauses", 0, 1, NO_POLL_EVENTS, },
+	{ "loop stalls", 20000, 0, ALL_EVENTS, },
+};
+
+static int control_interface, data_in, data_out;
+
+/* the trace analysis, of the data endpoints */
+struct analysis
+{
+	/* the cycle times of the packets received and not read yet, and
+	 * of those queued for the host and not collected yet, and how long
+	 * they waited */
+	uint32_t	out_arrivals[4], in_queued[4];
+	unsigned	out_head, out_tail, in_head, in_tail;
+	struct wait
+	{
+		uint64_t	total;
+		uint32_t	count, max;
+	}
+	out_wait, in_wait;
+	/* packets and bytes traced, and the data IN transfer completions */
+	uint32_t	out_packets, out_bytes, in_packets, in_bytes, in_completions;
+	/* the nak intervals, when they started, and their total length */
+	uint32_t	naks, nak_start[2];
+	uint64_t	nak_cycles;
+	/* the last poll exit, and the longest gap until the next poll */
+	uint32_t	poll_exit, max_poll_gap;
+	int		has_poll_exit;
+	uint32_t	events;
+};
+
+static void wait(struct wait * w, uint32_t cycles)
+{
+	w->total += cycles;
+	w->count ++;
+	if (cycles > w->max)
+		w->max = cycles;
+}
+
+static void analyse(struct analysis * a, const struct usb_trace_event * e)
+{
+	int in = e->ep >> 7;
+
+	a->events ++;
+	switch (e->type)
+	{
+	case USB_TRACE_CTR:
+		/* the arrivals of packets read already are not known */
+		if (e->ep == data_out && e->value && a->out_tail == a->out_head)
+			a->out_arrivals[a->out_head ++ % 4] = e->time;
+		else if (e->ep == data_in)
+		{
+			a->in_completions ++;
+			if (a->in_tail != a->in_head)
+				wait(& a->in_wait, e->time - a->in_queued[a->in_tail ++ % 4]);
+		}
+		break;
+	case USB_TRACE_PACKET:
+		if (e->ep == data_out)
+		{
+			a->out_packets ++, a->out_bytes += e->value;
+			if (a->out_tail != a->out_head)
+				wait(& a->out_wait, e->time - a->out_arrivals[a->out_tail ++ % 4]);
+		}
+		else if (e->ep == data_in)
+		{
+			a->in_packets ++, a->in_bytes += e->value;
+			a->in_queued[a->in_head ++ % 4] = e->time;
+		}
+		break;
+	case USB_TRACE_NAK:
+		if (e->ep != data_in && e->ep != data_out)
+			break;
+		if (e->value)
+			a->naks ++, a->nak_start[in] = e->time;
+		else
+			a->nak_cycles += e->time - a->nak_start[in];
+		break;
+	case USB_TRACE_POLL_ENTER:
+		if (a->has_poll_exit && e->time - a->poll_exit > a->max_poll_gap)
+			a->max_poll_gap = e->time - a->poll_exit;
+		break;
+	case USB_TRACE_POLL_EXIT:
+		a->poll_exit = e->time, a->has_poll_exit = 1;
+		break;
+	}
+}
+
+/* drains the trace, up to a read that does not fill the buffer - new events
+ * keep coming meanwhile; returns the events dropped so far, or -1 on
+ * failure */
+static int64_t drain(struct analysis * a, struct usbmon_pcap * pcap)
+{
+	uint32_t buf[READ_SIZE / sizeof(uint32_t)];
+	const struct usb_trace_header * h = (const struct usb_trace_header *) buf;
+	const struct usb_trace_event * e = (const struct usb_trace_event *) (h + 1);
+	int len, i, n;
+
+	do
+	{
+		if ((len = usbsim_host_vendor_request(control_interface, CDCACM_REQ_READ_TRACE, 0, buf, sizeof buf)) < (int) sizeof * h)
+			return -1;
+		n = (len - sizeof * h) / sizeof * e;
+		for (i = 0; i < n; i ++)
+		{
+			if (a)
+				analyse(a, e + i);
+			if (pcap && usbmon_pcap_event(pcap, e + i, h->cpu_hz) < 0)
+				return -1;
+		}
+	}
+	while (len == sizeof buf);
+	return h->dropped;
+}
+
+static double average_us(const struct wait * w)
+{
+	return w->count ? usbsim_cycles_to_us(w->total) / w->count : 0;
+}
+
+int main(int argc, char ** argv)
+{
+	uint8_t config[512];
+	struct usb_setup_data req =
+	{
+		.bmRequestType	= USB_REQ_TYPE_IN,
+		.bRequest	= USB_REQ_GET_DESCRIPTOR,
+		.wValue		= USB_DT_CONFIGURATION << 8,
+		.wIndex		= 0,
+		.wLength	= sizeof config,
+	};
+	const char * mode = argc > 1 ? argv[1] : "firmware";
+	FILE * f = 0;
+	unsigned i;
+	int config_length;
+
+	usbsim_start(usbsim_firmware_main);
+	if (usbsim_host_enumerate() || (config_length = usbsim_host_control(& req, config)) < 0)
+	{
+		fprintf(stderr, "enumeration failed\n");
+		return EXIT_FAILURE;
+	}
+	data_in = usbsim_host_find_endpoint(USB_CLASS_DATA, USB_ENDPOINT_ATTR_BULK, true);
+	data_out = usbsim_host_find_endpoint(USB_CLASS_DATA, USB_ENDPOINT_ATTR_BULK, false);
+	control_interface = usbsim_host_find_interface(USB_CLASS_CDC);
+	if (argc > 2 && !(f = fopen(argv[2], "wb")))
+	{
+		perror(argv[2]);
+		return EXIT_FAILURE;
+	}
+
+	printf("%-8s %-12s %10s %9s %9s %9s %9s %6s %9s %9s %8s %8s\n", "mode", "run", "bytes/s", "out wait", "max",
+			"in wait", "max", "naks", "nak time", "poll gap", "events", "dropped");
+	printf("%-8s %-12s %10s %9s %9s %9s %9s %6s %9s %9s\n", "", "", "", "us", "us", "us", "us", "", "us", "us");
+	for (i = 0; i < sizeof runs / sizeof * runs; i ++)
+	{
+		const struct run * r = runs + i;
+		struct analysis a = { 0, };
+		struct usbmon_pcap pcap;
+		uint32_t out_packets = 0, in_packets = 0, in_bytes = 0, end, idle, frame;
+		int64_t dropped;
+		uint64_t start, last_in;
+
+		usbsim_cost.main_loop_load = r->main_loop_load;
+		/* start with an empty trace */
+		if (usbsim_host_vendor_request(control_interface, CDCACM_REQ_SET_TRACE_MASK, 0, 0, 0) < 0 || (dropped = drain(0, 0)) < 0
+				|| usbsim_host_vendor_request(control_interface, CDCACM_REQ_SET_TRACE_MASK, r->mask, 0, 0) < 0)
+		{
+			fprintf(stderr, "trace requests failed\n");
+			return EXIT_FAILURE;
+		}
+		if (f && i == sizeof runs / sizeof * runs - 1)
+			usbmon_pcap_init(& pcap, f, config, config_length, 1, 1, 0);
+		start = last_in = usbsim_bus_cycles();
+		frame = usbsim_host_frame_number();
+		end = idle = frame + STREAM_FRAMES;
+		while ((int32_t) (usbsim_host_frame_number() - idle - IDLE_FRAMES) < 0)
+		{
+			uint8_t packet[PACKET_SIZE];
+			int len;
+
+			if (frame != usbsim_host_frame_number() && (frame = usbsim_host_frame_number()) % READ_FRAMES == 0)
+			{
+				if (drain(& a, f && i == sizeof runs / sizeof * runs - 1 ? & pcap : 0) < 0)
+				{
+					fprintf(stderr, "reading the trace failed\n");
+					return EXIT_FAILURE;
+				}
+			}
+			if (r->is_pausing && frame % PAUSE_PERIOD < PAUSE_FRAMES)
+			{
+				usbsim_host_idle_frames(1);
+				continue;
+			}
+			memset(packet, 'a' + frame % 26, sizeof packet);
+			if ((int32_t) (frame - end) < 0 && usbsim_host_out(data_out, packet, sizeof packet) == USBSIM_ACK)
+				out_packets ++;
+			if ((len = usbsim_host_in(data_in, packet, sizeof packet)) >= 0)
+			{
+				in_packets ++, in_bytes += len;
+				last_in = usbsim_bus_cycles();
+				if ((int32_t) (frame - idle) > 0)
+					idle = frame;
+			}
+		}
+		if (usbsim_host_vendor_request(control_interface, CDCACM_REQ_SET_TRACE_MASK, 0, 0, 0) < 0
+				|| (dropped = drain(& a, f && i == sizeof runs / sizeof * runs - 1 ? & pcap : 0) - dropped) < 0)
+		{
+			fprintf(stderr, "reading the trace failed\n");
+			return EXIT_FAILURE;
+		}
+		if (!dropped && (a.out_packets != out_packets || a.in_packets != in_packets || a.in_bytes != in_bytes))
+		{
+			fprintf(stderr, "%s: traced %u out, %u/%u in, host %u out, %u/%u in\n", r->name,
+					a.out_packets, a.in_packets, a.in_bytes, out_packets, in_packets, in_bytes);
+			return EXIT_FAILURE;
+		}
+		/* with the polls stalled, the firmware may queue the next packet
+		 * before it gets to a completion, and one completion is
+		 * traced for both packets */
+		if (!dropped && (r->main_loop_load ? !a.in_completions || a.in_completions > in_packets
+					: a.in_completions != in_packets))
+		{
+			fprintf(stderr, "%s: traced %u data IN completions, host %u in\n", r->name,
+					a.in_completions, in_packets);
+			return EXIT_FAILURE;
+		}
+		printf("%-8s %-12s %10.0f %9.1f %9.1f %9.1f %9.1f %6u %9.1f %9.1f %8u %8u\n", mode,
+				r->name, (double) in_bytes * USBSIM_CPU_HZ / (last_in - start),
+				average_us(& a.out_wait), usbsim_cycles_to_us(a.out_wait.max),
+				average_us(& a.in_wait), usbsim_cycles_to_us(a.in_wait.max),
+				a.naks, usbsim_cycles_to_us(a.nak_cycles), usbsim_cycles_to_us(a.max_poll_gap),
+				a.events, (unsigned) dropped);
+	}
+	if (f && fclose(f))
+	{
+		perror(argv[2]);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,137 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* benchmark: round trips of messages of various sizes through the loopback,
+ * read by the host the way a host driver reads a bulk IN pipe - into a buffer
+ * much larger than a packet, which the host controller only hands back on a
+ * short packet (or a full buffer); an echo that ends on a packet boundary
+ * must be terminated with a zero length packet, or the read waits for its
+ * timeout - the message sizes here make echoes of both kinds
+ *
+ * the device side transfer completion latency is taken from the firmware
+ * statistics */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libopencm3/usb/cdc.h>
+#include "usbsim.h"
+#include "cdcacm-stats.h"
+
+enum
+{
+	PACKET_SIZE	= 64,
+	ROUND_TRIPS	= 200,
+	/* the read buffer size, and the read timeout */
+	READ_SIZE	= 4096,
+	TIMEOUT_FRAMES	= 20,
+};
+
+/* the message data, which must not contain '>' */
+static uint8_t message_byte(unsigned offset)
+{
+	return 'a' + offset % 26;
+}
+
+/* the loopback echoes a message in chunks of up to a packet, each followed
+ * by a ">>>" marker; 61, 122, 183 and 244 bytes long messages make echoes of
+ * a whole number of packets */
+static const unsigned message_sizes[] = { 1, 61, 64, 122, 183, 244, 1000, };
+
+int main(void)
+{
+	int data_in, data_out, i;
+
+	usbsim_start(usbsim_firmware_main);
+	if (usbsim_host_enumerate())
+	{
+		fprintf(stderr, "enumeration failed\n");
+		return EXIT_FAILURE;
+	}
+	data_in = usbsim_host_find_endpoint(USB_CLASS_DATA, USB_ENDPOINT_ATTR_BULK, true);
+	data_out = usbsim_host_find_endpoint(USB_CLASS_DATA, USB_ENDPOINT_ATTR_BULK, false);
+
+	printf("%8s %8s %14s %14s %8s %8s %14s\n", "bytes", "echo", "avg trip", "max trip",
+			"stalls", "zlps", "avg transfer");
+	for (i = 0; i < (int) (sizeof message_sizes / sizeof * message_sizes); i ++)
+	{
+		unsigned size = message_sizes[i], echo = 0, stalls = 0, trip;
+		uint64_t total_cycles = 0, max_cycles = 0;
+		struct cdcacm_stats stats = cdcacm_stats[0];
+		uint8_t message[1024], buf[READ_SIZE];
+
+		for (trip = 0; trip < ROUND_TRIPS; trip ++)
+		{
+			unsigned received = 0, markers = 0, j;
+			uint64_t start = usbsim_bus_cycles(), cycles;
+
+			for (j = 0; j < size; j ++)
+				message[j] = message_byte(j);
+			if (usbsim_host_bulk_write(data_out, message, size, PACKET_SIZE, TIMEOUT_FRAMES) != (int) size)
+			{
+				fprintf(stderr, "write failed\n");
+				return EXIT_FAILURE;
+			}
+			echo = 0;
+			while (received < size || markers != 3)
+			{
+				uint32_t frame = usbsim_host_frame_number();
+				int len = usbsim_host_bulk_read(data_in, buf, sizeof buf, PACKET_SIZE, TIMEOUT_FRAMES);
+
+				if (usbsim_host_frame_number() - frame >= TIMEOUT_FRAMES)
+				{
+					/* the read ran into its timeout - with no data,
+					 * the echo is lost */
+					stalls ++;
+					if (!len)
+					{
+						fprintf(stderr, "no echo of a %u bytes message\n", size);
+						return EXIT_FAILURE;
+					}
+				}
+				for (j = 0; j < (unsigned) len; j ++)
+					if (buf[j] == '>')
+						markers ++;
+					else if (buf[j] == message_byte(received))
+						received ++, markers = 0;
+					else
+					{
+						fprintf(stderr, "bad echo of a %u bytes message\n", size);
+						return EXIT_FAILURE;
+					}
+				echo += len;
+			}
+			cycles = usbsim_bus_cycles() - start;
+			total_cycles += cycles;
+			if (cycles > max_cycles)
+				max_cycles = cycles;
+		}
+		printf("%8u %8u %11.1f us %11.1f us %8u %8u %11.1f us\n", size, echo,
+				usbsim_cycles_to_us(total_cycles) / ROUND_TRIPS,
+				usbsim_cycles_to_us(max_cycles), stalls,
+				(unsigned) (cdcacm_stats[0].tx.zlps - stats.tx.zlps),
+				usbsim_cycles_to_us(cdcacm_stats[0].tx_transfer_cycles - stats.tx_transfer_cycles)
+					/ (cdcacm_stats[0].tx_transfers - stats.tx_transfers));
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,207 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* benchmark: latency of urgent messages under a saturated bulk stream; the
+ * host streams full size packets through the loopback as fast as it can,
+ * with a '!' request in every 16th packet, which the firmware acknowledges
+ * through the notification endpoint; the time from the request being sent
+ * to its acknowledgement arriving there is compared to the time until the
+ * echo of the request arrives on the data IN endpoint, behind all the data
+ * queued before it */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libopencm3/usb/cdc.h>
+#include "usbsim.h"
+
+enum
+{
+	PACKET_SIZE	= 64,
+	PACKETS		= 4000,
+	REQUEST_PERIOD	= 16,
+	REQUESTS	= PACKETS / REQUEST_PERIOD,
+	TIMEOUT_FRAMES	= 100,
+	/* the firmware loopback acknowledgement message code */
+	URGENT_ACK	= 1,
+};
+
+/* the packet carrying request 'k', and the request offset in it */
+static unsigned request_packet(unsigned k)
+{
+	return k * REQUEST_PERIOD + REQUEST_PERIOD - 1;
+}
+
+static unsigned request_offset(unsigned k)
+{
+	return request_packet(k) * PACKET_SIZE + k * 13 % PACKET_SIZE;
+}
+
+/* the data streamed through the loopback, which must not contain '>', and
+ * contains '!' only at request offsets; 'offset' counts from the start of
+ * the run */
+static uint8_t stream_byte(unsigned offset)
+{
+	unsigned k = offset / PACKET_SIZE / REQUEST_PERIOD;
+
+	if (offset / PACKET_SIZE % REQUEST_PERIOD == REQUEST_PERIOD - 1 && offset == request_offset(k))
+		return '!';
+	return 'a' + offset % 26;
+}
+
+/* send times of the requests, and their acknowledgement and echo latencies,
+ * in bus cycles */
+static uint64_t sent[REQUESTS], urgent[REQUESTS], echoed[REQUESTS];
+/* the acknowledgement count, and the stream offset, at the start of a run */
+static unsigned first_ack;
+static uint32_t first_offset;
+static unsigned acks, bad_acks;
+/* the interrupt transfers that did not carry exactly one notification */
+static unsigned bad_notifications;
+
+static void notification_received(uint8_t ep, const void * data, int len)
+{
+	const uint8_t * p = data;
+	struct usb_cdc_notification n;
+	uint32_t offset;
+	unsigned k;
+
+	(void) ep;
+	/* host drivers only look at the first notification of a transfer */
+	if (len < (int) sizeof n || (memcpy(& n, p, sizeof n), len != (int) (sizeof n + n.wLength)))
+	{
+		bad_notifications ++;
+		return;
+	}
+	if ((n.bmRequestType & USB_REQ_TYPE_TYPE) == USB_REQ_TYPE_VENDOR && n.bNotification == URGENT_ACK
+			&& n.wLength == sizeof offset)
+	{
+		memcpy(& offset, p + sizeof n, sizeof offset);
+		k = (uint16_t) (n.wValue - first_ack);
+		if (k < REQUESTS && offset - first_offset == request_offset(k))
+			urgent[k] = usbsim_bus_cycles() - sent[k], acks ++;
+		else
+			bad_acks ++;
+	}
+}
+
+static int compare(const void * a, const void * b)
+{
+	uint64_t x = * (const uint64_t *) a, y = * (const uint64_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void print_percentiles(uint32_t load, const char * lane, uint64_t * cycles)
+{
+	qsort(cycles, REQUESTS, sizeof * cycles, compare);
+	printf("%10u %-8s %10.1f us %10.1f us %10.1f us\n", (unsigned) load, lane,
+			usbsim_cycles_to_us(cycles[REQUESTS / 2]),
+			usbsim_cycles_to_us(cycles[REQUESTS * 99 / 100]),
+			usbsim_cycles_to_us(cycles[REQUESTS - 1]));
+}
+
+int main(void)
+{
+	int data_in, data_out, i;
+
+	usbsim_start(usbsim_firmware_main);
+	if (usbsim_host_enumerate())
+	{
+		fprintf(stderr, "enumeration failed\n");
+		return EXIT_FAILURE;
+	}
+	data_in = usbsim_host_find_endpoint(USB_CLASS_DATA, USB_ENDPOINT_ATTR_BULK, true);
+	data_out = usbsim_host_find_endpoint(USB_CLASS_DATA, USB_ENDPOINT_ATTR_BULK, false);
+	usbsim_host_poll_periodic(usbsim_host_find_endpoint(USB_CLASS_CDC, USB_ENDPOINT_ATTR_INTERRUPT, true),
+			1, notification_received);
+
+	printf("%10s %-8s %13s %13s %13s\n", "load/iter", "lane", "p50", "p99", "max");
+	for (i = 0; i < (int) (sizeof usbsim_main_loop_loads / sizeof * usbsim_main_loop_loads); i ++)
+	{
+		unsigned sent_packets = 0, received = 0, markers = 0;
+		uint32_t timeout;
+
+		usbsim_cost.main_loop_load = usbsim_main_loop_loads[i];
+		acks = bad_acks = 0;
+		timeout = usbsim_host_frame_number() + TIMEOUT_FRAMES;
+		/* as in bench-throughput.c, the ">>>" markers in the echoed data
+		 * are skipped */
+		while (received < PACKETS * PACKET_SIZE || markers != 3)
+		{
+			uint8_t packet[PACKET_SIZE];
+			int len, j;
+
+			if (sent_packets < PACKETS)
+			{
+				uint64_t start = usbsim_bus_cycles();
+
+				for (j = 0; j < PACKET_SIZE; j ++)
+					packet[j] = stream_byte(sent_packets * PACKET_SIZE + j);
+				if (usbsim_host_out(data_out, packet, sizeof packet) == USBSIM_ACK)
+				{
+					if (sent_packets % REQUEST_PERIOD == REQUEST_PERIOD - 1)
+						sent[sent_packets / REQUEST_PERIOD] = start;
+					sent_packets ++;
+				}
+			}
+			len = usbsim_host_in(data_in, packet, sizeof packet);
+			for (j = 0; j < len; j ++)
+				if (packet[j] == '>')
+					markers ++;
+				else if (packet[j] == stream_byte(received))
+				{
+					if (packet[j] == '!')
+						echoed[received / PACKET_SIZE / REQUEST_PERIOD] = usbsim_bus_cycles()
+							- sent[received / PACKET_SIZE / REQUEST_PERIOD];
+					received ++, markers = 0;
+				}
+				else
+					break;
+			if (j < len)
+				break;
+			if (len > 0)
+				timeout = usbsim_host_frame_number() + TIMEOUT_FRAMES;
+			if ((int32_t) (usbsim_host_frame_number() - timeout) > 0)
+				break;
+		}
+		/* the last acknowledgements go out on the next frames */
+		usbsim_host_idle_frames(2);
+		if (received != PACKETS * PACKET_SIZE || markers != 3)
+		{
+			fprintf(stderr, "loopback failed after %u bytes\n", received);
+			return EXIT_FAILURE;
+		}
+		if (acks != REQUESTS || bad_acks || bad_notifications)
+		{
+			fprintf(stderr, "%u acknowledgements missing, %u bad, %u bad notification transfers\n",
+					REQUESTS - acks, bad_acks, bad_notifications);
+			return EXIT_FAILURE;
+		}
+		print_percentiles(usbsim_main_loop_loads[i], "urgent", urgent);
+		print_percentiles(usbsim_main_loop_loads[i], "bulk", echoed);
+		first_ack += REQUESTS;
+		first_offset += PACKETS * PACKET_SIZE;
+	}
+	return EXIT_SUCCESS;
+}
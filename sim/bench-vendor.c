@@ -0,0 +1,141 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* benchmark: raw bulk streams (host/usbraw.h) over the vendor specific
+ * interface, against the same host code driving the data interface of the
+ * serial port; loopback throughput and message round trip time with one and
+ * with several urbs queued in each direction, the host taking
+ * 'usbraw_sim_urb_latency' to handle each completed urb
+ *
+ * the host tty layer that a serial port is normally read through is not
+ * modelled - its cost comes on top of the serial port figures here, see
+ * host/bench-raw-tty.c for a comparison on real hardware */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libopencm3/usb/cdc.h>
+#include "usbsim.h"
+#include "usbraw-sim.h"
+#include "cdcacm-stats.h"
+
+enum
+{
+	STREAM_BYTES	= 1 << 17,
+	MESSAGES	= 200,
+	MESSAGE_SIZE	= 32,
+	URB_SIZE	= 512,
+	TIMEOUT_MS	= 100,
+};
+
+static uint8_t stream[STREAM_BYTES];
+
+/* the serial port echo has ">>>" markers inserted after each chunk, which are
+ * skipped; the data sent never contains '>' or '!' */
+struct check
+{
+	unsigned	received, len;
+	bool		is_marked;
+};
+
+static int check_echo(void * context, const uint8_t * data, unsigned len)
+{
+	struct check * c = context;
+	unsigned i;
+
+	for (i = 0; i < len; i ++)
+		if (c->is_marked && data[i] == '>')
+			continue;
+		else if (c->received == c->len || data[i] != stream[c->received ++])
+			return -1;
+	/* the markers after the last chunk of the serial port echo come in
+	 * the same packet as it, or in the next one; a message is complete
+	 * once they are in */
+	return c->received == c->len && (!c->is_marked || data[len - 1] == '>');
+}
+
+int main(void)
+{
+	static const struct
+	{
+		const char	* name;
+		uint8_t		interface_class;
+		bool		is_marked;
+	}
+	paths[] =
+	{
+		{ "serial", USB_CLASS_DATA, true, },
+		{ "vendor", USB_CLASS_VENDOR, false, },
+	};
+	static const unsigned depths[] = { 1, 2, 8, };
+	unsigned i, j, k;
+
+	for (i = 0; i < sizeof stream; i ++)
+		stream[i] = 'a' + i % 26;
+	usbsim_start(usbsim_firmware_main);
+	if (usbsim_host_enumerate())
+	{
+		fprintf(stderr, "enumeration failed\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("%-8s %6s %14s %14s %12s\n", "path", "urbs", "bytes/s", "round trip", "bytes/in");
+	for (i = 0; i < sizeof paths / sizeof * paths; i ++)
+		for (j = 0; j < sizeof depths / sizeof * depths; j ++)
+		{
+			struct cdcacm_stats * stats = cdcacm_stats + (paths[i].interface_class == USB_CLASS_VENDOR);
+			struct tx_coalesce_stats tx = stats->tx;
+			struct usbraw r;
+			struct check c = { .len = STREAM_BYTES, .is_marked = paths[i].is_marked, };
+			uint64_t start, cycles;
+			double rate;
+			int result;
+
+			if ((result = usbraw_open_sim(& r, paths[i].interface_class, 0, depths[j], URB_SIZE)))
+			{
+				fprintf(stderr, "%s: %s\n", paths[i].name, strerror(-result));
+				return EXIT_FAILURE;
+			}
+			start = usbsim_bus_cycles();
+			if ((result = usbraw_stream(& r, stream, STREAM_BYTES, check_echo, & c, TIMEOUT_MS)))
+				goto failed;
+			rate = (double) STREAM_BYTES * USBSIM_CPU_HZ / (usbsim_bus_cycles() - start);
+			start = usbsim_bus_cycles();
+			for (k = 0; k < MESSAGES; k ++)
+			{
+				c = (struct check) { .len = MESSAGE_SIZE, .is_marked = paths[i].is_marked, };
+				if ((result = usbraw_stream(& r, stream, MESSAGE_SIZE, check_echo, & c, TIMEOUT_MS)))
+					goto failed;
+			}
+			cycles = usbsim_bus_cycles() - start;
+			usbraw_close(& r);
+			printf("%-8s %6u %14.0f %11.1f us %12.1f\n", paths[i].name, depths[j], rate,
+					1e6 * cycles / MESSAGES / USBSIM_CPU_HZ,
+					(double) (stats->tx.bytes - tx.bytes) / (stats->tx.packets - tx.packets));
+			continue;
+failed:
+			fprintf(stderr, "%s, %u urbs: %s after %u bytes\n", paths[i].name, depths[j], strerror(-result), c.received);
+			return EXIT_FAILURE;
+		}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,200 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* a model of the dma1 controller, as far as memory to memory transfers go;
+ * a transfer is carried out as soon as its channel is enabled, and its
+ * transfer complete flag is set once the modelled transfer time has passed.
+ * every call into the driver is charged as a register access */
+
+#include <assert.h>
+#include <string.h>
+#include <libopencm3/stm32/dma.h>
+#include "usbsim.h"
+
+enum
+{
+	DMA_CHANNELS	= 7,
+};
+
+static struct
+{
+	uintptr_t	peripheral_address, memory_address;
+	uint16_t	count;
+	uint32_t	peripheral_size, memory_size;
+	bool		is_peripheral_increment, is_memory_increment;
+	bool		is_read_from_memory, is_mem2mem;
+	bool		is_enabled;
+	uint32_t	flags;
+	/* the cpu cycle at which the transfer completes */
+	uint64_t	complete_time;
+}
+channels[DMA_CHANNELS + 1];
+
+static void register_access(uint32_t dma, uint8_t channel)
+{
+	assert(dma == DMA1 && channel >= DMA_CHANNEL1 && channel <= DMA_CHANNEL7);
+	usbsim_charge(usbsim_cost.dma_register_access);
+}
+
+/* the access width, in bytes, of a DMA_CCR_PSIZE_x or DMA_CCR_MSIZE_x value */
+static unsigned width(uint32_t size, unsigned shift)
+{
+	return 1 << ((size >> shift) & 3);
+}
+
+/* a data item is read at the source width and written at the destination
+ * width, zero extended or truncated as needed; both are little endian */
+static void transfer(uint8_t channel)
+{
+	unsigned pwidth = width(channels[channel].peripheral_size, 8);
+	unsigned mwidth = width(channels[channel].memory_size, 10);
+	uintptr_t p = channels[channel].peripheral_address;
+	uintptr_t m = channels[channel].memory_address;
+	uint16_t i;
+
+	for (i = 0; i < channels[channel].count; i ++)
+	{
+		uint32_t x = 0;
+
+		if (channels[channel].is_read_from_memory)
+		{
+			memcpy(& x, (void *) m, mwidth);
+			memcpy((void *) p, & x, pwidth);
+		}
+		else
+		{
+			memcpy(& x, (void *) p, pwidth);
+			memcpy((void *) m, & x, mwidth);
+		}
+		if (channels[channel].is_peripheral_increment)
+			p += pwidth;
+		if (channels[channel].is_memory_increment)
+			m += mwidth;
+	}
+}
+
+void dma_channel_reset(uint32_t dma, uint8_t channel)
+{
+	register_access(dma, channel);
+	memset(& channels[channel], 0, sizeof channels[channel]);
+}
+
+void dma_clear_interrupt_flags(uint32_t dma, uint8_t channel, uint32_t interrupts)
+{
+	register_access(dma, channel);
+	channels[channel].flags &= ~ interrupts;
+}
+
+bool dma_get_interrupt_flag(uint32_t dma, uint8_t channel, uint32_t interrupts)
+{
+	register_access(dma, channel);
+	if (channels[channel].is_enabled && channels[channel].count
+			&& usbsim_cpu_cycles() >= channels[channel].complete_time)
+	{
+		channels[channel].count = 0;
+		channels[channel].flags |= DMA_GIF | DMA_TCIF;
+	}
+	return channels[channel].flags & interrupts;
+}
+
+void dma_enable_mem2mem_mode(uint32_t dma, uint8_t channel)
+{
+	register_access(dma, channel);
+	channels[channel].is_mem2mem = true;
+}
+
+void dma_set_priority(uint32_t dma, uint8_t channel, uint32_t prio)
+{
+	register_access(dma, channel);
+	(void) prio;
+}
+
+void dma_set_memory_size(uint32_t dma, uint8_t channel, uint32_t mem_size)
+{
+	register_access(dma, channel);
+	channels[channel].memory_size = mem_size;
+}
+
+void dma_set_peripheral_size(uint32_t dma, uint8_t channel, uint32_t peripheral_size)
+{
+	register_access(dma, channel);
+	channels[channel].peripheral_size = peripheral_size;
+}
+
+void dma_enable_memory_increment_mode(uint32_t dma, uint8_t channel)
+{
+	register_access(dma, channel);
+	channels[channel].is_memory_increment = true;
+}
+
+void dma_enable_peripheral_increment_mode(uint32_t dma, uint8_t channel)
+{
+	register_access(dma, channel);
+	channels[channel].is_peripheral_increment = true;
+}
+
+void dma_set_read_from_peripheral(uint32_t dma, uint8_t channel)
+{
+	register_access(dma, channel);
+	channels[channel].is_read_from_memory = false;
+}
+
+void dma_set_read_from_memory(uint32_t dma, uint8_t channel)
+{
+	register_access(dma, channel);
+	channels[channel].is_read_from_memory = true;
+}
+
+void dma_enable_channel(uint32_t dma, uint8_t channel)
+{
+	register_access(dma, channel);
+	/* peripheral requests are not modelled */
+	assert(channels[channel].is_mem2mem);
+	channels[channel].is_enabled = true;
+	transfer(channel);
+	channels[channel].complete_time = usbsim_cpu_cycles()
+		+ (uint64_t) usbsim_cost.dma_transfer * channels[channel].count;
+}
+
+void dma_disable_channel(uint32_t dma, uint8_t channel)
+{
+	register_access(dma, channel);
+	channels[channel].is_enabled = false;
+}
+
+void dma_set_peripheral_address(uint32_t dma, uint8_t channel, uintptr_t address)
+{
+	register_access(dma, channel);
+	channels[channel].peripheral_address = address;
+}
+
+void dma_set_memory_address(uint32_t dma, uint8_t channel, uintptr_t address)
+{
+	register_access(dma, channel);
+	channels[channel].memory_address = address;
+}
+
+void dma_set_number_of_data(uint32_t dma, uint8_t channel, uint16_t number)
+{
+	register_access(dma, channel);
+	channels[channel].count = number;
+}
@@ -0,0 +1,38 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* the firmware instrumentation hooks (see src/instrument.h) for the simulator
+ * build; this header is included ahead of every firmware source file, and
+ * charges the modelled cpu time of the firmware code the hooks mark */
+
+#ifndef FIRMWARE_HOOKS_H
+#define FIRMWARE_HOOKS_H
+
+#include "usbsim.h"
+
+#define INSTRUMENT_PACKET()		usbsim_charge(usbsim_cost.packet_overhead)
+#define INSTRUMENT_PMA_COPY(kernel, halfwords)	\
+	usbsim_charge(usbsim_cost.pma_copy_ ## kernel * (halfwords))
+#define INSTRUMENT_MAIN_LOOP()		usbsim_main_loop_iteration()
+#define INSTRUMENT_INTERRUPTED_PC()	usbsim_interrupted_pc()
+
+#endif /* FIRMWARE_HOOKS_H */
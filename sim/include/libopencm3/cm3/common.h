@@ -0,0 +1,20 @@
+/* host simulation stand-in for <libopencm3/cm3/common.h>; only the bits
+ * that the firmware and the other stand-in headers rely on are provided */
+#ifndef LIBOPENCM3_CM3_COMMON_H
+#define LIBOPENCM3_CM3_COMMON_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define BIT0	(1 << 0)
+#define BIT1	(1 << 1)
+
+#ifndef MIN
+#define MIN(a, b)	((a) < (b) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b)	((a) > (b) ? (a) : (b))
+#endif
+
+#endif /* LIBOPENCM3_CM3_COMMON_H */
@@ -0,0 +1,18 @@
+/* host simulation stand-in for <libopencm3/cm3/cortex.h> */
+#ifndef LIBOPENCM3_CORTEX_H
+#define LIBOPENCM3_CORTEX_H
+
+#include <libopencm3/cm3/common.h>
+
+void cm_enable_interrupts(void);
+void cm_disable_interrupts(void);
+bool cm_is_masked_interrupts(void);
+
+void usbsim_wait_for_interrupt(void);
+
+static inline void __WFI(void)
+{
+	usbsim_wait_for_interrupt();
+}
+
+#endif /* LIBOPENCM3_CORTEX_H */
@@ -0,0 +1,11 @@
+/* host simulation stand-in for <libopencm3/cm3/dwt.h>; the cycle counter
+ * counts the modelled cpu cycles */
+#ifndef LIBOPENCM3_CM3_DWT_H
+#define LIBOPENCM3_CM3_DWT_H
+
+#include <libopencm3/cm3/common.h>
+
+bool dwt_enable_cycle_counter(void);
+uint32_t dwt_read_cycle_counter(void);
+
+#endif /* LIBOPENCM3_CM3_DWT_H */
@@ -0,0 +1,24 @@
+/* host simulation stand-in for <libopencm3/cm3/nvic.h>; only the usb
+ * interrupt and the SysTick exception are modelled - SysTick always
+ * preempts the usb interrupt handler, priorities are not modelled */
+#ifndef LIBOPENCM3_NVIC_H
+#define LIBOPENCM3_NVIC_H
+
+#include <libopencm3/cm3/common.h>
+
+#define NVIC_USB_HP_CAN_TX_IRQ		19
+#define NVIC_USB_LP_CAN_RX0_IRQ		20
+#define NVIC_USB_WAKEUP_IRQ		42
+/* the system exceptions are negative */
+#define NVIC_SYSTICK_IRQ		-1
+
+void nvic_enable_irq(uint8_t irqn);
+void nvic_disable_irq(uint8_t irqn);
+void nvic_set_priority(uint8_t irqn, uint8_t priority);
+void nvic_set_pending_irq(uint8_t irqn);
+void nvic_clear_pending_irq(uint8_t irqn);
+
+void usb_lp_can_rx0_isr(void);
+void sys_tick_handler(void);
+
+#endif /* LIBOPENCM3_NVIC_H */
@@ -0,0 +1,20 @@
+/* host simulation stand-in for <libopencm3/cm3/systick.h>; SysTick counts
+ * the modelled cpu cycles, whatever the clock source */
+#ifndef LIBOPENCM3_SYSTICK_H
+#define LIBOPENCM3_SYSTICK_H
+
+#include <libopencm3/cm3/common.h>
+
+#define STK_CSR_CLKSOURCE_AHB_DIV8	(0 << 2)
+#define STK_CSR_CLKSOURCE_AHB		(1 << 2)
+#define STK_RVR_RELOAD			0x00ffffff
+
+void systick_set_reload(uint32_t value);
+void systick_set_clocksource(uint8_t clocksource);
+void systick_clear(void);
+void systick_counter_enable(void);
+void systick_counter_disable(void);
+void systick_interrupt_enable(void);
+void systick_interrupt_disable(void);
+
+#endif /* LIBOPENCM3_SYSTICK_H */
@@ -0,0 +1,53 @@
+/* host simulation stand-in for <libopencm3/stm32/dma.h>; only the memory to
+ * memory transfers of dma1 are modelled (dma-sim.c), and addresses are host
+ * pointers, so they are passed as 'uintptr_t' instead of 'uint32_t' */
+#ifndef LIBOPENCM3_DMA_H
+#define LIBOPENCM3_DMA_H
+
+#include <libopencm3/cm3/common.h>
+
+#define DMA1			0
+
+#define DMA_CHANNEL1		1
+#define DMA_CHANNEL2		2
+#define DMA_CHANNEL3		3
+#define DMA_CHANNEL4		4
+#define DMA_CHANNEL5		5
+#define DMA_CHANNEL6		6
+#define DMA_CHANNEL7		7
+
+#define DMA_GIF			(1 << 0)
+#define DMA_TCIF		(1 << 1)
+#define DMA_HTIF		(1 << 2)
+#define DMA_TEIF		(1 << 3)
+
+#define DMA_CCR_PSIZE_8BIT	(0 << 8)
+#define DMA_CCR_PSIZE_16BIT	(1 << 8)
+#define DMA_CCR_PSIZE_32BIT	(2 << 8)
+#define DMA_CCR_MSIZE_8BIT	(0 << 10)
+#define DMA_CCR_MSIZE_16BIT	(1 << 10)
+#define DMA_CCR_MSIZE_32BIT	(2 << 10)
+
+#define DMA_CCR_PL_LOW		(0 << 12)
+#define DMA_CCR_PL_MEDIUM	(1 << 12)
+#define DMA_CCR_PL_HIGH		(2 << 12)
+#define DMA_CCR_PL_VERY_HIGH	(3 << 12)
+
+void dma_channel_reset(uint32_t dma, uint8_t channel);
+void dma_clear_interrupt_flags(uint32_t dma, uint8_t channel, uint32_t interrupts);
+bool dma_get_interrupt_flag(uint32_t dma, uint8_t channel, uint32_t interrupts);
+void dma_enable_mem2mem_mode(uint32_t dma, uint8_t channel);
+void dma_set_priority(uint32_t dma, uint8_t channel, uint32_t prio);
+void dma_set_memory_size(uint32_t dma, uint8_t channel, uint32_t mem_size);
+void dma_set_peripheral_size(uint32_t dma, uint8_t channel, uint32_t peripheral_size);
+void dma_enable_memory_increment_mode(uint32_t dma, uint8_t channel);
+void dma_enable_peripheral_increment_mode(uint32_t dma, uint8_t channel);
+void dma_set_read_from_peripheral(uint32_t dma, uint8_t channel);
+void dma_set_read_from_memory(uint32_t dma, uint8_t channel);
+void dma_enable_channel(uint32_t dma, uint8_t channel);
+void dma_disable_channel(uint32_t dma, uint8_t channel);
+void dma_set_peripheral_address(uint32_t dma, uint8_t channel, uintptr_t address);
+void dma_set_memory_address(uint32_t dma, uint8_t channel, uintptr_t address);
+void dma_set_number_of_data(uint32_t dma, uint8_t channel, uint16_t number);
+
+#endif /* LIBOPENCM3_DMA_H */
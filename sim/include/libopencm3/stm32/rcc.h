@@ -0,0 +1,24 @@
+/* host simulation stand-in for <libopencm3/stm32/rcc.h>; clock setup is a
+ * no-op in the simulator, the modelled core always runs at 72 mhz */
+#ifndef LIBOPENCM3_RCC_H
+#define LIBOPENCM3_RCC_H
+
+#include <libopencm3/cm3/common.h>
+
+enum rcc_periph_clken {
+	RCC_GPIOA,
+	RCC_GPIOB,
+	RCC_GPIOC,
+	RCC_AFIO,
+	RCC_DMA1,
+	RCC_USB,
+};
+
+extern uint32_t rcc_ahb_frequency;
+extern uint32_t rcc_apb1_frequency;
+extern uint32_t rcc_apb2_frequency;
+
+void rcc_periph_clock_enable(enum rcc_periph_clken clken);
+void rcc_clock_setup_in_hse_8mhz_out_72mhz(void);
+
+#endif /* LIBOPENCM3_RCC_H */
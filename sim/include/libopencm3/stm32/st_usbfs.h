@@ -0,0 +1,203 @@
+/* host simulation stand-in for <libopencm3/stm32/st_usbfs.h>
+ *
+ * the register and packet memory area (pma) layout is that of the stm32f103
+ * ("st_usbfs_v1"): every 16 bit pma word occupies a 32 bit slot, so the pma
+ * is 512 bytes of storage spread over 1024 bytes of address space; the
+ * simulator keeps it in a host array with exactly this layout, so that the
+ * usual 'USB_PMA_BASE + offset * 2' address arithmetic works unmodified
+ *
+ * the endpoint registers have hardware write semantics (toggle-on-one status
+ * and data toggle bits, clear-on-zero ctr bits), so all register writes
+ * go through SET_REG(), which the simulator routes to its register model */
+#ifndef LIBOPENCM3_ST_USBFS_H
+#define LIBOPENCM3_ST_USBFS_H
+
+#include <libopencm3/cm3/common.h>
+
+struct usbsim_st_usbfs_regs
+{
+	volatile uint32_t	epr[8];
+	volatile uint32_t	cntr;
+	volatile uint32_t	istr;
+	volatile uint32_t	fnr;
+	volatile uint32_t	daddr;
+	volatile uint32_t	btable;
+};
+
+extern struct usbsim_st_usbfs_regs usbsim_st_usbfs_regs;
+extern uint32_t usbsim_pma[256];
+
+void usbsim_st_usbfs_reg_write(volatile uint32_t * reg, uint16_t value);
+
+/* --- usb registers ------------------------------------------------------- */
+
+#define USB_PMA_BASE		((uintptr_t) usbsim_pma)
+
+#define USB_EP_REG(EP)		(& usbsim_st_usbfs_regs.epr[(EP)])
+#define USB_CNTR_REG		(& usbsim_st_usbfs_regs.cntr)
+#define USB_ISTR_REG		(& usbsim_st_usbfs_regs.istr)
+#define USB_FNR_REG		(& usbsim_st_usbfs_regs.fnr)
+#define USB_DADDR_REG		(& usbsim_st_usbfs_regs.daddr)
+#define USB_BTABLE_REG		(& usbsim_st_usbfs_regs.btable)
+
+#define GET_REG(REG)		((uint16_t) *(REG))
+#define SET_REG(REG, VAL)	usbsim_st_usbfs_reg_write((REG), (uint16_t) (VAL))
+#define CLR_REG_BIT(REG, BIT)	SET_REG((REG), (~(BIT)))
+
+/* --- USB_CNTR values ----------------------------------------------------- */
+
+#define USB_CNTR_CTRM		0x8000
+#define USB_CNTR_PMAOVRM	0x4000
+#define USB_CNTR_ERRM		0x2000
+#define USB_CNTR_WKUPM		0x1000
+#define USB_CNTR_SUSPM		0x0800
+#define USB_CNTR_RESETM		0x0400
+#define USB_CNTR_SOFM		0x0200
+#define USB_CNTR_ESOFM		0x0100
+#define USB_CNTR_RESUME		0x0010
+#define USB_CNTR_FSUSP		0x0008
+#define USB_CNTR_LP_MODE	0x0004
+#define USB_CNTR_PWDN		0x0002
+#define USB_CNTR_FRES		0x0001
+
+/* --- USB_ISTR values ----------------------------------------------------- */
+
+#define USB_ISTR_CTR		0x8000
+#define USB_ISTR_PMAOVR		0x4000
+#define USB_ISTR_ERR		0x2000
+#define USB_ISTR_WKUP		0x1000
+#define USB_ISTR_SUSP		0x0800
+#define USB_ISTR_RESET		0x0400
+#define USB_ISTR_SOF		0x0200
+#define USB_ISTR_ESOF		0x0100
+#define USB_ISTR_DIR		0x0010
+#define USB_ISTR_EP_ID		0x000F
+
+#define USB_CLR_ISTR_PMAOVR()	CLR_REG_BIT(USB_ISTR_REG, USB_ISTR_PMAOVR)
+#define USB_CLR_ISTR_ERR()	CLR_REG_BIT(USB_ISTR_REG, USB_ISTR_ERR)
+#define USB_CLR_ISTR_WKUP()	CLR_REG_BIT(USB_ISTR_REG, USB_ISTR_WKUP)
+#define USB_CLR_ISTR_SUSP()	CLR_REG_BIT(USB_ISTR_REG, USB_ISTR_SUSP)
+#define USB_CLR_ISTR_RESET()	CLR_REG_BIT(USB_ISTR_REG, USB_ISTR_RESET)
+#define USB_CLR_ISTR_SOF()	CLR_REG_BIT(USB_ISTR_REG, USB_ISTR_SOF)
+#define USB_CLR_ISTR_ESOF()	CLR_REG_BIT(USB_ISTR_REG, USB_ISTR_ESOF)
+
+/* --- USB_FNR values ------------------------------------------------------ */
+
+#define USB_FNR_RXDP		(1 << 15)
+#define USB_FNR_RXDM		(1 << 14)
+#define USB_FNR_LCK		(1 << 13)
+#define USB_FNR_FN		0x07FF
+
+/* --- USB_DADDR values ---------------------------------------------------- */
+
+#define USB_DADDR_EF		(1 << 7)
+#define USB_DADDR_ADDR		0x007F
+
+/* --- USB_EPnR values ----------------------------------------------------- */
+
+#define USB_EP_RX_CTR		0x8000
+#define USB_EP_RX_DTOG		0x4000
+#define USB_EP_RX_STAT		0x3000
+#define USB_EP_SETUP		0x0800
+#define USB_EP_TYPE		0x0600
+#define USB_EP_KIND		0x0100
+#define USB_EP_TX_CTR		0x0080
+#define USB_EP_TX_DTOG		0x0040
+#define USB_EP_TX_STAT		0x0030
+#define USB_EP_ADDR		0x000F
+
+#define USB_EP_RX_STAT_DISABLED	0x0000
+#define USB_EP_RX_STAT_STALL	0x1000
+#define USB_EP_RX_STAT_NAK	0x2000
+#define USB_EP_RX_STAT_VALID	0x3000
+
+#define USB_EP_TX_STAT_DISABLED	0x0000
+#define USB_EP_TX_STAT_STALL	0x0010
+#define USB_EP_TX_STAT_NAK	0x0020
+#define USB_EP_TX_STAT_VALID	0x0030
+
+#define USB_EP_TYPE_BULK	0x0000
+#define USB_EP_TYPE_CONTROL	0x0200
+#define USB_EP_TYPE_ISO		0x0400
+#define USB_EP_TYPE_INTERRUPT	0x0600
+
+/* endpoint register bits that are not toggled by writing a one */
+#define USB_EP_NTOGGLE_MSK	(USB_EP_RX_CTR | USB_EP_SETUP | USB_EP_TYPE | \
+				 USB_EP_KIND | USB_EP_TX_CTR | USB_EP_ADDR)
+
+#define USB_EP_RX_STAT_TOG_MSK	(USB_EP_RX_STAT | USB_EP_NTOGGLE_MSK)
+#define USB_EP_TX_STAT_TOG_MSK	(USB_EP_TX_STAT | USB_EP_NTOGGLE_MSK)
+
+/* write 'BITS' into the toggle field 'FIELD', leaving all other toggle bits
+ * and both ctr flags untouched */
+#define TOG_SET_REG_BIT_MSK_AND_SET(REG, MSK, BIT, EXTRA_BITS)		\
+	SET_REG((REG), ((GET_REG(REG) & (MSK)) ^ (BIT)) | (EXTRA_BITS))
+
+#define USB_SET_EP_RX_STAT(EP, STAT)					\
+	TOG_SET_REG_BIT_MSK_AND_SET(USB_EP_REG(EP),			\
+		USB_EP_RX_STAT_TOG_MSK, STAT, USB_EP_RX_CTR | USB_EP_TX_CTR)
+#define USB_SET_EP_TX_STAT(EP, STAT)					\
+	TOG_SET_REG_BIT_MSK_AND_SET(USB_EP_REG(EP),			\
+		USB_EP_TX_STAT_TOG_MSK, STAT, USB_EP_RX_CTR | USB_EP_TX_CTR)
+
+#define USB_CLR_EP_RX_CTR(EP)						\
+	SET_REG(USB_EP_REG(EP), (GET_REG(USB_EP_REG(EP)) &		\
+		(USB_EP_NTOGGLE_MSK & ~USB_EP_RX_CTR)) | USB_EP_TX_CTR)
+#define USB_CLR_EP_TX_CTR(EP)						\
+	SET_REG(USB_EP_REG(EP), (GET_REG(USB_EP_REG(EP)) &		\
+		(USB_EP_NTOGGLE_MSK & ~USB_EP_TX_CTR)) | USB_EP_RX_CTR)
+
+#define USB_SET_EP_TYPE(EP, TYPE)					\
+	SET_REG(USB_EP_REG(EP), (GET_REG(USB_EP_REG(EP)) &		\
+		(USB_EP_NTOGGLE_MSK & ~USB_EP_TYPE)) | (TYPE)		\
+		| USB_EP_RX_CTR | USB_EP_TX_CTR)
+#define USB_SET_EP_KIND(EP)						\
+	SET_REG(USB_EP_REG(EP), (GET_REG(USB_EP_REG(EP)) &		\
+		USB_EP_NTOGGLE_MSK) | USB_EP_KIND			\
+		| USB_EP_RX_CTR | USB_EP_TX_CTR)
+#define USB_CLR_EP_KIND(EP)						\
+	SET_REG(USB_EP_REG(EP), (GET_REG(USB_EP_REG(EP)) &		\
+		(USB_EP_NTOGGLE_MSK & ~USB_EP_KIND))			\
+		| USB_EP_RX_CTR | USB_EP_TX_CTR)
+#define USB_SET_EP_ADDR(EP, ADDR)					\
+	SET_REG(USB_EP_REG(EP), (GET_REG(USB_EP_REG(EP)) &		\
+		(USB_EP_NTOGGLE_MSK & ~USB_EP_ADDR)) | (ADDR)		\
+		| USB_EP_RX_CTR | USB_EP_TX_CTR)
+
+/* writing back a set DTOG bit toggles - clears - it */
+#define USB_CLR_EP_RX_DTOG(EP)						\
+	SET_REG(USB_EP_REG(EP), GET_REG(USB_EP_REG(EP)) &		\
+		(USB_EP_NTOGGLE_MSK | USB_EP_RX_DTOG))
+#define USB_CLR_EP_TX_DTOG(EP)						\
+	SET_REG(USB_EP_REG(EP), GET_REG(USB_EP_REG(EP)) &		\
+		(USB_EP_NTOGGLE_MSK | USB_EP_TX_DTOG))
+
+/* --- buffer descriptor table --------------------------------------------- */
+
+#define USB_GET_BTABLE		GET_REG(USB_BTABLE_REG)
+
+#define USB_EP_TX_ADDR(EP)						\
+	((uint32_t *)(USB_PMA_BASE + (USB_GET_BTABLE + (EP) * 8 + 0) * 2))
+#define USB_EP_TX_COUNT(EP)						\
+	((uint32_t *)(USB_PMA_BASE + (USB_GET_BTABLE + (EP) * 8 + 2) * 2))
+#define USB_EP_RX_ADDR(EP)						\
+	((uint32_t *)(USB_PMA_BASE + (USB_GET_BTABLE + (EP) * 8 + 4) * 2))
+#define USB_EP_RX_COUNT(EP)						\
+	((uint32_t *)(USB_PMA_BASE + (USB_GET_BTABLE + (EP) * 8 + 6) * 2))
+
+#define USB_SET_EP_TX_ADDR(EP, ADDR)	SET_REG(USB_EP_TX_ADDR(EP), ADDR)
+#define USB_SET_EP_TX_COUNT(EP, COUNT)	SET_REG(USB_EP_TX_COUNT(EP), COUNT)
+#define USB_SET_EP_RX_ADDR(EP, ADDR)	SET_REG(USB_EP_RX_ADDR(EP), ADDR)
+#define USB_SET_EP_RX_COUNT(EP, COUNT)	SET_REG(USB_EP_RX_COUNT(EP), COUNT)
+
+#define USB_GET_EP_TX_ADDR(EP)		GET_REG(USB_EP_TX_ADDR(EP))
+#define USB_GET_EP_TX_COUNT(EP)		GET_REG(USB_EP_TX_COUNT(EP))
+#define USB_GET_EP_RX_ADDR(EP)		GET_REG(USB_EP_RX_ADDR(EP))
+#define USB_GET_EP_RX_COUNT(EP)		GET_REG(USB_EP_RX_COUNT(EP))
+
+#define USB_GET_EP_TX_BUFF(EP)						\
+	(USB_PMA_BASE + (uint8_t *)(uintptr_t)(USB_GET_EP_TX_ADDR(EP) * 2))
+#define USB_GET_EP_RX_BUFF(EP)						\
+	(USB_PMA_BASE + (uint8_t *)(uintptr_t)(USB_GET_EP_RX_ADDR(EP) * 2))
+
+#endif /* LIBOPENCM3_ST_USBFS_H */
@@ -0,0 +1,117 @@
+/* host simulation stand-in for <libopencm3/usb/cdc.h> */
+#ifndef LIBOPENCM3_CDC_H
+#define LIBOPENCM3_CDC_H
+
+#include <libopencm3/usb/usbstd.h>
+
+/* definitions of communications device class from
+ * "universal serial bus class definitions for communications devices
+ * revision 1.2" */
+
+/* table 2: communications device class code */
+#define USB_CLASS_CDC			0x02
+
+/* table 4: class subclass code */
+#define USB_CDC_SUBCLASS_DLCM		0x01
+#define USB_CDC_SUBCLASS_ACM		0x02
+
+/* table 5: communications interface class control protocol codes */
+#define USB_CDC_PROTOCOL_NONE		0x00
+#define USB_CDC_PROTOCOL_AT		0x01
+
+/* table 6: data interface class code */
+#define USB_CLASS_DATA			0x0A
+
+/* table 12: type values for the bDescriptorType field */
+#define CS_INTERFACE			0x24
+#define CS_ENDPOINT			0x25
+
+/* table 13: bDescriptor subtype in communications class functional
+ * descriptors */
+#define USB_CDC_TYPE_HEADER		0x00
+#define USB_CDC_TYPE_CALL_MANAGEMENT	0x01
+#define USB_CDC_TYPE_ACM		0x02
+#define USB_CDC_TYPE_UNION		0x06
+
+/* table 15: class-specific descriptor header format */
+struct usb_cdc_header_descriptor {
+	uint8_t bFunctionLength;
+	uint8_t bDescriptorType;
+	uint8_t bDescriptorSubtype;
+	uint16_t bcdCDC;
+} __attribute__((packed));
+
+/* table 16: union interface functional descriptor */
+struct usb_cdc_union_descriptor {
+	uint8_t bFunctionLength;
+	uint8_t bDescriptorType;
+	uint8_t bDescriptorSubtype;
+	uint8_t bControlInterface;
+	uint8_t bSubordinateInterface0;
+	/* ... */
+} __attribute__((packed));
+
+/* definitions for abstract control model devices from
+ * "universal serial bus communications class subclass specification for
+ * pstn devices" */
+
+/* table 3: call management functional descriptor */
+struct usb_cdc_call_management_descriptor {
+	uint8_t bFunctionLength;
+	uint8_t bDescriptorType;
+	uint8_t bDescriptorSubtype;
+	uint8_t bmCapabilities;
+	uint8_t bDataInterface;
+} __attribute__((packed));
+
+/* table 4: abstract control management functional descriptor */
+struct usb_cdc_acm_descriptor {
+	uint8_t bFunctionLength;
+	uint8_t bDescriptorType;
+	uint8_t bDescriptorSubtype;
+	uint8_t bmCapabilities;
+} __attribute__((packed));
+
+/* table 13: class-specific request codes for pstn subclasses */
+/* USB_CDC_REQ_SEND_ENCAPSULATED_COMMAND	0x00 */
+#define USB_CDC_REQ_SET_LINE_CODING		0x20
+#define USB_CDC_REQ_GET_LINE_CODING		0x21
+#define USB_CDC_REQ_SET_CONTROL_LINE_STATE	0x22
+#define USB_CDC_REQ_SEND_BREAK			0x23
+
+/* table 17: line coding structure */
+struct usb_cdc_line_coding {
+	uint32_t dwDTERate;
+	uint8_t bCharFormat;
+	uint8_t bParityType;
+	uint8_t bDataBits;
+} __attribute__((packed));
+
+enum usb_cdc_line_coding_bCharFormat {
+	USB_CDC_1_STOP_BITS			= 0,
+	USB_CDC_1_5_STOP_BITS			= 1,
+	USB_CDC_2_STOP_BITS			= 2,
+};
+
+enum usb_cdc_line_coding_bParityType {
+	USB_CDC_NO_PARITY			= 0,
+	USB_CDC_ODD_PARITY			= 1,
+	USB_CDC_EVEN_PARITY			= 2,
+	USB_CDC_MARK_PARITY			= 3,
+	USB_CDC_SPACE_PARITY			= 4,
+};
+
+/* table 30: class-specific notification codes for pstn subclasses */
+/* 0x00 network connection */
+#define USB_CDC_NOTIFY_SERIAL_STATE		0x20
+
+/* notification structure from the pstn spec, section 6.5.4 */
+struct usb_cdc_notification {
+	uint8_t bmRequestType;
+	uint8_t bNotification;
+	uint16_t wValue;
+	uint16_t wIndex;
+	uint16_t wLength;
+} __attribute__((packed));
+
+#endif /* LIBOPENCM3_CDC_H */
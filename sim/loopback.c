@@ -0,0 +1,85 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+/* scripted host driving the firmware loopback test: every packet sent to the
+ * data OUT endpoint is expected back on the data IN endpoint, followed by
+ * a ">>>" marker; the device may split the echo into packets differently */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libopencm3/usb/cdc.h>
+#include "usbsim.h"
+
+enum
+{
+	PACKET_SIZE	= 64,
+	TRANSFERS	= 2000,
+	TIMEOUT_FRAMES	= 100,
+};
+
+int main(void)
+{
+	int data_in, data_out, i;
+	uint64_t start;
+	uint8_t out[PACKET_SIZE], in[PACKET_SIZE + 3];
+
+	usbsim_start(usbsim_firmware_main);
+	if (usbsim_host_enumerate())
+	{
+		fprintf(stderr, "enumeration failed\n");
+		return EXIT_FAILURE;
+	}
+	printf("enumerated in %.3f ms, endpoint 0 size %d bytes\n",
+			(double) usbsim_bus_cycles() * 1000 / USBSIM_CPU_HZ, usbsim_host_ep0_size());
+
+	data_in = usbsim_host_find_endpoint(USB_CLASS_DATA, USB_ENDPOINT_ATTR_BULK, true);
+	data_out = usbsim_host_find_endpoint(USB_CLASS_DATA, USB_ENDPOINT_ATTR_BULK, false);
+	if (data_in == -1 || data_out == -1)
+	{
+		fprintf(stderr, "data endpoints not found\n");
+		return EXIT_FAILURE;
+	}
+
+	usbsim_reset_stats();
+	start = usbsim_bus_cycles();
+	for (i = 0; i < TRANSFERS; i ++)
+	{
+		int j, len = 1 + i % PACKET_SIZE;
+		for (j = 0; j < len; j ++)
+			out[j] = i + j;
+		if (usbsim_host_bulk_write(data_out, out, len, PACKET_SIZE, TIMEOUT_FRAMES) != len
+				|| usbsim_host_bulk_read_stream(data_in, in, len + 3, PACKET_SIZE, TIMEOUT_FRAMES) != len + 3
+				|| memcmp(in, out, len) || memcmp(in + len, ">>>", 3))
+		{
+			fprintf(stderr, "loopback data mismatch at transfer %d\n", i);
+			return EXIT_FAILURE;
+		}
+	}
+	printf("%d loopback transfers, %.1f transfers/s\n", TRANSFERS,
+			(double) TRANSFERS * USBSIM_CPU_HZ / (usbsim_bus_cycles() - start));
+	usbsim_print_stats("loopback");
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,192 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+/* stand-ins for the libopencm3 core and clock functions the firmware uses;
+ * the modelled cpu always runs at 72 mhz, and the only interrupt sources
+ * modelled are the usb peripheral and SysTick */
+
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/dwt.h>
+#include <libopencm3/cm3/systick.h>
+#include "usbsim.h"
+
+uint32_t rcc_ahb_frequency = 8000000;
+uint32_t rcc_apb1_frequency = 8000000;
+uint32_t rcc_apb2_frequency = 8000000;
+
+static bool nvic_enabled[64];
+/* software set pending state; the pending state of the usb interrupt line
+ * itself is kept by the peripheral model */
+static bool nvic_pending[64];
+static bool primask;
+
+/* SysTick counts cpu cycles - only the processor clock source is modelled -
+ * and 'wrap' is the cpu cycle at which it next counts down to zero; a wrap
+ * which is not yet taken stays pending, later ones are lost, as with the
+ * single pending bit of the real exception */
+static struct
+{
+	uint32_t	reload;
+	bool		is_counting, is_interrupt_enabled;
+	uint64_t	wrap;
+}
+systick;
+
+void rcc_periph_clock_enable(enum rcc_periph_clken clken)
+{
+	(void) clken;
+}
+
+void rcc_clock_setup_in_hse_8mhz_out_72mhz(void)
+{
+	rcc_ahb_frequency = USBSIM_CPU_HZ;
+	rcc_apb1_frequency = USBSIM_CPU_HZ / 2;
+	rcc_apb2_frequency = USBSIM_CPU_HZ;
+}
+
+void nvic_enable_irq(uint8_t irqn)
+{
+	nvic_enabled[irqn] = true;
+	/* an interrupt which is already pending is taken right away */
+	usbsim_charge(1);
+}
+
+void nvic_disable_irq(uint8_t irqn)
+{
+	nvic_enabled[irqn] = false;
+}
+
+void nvic_set_pending_irq(uint8_t irqn)
+{
+	nvic_pending[irqn] = true;
+	usbsim_charge(1);
+}
+
+void nvic_clear_pending_irq(uint8_t irqn)
+{
+	nvic_pending[irqn] = false;
+}
+
+void nvic_set_priority(uint8_t irqn, uint8_t priority)
+{
+	(void) irqn, (void) priority;
+}
+
+void cm_enable_interrupts(void)
+{
+	primask = false;
+	usbsim_interrupts_unmasked(__builtin_return_address(0));
+}
+
+void cm_disable_interrupts(void)
+{
+	primask = true;
+}
+
+bool cm_is_masked_interrupts(void)
+{
+	return primask;
+}
+
+bool dwt_enable_cycle_counter(void)
+{
+	return true;
+}
+
+uint32_t dwt_read_cycle_counter(void)
+{
+	/* a load from the counter register */
+	usbsim_charge_at(2, __builtin_return_address(0));
+	return usbsim_cpu_cycles();
+}
+
+void systick_set_reload(uint32_t value)
+{
+	systick.reload = value & STK_RVR_RELOAD;
+}
+
+void systick_set_clocksource(uint8_t clocksource)
+{
+	(void) clocksource;
+}
+
+void systick_clear(void)
+{
+	systick.wrap = usbsim_cpu_cycles() + systick.reload + 1;
+}
+
+void systick_counter_enable(void)
+{
+	if (!systick.is_counting)
+		systick_clear();
+	systick.is_counting = true;
+}
+
+void systick_counter_disable(void)
+{
+	systick.is_counting = false;
+}
+
+void systick_interrupt_enable(void)
+{
+	systick.is_interrupt_enabled = true;
+}
+
+void systick_interrupt_disable(void)
+{
+	systick.is_interrupt_enabled = false;
+}
+
+bool usbsim_systick_pending(void)
+{
+	return usbsim_systick_next_wrap() <= usbsim_cpu_cycles();
+}
+
+uint64_t usbsim_systick_next_wrap(void)
+{
+	return systick.is_counting && systick.is_interrupt_enabled && systick.reload ? systick.wrap : UINT64_MAX;
+}
+
+void usbsim_systick_taken(void)
+{
+	uint64_t period = systick.reload + 1;
+
+	systick.wrap += (usbsim_cpu_cycles() - systick.wrap) / period * period + period;
+}
+
+bool usbsim_nvic_irq_enabled(uint8_t irqn)
+{
+	return nvic_enabled[irqn];
+}
+
+bool usbsim_nvic_irq_pending(uint8_t irqn)
+{
+	return nvic_pending[irqn];
+}
+
+bool usbsim_interrupts_masked(void)
+{
+	return primask;
+}
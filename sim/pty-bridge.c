@@ -0,0 +1,342 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* bridges the serial ports of the simulated firmware to linux pseudo
+ * terminals, so that host software written for /dev/ttyACM* - and host side
+ * benchmarks - can run against the firmware logic without a board
+ *
+ * the program enumerates the simulated device, creates a pty for the data
+ * interface of each serial port, prints the names of their slave sides, and
+ * then runs the bus frame by frame, with the simulated frames paced to the
+ * wall clock; in each frame the host moves data between the ptys and the
+ * bulk endpoints, the way a host controller does:
+ *	- the bulk transactions of a frame are issued round robin over the
+ *	endpoints with data to move, up to '-p' data packets per frame
+ *	(e.g. the 19 full size packets a full speed frame holds at most, or
+ *	fewer, to model a host controller that schedules less), and an
+ *	endpoint that naks is not retried before the next frame
+ *	- IN transactions are issued only while the pty is open and can take a
+ *	full packet, so a slow reader applies backpressure to the device
+ *	- opening the pty raises DTR and RTS, closing it drops them, as the
+ *	linux cdc-acm driver does
+ * '-f' sets the wall clock time of a simulated frame in microseconds, 1000
+ * for real time; with '-f 0' the frames run as fast as the simulation goes
+ * while there is data to move; '-r' records the session - enumeration
+ * included - to a trace file, for replay by bench-replay (session-sim.h)
+ *
+ * usage: pty-bridge [-p packets per frame] [-f frame period in us] [-r trace]
+ * the bridge runs until interrupted, and then prints the bus statistics */
+
+#define _XOPEN_SOURCE	600
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libopencm3/usb/cdc.h>
+#include "usbsim.h"
+#include "session-sim.h"
+
+enum
+{
+	PACKET_SIZE		= 64,
+	MAX_PORTS		= 4,
+	/* the data read from a pty, but not yet sent to the device */
+	OUT_BUFFER_SIZE		= 4096,
+	/* the frames the simulation may fall behind the wall clock, before it
+	 * stops trying to catch up */
+	MAX_LAG_FRAMES		= 100,
+	CONTROL_LINE_DTR_RTS	= 3,
+};
+
+static struct port
+{
+	int		master;
+	int		data_in, data_out;
+	uint8_t		control_interface;
+	bool		is_open;
+	/* the endpoints naked in this frame */
+	bool		is_in_naked, is_out_naked;
+	uint8_t		out[OUT_BUFFER_SIZE];
+	unsigned	out_head, out_len;
+	/* a received packet the pty had no room for */
+	uint8_t		in[PACKET_SIZE];
+	unsigned	in_len;
+	uint64_t	bytes_in, bytes_out;
+}
+ports[MAX_PORTS];
+static unsigned port_count;
+
+static volatile sig_atomic_t is_interrupted;
+
+static void interrupted(int signal)
+{
+	(void) signal;
+	is_interrupted = 1;
+}
+
+static int set_control_line_state(struct port * p, uint16_t state)
+{
+	return usbsim_host_control(& (struct usb_setup_data) { .bmRequestType = USB_REQ_TYPE_CLASS | USB_REQ_TYPE_INTERFACE,
+			.bRequest = USB_CDC_REQ_SET_CONTROL_LINE_STATE, .wValue = state, .wIndex = p->control_interface, }, 0);
+}
+
+static int open_pty(void)
+{
+	struct termios t;
+	int master, slave;
+
+	if ((master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK)) < 0)
+		return -1;
+	if (grantpt(master) || unlockpt(master) || (slave = open(ptsname(master), O_RDWR | O_NOCTTY)) < 0)
+	{
+		close(master);
+		return -1;
+	}
+	/* a raw line, as a serial port used for data; the slave is closed
+	 * again, so that the master reports a hangup until it is opened */
+	if (!tcgetattr(slave, & t))
+	{
+		cfmakeraw(& t);
+		tcsetattr(slave, TCSANOW, & t);
+	}
+	close(slave);
+	return master;
+}
+
+/* moves data between the pty and the port buffers, and tracks whether the
+ * pty is open */
+static void pump(struct port * p)
+{
+	struct pollfd pfd = { .fd = p->master, .events = POLLIN, };
+	bool is_open;
+	ssize_t len;
+
+	poll(& pfd, 1, 0);
+	is_open = !(pfd.revents & POLLHUP);
+	if (is_open != p->is_open)
+	{
+		p->is_open = is_open;
+		set_control_line_state(p, is_open ? CONTROL_LINE_DTR_RTS : 0);
+	}
+	if (!is_open)
+		return;
+	if (p->out_head && p->out_len < sizeof p->out / 2)
+	{
+		memmove(p->out, p->out + p->out_head, p->out_len);
+		p->out_head = 0;
+	}
+	if (pfd.revents & POLLIN && p->out_head + p->out_len < sizeof p->out
+			&& (len = read(p->master, p->out + p->out_head + p->out_len, sizeof p->out - p->out_head - p->out_len)) > 0)
+		p->out_len += len;
+	if (p->in_len && (len = write(p->master, p->in, p->in_len)) > 0)
+	{
+		memmove(p->in, p->in + len, p->in_len - len);
+		p->in_len -= len;
+	}
+}
+
+/* a data transaction on the port; returns whether a data packet was
+ * transferred */
+static bool transfer(struct port * p, bool is_in)
+{
+	int len;
+
+	if (is_in)
+	{
+		if ((len = usbsim_host_in(p->data_in, p->in, sizeof p->in)) < 0)
+		{
+			p->is_in_naked = true;
+			return false;
+		}
+		p->in_len = len;
+		p->bytes_in += len;
+		pump(p);
+		return true;
+	}
+	len = MIN(p->out_len, (unsigned) PACKET_SIZE);
+	if (usbsim_host_out(p->data_out, p->out + p->out_head, len) != USBSIM_ACK)
+	{
+		p->is_out_naked = true;
+		return false;
+	}
+	p->out_head += len;
+	p->out_len -= len;
+	p->bytes_out += len;
+	return true;
+}
+
+/* the bulk transactions of a frame; returns the number of data packets
+ * transferred */
+static unsigned run_frame(unsigned max_packets)
+{
+	uint32_t frame = usbsim_host_frame_number();
+	unsigned packets = 0, i;
+	bool is_busy = true;
+
+	for (i = 0; i < port_count; i ++)
+	{
+		ports[i].is_in_naked = ports[i].is_out_naked = false;
+		pump(ports + i);
+	}
+	while (is_busy && packets < max_packets && usbsim_host_frame_number() == frame)
+	{
+		is_busy = false;
+		for (i = 0; i < port_count && packets < max_packets; i ++)
+		{
+			struct port * p = ports + i;
+
+			if (p->out_len && !p->is_out_naked)
+				is_busy = true, packets += transfer(p, false);
+			if (p->is_open && !p->in_len && !p->is_in_naked && packets < max_packets)
+				is_busy = true, packets += transfer(p, true);
+		}
+	}
+	/* the rest of the frame is idle */
+	if (usbsim_host_frame_number() == frame)
+		usbsim_host_idle(USBSIM_CYCLES_PER_FRAME - usbsim_bus_cycles() % USBSIM_CYCLES_PER_FRAME);
+	return packets;
+}
+
+static void timespec_add_us(struct timespec * t, unsigned us)
+{
+	t->tv_nsec += us * 1000l;
+	t->tv_sec += t->tv_nsec / 1000000000;
+	t->tv_nsec %= 1000000000;
+}
+
+static bool timespec_before(const struct timespec * a, const struct timespec * b)
+{
+	return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+int main(int argc, char ** argv)
+{
+	unsigned max_packets = 19, frame_us = 1000, i, late_frames = 0;
+	struct timespec deadline, lag;
+	FILE * trace = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "p:f:r:")) != -1)
+		switch (opt)
+		{
+		case 'p': max_packets = strtoul(optarg, 0, 0); break;
+		case 'f': frame_us = strtoul(optarg, 0, 0); break;
+		case 'r':
+			if (!(trace = fopen(optarg, "w")))
+			{
+				perror(optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		default: optind = argc + 1; break;
+		}
+	if (optind != argc || !max_packets || frame_us > 1000000)
+	{
+		fprintf(stderr, "usage: %s [-p packets per frame] [-f frame period in us] [-r trace]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	usbsim_start(usbsim_firmware_main);
+	if (trace)
+		usbsim_session_record_start(trace);
+	if (usbsim_host_enumerate())
+	{
+		fprintf(stderr, "enumeration failed\n");
+		return EXIT_FAILURE;
+	}
+	for (port_count = 0; port_count < MAX_PORTS; port_count ++)
+	{
+		struct port * p = ports + port_count;
+		int interface = usbsim_host_find_interface_nth(USB_CLASS_CDC, port_count);
+
+		p->data_in = usbsim_host_find_endpoint_nth(USB_CLASS_DATA, port_count, USB_ENDPOINT_ATTR_BULK, true);
+		p->data_out = usbsim_host_find_endpoint_nth(USB_CLASS_DATA, port_count, USB_ENDPOINT_ATTR_BULK, false);
+		if (interface == -1 || p->data_in == -1 || p->data_out == -1)
+			break;
+		p->control_interface = interface;
+		if ((p->master = open_pty()) < 0)
+		{
+			perror("creating a pty failed");
+			return EXIT_FAILURE;
+		}
+		printf("port %u: %s\n", port_count, ptsname(p->master));
+	}
+	if (!port_count)
+	{
+		fprintf(stderr, "the device has no serial port\n");
+		return EXIT_FAILURE;
+	}
+	fflush(stdout);
+
+	signal(SIGINT, interrupted);
+	signal(SIGTERM, interrupted);
+	signal(SIGPIPE, SIG_IGN);
+	usbsim_reset_stats();
+	clock_gettime(CLOCK_MONOTONIC, & deadline);
+	while (!is_interrupted)
+	{
+		unsigned packets = run_frame(max_packets);
+		struct timespec now;
+
+		if (!frame_us)
+		{
+			/* free running; an idle bridge waits for the host side */
+			if (!packets)
+				usleep(1000);
+			continue;
+		}
+		timespec_add_us(& deadline, frame_us);
+		clock_gettime(CLOCK_MONOTONIC, & now);
+		lag = deadline;
+		timespec_add_us(& lag, MAX_LAG_FRAMES * frame_us);
+		if (timespec_before(& now, & deadline))
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, & deadline, 0);
+		else
+		{
+			late_frames ++;
+			if (timespec_before(& lag, & now))
+				deadline = now;
+		}
+	}
+
+	usbsim_print_stats("pty bridge");
+	for (i = 0; i < port_count; i ++)
+		printf("\tport %u                bytes in %llu, out %llu\n", i,
+				(unsigned long long) ports[i].bytes_in, (unsigned long long) ports[i].bytes_out);
+	if (frame_us)
+		printf("\tlate frames           %u\n", late_frames);
+	if (trace && (usbsim_session_record_stop() || fclose(trace)))
+	{
+		fprintf(stderr, "writing the trace failed\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
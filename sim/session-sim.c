@@ -0,0 +1,223 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* recording and replay of host sessions; see session-sim.h */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "usbsim.h"
+#include "session-sim.h"
+
+enum
+{
+	/* the largest full speed packet, an isochronous one */
+	MAX_PACKET	= 1023,
+	MAX_LINE	= 2 * MAX_PACKET + 128,
+};
+
+static const char header[] = "# usbsim session 1\n";
+
+static const char * const type_names[] =
+{
+	[USBSIM_TRANSACTION_RESET]	= "reset",
+	[USBSIM_TRANSACTION_SETUP]	= "setup",
+	[USBSIM_TRANSACTION_OUT]	= "out",
+	[USBSIM_TRANSACTION_IN]		= "in",
+	[USBSIM_TRANSACTION_ISO_IN]	= "iso-in",
+};
+
+/*
+ * recording; the transactions issued by the periodic schedule of the host
+ * complete before the transaction that made room for them in the frame, so
+ * the records are sorted by their bus cycles before they are written
+ */
+static struct record
+{
+	uint64_t	start;
+	size_t		seq;
+	char		* line;
+}
+* records;
+static size_t record_count, record_size;
+static FILE * record_file;
+
+static void record_transaction(const struct usbsim_transaction * t)
+{
+	char line[MAX_LINE], * p = line;
+	unsigned i;
+
+	if (record_count == record_size)
+	{
+		record_size = record_size ? 2 * record_size : 1024;
+		if (!(records = realloc(records, record_size * sizeof * records)))
+			abort();
+	}
+	p += sprintf(p, "%" PRIu64 " %s %u %u %u %d", t->start, type_names[t->type], t->address, t->ep, t->len, t->result);
+	if (t->type == USBSIM_TRANSACTION_SETUP || t->type == USBSIM_TRANSACTION_OUT)
+	{
+		* p ++ = ' ';
+		for (i = 0; i < t->len; i ++)
+			p += sprintf(p, "%02x", ((const uint8_t *) t->data)[i]);
+	}
+	records[record_count].start = t->start;
+	records[record_count].seq = record_count;
+	if (!(records[record_count ++].line = strdup(line)))
+		abort();
+}
+
+static int compare_records(const void * a, const void * b)
+{
+	const struct record * x = a, * y = b;
+
+	if (x->start != y->start)
+		return x->start < y->start ? -1 : 1;
+	return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+void usbsim_session_record_start(FILE * f)
+{
+	record_file = f;
+	record_count = 0;
+	usbsim_transaction_hook = record_transaction;
+}
+
+int usbsim_session_record_stop(void)
+{
+	size_t i;
+
+	usbsim_transaction_hook = 0;
+	qsort(records, record_count, sizeof * records, compare_records);
+	fputs(header, record_file);
+	for (i = 0; i < record_count; i ++)
+	{
+		fprintf(record_file, "%s\n", records[i].line);
+		free(records[i].line);
+	}
+	fprintf(record_file, "%" PRIu64 " end\n", usbsim_bus_cycles());
+	free(records);
+	records = 0;
+	record_count = record_size = 0;
+	return fflush(record_file) || ferror(record_file) ? -EIO : 0;
+}
+
+
+/*
+ * replay
+ */
+static int parse_data(const char * s, uint8_t * data, unsigned len)
+{
+	unsigned i;
+
+	for (i = 0; i < len; i ++)
+		if (sscanf(s + 2 * i, "%2hhx", data + i) != 1)
+			return -EINVAL;
+	return 0;
+}
+
+static int replay_transaction(const char * line, struct usbsim_session_replay_stats * stats)
+{
+	unsigned address, ep, len, i;
+	int recorded, result, n = 0;
+	uint8_t data[MAX_PACKET];
+	uint64_t start;
+	char type[8];
+
+	if (sscanf(line, "%" SCNu64 " %7s %n", & start, type, & n) != 2 || !n)
+		return -EINVAL;
+	if (usbsim_bus_cycles() < start)
+		usbsim_host_idle(start - usbsim_bus_cycles());
+	if (!strcmp(type, "end"))
+	{
+		stats->end = start;
+		return 1;
+	}
+	for (i = 0; i < sizeof type_names / sizeof * type_names; i ++)
+		if (!strcmp(type, type_names[i]))
+			break;
+	line += n, n = 0;
+	if (i == sizeof type_names / sizeof * type_names
+			|| sscanf(line, "%u %u %u %d %n", & address, & ep, & len, & recorded, & n) != 4 || !n
+			|| address > 127 || ep > 0xff || len > MAX_PACKET)
+		return -EINVAL;
+	if (!stats->transactions ++)
+		stats->start = start;
+	usbsim_host_set_address(address);
+	switch ((enum usbsim_transaction_type) i)
+	{
+	case USBSIM_TRANSACTION_RESET:
+		usbsim_host_reset();
+		result = USBSIM_ACK;
+		break;
+	case USBSIM_TRANSACTION_SETUP:
+	{
+		struct usb_setup_data req;
+
+		if (len != sizeof req || parse_data(line + n, data, len))
+			return -EINVAL;
+		memcpy(& req, data, sizeof req);
+		result = usbsim_host_setup(ep, & req);
+		break;
+	}
+	case USBSIM_TRANSACTION_OUT:
+		if (parse_data(line + n, data, len))
+			return -EINVAL;
+		result = usbsim_host_out(ep, data, len);
+		break;
+	case USBSIM_TRANSACTION_IN:
+		result = usbsim_host_in(ep, data, len);
+		break;
+	case USBSIM_TRANSACTION_ISO_IN:
+		result = usbsim_host_iso_in(ep, data, len);
+		break;
+	default:
+		return -EINVAL;
+	}
+	if (result != recorded)
+		stats->divergent ++;
+	return 0;
+}
+
+int usbsim_session_replay(FILE * f, struct usbsim_session_replay_stats * stats, unsigned * line)
+{
+	static char buf[MAX_LINE];
+	int result = 0;
+
+	memset(stats, 0, sizeof * stats);
+	* line = 0;
+	while (fgets(buf, sizeof buf, f))
+	{
+		++ * line;
+		if (!strchr(buf, '\n') && !feof(f))
+			return -EINVAL;
+		if (* line == 1 && strcmp(buf, header))
+			return -EINVAL;
+		if (buf[0] == '#')
+			continue;
+		if ((result = replay_transaction(buf, stats)))
+			return result < 0 ? result : 0;
+	}
+	/* a trace without an end is truncated */
+	return ferror(f) ? -EIO : -EINVAL;
+}
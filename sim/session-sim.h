@@ -0,0 +1,72 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* recording and replay of host sessions, for performance regression runs
+ * against fixed - e.g. recorded from real host software over the pty bridge
+ * - rather than synthetic traffic
+ *
+ * a session trace is a text file, a line per transaction, or bus reset, as
+ * the scripted host issued it (see 'struct usbsim_transaction'):
+ *	<bus cycle> <type> <address> <endpoint> <length> <result> [<hex data>]
+ * where the type is 'reset', 'setup', 'out', 'in' or 'iso-in', the length
+ * is the data length, or the maximum length of an IN transaction, and the
+ * result is the outcome the host saw - the received length of an IN
+ * transaction, or one of the USBSIM_xxx codes; SETUP and OUT transactions
+ * carry their data, IN transactions only their length. the trace starts
+ * with a '# usbsim session 1' line, ends with an '<bus cycle> end' line,
+ * and may hold other '#' comment lines
+ *
+ * the replay is open loop: each transaction is issued at the recorded bus
+ * cycle - or as soon as the one before has completed, if that is later -
+ * whatever the firmware responded to the ones before, so that each replay
+ * of a trace offers the firmware the exact same traffic; a transaction with
+ * an outcome different from the recorded one is counted as divergent, and
+ * data the firmware naked where it took it when the trace was recorded is
+ * not sent again */
+
+#ifndef SESSION_SIM_H
+#define SESSION_SIM_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+struct usbsim_session_replay_stats
+{
+	uint64_t	transactions;
+	uint64_t	divergent;
+	/* the bus cycles of the first transaction and of the trace end */
+	uint64_t	start, end;
+};
+
+/* records the host transactions from now on, up to
+ * 'usbsim_session_record_stop()'; the transactions are kept in memory, and
+ * written to 'f' - in bus time order - when the recording stops, which
+ * returns 0, or a negative errno value */
+void usbsim_session_record_start(FILE * f);
+int usbsim_session_record_stop(void);
+
+/* replays the trace in 'f' on the simulated device, which must not have
+ * been enumerated yet; returns 0, or -EINVAL for a malformed trace - with
+ * the line number in 'line' - or another negative errno value */
+int usbsim_session_replay(FILE * f, struct usbsim_session_replay_stats * stats, unsigned * line);
+
+#endif /* SESSION_SIM_H */
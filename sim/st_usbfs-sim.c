@@ -0,0 +1,376 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* register level model of the stm32f103 usb full speed device peripheral
+ *
+ * this models what the firmware can observe of the peripheral: the endpoint
+ * registers with their write semantics, the interrupt status register, the
+ * device address register, and the packet memory area with the buffer
+ * descriptor table in it; on the bus side, the transaction functions
+ * implement the reaction of the peripheral to SETUP/OUT/IN tokens, as
+ * described in the 'universal serial bus full speed device interface' chapter
+ * of the stm32f10x reference manual (rm0008)
+ *
+ * double buffered bulk endpoints (EP_KIND set on a bulk endpoint) are
+ * modelled as follows: the peripheral uses the buffer selected by the
+ * DTOG bit of the endpoint direction, the application owns the buffer selected
+ * by the SW_BUF bit (the DTOG bit of the other direction); a transaction
+ * is performed only if DTOG != SW_BUF, otherwise the peripheral naks; after a
+ * successful transaction DTOG is toggled and CTR is set, STAT is left
+ * untouched */
+
+#include <string.h>
+#include <assert.h>
+
+#include <libopencm3/stm32/st_usbfs.h>
+#include "usbsim.h"
+
+struct usbsim_st_usbfs_regs usbsim_st_usbfs_regs;
+uint32_t usbsim_pma[256] __attribute__((aligned(4)));
+
+/* latched interrupt flags of the ISTR register; the CTR, DIR and EP_ID fields
+ * are derived from the endpoint registers */
+static uint16_t istr_flags;
+/* bus time of the last transfer completion on each endpoint register,
+ * index 0 for reception (ctr_rx), 1 for transmission (ctr_tx) */
+static uint64_t ctr_timestamp[USBSIM_MAX_ENDPOINTS][2];
+/* the endpoint register and ctr flag of a data transaction in progress,
+ * which completes with the handshake packet */
+static int pending_endpoint = -1;
+static uint16_t pending_ctr;
+
+enum
+{
+	EPR_RW_MASK		= USB_EP_TYPE | USB_EP_KIND | USB_EP_ADDR,
+	EPR_TOGGLE_MASK		= USB_EP_RX_DTOG | USB_EP_RX_STAT | USB_EP_TX_DTOG | USB_EP_TX_STAT,
+	EPR_CTR_MASK		= USB_EP_RX_CTR | USB_EP_TX_CTR,
+	ISTR_FLAGS_MASK		= USB_ISTR_PMAOVR | USB_ISTR_ERR | USB_ISTR_WKUP | USB_ISTR_SUSP
+					| USB_ISTR_RESET | USB_ISTR_SOF | USB_ISTR_ESOF,
+};
+
+static void update_istr(void)
+{
+	uint16_t istr = istr_flags;
+	int i;
+
+	/* the peripheral reports the lowest numbered endpoint with a pending
+	 * transfer completion; reception takes precedence over transmission */
+	for (i = 0; i < USBSIM_MAX_ENDPOINTS; i ++)
+		if (usbsim_st_usbfs_regs.epr[i] & EPR_CTR_MASK)
+		{
+			istr |= USB_ISTR_CTR | i;
+			if (usbsim_st_usbfs_regs.epr[i] & USB_EP_RX_CTR)
+				istr |= USB_ISTR_DIR;
+			break;
+		}
+	usbsim_st_usbfs_regs.istr = istr;
+}
+
+static void service_latency(int ep, int dir)
+{
+	uint64_t now = usbsim_cpu_cycles(), latency;
+
+	latency = now > ctr_timestamp[ep][dir] ? now - ctr_timestamp[ep][dir] : 0;
+	usbsim_stats.serviced_transfers ++;
+	usbsim_stats.total_service_latency += latency;
+	if (latency > usbsim_stats.max_service_latency)
+		usbsim_stats.max_service_latency = latency;
+}
+
+static void epr_write(int ep, uint16_t value)
+{
+	uint16_t old = usbsim_st_usbfs_regs.epr[ep], x;
+
+	x = (value & EPR_RW_MASK) | ((old ^ value) & EPR_TOGGLE_MASK)
+		| (old & value & EPR_CTR_MASK) | (old & USB_EP_SETUP);
+	if ((old & USB_EP_RX_CTR) && !(x & USB_EP_RX_CTR))
+		service_latency(ep, 0);
+	if ((old & USB_EP_TX_CTR) && !(x & USB_EP_TX_CTR))
+		service_latency(ep, 1);
+	usbsim_st_usbfs_regs.epr[ep] = x;
+	update_istr();
+}
+
+void usbsim_st_usbfs_reg_write(volatile uint32_t * reg, uint16_t value)
+{
+	if (reg >= usbsim_st_usbfs_regs.epr && reg < usbsim_st_usbfs_regs.epr + USBSIM_MAX_ENDPOINTS)
+		epr_write(reg - usbsim_st_usbfs_regs.epr, value);
+	else if (reg == & usbsim_st_usbfs_regs.istr)
+	{
+		/* interrupt flags are cleared by writing zero, writing one has
+		 * no effect */
+		istr_flags &= value | ~ ISTR_FLAGS_MASK;
+		update_istr();
+	}
+	else if (reg == & usbsim_st_usbfs_regs.btable)
+		* reg = value & 0xfff8;
+	else
+		/* everything else, including the packet memory area, is
+		 * plain read/write storage */
+		* reg = value;
+	usbsim_charge_at(1, __builtin_return_address(0));
+}
+
+
+/*
+ * packet memory area access, bus side
+ */
+static void pma_write(uint16_t pma_address, const uint8_t * data, unsigned len)
+{
+	unsigned i;
+	assert(pma_address + len <= USBSIM_PMA_SIZE);
+	for (i = 0; i < len; i ++, pma_address ++)
+	{
+		uint32_t * w = usbsim_pma + pma_address / 2;
+		if (pma_address & 1)
+			* w = (* w & 0x00ff) | (data[i] << 8);
+		else
+			* w = (* w & 0xff00) | data[i];
+	}
+}
+
+static void pma_read(uint16_t pma_address, uint8_t * data, unsigned len)
+{
+	unsigned i;
+	assert(pma_address + len <= USBSIM_PMA_SIZE);
+	for (i = 0; i < len; i ++, pma_address ++)
+		data[i] = usbsim_pma[pma_address / 2] >> ((pma_address & 1) ? 8 : 0);
+}
+
+static uint16_t btable_read(int ep, int field)
+{
+	return usbsim_pma[(usbsim_st_usbfs_regs.btable + ep * 8 + field * 2) / 2];
+}
+
+static void btable_write(int ep, int field, uint16_t value)
+{
+	usbsim_pma[(usbsim_st_usbfs_regs.btable + ep * 8 + field * 2) / 2] = value;
+}
+
+enum { BT_ADDR_TX = 0, BT_COUNT_TX, BT_ADDR_RX, BT_COUNT_RX, };
+
+/* the size of a reception buffer, as encoded in the BL_SIZE/NUM_BLOCK fields
+ * of a COUNT_RX buffer descriptor table entry */
+static unsigned rx_buffer_size(uint16_t count_rx)
+{
+	unsigned blocks = (count_rx >> 10) & 0x1f;
+	return (count_rx & 0x8000) ? (blocks + 1) * 32 : blocks * 2;
+}
+
+/*
+ * bus side
+ */
+static int find_endpoint(uint8_t address, uint8_t ep)
+{
+	int i;
+	if (!(usbsim_st_usbfs_regs.daddr & USB_DADDR_EF)
+			|| (usbsim_st_usbfs_regs.daddr & USB_DADDR_ADDR) != address)
+		return -1;
+	for (i = 0; i < USBSIM_MAX_ENDPOINTS; i ++)
+		if ((usbsim_st_usbfs_regs.epr[i] & USB_EP_ADDR) == ep)
+			return i;
+	return -1;
+}
+
+static void transfer_complete(int ep, uint16_t ctr_bit)
+{
+	usbsim_st_usbfs_regs.epr[ep] |= ctr_bit;
+	ctr_timestamp[ep][ctr_bit == USB_EP_RX_CTR ? 0 : 1] = usbsim_bus_cycles();
+	update_istr();
+}
+
+static bool is_double_buffered(uint16_t epr)
+{
+	return (epr & (USB_EP_TYPE | USB_EP_KIND)) == (USB_EP_TYPE_BULK | USB_EP_KIND)
+		|| (epr & USB_EP_TYPE) == USB_EP_TYPE_ISO;
+}
+
+void usbsim_st_usbfs_bus_reset(void)
+{
+	/* a bus reset disables all endpoints and clears the device address;
+	 * reprogramming them is up to the firmware */
+	memset((void *) usbsim_st_usbfs_regs.epr, 0, sizeof usbsim_st_usbfs_regs.epr);
+	usbsim_st_usbfs_regs.daddr = 0;
+	istr_flags |= USB_ISTR_RESET;
+	update_istr();
+}
+
+void usbsim_st_usbfs_sof(uint16_t frame_number)
+{
+	usbsim_st_usbfs_regs.fnr = (usbsim_st_usbfs_regs.fnr & ~ USB_FNR_FN) | (frame_number & USB_FNR_FN);
+	istr_flags |= USB_ISTR_SOF;
+	update_istr();
+}
+
+bool usbsim_st_usbfs_irq_pending(void)
+{
+	return (usbsim_st_usbfs_regs.istr & usbsim_st_usbfs_regs.cntr & 0xff00) != 0;
+}
+
+int usbsim_st_usbfs_setup(uint8_t address, uint8_t ep, const void * setup_packet)
+{
+	int i = find_endpoint(address, ep);
+	uint16_t epr;
+
+	if (i == -1)
+		return USBSIM_TIMEOUT;
+	epr = usbsim_st_usbfs_regs.epr[i];
+	/* setup packets are accepted by control endpoints regardless of the
+	 * STAT_RX state, unless the endpoint is disabled */
+	if ((epr & USB_EP_TYPE) != USB_EP_TYPE_CONTROL || (epr & USB_EP_RX_STAT) == USB_EP_RX_STAT_DISABLED)
+		return USBSIM_TIMEOUT;
+	pma_write(btable_read(i, BT_ADDR_RX), setup_packet, 8);
+	btable_write(i, BT_COUNT_RX, (btable_read(i, BT_COUNT_RX) & 0xfc00) | 8);
+	/* a setup transaction leaves both directions naking, and selects DATA1
+	 * for the data stage that follows */
+	epr = (epr & ~ (USB_EP_RX_STAT | USB_EP_TX_STAT)) | USB_EP_RX_STAT_NAK | USB_EP_TX_STAT_NAK
+		| USB_EP_SETUP | USB_EP_RX_DTOG | USB_EP_TX_DTOG;
+	usbsim_st_usbfs_regs.epr[i] = epr;
+	transfer_complete(i, USB_EP_RX_CTR);
+	usbsim_stats.setup_transactions ++;
+	return USBSIM_ACK;
+}
+
+int usbsim_st_usbfs_out(uint8_t address, uint8_t ep, const void * data, unsigned len)
+{
+	int i = find_endpoint(address, ep);
+	uint16_t epr, count_field, buffer_field;
+
+	if (i == -1)
+		return USBSIM_TIMEOUT;
+	epr = usbsim_st_usbfs_regs.epr[i];
+	switch (epr & USB_EP_RX_STAT)
+	{
+		case USB_EP_RX_STAT_DISABLED:
+			return USBSIM_TIMEOUT;
+		case USB_EP_RX_STAT_STALL:
+			usbsim_stats.out_stall ++;
+			return USBSIM_STALL;
+		case USB_EP_RX_STAT_NAK:
+			usbsim_stats.out_nak ++;
+			return USBSIM_NAK;
+	}
+	count_field = BT_COUNT_RX;
+	buffer_field = BT_ADDR_RX;
+	if (is_double_buffered(epr))
+	{
+		bool dtog = epr & USB_EP_RX_DTOG, sw_buf = epr & USB_EP_TX_DTOG;
+		if (dtog == sw_buf)
+		{
+			usbsim_stats.out_nak ++;
+			return USBSIM_NAK;
+		}
+		/* in double buffered mode, buffer 0 is described by the 'tx'
+		 * entries of the buffer descriptor table */
+		count_field = dtog ? BT_COUNT_RX : BT_COUNT_TX;
+		buffer_field = dtog ? BT_ADDR_RX : BT_ADDR_TX;
+	}
+	if (len > rx_buffer_size(btable_read(i, count_field)))
+	{
+		/* babble - the packet does not fit in the reception buffer;
+		 * the peripheral signals an error and does not handshake */
+		istr_flags |= USB_ISTR_ERR;
+		update_istr();
+		return USBSIM_TIMEOUT;
+	}
+	pma_write(btable_read(i, buffer_field), data, len);
+	btable_write(i, count_field, (btable_read(i, count_field) & 0xfc00) | len);
+	pending_endpoint = i;
+	pending_ctr = USB_EP_RX_CTR;
+	usbsim_stats.out_ack ++;
+	usbsim_stats.bytes_out += len;
+	return USBSIM_ACK;
+}
+
+int usbsim_st_usbfs_in(uint8_t address, uint8_t ep, void * buf, unsigned maxlen)
+{
+	int i = find_endpoint(address, ep);
+	uint16_t epr, count_field, buffer_field;
+	unsigned len;
+
+	if (i == -1)
+		return USBSIM_TIMEOUT;
+	epr = usbsim_st_usbfs_regs.epr[i];
+	switch (epr & USB_EP_TX_STAT)
+	{
+		case USB_EP_TX_STAT_DISABLED:
+			return USBSIM_TIMEOUT;
+		case USB_EP_TX_STAT_STALL:
+			usbsim_stats.in_stall ++;
+			return USBSIM_STALL;
+		case USB_EP_TX_STAT_NAK:
+			usbsim_stats.in_nak ++;
+			return USBSIM_NAK;
+	}
+	count_field = BT_COUNT_TX;
+	buffer_field = BT_ADDR_TX;
+	if (is_double_buffered(epr))
+	{
+		bool dtog = epr & USB_EP_TX_DTOG, sw_buf = epr & USB_EP_RX_DTOG;
+		/* an isochronous endpoint has no handshake; it sends whatever
+		 * the buffer selected by DTOG_TX holds */
+		if ((epr & USB_EP_TYPE) != USB_EP_TYPE_ISO && dtog == sw_buf)
+		{
+			usbsim_stats.in_nak ++;
+			return USBSIM_NAK;
+		}
+		count_field = dtog ? BT_COUNT_RX : BT_COUNT_TX;
+		buffer_field = dtog ? BT_ADDR_RX : BT_ADDR_TX;
+	}
+	len = btable_read(i, count_field) & 0x3ff;
+	/* the host would flag a packet longer than it asked for as babble;
+	 * the scripted host always asks for the endpoint maximum packet size */
+	assert(len <= maxlen);
+	pma_read(btable_read(i, buffer_field), buf, len);
+	pending_endpoint = i;
+	pending_ctr = USB_EP_TX_CTR;
+	usbsim_stats.in_ack ++;
+	usbsim_stats.bytes_in += len;
+	return len;
+}
+
+void usbsim_st_usbfs_handshake(void)
+{
+	int i = pending_endpoint;
+	uint16_t epr;
+
+	assert(i != -1);
+	pending_endpoint = -1;
+	epr = usbsim_st_usbfs_regs.epr[i];
+	if (pending_ctr == USB_EP_RX_CTR)
+	{
+		if (is_double_buffered(epr))
+			epr ^= USB_EP_RX_DTOG;
+		else
+			epr = (epr & ~ USB_EP_RX_STAT) | USB_EP_RX_STAT_NAK;
+		epr &= ~ USB_EP_SETUP;
+	}
+	else
+	{
+		if (is_double_buffered(epr))
+			epr ^= USB_EP_TX_DTOG;
+		else
+			epr = (epr & ~ USB_EP_TX_STAT) | USB_EP_TX_STAT_NAK;
+	}
+	usbsim_st_usbfs_regs.epr[i] = epr;
+	transfer_complete(i, pending_ctr);
+}
@@ -0,0 +1,1057 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* model of the libopencm3 usb device core (usb.c, usb_control.c,
+ * usb_standard.c) and of the 'st_usbfs_v1_usb_driver' that the firmware
+ * is built against
+ *
+ * the logic follows the libopencm3 sources closely - including the control
+ * transfer state machine, the runtime serialization of the configuration
+ * descriptor, and the linear packet memory allocation of usbd_ep_setup() -
+ * so that the firmware sees the same behavior as on the target; the driver
+ * accesses the peripheral only through the st_usbfs register model */
+
+#include <assert.h>
+#include <string.h>
+
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/st_usbfs.h>
+#include <libopencm3/usb/usbd.h>
+#include "usbsim.h"
+
+enum
+{
+	MAX_USER_CONTROL_CALLBACK	= 4,
+	MAX_USER_SET_CONFIG_CALLBACK	= 4,
+	/* the buffer descriptor table occupies the first 64 bytes of the pma */
+	USBD_PM_TOP			= 0x40,
+};
+
+enum usb_transaction
+{
+	USB_TRANSACTION_IN,
+	USB_TRANSACTION_OUT,
+	USB_TRANSACTION_SETUP,
+};
+
+enum usb_control_state
+{
+	IDLE, STALLED,
+	DATA_IN, LAST_DATA_IN, DATA_OUT, LAST_DATA_OUT,
+	STATUS_IN, STATUS_OUT,
+};
+
+struct _usbd_driver
+{
+	usbd_device * (* init)(void);
+};
+
+struct user_control_callback
+{
+	usbd_control_callback	cb;
+	uint8_t			type;
+	uint8_t			type_mask;
+};
+
+struct _usbd_device
+{
+	const struct usb_device_descriptor	* desc;
+	const struct usb_config_descriptor	* config;
+	const char * const			* strings;
+	int					num_strings;
+
+	uint8_t					* ctrl_buf;
+	uint16_t				ctrl_buf_len;
+
+	uint8_t					current_address;
+	uint8_t					current_config;
+
+	uint16_t				pm_top;
+
+	void	(* user_callback_reset)(void);
+	void	(* user_callback_suspend)(void);
+	void	(* user_callback_resume)(void);
+	void	(* user_callback_sof)(void);
+
+	struct
+	{
+		enum usb_control_state		state;
+		struct usb_setup_data		req __attribute__((aligned(4)));
+		uint8_t				* ctrl_buf;
+		uint16_t			ctrl_len;
+		usbd_control_complete_callback	complete;
+		bool				needs_zlp;
+	}
+	control_state;
+
+	struct user_control_callback		user_control_callback[MAX_USER_CONTROL_CALLBACK];
+	usbd_endpoint_callback			user_callback_ctr[USBSIM_MAX_ENDPOINTS][3];
+	usbd_set_config_callback		user_callback_set_config[MAX_USER_SET_CONFIG_CALLBACK];
+	usbd_set_altsetting_callback		user_callback_set_altsetting;
+};
+
+static usbd_device st_usbfs_dev;
+static bool st_usbfs_force_nak[USBSIM_MAX_ENDPOINTS];
+
+static usbd_device * st_usbfs_v1_usbd_init(void)
+{
+	rcc_periph_clock_enable(RCC_USB);
+	SET_REG(USB_CNTR_REG, 0);
+	SET_REG(USB_BTABLE_REG, 0);
+	SET_REG(USB_ISTR_REG, 0);
+	/* enable RESET, SUSPEND, RESUME and CTR interrupts */
+	SET_REG(USB_CNTR_REG, USB_CNTR_RESETM | USB_CNTR_CTRM | USB_CNTR_SUSPM | USB_CNTR_WKUPM);
+	usbsim_device_connect();
+	return & st_usbfs_dev;
+}
+
+const usbd_driver st_usbfs_v1_usb_driver =
+{
+	.init	= st_usbfs_v1_usbd_init,
+};
+
+
+/*
+ * st_usbfs driver
+ */
+static void st_usbfs_set_address(uint8_t addr)
+{
+	SET_REG(USB_DADDR_REG, (addr & USB_DADDR_ADDR) | USB_DADDR_EF);
+}
+
+static uint16_t st_usbfs_set_ep_rx_bufsize(uint8_t ep, uint32_t size)
+{
+	uint16_t realsize;
+	/* writes USB_EP_RX_COUNT_BL_SIZE and NUM_BLOCKS; see rm0008 for the
+	 * encoding - two byte blocks up to 62 bytes, 32 byte blocks above */
+	if (size > 62)
+	{
+		if (size & 0x1f)
+			size += 32;
+		size >>= 5;
+		USB_SET_EP_RX_COUNT(ep, (1 << 15) | ((size - 1) << 10));
+		realsize = size << 5;
+	}
+	else
+	{
+		if (size & 1)
+			size ++;
+		USB_SET_EP_RX_COUNT(ep, size << (10 - 1));
+		realsize = size;
+	}
+	return realsize;
+}
+
+static void st_usbfs_copy_to_pm(volatile void * vPM, const void * buf, uint16_t len)
+{
+	const uint8_t * lbuf = buf;
+	volatile uint32_t * PM = vPM;
+	uint32_t i;
+
+	for (i = 0; i < len; i += 2)
+		* PM ++ = lbuf[i] | ((i + 1 < len ? lbuf[i + 1] : 0) << 8);
+	usbsim_charge(usbsim_cost.pma_copy_generic * ((len + 1) / 2));
+}
+
+static void st_usbfs_copy_from_pm(void * buf, const volatile void * vPM, uint16_t len)
+{
+	uint8_t * lbuf = buf;
+	const volatile uint32_t * PM = vPM;
+	uint32_t i;
+
+	for (i = 0; i < len; i ++)
+		lbuf[i] = PM[i / 2] >> ((i & 1) ? 8 : 0);
+	usbsim_charge(usbsim_cost.pma_copy_generic * ((len + 1) / 2));
+}
+
+static void st_usbfs_endpoints_reset(usbd_device * dev)
+{
+	int i;
+	/* reset all endpoints */
+	for (i = 1; i < USBSIM_MAX_ENDPOINTS; i ++)
+	{
+		USB_SET_EP_TX_STAT(i, USB_EP_TX_STAT_DISABLED);
+		USB_SET_EP_RX_STAT(i, USB_EP_RX_STAT_DISABLED);
+	}
+	dev->pm_top = USBD_PM_TOP + (2 * dev->desc->bMaxPacketSize0);
+}
+
+static void _usbd_reset(usbd_device * usbd_dev);
+static void _usbd_control_setup(usbd_device * usbd_dev, uint8_t ea);
+static void _usbd_control_out(usbd_device * usbd_dev, uint8_t ea);
+static void _usbd_control_in(usbd_device * usbd_dev, uint8_t ea);
+
+
+/*
+ * usbd api
+ */
+usbd_device * usbd_init(const usbd_driver * driver,
+		const struct usb_device_descriptor * dev,
+		const struct usb_config_descriptor * conf,
+		const char * const * strings, int num_strings,
+		uint8_t * control_buffer, uint16_t control_buffer_size)
+{
+	usbd_device * usbd_dev;
+
+	usbd_dev = driver->init();
+
+	usbd_dev->desc = dev;
+	usbd_dev->config = conf;
+	usbd_dev->strings = strings;
+	usbd_dev->num_strings = num_strings;
+	usbd_dev->ctrl_buf = control_buffer;
+	usbd_dev->ctrl_buf_len = control_buffer_size;
+
+	usbd_dev->user_callback_ctr[0][USB_TRANSACTION_SETUP] = _usbd_control_setup;
+	usbd_dev->user_callback_ctr[0][USB_TRANSACTION_OUT] = _usbd_control_out;
+	usbd_dev->user_callback_ctr[0][USB_TRANSACTION_IN] = _usbd_control_in;
+
+	return usbd_dev;
+}
+
+void usbd_register_reset_callback(usbd_device * usbd_dev, void (* callback)(void))
+{
+	usbd_dev->user_callback_reset = callback;
+}
+
+void usbd_register_suspend_callback(usbd_device * usbd_dev, void (* callback)(void))
+{
+	usbd_dev->user_callback_suspend = callback;
+}
+
+void usbd_register_resume_callback(usbd_device * usbd_dev, void (* callback)(void))
+{
+	usbd_dev->user_callback_resume = callback;
+}
+
+void usbd_register_sof_callback(usbd_device * usbd_dev, void (* callback)(void))
+{
+	usbd_dev->user_callback_sof = callback;
+}
+
+int usbd_register_control_callback(usbd_device * usbd_dev, uint8_t type,
+		uint8_t type_mask, usbd_control_callback callback)
+{
+	int i;
+
+	for (i = 0; i < MAX_USER_CONTROL_CALLBACK; i ++)
+	{
+		if (usbd_dev->user_control_callback[i].cb)
+			continue;
+		usbd_dev->user_control_callback[i].type = type;
+		usbd_dev->user_control_callback[i].type_mask = type_mask;
+		usbd_dev->user_control_callback[i].cb = callback;
+		return 0;
+	}
+	return -1;
+}
+
+int usbd_register_set_config_callback(usbd_device * usbd_dev, usbd_set_config_callback callback)
+{
+	int i;
+
+	for (i = 0; i < MAX_USER_SET_CONFIG_CALLBACK; i ++)
+	{
+		if (usbd_dev->user_callback_set_config[i])
+		{
+			if (usbd_dev->user_callback_set_config[i] == callback)
+				return 0;
+			continue;
+		}
+		usbd_dev->user_callback_set_config[i] = callback;
+		return 0;
+	}
+	return -1;
+}
+
+void usbd_register_set_altsetting_callback(usbd_device * usbd_dev, usbd_set_altsetting_callback callback)
+{
+	usbd_dev->user_callback_set_altsetting = callback;
+}
+
+void usbd_disconnect(usbd_device * usbd_dev, bool disconnected)
+{
+	(void) usbd_dev, (void) disconnected;
+}
+
+void usbd_ep_setup(usbd_device * dev, uint8_t addr, uint8_t type,
+		uint16_t max_size, usbd_endpoint_callback callback)
+{
+	/* translate usb standard type codes to stm32 */
+	static const uint16_t typelookup[] =
+	{
+		[USB_ENDPOINT_ATTR_CONTROL]	= USB_EP_TYPE_CONTROL,
+		[USB_ENDPOINT_ATTR_ISOCHRONOUS]	= USB_EP_TYPE_ISO,
+		[USB_ENDPOINT_ATTR_BULK]	= USB_EP_TYPE_BULK,
+		[USB_ENDPOINT_ATTR_INTERRUPT]	= USB_EP_TYPE_INTERRUPT,
+	};
+	uint8_t dir = addr & 0x80;
+	addr &= 0x7f;
+
+	/* assign address */
+	USB_SET_EP_ADDR(addr, addr);
+	USB_SET_EP_TYPE(addr, typelookup[type & USB_ENDPOINT_ATTR_TYPE]);
+
+	if (dir || (addr == 0))
+	{
+		USB_SET_EP_TX_ADDR(addr, dev->pm_top);
+		if (callback)
+			dev->user_callback_ctr[addr][USB_TRANSACTION_IN] = callback;
+		USB_CLR_EP_TX_DTOG(addr);
+		USB_SET_EP_TX_STAT(addr, USB_EP_TX_STAT_NAK);
+		dev->pm_top += max_size;
+	}
+
+	if (!dir)
+	{
+		uint16_t realsize;
+		USB_SET_EP_RX_ADDR(addr, dev->pm_top);
+		realsize = st_usbfs_set_ep_rx_bufsize(addr, max_size);
+		if (callback)
+			dev->user_callback_ctr[addr][USB_TRANSACTION_OUT] = callback;
+		USB_CLR_EP_RX_DTOG(addr);
+		USB_SET_EP_RX_STAT(addr, USB_EP_RX_STAT_VALID);
+		dev->pm_top += realsize;
+	}
+	/* the model keeps the libopencm3 behavior of not checking for pma
+	 * exhaustion, but there is no excuse for a firmware doing this */
+	if (dev->pm_top > USBSIM_PMA_SIZE)
+		__builtin_trap();
+}
+
+void usbd_ep_stall_set(usbd_device * dev, uint8_t addr, uint8_t stall)
+{
+	(void) dev;
+	if (addr == 0)
+		USB_SET_EP_TX_STAT(addr, stall ? USB_EP_TX_STAT_STALL : USB_EP_TX_STAT_NAK);
+
+	if (addr & 0x80)
+	{
+		addr &= 0x7f;
+		USB_SET_EP_TX_STAT(addr, stall ? USB_EP_TX_STAT_STALL : USB_EP_TX_STAT_NAK);
+		/* reset to DATA0 if clearing stall condition */
+		if (!stall)
+			USB_CLR_EP_TX_DTOG(addr);
+	}
+	else
+	{
+		/* reset to DATA0 if clearing stall condition */
+		if (!stall)
+			USB_CLR_EP_RX_DTOG(addr);
+		USB_SET_EP_RX_STAT(addr, stall ? USB_EP_RX_STAT_STALL : USB_EP_RX_STAT_VALID);
+	}
+}
+
+uint8_t usbd_ep_stall_get(usbd_device * dev, uint8_t addr)
+{
+	(void) dev;
+	if (addr & 0x80)
+		return (* USB_EP_REG(addr & 0x7f) & USB_EP_TX_STAT) == USB_EP_TX_STAT_STALL;
+	return (* USB_EP_REG(addr) & USB_EP_RX_STAT) == USB_EP_RX_STAT_STALL;
+}
+
+void usbd_ep_nak_set(usbd_device * dev, uint8_t addr, uint8_t nak)
+{
+	(void) dev;
+	/* it does not make sense to force nak on IN endpoints */
+	if (addr & 0x80)
+		return;
+
+	st_usbfs_force_nak[addr] = nak;
+
+	if (nak)
+		USB_SET_EP_RX_STAT(addr, USB_EP_RX_STAT_NAK);
+	else
+		USB_SET_EP_RX_STAT(addr, USB_EP_RX_STAT_VALID);
+}
+
+uint16_t usbd_ep_write_packet(usbd_device * dev, uint8_t addr, const void * buf, uint16_t len)
+{
+	(void) dev;
+	addr &= 0x7f;
+
+	usbsim_charge(usbsim_cost.packet_overhead);
+	if ((* USB_EP_REG(addr) & USB_EP_TX_STAT) == USB_EP_TX_STAT_VALID)
+		return 0;
+
+	st_usbfs_copy_to_pm(USB_GET_EP_TX_BUFF(addr), buf, len);
+	USB_SET_EP_TX_COUNT(addr, len);
+	USB_SET_EP_TX_STAT(addr, USB_EP_TX_STAT_VALID);
+
+	return len;
+}
+
+uint16_t usbd_ep_read_packet(usbd_device * dev, uint8_t addr, void * buf, uint16_t len)
+{
+	(void) dev;
+
+	usbsim_charge(usbsim_cost.packet_overhead);
+	if ((* USB_EP_REG(addr) & USB_EP_RX_STAT) == USB_EP_RX_STAT_VALID)
+		return 0;
+
+	len = MIN(USB_GET_EP_RX_COUNT(addr) & 0x3ff, len);
+	st_usbfs_copy_from_pm(buf, USB_GET_EP_RX_BUFF(addr), len);
+	USB_CLR_EP_RX_CTR(addr);
+
+	if (!st_usbfs_force_nak[addr])
+		USB_SET_EP_RX_STAT(addr, USB_EP_RX_STAT_VALID);
+
+	return len;
+}
+
+static void st_usbfs_poll(usbd_device * dev)
+{
+	uint16_t istr;
+
+	usbsim_charge(usbsim_cost.poll);
+	usbsim_stats.polls ++;
+
+	istr = * USB_ISTR_REG;
+
+	if (istr & USB_ISTR_RESET)
+	{
+		USB_CLR_ISTR_RESET();
+		dev->pm_top = USBD_PM_TOP;
+		_usbd_reset(dev);
+		return;
+	}
+
+	if (istr & USB_ISTR_CTR)
+	{
+		uint8_t ep = istr & USB_ISTR_EP_ID;
+		uint8_t type;
+
+		if (istr & USB_ISTR_DIR)
+		{
+			/* OUT or SETUP? */
+			if (* USB_EP_REG(ep) & USB_EP_SETUP)
+				type = USB_TRANSACTION_SETUP;
+			else
+				type = USB_TRANSACTION_OUT;
+		}
+		else
+		{
+			type = USB_TRANSACTION_IN;
+			USB_CLR_EP_TX_CTR(ep);
+		}
+
+		if (dev->user_callback_ctr[ep][type])
+			dev->user_callback_ctr[ep][type](dev, ep);
+		else
+			USB_CLR_EP_RX_CTR(ep);
+	}
+
+	if (istr & USB_ISTR_SUSP)
+	{
+		USB_CLR_ISTR_SUSP();
+		if (dev->user_callback_suspend)
+			dev->user_callback_suspend();
+	}
+
+	if (istr & USB_ISTR_WKUP)
+	{
+		USB_CLR_ISTR_WKUP();
+		if (dev->user_callback_resume)
+			dev->user_callback_resume();
+	}
+
+	if (istr & USB_ISTR_SOF)
+	{
+		USB_CLR_ISTR_SOF();
+		if (dev->user_callback_sof)
+			dev->user_callback_sof();
+	}
+
+	if (dev->user_callback_sof)
+		SET_REG(USB_CNTR_REG, GET_REG(USB_CNTR_REG) | USB_CNTR_SOFM);
+	else
+		SET_REG(USB_CNTR_REG, GET_REG(USB_CNTR_REG) & ~ USB_CNTR_SOFM);
+}
+
+/* the cycles of a poll are those of the driver, and of the firmware
+ * callbacks it makes, and of the interrupts taken meanwhile */
+void usbd_poll(usbd_device * dev)
+{
+	uint64_t start = usbsim_cpu_cycles(), cycles;
+
+	st_usbfs_poll(dev);
+	cycles = usbsim_cpu_cycles() - start;
+	usbsim_stats.poll_cycles += cycles;
+	if (cycles > usbsim_stats.max_poll_cycles)
+		usbsim_stats.max_poll_cycles = cycles;
+}
+
+
+/*
+ * standard requests
+ */
+static uint16_t build_config_descriptor(usbd_device * usbd_dev, uint8_t * buf, uint16_t len)
+{
+	uint8_t * tmpbuf = buf;
+	const struct usb_config_descriptor * cfg = usbd_dev->config;
+	uint16_t count, total = 0, totallen = 0;
+	uint16_t i, j, k;
+
+	memcpy(buf, cfg, count = MIN(len, cfg->bLength));
+	buf += count;
+	len -= count;
+	total += count;
+	totallen += cfg->bLength;
+
+	/* for each interface... */
+	for (i = 0; i < cfg->bNumInterfaces; i ++)
+	{
+		/* interface association descriptor, if any */
+		if (cfg->interface[i].iface_assoc)
+		{
+			const struct usb_iface_assoc_descriptor * assoc = cfg->interface[i].iface_assoc;
+			memcpy(buf, assoc, count = MIN(len, assoc->bLength));
+			buf += count;
+			len -= count;
+			total += count;
+			totallen += assoc->bLength;
+		}
+		/* for each alternate setting... */
+		for (j = 0; j < cfg->interface[i].num_altsetting; j ++)
+		{
+			const struct usb_interface_descriptor * iface = & cfg->interface[i].altsetting[j];
+			/* copy interface descriptor */
+			memcpy(buf, iface, count = MIN(len, iface->bLength));
+			buf += count;
+			len -= count;
+			total += count;
+			totallen += iface->bLength;
+			/* copy extra bytes (function descriptors) */
+			if (iface->extra)
+			{
+				memcpy(buf, iface->extra, count = MIN(len, iface->extralen));
+				buf += count;
+				len -= count;
+				total += count;
+				totallen += iface->extralen;
+			}
+			/* for each endpoint... */
+			for (k = 0; k < iface->bNumEndpoints; k ++)
+			{
+				const struct usb_endpoint_descriptor * ep = & iface->endpoint[k];
+				memcpy(buf, ep, count = MIN(len, ep->bLength));
+				buf += count;
+				len -= count;
+				total += count;
+				totallen += ep->bLength;
+				if (ep->extra)
+				{
+					memcpy(buf, ep->extra, count = MIN(len, ep->extralen));
+					buf += count;
+					len -= count;
+					total += count;
+					totallen += ep->extralen;
+				}
+			}
+		}
+	}
+
+	/* fill in wTotalLength */
+	if (total > 2)
+		tmpbuf[2] = totallen & 0xff;
+	if (total > 3)
+		tmpbuf[3] = totallen >> 8;
+
+	return total;
+}
+
+static int usb_descriptor_type(uint16_t wValue)
+{
+	return wValue >> 8;
+}
+
+static int usb_descriptor_index(uint16_t wValue)
+{
+	return wValue & 0xff;
+}
+
+static enum usbd_request_return_codes usb_standard_get_descriptor(usbd_device * usbd_dev,
+		struct usb_setup_data * req, uint8_t ** buf, uint16_t * len)
+{
+	int i, array_idx, descr_idx;
+	struct usb_string_descriptor * sd;
+
+	descr_idx = usb_descriptor_index(req->wValue);
+
+	switch (usb_descriptor_type(req->wValue))
+	{
+		case USB_DT_DEVICE:
+			* buf = (uint8_t *) usbd_dev->desc;
+			* len = MIN(* len, usbd_dev->desc->bLength);
+			return USBD_REQ_HANDLED;
+		case USB_DT_CONFIGURATION:
+			* buf = usbd_dev->ctrl_buf;
+			* len = build_config_descriptor(usbd_dev, * buf, MIN(* len, usbd_dev->ctrl_buf_len));
+			usbsim_charge(4 * * len);
+			return USBD_REQ_HANDLED;
+		case USB_DT_STRING:
+			sd = (struct usb_string_descriptor *) usbd_dev->ctrl_buf;
+
+			if (descr_idx == 0)
+			{
+				/* send sane language id descriptor... */
+				sd->wData[0] = USB_LANGID_ENGLISH_US;
+				sd->bLength = sizeof sd->bLength + sizeof sd->bDescriptorType + sizeof sd->wData[0];
+				* len = MIN(* len, sd->bLength);
+			}
+			else
+			{
+				array_idx = descr_idx - 1;
+
+				if (!usbd_dev->strings)
+					/* device doesn't support strings */
+					return USBD_REQ_NOTSUPP;
+				/* check that string index is in range */
+				if (array_idx >= usbd_dev->num_strings)
+					return USBD_REQ_NOTSUPP;
+				/* strings with language ids differing from
+				 * USB_LANGID_ENGLISH_US are not supported */
+				if (req->wIndex != USB_LANGID_ENGLISH_US)
+					return USBD_REQ_NOTSUPP;
+
+				/* this string is returned as utf16, hence the
+				 * multiplication */
+				sd->bLength = strlen(usbd_dev->strings[array_idx]) * 2
+					+ sizeof sd->bLength + sizeof sd->bDescriptorType;
+				* len = MIN(* len, sd->bLength);
+
+				for (i = 0; i < (* len / 2) - 1; i ++)
+					sd->wData[i] = usbd_dev->strings[array_idx][i];
+			}
+
+			sd->bDescriptorType = USB_DT_STRING;
+			* buf = (uint8_t *) sd;
+
+			return USBD_REQ_HANDLED;
+	}
+	return USBD_REQ_NOTSUPP;
+}
+
+static enum usbd_request_return_codes usb_standard_set_configuration(usbd_device * usbd_dev,
+		struct usb_setup_data * req, uint8_t ** buf, uint16_t * len)
+{
+	int i;
+	(void) buf, (void) len;
+
+	if (req->wValue > 0)
+	{
+		/* the model supports a single configuration, as does the
+		 * firmware */
+		if (req->wValue != usbd_dev->config->bConfigurationValue)
+			return USBD_REQ_NOTSUPP;
+	}
+
+	/* reset all alternate settings configuration */
+	for (i = 0; i < usbd_dev->config->bNumInterfaces; i ++)
+		if (usbd_dev->config->interface[i].cur_altsetting)
+			* usbd_dev->config->interface[i].cur_altsetting = 0;
+
+	usbd_dev->current_config = req->wValue;
+
+	/* reset all endpoints */
+	st_usbfs_endpoints_reset(usbd_dev);
+
+	if (usbd_dev->user_callback_set_config[0])
+	{
+		/* flush control callbacks; these will be reregistered
+		 * by the user handler */
+		for (i = 0; i < MAX_USER_CONTROL_CALLBACK; i ++)
+			usbd_dev->user_control_callback[i].cb = NULL;
+
+		for (i = 0; i < MAX_USER_SET_CONFIG_CALLBACK; i ++)
+			if (usbd_dev->user_callback_set_config[i])
+				usbd_dev->user_callback_set_config[i](usbd_dev, req->wValue);
+	}
+
+	return USBD_REQ_HANDLED;
+}
+
+static enum usbd_request_return_codes usb_standard_request_device(usbd_device * usbd_dev,
+		struct usb_setup_data * req, uint8_t ** buf, uint16_t * len)
+{
+	switch (req->bRequest)
+	{
+		case USB_REQ_GET_STATUS:
+			if (* len > 2)
+				* len = 2;
+			(* buf)[0] = 0;
+			(* buf)[1] = 0;
+			return USBD_REQ_HANDLED;
+		case USB_REQ_SET_ADDRESS:
+			/* the address is only set after the status stage of the
+			 * SET_ADDRESS request completes, see _usbd_control_in() */
+			if (req->bmRequestType != 0 || req->wValue >= 128)
+				return USBD_REQ_NOTSUPP;
+			usbd_dev->current_address = req->wValue;
+			return USBD_REQ_HANDLED;
+		case USB_REQ_SET_CONFIGURATION:
+			return usb_standard_set_configuration(usbd_dev, req, buf, len);
+		case USB_REQ_GET_CONFIGURATION:
+			if (* len > 1)
+				* len = 1;
+			(* buf)[0] = usbd_dev->current_config;
+			return USBD_REQ_HANDLED;
+		case USB_REQ_GET_DESCRIPTOR:
+			return usb_standard_get_descriptor(usbd_dev, req, buf, len);
+	}
+	return USBD_REQ_NOTSUPP;
+}
+
+static enum usbd_request_return_codes usb_standard_request_interface(usbd_device * usbd_dev,
+		struct usb_setup_data * req, uint8_t ** buf, uint16_t * len)
+{
+	const struct usb_interface * iface;
+
+	if (req->wIndex >= usbd_dev->config->bNumInterfaces)
+		return USBD_REQ_NOTSUPP;
+	iface = & usbd_dev->config->interface[req->wIndex];
+
+	switch (req->bRequest)
+	{
+		case USB_REQ_GET_STATUS:
+			if (* len > 2)
+				* len = 2;
+			(* buf)[0] = 0;
+			(* buf)[1] = 0;
+			return USBD_REQ_HANDLED;
+		case USB_REQ_GET_INTERFACE:
+			* len = 1;
+			(* buf)[0] = iface->cur_altsetting ? * iface->cur_altsetting : 0;
+			return USBD_REQ_HANDLED;
+		case USB_REQ_SET_INTERFACE:
+			if (req->wValue >= iface->num_altsetting)
+				return USBD_REQ_NOTSUPP;
+			if (iface->cur_altsetting)
+				* iface->cur_altsetting = req->wValue;
+			else if (req->wValue > 0)
+				return USBD_REQ_NOTSUPP;
+			if (usbd_dev->user_callback_set_altsetting)
+				usbd_dev->user_callback_set_altsetting(usbd_dev, req->wIndex, req->wValue);
+			* len = 0;
+			return USBD_REQ_HANDLED;
+	}
+	return USBD_REQ_NOTSUPP;
+}
+
+static enum usbd_request_return_codes usb_standard_request_endpoint(usbd_device * usbd_dev,
+		struct usb_setup_data * req, uint8_t ** buf, uint16_t * len)
+{
+	switch (req->bRequest)
+	{
+		case USB_REQ_CLEAR_FEATURE:
+			if (req->wValue != USB_FEAT_ENDPOINT_HALT)
+				return USBD_REQ_NOTSUPP;
+			usbd_ep_stall_set(usbd_dev, req->wIndex, 0);
+			return USBD_REQ_HANDLED;
+		case USB_REQ_SET_FEATURE:
+			if (req->wValue != USB_FEAT_ENDPOINT_HALT)
+				return USBD_REQ_NOTSUPP;
+			usbd_ep_stall_set(usbd_dev, req->wIndex, 1);
+			return USBD_REQ_HANDLED;
+		case USB_REQ_GET_STATUS:
+			(* buf)[0] = usbd_ep_stall_get(usbd_dev, req->wIndex) ? 1 : 0;
+			(* buf)[1] = 0;
+			* len = 2;
+			return USBD_REQ_HANDLED;
+	}
+	return USBD_REQ_NOTSUPP;
+}
+
+static enum usbd_request_return_codes _usbd_standard_request(usbd_device * usbd_dev,
+		struct usb_setup_data * req, uint8_t ** buf, uint16_t * len)
+{
+	/* FIXME: have class/vendor requests as well */
+	if ((req->bmRequestType & USB_REQ_TYPE_TYPE) != USB_REQ_TYPE_STANDARD)
+		return USBD_REQ_NOTSUPP;
+
+	switch (req->bmRequestType & USB_REQ_TYPE_RECIPIENT)
+	{
+		case USB_REQ_TYPE_DEVICE:
+			return usb_standard_request_device(usbd_dev, req, buf, len);
+		case USB_REQ_TYPE_INTERFACE:
+			return usb_standard_request_interface(usbd_dev, req, buf, len);
+		case USB_REQ_TYPE_ENDPOINT:
+			return usb_standard_request_endpoint(usbd_dev, req, buf, len);
+	}
+	return USBD_REQ_NOTSUPP;
+}
+
+
+/*
+ * control transfers
+ */
+static void stall_transaction(usbd_device * usbd_dev)
+{
+	usbd_ep_stall_set(usbd_dev, 0, 1);
+	usbd_dev->control_state.state = IDLE;
+}
+
+/* a zero length packet terminates a data stage which is shorter than
+ * requested by the host, and ends on a packet boundary */
+static bool needs_zlp(uint16_t len, uint16_t wLength, uint8_t ep_size)
+{
+	if (len < wLength)
+		if (len && (len % ep_size == 0))
+			return true;
+	return false;
+}
+
+static void usb_control_send_chunk(usbd_device * usbd_dev)
+{
+	if (usbd_dev->desc->bMaxPacketSize0 < usbd_dev->control_state.ctrl_len)
+	{
+		/* data stage, normal transmission */
+		usbd_ep_write_packet(usbd_dev, 0, usbd_dev->control_state.ctrl_buf, usbd_dev->desc->bMaxPacketSize0);
+		usbd_dev->control_state.state = DATA_IN;
+		usbd_dev->control_state.ctrl_buf += usbd_dev->desc->bMaxPacketSize0;
+		usbd_dev->control_state.ctrl_len -= usbd_dev->desc->bMaxPacketSize0;
+	}
+	else
+	{
+		/* data stage, end of transmission */
+		usbd_ep_write_packet(usbd_dev, 0, usbd_dev->control_state.ctrl_buf, usbd_dev->control_state.ctrl_len);
+		usbd_dev->control_state.state = usbd_dev->control_state.needs_zlp ? DATA_IN : LAST_DATA_IN;
+		usbd_dev->control_state.needs_zlp = false;
+		usbd_dev->control_state.ctrl_len = 0;
+		usbd_dev->control_state.ctrl_buf = NULL;
+	}
+}
+
+static int usb_control_recv_chunk(usbd_device * usbd_dev)
+{
+	uint16_t packetsize = MIN(usbd_dev->desc->bMaxPacketSize0,
+			usbd_dev->control_state.req.wLength - usbd_dev->control_state.ctrl_len);
+	uint16_t size = usbd_ep_read_packet(usbd_dev, 0,
+			usbd_dev->control_state.ctrl_buf + usbd_dev->control_state.ctrl_len, packetsize);
+
+	if (size != packetsize)
+	{
+		stall_transaction(usbd_dev);
+		return -1;
+	}
+
+	usbd_dev->control_state.ctrl_len += size;
+
+	return packetsize;
+}
+
+/* not in libopencm3; a configuration descriptor the firmware sends itself,
+ * instead of having it assembled by the core, must be the one the core
+ * would assemble from the descriptor structures the firmware passed to
+ * usbd_init() - and that the core uses for the interface requests */
+static void check_config_descriptor(usbd_device * usbd_dev, struct usb_setup_data * req)
+{
+	uint8_t config[1024];
+	uint16_t len;
+
+	if ((req->bmRequestType & (USB_REQ_TYPE_DIRECTION | USB_REQ_TYPE_TYPE | USB_REQ_TYPE_RECIPIENT))
+			!= (USB_REQ_TYPE_IN | USB_REQ_TYPE_STANDARD | USB_REQ_TYPE_DEVICE)
+			|| req->bRequest != USB_REQ_GET_DESCRIPTOR
+			|| usb_descriptor_type(req->wValue) != USB_DT_CONFIGURATION)
+		return;
+	len = build_config_descriptor(usbd_dev, config, MIN(req->wLength, sizeof config));
+	assert(usbd_dev->control_state.ctrl_len == len);
+	assert(!memcmp(usbd_dev->control_state.ctrl_buf, config, len));
+}
+
+static enum usbd_request_return_codes usb_control_request_dispatch(usbd_device * usbd_dev,
+		struct usb_setup_data * req)
+{
+	int i, result = 0;
+	struct user_control_callback * cb = usbd_dev->user_control_callback;
+
+	usbsim_charge(usbsim_cost.control_request);
+	/* call user command hook function */
+	for (i = 0; i < MAX_USER_CONTROL_CALLBACK; i ++)
+	{
+		if (cb[i].cb == NULL)
+			break;
+
+		if ((req->bmRequestType & cb[i].type_mask) == cb[i].type)
+		{
+			result = cb[i].cb(usbd_dev, req, & usbd_dev->control_state.ctrl_buf,
+					& usbd_dev->control_state.ctrl_len,
+					& usbd_dev->control_state.complete);
+			if (result == USBD_REQ_HANDLED)
+				check_config_descriptor(usbd_dev, req);
+			if (result == USBD_REQ_HANDLED || result == USBD_REQ_NOTSUPP)
+				return result;
+		}
+	}
+
+	/* try standard request if not already handled */
+	return _usbd_standard_request(usbd_dev, req, & usbd_dev->control_state.ctrl_buf,
+			& usbd_dev->control_state.ctrl_len);
+}
+
+/* handle commands and read requests */
+static void usb_control_setup_read(usbd_device * usbd_dev, struct usb_setup_data * req)
+{
+	usbd_dev->control_state.ctrl_buf = usbd_dev->ctrl_buf;
+	usbd_dev->control_state.ctrl_len = req->wLength;
+
+	if (usb_control_request_dispatch(usbd_dev, req))
+	{
+		if (req->wLength)
+		{
+			usbd_dev->control_state.needs_zlp = needs_zlp(usbd_dev->control_state.ctrl_len,
+					req->wLength, usbd_dev->desc->bMaxPacketSize0);
+			/* go to data out stage if handled */
+			usb_control_send_chunk(usbd_dev);
+		}
+		else
+		{
+			/* go to status stage if handled */
+			usbd_ep_write_packet(usbd_dev, 0, NULL, 0);
+			usbd_dev->control_state.state = STATUS_IN;
+		}
+	}
+	else
+		/* stall endpoint on failure */
+		stall_transaction(usbd_dev);
+}
+
+static void usb_control_setup_write(usbd_device * usbd_dev, struct usb_setup_data * req)
+{
+	if (req->wLength > usbd_dev->ctrl_buf_len)
+	{
+		stall_transaction(usbd_dev);
+		return;
+	}
+
+	/* buffer into which to write received data */
+	usbd_dev->control_state.ctrl_buf = usbd_dev->ctrl_buf;
+	usbd_dev->control_state.ctrl_len = 0;
+	/* wait for DATA OUT stage */
+	if (req->wLength > usbd_dev->desc->bMaxPacketSize0)
+		usbd_dev->control_state.state = DATA_OUT;
+	else
+		usbd_dev->control_state.state = LAST_DATA_OUT;
+
+	usbd_ep_nak_set(usbd_dev, 0, 0);
+}
+
+static void _usbd_control_setup(usbd_device * usbd_dev, uint8_t ea)
+{
+	struct usb_setup_data * req = & usbd_dev->control_state.req;
+	(void) ea;
+
+	usbd_dev->control_state.complete = NULL;
+
+	usbd_ep_nak_set(usbd_dev, 0, 1);
+
+	if (usbd_ep_read_packet(usbd_dev, 0, req, 8) != 8)
+	{
+		stall_transaction(usbd_dev);
+		return;
+	}
+
+	if (req->wLength == 0)
+		usb_control_setup_read(usbd_dev, req);
+	else if (req->bmRequestType & 0x80)
+		usb_control_setup_read(usbd_dev, req);
+	else
+		usb_control_setup_write(usbd_dev, req);
+}
+
+static void _usbd_control_out(usbd_device * usbd_dev, uint8_t ea)
+{
+	(void) ea;
+
+	switch (usbd_dev->control_state.state)
+	{
+		case DATA_OUT:
+			if (usb_control_recv_chunk(usbd_dev) < 0)
+				break;
+			if ((usbd_dev->control_state.req.wLength - usbd_dev->control_state.ctrl_len)
+					<= usbd_dev->desc->bMaxPacketSize0)
+				usbd_dev->control_state.state = LAST_DATA_OUT;
+			break;
+		case LAST_DATA_OUT:
+			if (usb_control_recv_chunk(usbd_dev) < 0)
+				break;
+			/* we have now received the full data payload; invoke
+			 * callback to process */
+			if (usb_control_request_dispatch(usbd_dev, & usbd_dev->control_state.req))
+			{
+				/* go to status stage on success */
+				usbd_ep_write_packet(usbd_dev, 0, NULL, 0);
+				usbd_dev->control_state.state = STATUS_IN;
+			}
+			else
+				stall_transaction(usbd_dev);
+			break;
+		case STATUS_OUT:
+			usbd_ep_read_packet(usbd_dev, 0, NULL, 0);
+			usbd_dev->control_state.state = IDLE;
+			if (usbd_dev->control_state.complete)
+				usbd_dev->control_state.complete(usbd_dev, & usbd_dev->control_state.req);
+			usbd_dev->control_state.complete = NULL;
+			break;
+		default:
+			stall_transaction(usbd_dev);
+	}
+}
+
+static void _usbd_control_in(usbd_device * usbd_dev, uint8_t ea)
+{
+	struct usb_setup_data * req = & usbd_dev->control_state.req;
+	(void) ea;
+
+	switch (usbd_dev->control_state.state)
+	{
+		case DATA_IN:
+			usb_control_send_chunk(usbd_dev);
+			break;
+		case LAST_DATA_IN:
+			usbd_dev->control_state.state = STATUS_OUT;
+			usbd_ep_nak_set(usbd_dev, 0, 0);
+			break;
+		case STATUS_IN:
+			if (usbd_dev->control_state.complete)
+				usbd_dev->control_state.complete(usbd_dev, & usbd_dev->control_state.req);
+
+			/* exception: handle SET ADDRESS function here... */
+			if ((req->bmRequestType == 0) && (req->bRequest == USB_REQ_SET_ADDRESS))
+				st_usbfs_set_address(req->wValue);
+			usbd_dev->control_state.state = IDLE;
+			break;
+		default:
+			stall_transaction(usbd_dev);
+	}
+}
+
+static void _usbd_reset(usbd_device * usbd_dev)
+{
+	usbd_dev->current_address = 0;
+	usbd_dev->current_config = 0;
+	usbd_ep_setup(usbd_dev, 0, USB_ENDPOINT_ATTR_CONTROL, usbd_dev->desc->bMaxPacketSize0, NULL);
+	st_usbfs_set_address(0);
+
+	if (usbd_dev->user_callback_reset)
+		usbd_dev->user_callback_reset();
+}
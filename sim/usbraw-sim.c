@@ -0,0 +1,170 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* the host simulator transport of the raw bulk streams; see usbraw-sim.h */
+
+#include <errno.h>
+#include <stdbool.h>
+
+#include "usbsim.h"
+#include "usbraw-sim.h"
+
+/* some 30 us; a completion interrupt, the host program reaping the urb, and
+ * the host controller picking up the urb queued next */
+uint32_t usbraw_sim_urb_latency = 30 * (USBSIM_CPU_HZ / 1000000);
+
+static struct
+{
+	/* the urbs queued, in the order they were, and the bus time from
+	 * which each one - by index in the stream - can be worked on */
+	struct usbraw_urb	* queued[2 * USBRAW_MAX_DEPTH];
+	unsigned		queued_count;
+	uint64_t		ready[2 * USBRAW_MAX_DEPTH];
+	/* the urbs completed, and not reaped yet, in the order they were */
+	struct usbraw_urb	* completed[2 * USBRAW_MAX_DEPTH];
+	unsigned		completed_head, completed_tail;
+}
+sim;
+
+static void sim_complete(unsigned i, int status)
+{
+	struct usbraw_urb * urb = sim.queued[i];
+
+	urb->status = status;
+	for (sim.queued_count --; i < sim.queued_count; i ++)
+		sim.queued[i] = sim.queued[i + 1];
+	sim.completed[sim.completed_head ++ % (2 * USBRAW_MAX_DEPTH)] = urb;
+}
+
+static int sim_submit(struct usbraw * r, struct usbraw_urb * urb)
+{
+	if (sim.queued_count == 2 * USBRAW_MAX_DEPTH)
+		return -EBUSY;
+	urb->actual = 0;
+	urb->status = 0;
+	sim.ready[urb - r->urbs] = usbsim_bus_cycles() + usbraw_sim_urb_latency;
+	sim.queued[sim.queued_count ++] = urb;
+	return 0;
+}
+
+/* a transaction on the endpoint of the queued urb 'i'; returns true if the
+ * urb completes */
+static bool sim_transaction(unsigned i)
+{
+	struct usbraw_urb * urb = sim.queued[i];
+	unsigned len = urb->len - urb->actual < USBRAW_PACKET_SIZE ? urb->len - urb->actual : USBRAW_PACKET_SIZE;
+	int result;
+
+	if (urb->ep & 0x80)
+		result = usbsim_host_in(urb->ep, urb->buf + urb->actual, len);
+	else if ((result = usbsim_host_out(urb->ep, urb->buf + urb->actual, len)) == USBSIM_ACK)
+		result = len;
+	if (result == USBSIM_STALL)
+	{
+		sim_complete(i, -EPIPE);
+		return true;
+	}
+	if (result < 0)
+		return false;
+	urb->actual += result;
+	/* a short packet ends an IN transfer */
+	if (urb->actual < urb->len && result == (int) len)
+		return false;
+	sim_complete(i, 0);
+	return true;
+}
+
+static struct usbraw_urb * sim_reap(struct usbraw * r, int timeout_ms)
+{
+	uint32_t timeout = usbsim_host_frame_number() + timeout_ms;
+	uint64_t now, next;
+	uint8_t eps[2 * USBRAW_MAX_DEPTH];
+	unsigned i, j, ep_count;
+
+	while (sim.completed_tail == sim.completed_head)
+	{
+		if (!sim.queued_count || (int32_t) (usbsim_host_frame_number() - timeout) > 0)
+			return 0;
+		/* a round of transactions, one to each endpoint that has a urb
+		 * ready - the first one queued on it */
+		now = usbsim_bus_cycles();
+		next = UINT64_MAX;
+		for (i = ep_count = 0; i < sim.queued_count; i ++)
+		{
+			for (j = 0; j < ep_count && eps[j] != sim.queued[i]->ep; j ++)
+				;
+			if (j < ep_count)
+				continue;
+			eps[ep_count ++] = sim.queued[i]->ep;
+			if (sim.ready[sim.queued[i] - r->urbs] > now)
+			{
+				if (sim.ready[sim.queued[i] - r->urbs] < next)
+					next = sim.ready[sim.queued[i] - r->urbs];
+				continue;
+			}
+			next = now;
+			if (sim_transaction(i))
+				/* the urbs behind it have moved up */
+				i --;
+		}
+		if (next > now)
+			usbsim_host_idle(next - now);
+	}
+	return sim.completed[sim.completed_tail ++ % (2 * USBRAW_MAX_DEPTH)];
+}
+
+static void sim_discard(struct usbraw * r, struct usbraw_urb * urb)
+{
+	unsigned i;
+
+	(void) r;
+	for (i = 0; i < sim.queued_count; i ++)
+		if (sim.queued[i] == urb)
+		{
+			sim_complete(i, -ENOENT);
+			return;
+		}
+}
+
+static void sim_close(struct usbraw * r)
+{
+	(void) r;
+}
+
+static const struct usbraw_transport sim_transport =
+{
+	.submit		= sim_submit,
+	.reap		= sim_reap,
+	.discard	= sim_discard,
+	.close		= sim_close,
+};
+
+int usbraw_open_sim(struct usbraw * r, uint8_t interface_class, unsigned n, unsigned depth, unsigned urb_size)
+{
+	int ep_in = usbsim_host_find_endpoint_nth(interface_class, n, USB_ENDPOINT_ATTR_BULK, true);
+	int ep_out = usbsim_host_find_endpoint_nth(interface_class, n, USB_ENDPOINT_ATTR_BULK, false);
+
+	if (ep_in < 0 || ep_out < 0)
+		return -ENODEV;
+	sim.queued_count = sim.completed_head = sim.completed_tail = 0;
+	return usbraw_init(r, & sim_transport, 0, ep_in, ep_out, depth, urb_size);
+}
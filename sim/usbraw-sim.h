@@ -0,0 +1,43 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* the host simulator transport of the raw bulk streams (host/usbraw.h); a
+ * model of a host controller, which works on the first urb queued on each
+ * endpoint, issuing a transaction to each such endpoint in turn, and of the
+ * host software, which takes 'usbraw_sim_urb_latency' cycles from queuing a
+ * urb - e.g. after reaping the previous one - until the host controller
+ * starts on it */
+
+#ifndef USBRAW_SIM_H
+#define USBRAW_SIM_H
+
+#include <stdint.h>
+#include "usbraw.h"
+
+extern uint32_t usbraw_sim_urb_latency;
+
+/* sets up a stream over the bulk endpoints of the 'n'th interface of class
+ * 'interface_class' of the simulated device, which must be enumerated;
+ * returns zero, or a negative errno value */
+int usbraw_open_sim(struct usbraw * r, uint8_t interface_class, unsigned n, unsigned depth, unsigned urb_size);
+
+#endif /* USBRAW_SIM_H */
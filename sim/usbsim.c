@@ -0,0 +1,897 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* simulator scheduling - the two clocks, the firmware coroutine - and the
+ * scripted host with its full speed bus timing model */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <ucontext.h>
+
+#include <libopencm3/usb/usbstd.h>
+#include <libopencm3/usb/cdc.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/cortex.h>
+#include "usbsim.h"
+
+struct usbsim_cost_model usbsim_cost =
+{
+	.poll			= 40,
+	.isr_entry		= 24,
+	.packet_overhead	= 30,
+	/* a halfword load, a byte merge and a strided store, the loop, and
+	 * a wait state on the apb1 bus */
+	.pma_copy_generic	= 7,
+	/* the unrolled kernels: half a word load, or two byte loads and a
+	 * merge, and the store with its wait state; the loop overhead is
+	 * spread over four halfwords */
+	.pma_copy_aligned	= 4,
+	.pma_copy_unaligned	= 5,
+	/* a driver call, and a read-modify-write of a channel register */
+	.dma_register_access	= 8,
+	/* an sram read and a packet memory write through the apb1 bridge */
+	.dma_transfer		= 5,
+	.control_request	= 200,
+	.main_loop_load		= 0,
+};
+
+struct usbsim_stats usbsim_stats;
+
+const uint32_t usbsim_main_loop_loads[3] = { 0, 20000, 100000, };
+
+/*
+ * bus timing, in bits; a transaction is made up of a token packet, an
+ * optional data packet, and an optional handshake packet, separated by
+ * bus turnaround times; bit stuffing is not accounted for
+ */
+enum
+{
+	SYNC_PID_EOP_BITS	= 8 + 8 + 3,
+	TOKEN_BITS		= SYNC_PID_EOP_BITS + 16,
+	HANDSHAKE_BITS		= SYNC_PID_EOP_BITS,
+	DATA_OVERHEAD_BITS	= SYNC_PID_EOP_BITS + 16,
+	TURNAROUND_BITS		= 16,
+	SOF_BITS		= TOKEN_BITS,
+	/* no transaction is started this close to the end of a frame */
+	EOF_GUARD_BITS		= 64,
+	/* length of a bus reset, and the reset recovery time */
+	RESET_MS		= 10,
+	RESET_RECOVERY_MS	= 10,
+	SET_ADDRESS_RECOVERY_MS	= 2,
+	MAX_PERIODIC_ENDPOINTS	= 4,
+	/* the largest full speed isochronous packet */
+	MAX_PERIODIC_PACKET	= 1023,
+	/* control transactions are retried for this long before giving up */
+	CONTROL_TIMEOUT_MS	= 5000,
+};
+
+static uint64_t bus_clock, cpu_clock;
+/* the cpu clock when the statistics were last reset */
+static uint64_t stats_cpu_clock;
+
+static ucontext_t host_context, device_context;
+static bool in_device_context, in_isr, in_systick, device_connected;
+/* the firmware code the last cycles were charged to */
+static const void * interrupted_pc;
+/* set when the main loop work of an iteration is to be charged once
+ * interrupts are unmasked */
+static bool is_main_loop_work_deferred;
+static int (* firmware_entry)(void);
+
+void (* usbsim_transaction_hook)(const struct usbsim_transaction * t);
+
+static struct
+{
+	uint8_t		address;
+	uint8_t		ep0_size;
+	uint32_t	frame_number;
+	bool		periodic_pending, in_periodic;
+	uint8_t		config[512];
+	int		config_length;
+	/* bus time taken by the traffic of other devices in each frame */
+	unsigned	foreign_bits;
+	struct
+	{
+		uint8_t		ep;
+		bool		is_isochronous;
+		unsigned	interval;
+		unsigned	max_packet;
+		void		(* callback)(uint8_t ep, const void * data, int len);
+	}
+	periodic[MAX_PERIODIC_ENDPOINTS];
+}
+host;
+
+/* the firmware defines the usb interrupt handler only when it is built
+ * for interrupt driven operation, and the SysTick handler only when it is
+ * built with the sampling profiler */
+#pragma weak usb_lp_can_rx0_isr
+#pragma weak sys_tick_handler
+
+uint64_t usbsim_bus_cycles(void)
+{
+	return bus_clock;
+}
+
+uint64_t usbsim_cpu_cycles(void)
+{
+	return cpu_clock;
+}
+
+uint64_t usbsim_busy_cycles(void)
+{
+	return cpu_clock - stats_cpu_clock - usbsim_stats.sleep_cycles;
+}
+
+double usbsim_cycles_to_us(uint64_t cycles)
+{
+	return 1e6 * cycles / USBSIM_CPU_HZ;
+}
+
+void usbsim_reset_stats(void)
+{
+	memset(& usbsim_stats, 0, sizeof usbsim_stats);
+	stats_cpu_clock = cpu_clock;
+}
+
+void usbsim_print_stats(const char * title)
+{
+	printf("%s:\n", title);
+	printf("\tbus time              %.3f ms (%llu frames)\n", (double) bus_clock * 1000 / USBSIM_CPU_HZ,
+			(unsigned long long) usbsim_stats.frames);
+	printf("\tIN  ack/nak/stall     %llu/%llu/%llu, %llu bytes\n",
+			(unsigned long long) usbsim_stats.in_ack, (unsigned long long) usbsim_stats.in_nak,
+			(unsigned long long) usbsim_stats.in_stall, (unsigned long long) usbsim_stats.bytes_in);
+	printf("\tOUT ack/nak/stall     %llu/%llu/%llu, %llu bytes\n",
+			(unsigned long long) usbsim_stats.out_ack, (unsigned long long) usbsim_stats.out_nak,
+			(unsigned long long) usbsim_stats.out_stall, (unsigned long long) usbsim_stats.bytes_out);
+	printf("\tSETUP                 %llu\n", (unsigned long long) usbsim_stats.setup_transactions);
+	printf("\tpolls/interrupts      %llu/%llu\n", (unsigned long long) usbsim_stats.polls,
+			(unsigned long long) usbsim_stats.interrupts);
+	if (usbsim_stats.polls)
+		printf("\tusbd_poll cycles      avg %llu, max %llu\n",
+				(unsigned long long) (usbsim_stats.poll_cycles / usbsim_stats.polls),
+				(unsigned long long) usbsim_stats.max_poll_cycles);
+	if (usbsim_stats.in_ack + usbsim_stats.out_ack)
+		printf("\tbusy cycles/packet    %llu\n",
+				(unsigned long long) (usbsim_busy_cycles() / (usbsim_stats.in_ack + usbsim_stats.out_ack)));
+	if (usbsim_stats.serviced_transfers)
+		printf("\tservice latency       avg %llu, max %llu cycles\n",
+				(unsigned long long) (usbsim_stats.total_service_latency / usbsim_stats.serviced_transfers),
+				(unsigned long long) usbsim_stats.max_service_latency);
+}
+
+
+/*
+ * device side
+ */
+static bool usb_irq_pending(void)
+{
+	return usb_lp_can_rx0_isr && usbsim_nvic_irq_enabled(NVIC_USB_LP_CAN_RX0_IRQ)
+		&& (usbsim_st_usbfs_irq_pending() || usbsim_nvic_irq_pending(NVIC_USB_LP_CAN_RX0_IRQ));
+}
+
+static bool systick_pending(void)
+{
+	return sys_tick_handler && usbsim_systick_pending();
+}
+
+static bool irq_pending(void)
+{
+	return usb_irq_pending() || systick_pending();
+}
+
+/* take pending interrupts; interrupt handlers are run at the points where
+ * the firmware calls into the simulator, which stands in for the
+ * instruction boundary at which the core would take the exception */
+static void service_interrupts(void)
+{
+	if (usbsim_interrupts_masked())
+		return;
+	/* SysTick preempts the usb interrupt handler */
+	while (!in_systick && systick_pending())
+	{
+		in_systick = true;
+		usbsim_systick_taken();
+		cpu_clock += usbsim_cost.isr_entry;
+		sys_tick_handler();
+		in_systick = false;
+	}
+	if (in_isr || in_systick)
+		return;
+	while (usb_irq_pending())
+	{
+		in_isr = true;
+		/* exception entry clears the software pending state */
+		nvic_clear_pending_irq(NVIC_USB_LP_CAN_RX0_IRQ);
+		cpu_clock += usbsim_cost.isr_entry;
+		usbsim_stats.interrupts ++;
+		usb_lp_can_rx0_isr();
+		in_isr = false;
+	}
+}
+
+static void yield_to_host(void)
+{
+	assert(in_device_context);
+	in_device_context = false;
+	swapcontext(& device_context, & host_context);
+	in_device_context = true;
+}
+
+void usbsim_charge(uint32_t cycles)
+{
+	usbsim_charge_at(cycles, __builtin_return_address(0));
+}
+
+void usbsim_charge_at(uint32_t cycles, const void * pc)
+{
+	if (!in_device_context)
+		/* peripheral accesses made by the host side model are free */
+		return;
+	interrupted_pc = pc;
+	cpu_clock += cycles;
+	if (cpu_clock >= bus_clock)
+		yield_to_host();
+	service_interrupts();
+}
+
+void usbsim_main_loop_iteration(void)
+{
+	uint32_t load = usbsim_cost.main_loop_load;
+
+	if (in_isr || in_systick || !in_device_context)
+		return;
+	if (usbsim_interrupts_masked())
+	{
+		/* the main loop is about to wait for an interrupt with
+		 * interrupts masked; the work is done once they are unmasked */
+		is_main_loop_work_deferred = true;
+		return;
+	}
+	/* application work is interruptible, charge it in small slices */
+	while (load)
+	{
+		uint32_t slice = MIN(load, 64u);
+		usbsim_charge(slice);
+		load -= slice;
+	}
+}
+
+uint32_t usbsim_interrupted_pc(void)
+{
+	return (uint32_t) (uintptr_t) interrupted_pc;
+}
+
+void usbsim_interrupts_unmasked(const void * pc)
+{
+	/* pending interrupts are taken right away */
+	usbsim_charge_at(1, pc);
+	if (is_main_loop_work_deferred)
+	{
+		is_main_loop_work_deferred = false;
+		usbsim_main_loop_iteration();
+	}
+}
+
+void usbsim_wait_for_interrupt(void)
+{
+	usbsim_main_loop_iteration();
+	/* as the 'wfi' instruction, return when an interrupt is pending, even
+	 * if interrupts are masked; the cpu sleeps until the bus catches up,
+	 * or SysTick wraps */
+	interrupted_pc = __builtin_return_address(0);
+	while (!irq_pending())
+	{
+		uint64_t wake = MIN(bus_clock, usbsim_systick_next_wrap());
+
+		if (cpu_clock < wake)
+			usbsim_stats.sleep_cycles += wake - cpu_clock, cpu_clock = wake;
+		else
+			yield_to_host();
+	}
+	service_interrupts();
+}
+
+/* the firmware has initialized the usb peripheral, and is ready to be reset
+ * and enumerated by the host */
+void usbsim_device_connect(void)
+{
+	device_connected = true;
+}
+
+static void device_main(void)
+{
+	in_device_context = true;
+	firmware_entry();
+	/* the firmware is not supposed to return, but if it does, idle */
+	while (1)
+		usbsim_wait_for_interrupt();
+}
+
+void usbsim_start(int (* firmware_main)(void))
+{
+	static char device_stack[1 << 20];
+
+	firmware_entry = firmware_main;
+	getcontext(& device_context);
+	device_context.uc_stack.ss_sp = device_stack;
+	device_context.uc_stack.ss_size = sizeof device_stack;
+	device_context.uc_link = NULL;
+	makecontext(& device_context, device_main, 0);
+	host.ep0_size = 8;
+}
+
+/* let the firmware run until it catches up with the bus clock */
+static void run_device(void)
+{
+	assert(!in_device_context);
+	while (cpu_clock < bus_clock)
+		swapcontext(& host_context, & device_context);
+}
+
+
+/*
+ * bus and frame scheduling
+ */
+static void run_periodic_schedule(void);
+
+static void start_frame(void)
+{
+	host.frame_number ++;
+	usbsim_stats.frames ++;
+	usbsim_st_usbfs_sof(host.frame_number);
+	bus_clock += SOF_BITS * USBSIM_CYCLES_PER_BIT;
+	host.periodic_pending = true;
+}
+
+static void bus_advance(uint64_t cycles)
+{
+	uint64_t end = bus_clock + cycles;
+
+	while (bus_clock < end)
+	{
+		uint64_t next_frame = (bus_clock / USBSIM_CYCLES_PER_FRAME + 1) * USBSIM_CYCLES_PER_FRAME;
+		if (end < next_frame)
+			bus_clock = end;
+		else
+		{
+			bus_clock = next_frame;
+			run_device();
+			start_frame();
+			if (end < bus_clock)
+				end = bus_clock;
+		}
+		run_device();
+	}
+	run_periodic_schedule();
+}
+
+/* make room in the current frame for a transaction of 'bits' duration, moving
+ * on to the next frame if it does not fit */
+static void bus_schedule(unsigned bits)
+{
+	uint64_t frame_end = (bus_clock / USBSIM_CYCLES_PER_FRAME + 1) * USBSIM_CYCLES_PER_FRAME;
+
+	run_periodic_schedule();
+	if (bus_clock + (bits + EOF_GUARD_BITS) * USBSIM_CYCLES_PER_BIT > frame_end)
+		bus_advance(frame_end - bus_clock);
+}
+
+static void run_periodic_schedule(void)
+{
+	int i;
+
+	if (!host.periodic_pending || host.in_periodic)
+		return;
+	host.periodic_pending = false;
+	host.in_periodic = true;
+	for (i = 0; i < MAX_PERIODIC_ENDPOINTS; i ++)
+	{
+		uint8_t buf[MAX_PERIODIC_PACKET];
+		int len;
+
+		if (!host.periodic[i].callback || host.frame_number % host.periodic[i].interval)
+			continue;
+		if (host.periodic[i].is_isochronous)
+			len = usbsim_host_iso_in(host.periodic[i].ep, buf, host.periodic[i].max_packet);
+		else
+			len = usbsim_host_in(host.periodic[i].ep, buf, host.periodic[i].max_packet);
+		if (len != USBSIM_NAK)
+			host.periodic[i].callback(host.periodic[i].ep, buf, len);
+	}
+	/* the other devices on the bus get their share of the frame after the
+	 * periodic transfers of this one */
+	if (host.foreign_bits)
+		bus_advance((uint64_t) host.foreign_bits * USBSIM_CYCLES_PER_BIT);
+	host.in_periodic = false;
+}
+
+
+/*
+ * host
+ */
+void usbsim_host_idle(uint64_t cycles)
+{
+	bus_advance(cycles);
+}
+
+void usbsim_host_idle_frames(unsigned frames)
+{
+	bus_advance((uint64_t) frames * USBSIM_CYCLES_PER_FRAME);
+}
+
+uint32_t usbsim_host_frame_number(void)
+{
+	return host.frame_number;
+}
+
+uint8_t usbsim_host_ep0_size(void)
+{
+	return host.ep0_size;
+}
+
+static void transaction_done(uint64_t start, enum usbsim_transaction_type type, uint8_t ep,
+		const void * data, unsigned len, int result)
+{
+	if (usbsim_transaction_hook)
+		usbsim_transaction_hook(& (struct usbsim_transaction) { .start = start, .type = type,
+				.address = host.address, .ep = ep, .data = data, .len = len, .result = result, });
+}
+
+void usbsim_host_reset(void)
+{
+	transaction_done(bus_clock, USBSIM_TRANSACTION_RESET, 0, 0, 0, USBSIM_ACK);
+	/* wait for the device to attach to the bus */
+	while (!device_connected)
+		usbsim_host_idle_frames(1);
+	usbsim_st_usbfs_bus_reset();
+	host.address = 0;
+	host.ep0_size = 8;
+	host.config_length = 0;
+	memset(host.periodic, 0, sizeof host.periodic);
+	usbsim_host_idle_frames(RESET_MS + RESET_RECOVERY_MS);
+}
+
+static void poll_periodic(uint8_t ep, bool is_isochronous, unsigned interval, unsigned max_packet,
+		void (* callback)(uint8_t ep, const void * data, int len))
+{
+	int i;
+
+	assert(max_packet <= MAX_PERIODIC_PACKET);
+	for (i = 0; i < MAX_PERIODIC_ENDPOINTS; i ++)
+		if (!host.periodic[i].callback || host.periodic[i].ep == ep)
+		{
+			host.periodic[i].ep = ep;
+			host.periodic[i].is_isochronous = is_isochronous;
+			host.periodic[i].interval = interval ? interval : 1;
+			host.periodic[i].max_packet = max_packet;
+			host.periodic[i].callback = callback;
+			return;
+		}
+	assert(0);
+}
+
+void usbsim_host_poll_periodic(uint8_t ep, unsigned interval,
+		void (* callback)(uint8_t ep, const void * data, int len))
+{
+	poll_periodic(ep, false, interval, 64, callback);
+}
+
+void usbsim_host_poll_isochronous(uint8_t ep, unsigned max_packet,
+		void (* callback)(uint8_t ep, const void * data, int len))
+{
+	poll_periodic(ep, true, 1, max_packet, callback);
+}
+
+void usbsim_host_stop_polling(uint8_t ep)
+{
+	int i;
+	for (i = 0; i < MAX_PERIODIC_ENDPOINTS; i ++)
+		if (host.periodic[i].ep == ep)
+			host.periodic[i].callback = NULL;
+}
+
+void usbsim_host_set_foreign_load(unsigned bits_per_frame)
+{
+	host.foreign_bits = bits_per_frame;
+}
+
+void usbsim_host_set_address(uint8_t address)
+{
+	host.address = address;
+}
+
+int usbsim_host_setup(uint8_t ep, const struct usb_setup_data * req)
+{
+	int result;
+	uint64_t start;
+	unsigned bits = TOKEN_BITS + TURNAROUND_BITS + DATA_OVERHEAD_BITS + 8 * 8 + TURNAROUND_BITS + HANDSHAKE_BITS;
+
+	bus_schedule(bits);
+	start = bus_clock;
+	bus_advance(bits * USBSIM_CYCLES_PER_BIT);
+	result = usbsim_st_usbfs_setup(host.address, ep, req);
+	run_device();
+	transaction_done(start, USBSIM_TRANSACTION_SETUP, ep, req, sizeof * req, result);
+	return result;
+}
+
+int usbsim_host_out(uint8_t ep, const void * data, unsigned len)
+{
+	int result;
+	uint64_t start;
+	unsigned bits = TOKEN_BITS + TURNAROUND_BITS + DATA_OVERHEAD_BITS + 8 * len + TURNAROUND_BITS + HANDSHAKE_BITS;
+
+	bus_schedule(bits);
+	start = bus_clock;
+	result = usbsim_st_usbfs_out(host.address, ep & 0x7f, data, len);
+	bus_advance(bits * USBSIM_CYCLES_PER_BIT);
+	if (result == USBSIM_ACK)
+	{
+		usbsim_st_usbfs_handshake();
+		run_device();
+	}
+	transaction_done(start, USBSIM_TRANSACTION_OUT, ep, data, len, result);
+	return result;
+}
+
+int usbsim_host_in(uint8_t ep, void * buf, unsigned maxlen)
+{
+	int result;
+	uint64_t start;
+	unsigned bits = TOKEN_BITS + TURNAROUND_BITS + DATA_OVERHEAD_BITS + 8 * maxlen + TURNAROUND_BITS + HANDSHAKE_BITS;
+
+	/* account for the bus time actually used, which is known once the
+	 * peripheral has responded to the token */
+	bus_schedule(bits);
+	start = bus_clock;
+	result = usbsim_st_usbfs_in(host.address, ep & 0x7f, buf, maxlen);
+	if (result >= 0)
+		bits = TOKEN_BITS + TURNAROUND_BITS + DATA_OVERHEAD_BITS + 8 * result + TURNAROUND_BITS + HANDSHAKE_BITS;
+	else
+		bits = TOKEN_BITS + TURNAROUND_BITS + HANDSHAKE_BITS;
+	bus_advance(bits * USBSIM_CYCLES_PER_BIT);
+	if (result >= 0)
+	{
+		usbsim_st_usbfs_handshake();
+		run_device();
+	}
+	transaction_done(start, USBSIM_TRANSACTION_IN, ep, buf, maxlen, result);
+	return result;
+}
+
+int usbsim_host_iso_in(uint8_t ep, void * buf, unsigned maxlen)
+{
+	int result;
+	uint64_t start;
+	unsigned bits = TOKEN_BITS + TURNAROUND_BITS + DATA_OVERHEAD_BITS + 8 * maxlen;
+
+	/* isochronous transactions have no handshake, and no retries; the bus
+	 * time of a periodic transaction is reserved, and the scripted host
+	 * does not check that a frame can hold it */
+	bus_schedule(bits);
+	start = bus_clock;
+	result = usbsim_st_usbfs_in(host.address, ep & 0x7f, buf, maxlen);
+	if (result >= 0)
+		bits = TOKEN_BITS + TURNAROUND_BITS + DATA_OVERHEAD_BITS + 8 * result;
+	else
+		bits = TOKEN_BITS + TURNAROUND_BITS;
+	bus_advance(bits * USBSIM_CYCLES_PER_BIT);
+	if (result >= 0)
+	{
+		/* the peripheral completes the transfer once the data packet
+		 * has been sent */
+		usbsim_st_usbfs_handshake();
+		run_device();
+	}
+	transaction_done(start, USBSIM_TRANSACTION_ISO_IN, ep, buf, maxlen, result);
+	return result;
+}
+
+static bool control_timed_out(uint64_t start)
+{
+	return bus_clock - start > (uint64_t) CONTROL_TIMEOUT_MS * USBSIM_CYCLES_PER_FRAME;
+}
+
+/* perform a control transfer assuming endpoint 0 maximum packet size 'mps';
+ * this is needed because the first descriptor request during enumeration is
+ * issued before the device maximum packet size is known */
+static int host_control(const struct usb_setup_data * req, void * data, uint8_t mps)
+{
+	uint64_t start = bus_clock;
+	uint8_t * p = data;
+	int result, len = 0;
+	uint8_t dummy;
+
+	if ((result = usbsim_host_setup(0, req)) != USBSIM_ACK)
+		return result;
+
+	if (req->bmRequestType & USB_REQ_TYPE_IN)
+	{
+		/* data stage, until a short packet or all data requested
+		 * is received */
+		while (len < req->wLength)
+		{
+			uint8_t packet[64];
+			result = usbsim_host_in(0, packet, MIN(sizeof packet, (unsigned) mps));
+			if (result == USBSIM_NAK && !control_timed_out(start))
+				continue;
+			if (result < 0)
+				return result;
+			result = MIN(result, req->wLength - len);
+			memcpy(p + len, packet, result);
+			len += result;
+			if (result < mps)
+				break;
+		}
+		/* status stage */
+		while ((result = usbsim_host_out(0, & dummy, 0)) == USBSIM_NAK && !control_timed_out(start))
+			;
+	}
+	else
+	{
+		while (len < req->wLength)
+		{
+			int chunk = MIN(req->wLength - len, mps);
+			result = usbsim_host_out(0, p + len, chunk);
+			if (result == USBSIM_NAK && !control_timed_out(start))
+				continue;
+			if (result < 0)
+				return result;
+			len += chunk;
+		}
+		/* status stage */
+		while ((result = usbsim_host_in(0, & dummy, 0)) == USBSIM_NAK && !control_timed_out(start))
+			;
+	}
+	if (result < 0)
+		return result;
+	if (req->bmRequestType == 0 && req->bRequest == USB_REQ_SET_ADDRESS)
+	{
+		host.address = req->wValue;
+		usbsim_host_idle_frames(SET_ADDRESS_RECOVERY_MS);
+	}
+	return len;
+}
+
+int usbsim_host_control(const struct usb_setup_data * req, void * data)
+{
+	return host_control(req, data, host.ep0_size);
+}
+
+int usbsim_host_set_line_coding(uint8_t interface, uint32_t rate)
+{
+	struct usb_cdc_line_coding line_coding =
+	{
+		.dwDTERate	= rate,
+		.bCharFormat	= USB_CDC_1_STOP_BITS,
+		.bParityType	= USB_CDC_NO_PARITY,
+		.bDataBits	= 8,
+	};
+	struct usb_setup_data req =
+	{
+		.bmRequestType	= USB_REQ_TYPE_CLASS | USB_REQ_TYPE_INTERFACE,
+		.bRequest	= USB_CDC_REQ_SET_LINE_CODING,
+		.wValue		= 0,
+		.wIndex		= interface,
+		.wLength	= sizeof line_coding,
+	};
+
+	return usbsim_host_control(& req, & line_coding);
+}
+
+int usbsim_host_get_line_coding(uint8_t interface, struct usb_cdc_line_coding * line_coding)
+{
+	struct usb_setup_data req =
+	{
+		.bmRequestType	= USB_REQ_TYPE_IN | USB_REQ_TYPE_CLASS | USB_REQ_TYPE_INTERFACE,
+		.bRequest	= USB_CDC_REQ_GET_LINE_CODING,
+		.wValue		= 0,
+		.wIndex		= interface,
+		.wLength	= sizeof * line_coding,
+	};
+
+	return usbsim_host_control(& req, line_coding);
+}
+
+int usbsim_host_vendor_request(uint8_t interface, uint8_t request, uint16_t value, void * data, uint16_t len)
+{
+	struct usb_setup_data req =
+	{
+		.bmRequestType	= (len ? USB_REQ_TYPE_IN : 0) | USB_REQ_TYPE_VENDOR | USB_REQ_TYPE_INTERFACE,
+		.bRequest	= request,
+		.wValue		= value,
+		.wIndex		= interface,
+		.wLength	= len,
+	};
+
+	return usbsim_host_control(& req, data);
+}
+
+int usbsim_host_bulk_write(uint8_t ep, const void * data, unsigned len, unsigned packet_size, unsigned timeout_frames)
+{
+	const uint8_t * p = data;
+	unsigned total = 0;
+	uint32_t deadline = host.frame_number + timeout_frames;
+
+	while (total < len && host.frame_number < deadline)
+	{
+		unsigned chunk = MIN(len - total, packet_size);
+		int result = usbsim_host_out(ep, p + total, chunk);
+		if (result == USBSIM_NAK)
+			continue;
+		if (result != USBSIM_ACK)
+			break;
+		total += chunk;
+		deadline = host.frame_number + timeout_frames;
+	}
+	return total;
+}
+
+int usbsim_host_bulk_read(uint8_t ep, void * buf, unsigned len, unsigned packet_size, unsigned timeout_frames)
+{
+	uint8_t * p = buf, packet[1024];
+	unsigned total = 0;
+	uint32_t deadline = host.frame_number + timeout_frames;
+
+	assert(packet_size <= sizeof packet);
+	while (total < len && host.frame_number < deadline)
+	{
+		int result = usbsim_host_in(ep, packet, packet_size);
+		if (result == USBSIM_NAK)
+			continue;
+		if (result < 0)
+			break;
+		result = MIN((unsigned) result, len - total);
+		memcpy(p + total, packet, result);
+		total += result;
+		if ((unsigned) result < packet_size)
+			break;
+		deadline = host.frame_number + timeout_frames;
+	}
+	return total;
+}
+
+int usbsim_host_bulk_read_stream(uint8_t ep, void * buf, unsigned len, unsigned packet_size, unsigned timeout_frames)
+{
+	uint8_t * p = buf, packet[1024];
+	unsigned total = 0;
+	uint32_t deadline = host.frame_number + timeout_frames;
+
+	assert(packet_size <= sizeof packet);
+	while (total < len && host.frame_number < deadline)
+	{
+		int result = usbsim_host_in(ep, packet, packet_size);
+		if (result == USBSIM_NAK)
+			continue;
+		if (result < 0)
+			break;
+		/* more data than expected is a test failure, not a short read */
+		assert((unsigned) result <= len - total);
+		memcpy(p + total, packet, result);
+		total += result;
+		deadline = host.frame_number + timeout_frames;
+	}
+	return total;
+}
+
+int usbsim_host_enumerate(void)
+{
+	struct usb_device_descriptor device;
+	struct usb_setup_data req;
+	int result;
+
+	/* this follows the linux enumeration sequence: a first 64 byte device
+	 * descriptor request to learn the endpoint 0 packet size, a second
+	 * reset, and then addressing and configuration proper */
+	usbsim_host_reset();
+	req = (struct usb_setup_data) { .bmRequestType = USB_REQ_TYPE_IN, .bRequest = USB_REQ_GET_DESCRIPTOR,
+		.wValue = USB_DT_DEVICE << 8, .wIndex = 0, .wLength = 64, };
+	if ((result = host_control(& req, & device, 64)) < 8)
+		return -1;
+	usbsim_host_reset();
+	host.ep0_size = device.bMaxPacketSize0;
+
+	req = (struct usb_setup_data) { .bmRequestType = 0, .bRequest = USB_REQ_SET_ADDRESS,
+		.wValue = 1, .wIndex = 0, .wLength = 0, };
+	if (usbsim_host_control(& req, 0) < 0)
+		return -1;
+
+	req = (struct usb_setup_data) { .bmRequestType = USB_REQ_TYPE_IN, .bRequest = USB_REQ_GET_DESCRIPTOR,
+		.wValue = USB_DT_DEVICE << 8, .wIndex = 0, .wLength = sizeof device, };
+	if (usbsim_host_control(& req, & device) != sizeof device)
+		return -1;
+
+	req = (struct usb_setup_data) { .bmRequestType = USB_REQ_TYPE_IN, .bRequest = USB_REQ_GET_DESCRIPTOR,
+		.wValue = USB_DT_CONFIGURATION << 8, .wIndex = 0, .wLength = USB_DT_CONFIGURATION_SIZE, };
+	if (usbsim_host_control(& req, host.config) != USB_DT_CONFIGURATION_SIZE)
+		return -1;
+	req.wLength = host.config[2] | host.config[3] << 8;
+	if (req.wLength > sizeof host.config)
+		return -1;
+	if ((result = usbsim_host_control(& req, host.config)) != req.wLength)
+		return -1;
+	host.config_length = result;
+
+	req = (struct usb_setup_data) { .bmRequestType = 0, .bRequest = USB_REQ_SET_CONFIGURATION,
+		.wValue = host.config[5], .wIndex = 0, .wLength = 0, };
+	if (usbsim_host_control(& req, 0) < 0)
+		return -1;
+	return 0;
+}
+
+int usbsim_host_find_endpoint_nth(uint8_t interface_class, unsigned n, uint8_t attributes, bool in)
+{
+	int i, current_class = -1, count = 0;
+
+	for (i = 0; i + 1 < host.config_length && host.config[i]; i += host.config[i])
+	{
+		const uint8_t * d = host.config + i;
+		/* the alternate settings of an interface follow its default
+		 * setting, and are searched along with it */
+		if (d[1] == USB_DT_INTERFACE)
+		{
+			current_class = d[5];
+			if (current_class == interface_class && !d[3])
+				count ++;
+		}
+		else if (d[1] == USB_DT_ENDPOINT && current_class == interface_class && count == (int) n + 1
+				&& (d[3] & USB_ENDPOINT_ATTR_TYPE) == attributes
+				&& !!(d[2] & 0x80) == in)
+			return d[2];
+	}
+	return -1;
+}
+
+int usbsim_host_find_endpoint(uint8_t interface_class, uint8_t attributes, bool in)
+{
+	return usbsim_host_find_endpoint_nth(interface_class, 0, attributes, in);
+}
+
+int usbsim_host_find_interface_nth(uint8_t interface_class, unsigned n)
+{
+	int i;
+
+	for (i = 0; i + 1 < host.config_length && host.config[i]; i += host.config[i])
+		if (host.config[i + 1] == USB_DT_INTERFACE && host.config[i + 5] == interface_class
+				&& !host.config[i + 3] && !n --)
+			return host.config[i + 2];
+	return -1;
+}
+
+int usbsim_host_find_interface(uint8_t interface_class)
+{
+	return usbsim_host_find_interface_nth(interface_class, 0);
+}
+
+int usbsim_host_count_descriptors(uint8_t type)
+{
+	int i, count = 0;
+
+	for (i = 0; i + 1 < host.config_length && host.config[i]; i += host.config[i])
+		if (host.config[i + 1] == type)
+			count ++;
+	return count;
+}
@@ -0,0 +1,279 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* host-side simulation of the usb cdc acm firmware
+ *
+ * the firmware (src/usb-cdc-acm.c) is compiled for the host against the
+ * stand-in libopencm3 headers in sim/include; its 'main()' is renamed to
+ * 'usbsim_firmware_main()' and runs as a coroutine on its own stack. the
+ * simulator provides:
+ *	- a register level model of the stm32f103 usb peripheral ('st_usbfs_v1'),
+ *	including the 512 byte packet memory area (pma), the buffer descriptor
+ *	table and the per-endpoint STAT_TX/STAT_RX (disabled/stall/nak/valid)
+ *	state machines (st_usbfs-sim.c)
+ *	- a model of the libopencm3 usb device core and the st_usbfs_v1 driver,
+ *	operating on the register model (usbd-sim.c)
+ *	- a full speed bus and scripted host, which issue SETUP/OUT/IN tokens
+ *	against the peripheral model within 1 ms frames (usbsim.c)
+ *
+ * time is kept in cpu cycles of the modelled 72 mhz cortex-m3; there are two
+ * clocks - the bus clock, advanced by the host as it issues transactions, and
+ * the cpu clock, advanced by the firmware as it calls into the (modelled)
+ * usb core and driver. the firmware runs until its clock catches up with the
+ * bus clock, and then yields to the host; the cost of the firmware itself is
+ * only modelled as far as 'usbsim_cost' describes it, the simulator is
+ * meant for functional and relative performance measurements, not for
+ * cycle exact figures */
+
+#ifndef USBSIM_H
+#define USBSIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <libopencm3/usb/usbstd.h>
+
+enum
+{
+	USBSIM_CPU_HZ			= 72000000,
+	/* full speed usb signals at 12 mbit/s */
+	USBSIM_CYCLES_PER_BIT		= USBSIM_CPU_HZ / 12000000,
+	USBSIM_CYCLES_PER_FRAME		= USBSIM_CPU_HZ / 1000,
+	USBSIM_BITS_PER_FRAME		= 12000,
+	USBSIM_MAX_ENDPOINTS		= 8,
+	USBSIM_PMA_SIZE			= 512,
+};
+
+/* transaction outcomes, as seen by the host */
+enum
+{
+	USBSIM_ACK			= 0,
+	USBSIM_NAK			= -1,
+	USBSIM_STALL			= -2,
+	USBSIM_TIMEOUT			= -3,
+};
+
+/* modelled cpu cost, in cycles, of the usb core and driver code that the
+ * simulator stands in for; 'main_loop_load' models application work done
+ * once per firmware main loop iteration (see INSTRUMENT_MAIN_LOOP() in
+ * src/instrument.h, and the idle wait); the 'pma_copy_x' costs are per halfword, of
+ * the pma.c copy kernel 'x' (the generic kernel also stands for the copies
+ * of the modelled libopencm3 driver), and 'dma_transfer' is the time a
+ * dma1 data item takes */
+struct usbsim_cost_model
+{
+	uint32_t	poll;
+	uint32_t	isr_entry;
+	uint32_t	packet_overhead;
+	uint32_t	pma_copy_generic;
+	uint32_t	pma_copy_aligned;
+	uint32_t	pma_copy_unaligned;
+	uint32_t	dma_register_access;
+	uint32_t	dma_transfer;
+	uint32_t	control_request;
+	uint32_t	main_loop_load;
+};
+
+struct usbsim_stats
+{
+	/* bus side */
+	uint64_t	frames;
+	uint64_t	setup_transactions;
+	uint64_t	in_ack, in_nak, in_stall;
+	uint64_t	out_ack, out_nak, out_stall;
+	uint64_t	bytes_in, bytes_out;
+	/* device side */
+	uint64_t	polls;
+	uint64_t	interrupts;
+	/* cpu cycles spent in usbd_poll(), the callbacks it makes included, and
+	 * the most spent in a single poll; and the cycles the cpu spent asleep,
+	 * waiting for an interrupt */
+	uint64_t	poll_cycles, max_poll_cycles;
+	uint64_t	sleep_cycles;
+	/* 'service latency' is the time from an endpoint transfer completing
+	 * on the bus (the peripheral setting CTR_RX/CTR_TX) until the firmware
+	 * acknowledges the completion by clearing the ctr flag */
+	uint64_t	serviced_transfers;
+	uint64_t	total_service_latency;
+	uint64_t	max_service_latency;
+};
+
+extern struct usbsim_cost_model usbsim_cost;
+extern struct usbsim_stats usbsim_stats;
+/* the 'main_loop_load' values the benchmarks compare - an idle, a lightly
+ * and a heavily loaded main loop */
+extern const uint32_t usbsim_main_loop_loads[3];
+
+/* the firmware entry point, 'main()' of src/usb-cdc-acm.c renamed */
+int usbsim_firmware_main(void);
+
+/* simulator control */
+void usbsim_start(int (* firmware_main)(void));
+uint64_t usbsim_bus_cycles(void);
+uint64_t usbsim_cpu_cycles(void);
+/* the cpu cycles since the statistics were last reset that the cpu was not
+ * asleep */
+uint64_t usbsim_busy_cycles(void);
+/* a number of cpu cycles, in microseconds */
+double usbsim_cycles_to_us(uint64_t cycles);
+void usbsim_reset_stats(void);
+void usbsim_print_stats(const char * title);
+
+/* device side, called from within the firmware context only */
+void usbsim_device_connect(void);
+void usbsim_charge(uint32_t cycles);
+/* the same, for the stand-ins of single instructions - a register access -
+ * which charge their cycles to the firmware code at 'pc' that calls them */
+void usbsim_charge_at(uint32_t cycles, const void * pc);
+void usbsim_main_loop_iteration(void);
+/* the firmware code an exception taken now interrupts - the place the
+ * cycles charged last were charged to - as a 32 bit address; the firmware
+ * is linked as a position dependent executable when this is used */
+uint32_t usbsim_interrupted_pc(void);
+/* usbsim_wait_for_interrupt(), which implements __WFI(), is declared in the
+ * cortex.h stand-in */
+/* nvic and primask state, from the core model (mcu-sim.c) */
+bool usbsim_nvic_irq_enabled(uint8_t irqn);
+bool usbsim_nvic_irq_pending(uint8_t irqn);
+bool usbsim_interrupts_masked(void);
+/* called by the core model when interrupts are unmasked, by the firmware
+ * code at 'pc' */
+void usbsim_interrupts_unmasked(const void * pc);
+/* SysTick state, from the core model; whether the SysTick exception is
+ * pending, the cpu cycle at which the counter wraps next (UINT64_MAX if
+ * it does not raise exceptions), and the exception has been taken */
+bool usbsim_systick_pending(void);
+uint64_t usbsim_systick_next_wrap(void);
+void usbsim_systick_taken(void);
+
+/* peripheral model, bus side; the peripheral decides how to respond to a
+ * token when it is received, and signals the completion of a successful
+ * data transaction (sets CTR) at the end of it - so a successful
+ * 'usbsim_st_usbfs_out()' or 'usbsim_st_usbfs_in()' must be followed by a
+ * call to 'usbsim_st_usbfs_handshake()' once the data packet has been
+ * transmitted; 'usbsim_st_usbfs_in()' returns the packet length on success,
+ * the other transaction functions return USBSIM_ACK, all of them return
+ * USBSIM_NAK, USBSIM_STALL or USBSIM_TIMEOUT (no response) otherwise */
+void usbsim_st_usbfs_bus_reset(void);
+void usbsim_st_usbfs_sof(uint16_t frame_number);
+int usbsim_st_usbfs_setup(uint8_t address, uint8_t ep, const void * setup_packet);
+int usbsim_st_usbfs_out(uint8_t address, uint8_t ep, const void * data, unsigned len);
+int usbsim_st_usbfs_in(uint8_t address, uint8_t ep, void * buf, unsigned maxlen);
+void usbsim_st_usbfs_handshake(void);
+bool usbsim_st_usbfs_irq_pending(void);
+
+/* scripted host; all functions advance the bus clock by the bus time of the
+ * transactions they issue, letting the firmware run meanwhile */
+void usbsim_host_reset(void);
+void usbsim_host_idle(uint64_t cycles);
+void usbsim_host_idle_frames(unsigned frames);
+uint32_t usbsim_host_frame_number(void);
+int usbsim_host_setup(uint8_t ep, const struct usb_setup_data * req);
+int usbsim_host_out(uint8_t ep, const void * data, unsigned len);
+int usbsim_host_in(uint8_t ep, void * buf, unsigned maxlen);
+/* a complete control transfer on endpoint 0, retrying naks; returns the
+ * number of data stage bytes transferred, or a negative error code */
+int usbsim_host_control(const struct usb_setup_data * req, void * data);
+/* a SET_LINE_CODING request to the cdc control interface 'interface', for
+ * 'rate' baud, 8 data bits, no parity and 1 stop bit - which is how the
+ * firmware test modes are selected */
+int usbsim_host_set_line_coding(uint8_t interface, uint32_t rate);
+struct usb_cdc_line_coding;
+/* a GET_LINE_CODING request to the cdc control interface 'interface'; returns
+ * the number of bytes read to 'line_coding', or a negative error code */
+int usbsim_host_get_line_coding(uint8_t interface, struct usb_cdc_line_coding * line_coding);
+/* a vendor request to the interface 'interface'; an IN request if 'len' is
+ * nonzero, reading up to 'len' bytes to 'data' */
+int usbsim_host_vendor_request(uint8_t interface, uint8_t request, uint16_t value, void * data, uint16_t len);
+/* bulk transfers of arbitrary length, split into 'packet_size' packets and
+ * retrying naks for up to 'timeout_frames' frames; return the number of bytes
+ * transferred, a short count means a timeout; 'usbsim_host_bulk_read()'
+ * returns once 'len' bytes are read, or on a short packet */
+int usbsim_host_bulk_write(uint8_t ep, const void * data, unsigned len, unsigned packet_size, unsigned timeout_frames);
+int usbsim_host_bulk_read(uint8_t ep, void * buf, unsigned len, unsigned packet_size, unsigned timeout_frames);
+/* as 'usbsim_host_bulk_read()', but reads on past short packets, for byte
+ * stream data which the device may split into packets arbitrarily */
+int usbsim_host_bulk_read_stream(uint8_t ep, void * buf, unsigned len, unsigned packet_size, unsigned timeout_frames);
+/* reset, address and configure the device; returns 0 on success */
+int usbsim_host_enumerate(void);
+uint8_t usbsim_host_ep0_size(void);
+/* look up an endpoint address in the configuration descriptor read during
+ * enumeration; returns -1 if there is no such endpoint */
+int usbsim_host_find_endpoint(uint8_t interface_class, uint8_t attributes, bool in);
+/* the same, for the number of the first interface of a class */
+int usbsim_host_find_interface(uint8_t interface_class);
+/* the same, for the 'n'th interface of a class (counting from zero), as in
+ * a composite device with several functions of the same class */
+int usbsim_host_find_endpoint_nth(uint8_t interface_class, unsigned n, uint8_t attributes, bool in);
+int usbsim_host_find_interface_nth(uint8_t interface_class, unsigned n);
+/* the number of descriptors of a type in the configuration descriptor */
+int usbsim_host_count_descriptors(uint8_t type);
+/* periodic (interrupt endpoint) polling, serviced at the start of every
+ * 'interval' frames before any bulk traffic of the frame, as host
+ * controllers do */
+void usbsim_host_poll_periodic(uint8_t ep, unsigned interval,
+		void (* callback)(uint8_t ep, const void * data, int len));
+/* the same, for an isochronous IN endpoint with 'max_packet' byte packets
+ * (up to 1023), polled every frame; an isochronous transaction has no
+ * handshake - the callback receives the packet the device sent, or the
+ * USBSIM_TIMEOUT of an endpoint that did not respond */
+void usbsim_host_poll_isochronous(uint8_t ep, unsigned max_packet,
+		void (* callback)(uint8_t ep, const void * data, int len));
+void usbsim_host_stop_polling(uint8_t ep);
+/* a single isochronous IN transaction */
+int usbsim_host_iso_in(uint8_t ep, void * buf, unsigned maxlen);
+/* the bus time taken in every frame by the traffic of other devices on the
+ * bus, after the periodic transfers of this device - 0 by default */
+void usbsim_host_set_foreign_load(unsigned bits_per_frame);
+/* the device address the transactions are issued to; set by the
+ * SET_ADDRESS request of 'usbsim_host_control()', and by a bus reset */
+void usbsim_host_set_address(uint8_t address);
+
+/* the transactions the host issues, and its bus resets, as the transaction
+ * functions above - including those issued by the control, bulk and
+ * periodic helpers - see them; 'start' is the bus cycle at which the
+ * transaction went on the bus, 'data' the SETUP or OUT data, or the data
+ * received by an IN transaction, and 'len' the data length, or the maximum
+ * length of an IN transaction; for recording host sessions (session-sim.h) */
+enum usbsim_transaction_type
+{
+	USBSIM_TRANSACTION_RESET,
+	USBSIM_TRANSACTION_SETUP,
+	USBSIM_TRANSACTION_OUT,
+	USBSIM_TRANSACTION_IN,
+	USBSIM_TRANSACTION_ISO_IN,
+};
+
+struct usbsim_transaction
+{
+	uint64_t	start;
+	enum usbsim_transaction_type	type;
+	uint8_t		address;
+	uint8_t		ep;
+	const void	* data;
+	unsigned	len;
+	int		result;
+};
+
+/* called after each transaction, if set */
+extern void (* usbsim_transaction_hook)(const struct usbsim_transaction * t);
+
+#endif /* USBSIM_H */
@@ -0,0 +1,86 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* performance counters of the usb cdc acm firmware (usb-cdc-acm.c); unlike
+ * the statistics (cdcacm-stats.h), which are per port and meant for a
+ * debugger, the counters are a fixed layout block for the host side tools,
+ * read with the CDCACM_REQ_GET_COUNTERS vendor request (cdcacm-requests.h)
+ * on the default control endpoint, without disturbing the data streams; the
+ * host reads them at a fixed rate, and takes the differences of successive
+ * readings - so the counts are 32 bit, and simply wrap around - while the
+ * high-water marks and the maxima are reset by each reading, and cover the
+ * time since the one before */
+
+#ifndef CDCACM_COUNTERS_H
+#define CDCACM_COUNTERS_H
+
+#include <stdint.h>
+
+enum
+{
+	/* the endpoint numbers (endpoint registers) of the usb peripheral */
+	CDCACM_COUNTERS_ENDPOINTS	= 8,
+	/* the serial ports, and the vendor interface port, after them */
+	CDCACM_COUNTERS_PORTS		= 4,
+};
+
+struct cdcacm_endpoint_counters
+{
+	/* the packets transferred, and the bytes in them */
+	uint32_t	packets;
+	uint32_t	bytes;
+	/* the times the endpoint started naking the host because the
+	 * firmware held data back - received packets left in a data OUT
+	 * endpoint, or data left in the tx buffer of a data IN endpoint that
+	 * ran out of packets to send; an endpoint with nothing to transfer
+	 * also naks the host, but that is not counted */
+	uint32_t	naks;
+};
+
+struct cdcacm_counters
+{
+	/* the cpu clock, the unit of the cycle counts below */
+	uint32_t			cpu_hz;
+	/* indexed by the endpoint number, and the direction - 0 for OUT, 1
+	 * for IN; the default control endpoint is not counted */
+	struct cdcacm_endpoint_counters	endpoints[CDCACM_COUNTERS_ENDPOINTS][2];
+	/* the most data the rx and tx buffers of each port held, as seen by
+	 * the driver */
+	uint32_t			rx_high_water[CDCACM_COUNTERS_PORTS];
+	uint32_t			tx_high_water[CDCACM_COUNTERS_PORTS];
+	/* the iterations of the firmware main loop */
+	uint32_t			main_loop_iterations;
+	/* the times the usb peripheral and the ring buffers were serviced -
+	 * usb interrupts, or polls in a polled build - and the longest
+	 * service, in cpu cycles */
+	uint32_t			services;
+	uint32_t			max_service_cycles;
+	/* the longest time the usb peripheral could not be serviced, in cpu
+	 * cycles; in a polled build, the time between two polls, and in an
+	 * interrupt driven one, the time the main loop kept interrupts
+	 * masked */
+	uint32_t			max_service_latency;
+};
+
+extern struct cdcacm_counters cdcacm_counters;
+
+#endif /* CDCACM_COUNTERS_H */
@@ -0,0 +1,62 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* the vendor specific control requests of the usb cdc acm firmware, for the
+ * host side tools; they go to the control interface of a serial port
+ * (wIndex), and concern that port - they are sent on the default control
+ * endpoint, so they do not disturb the data streams of the port */
+
+#ifndef CDCACM_REQUESTS_H
+#define CDCACM_REQUESTS_H
+
+enum
+{
+	/* device to host; the latency probe histogram of the port, a
+	 * 'struct latency_histogram' (see latency-histogram.h) */
+	CDCACM_REQ_GET_LATENCY_HISTOGRAM	= 1,
+	/* host to device, no data stage; clears the latency probe histogram */
+	CDCACM_REQ_CLEAR_LATENCY_HISTOGRAM	= 2,
+	/* device to host; the performance counters of the device, a 'struct
+	 * cdcacm_counters' (see cdcacm-counters.h) - they are not specific to
+	 * the port the request goes to, and reading them resets their
+	 * high-water marks and maxima */
+	CDCACM_REQ_GET_COUNTERS			= 3,
+	/* host to device, no data stage; selects the usb event trace types
+	 * recorded (see usb-trace.h), wValue is the trace mask - zero turns
+	 * tracing off */
+	CDCACM_REQ_SET_TRACE_MASK		= 4,
+	/* device to host; moves the oldest events out of the usb event trace,
+	 * a 'struct usb_trace_header' followed by as many events as there are,
+	 * up to the request length - and the device buffer size,
+	 * USB_CDCACM_TRACE_READ_SIZE of usb-cdc-acm.c */
+	CDCACM_REQ_READ_TRACE			= 5,
+	/* host to device, no data stage; starts the sampling profiler (see
+	 * profiler.h), wValue is the sampling rate in Hz - zero stops it; the
+	 * request is not supported by firmware built without the profiler */
+	CDCACM_REQ_SET_PROFILER			= 6,
+	/* device to host; moves the oldest samples out of the profiler, a
+	 * 'struct profiler_header' followed by the samples, up to the request
+	 * length - and USB_CDCACM_PROFILE_READ_SIZE of usb-cdc-acm.c */
+	CDCACM_REQ_READ_PROFILE			= 7,
+};
+
+#endif /* CDCACM_REQUESTS_H */
@@ -0,0 +1,85 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* statistics of the usb cdc acm firmware (usb-cdc-acm.c); they are kept in
+ * the global 'cdcacm_stats' array, one entry per serial port, and one more for
+ * the vendor interface, if there is one, for a debugger to read - and the
+ * host simulator benchmarks read them directly */
+
+#ifndef CDCACM_STATS_H
+#define CDCACM_STATS_H
+
+#include <stdint.h>
+#include "tx-coalesce.h"
+#include "latency-histogram.h"
+
+struct cdcacm_stats
+{
+	/* data IN packets, see tx-coalesce.h */
+	struct tx_coalesce_stats	tx;
+	/* data IN transfers completed, and their completion latency, in cpu
+	 * cycles - from the first packet of a transfer being passed to the
+	 * endpoint, to the host acknowledging the packet that terminates
+	 * it - in total, and the longest */
+	uint32_t			tx_transfers;
+	uint64_t			tx_transfer_cycles;
+	uint32_t			tx_max_transfer_cycles;
+	/* rx buffer flow control; the number of times the data OUT endpoint
+	 * was made to nak the host because the rx buffer reached its high
+	 * watermark, the frames (milliseconds) it spent naking in total, and
+	 * the longest of these intervals */
+	uint32_t			rx_throttles;
+	uint32_t			rx_throttled_frames;
+	uint32_t			rx_max_throttled_frames;
+	/* SERIAL_STATE notifications sent, and the events (overruns, framing
+	 * errors...) they reported - several events may be coalesced into a
+	 * notification */
+	uint32_t			serial_state_notifications;
+	uint32_t			serial_events;
+	/* latency critical messages sent through the notification endpoint */
+	uint32_t			urgent_messages;
+	/* the isochronous stream of the first port; the packets passed to the
+	 * endpoint, and the bytes in them, the packets that were short of
+	 * data (underruns), the application writes dropped because the sample
+	 * buffer was full (overruns), and the frames the host did not collect
+	 * a packet in */
+	uint32_t			iso_packets;
+	uint32_t			iso_bytes;
+	uint32_t			iso_underruns;
+	uint32_t			iso_overruns;
+	uint32_t			iso_missed_frames;
+	/* the test modes of the serial ports; the bytes generated by the IN
+	 * source or the PRBS generator, the bytes received by the OUT sink or
+	 * the PRBS checker, and the received bytes the checker found in
+	 * error */
+	uint64_t			test_tx_bytes;
+	uint64_t			test_rx_bytes;
+	uint32_t			prbs_errors;
+	/* the latency probe test mode; the time the device takes to answer
+	 * each packet received, in cpu cycles, from its arrival to the answer
+	 * being passed to the data IN endpoint */
+	struct latency_histogram	latency;
+};
+
+extern struct cdcacm_stats cdcacm_stats[];
+
+#endif /* CDCACM_STATS_H */
@@ -0,0 +1,52 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* instrumentation hooks; they expand to nothing in the firmware build, and
+ * the host simulator build (sim/) defines them, to account for the time the
+ * firmware spends in code that the simulator does not model otherwise */
+
+#ifndef INSTRUMENT_H
+#define INSTRUMENT_H
+
+/* a packet has been moved between packet memory and a firmware buffer */
+#ifndef INSTRUMENT_PACKET
+#define INSTRUMENT_PACKET()
+#endif
+
+/* 'halfwords' halfwords of packet memory have been read or written, by the
+ * pma.c copy kernel 'kernel' ('generic', 'aligned' or 'unaligned') */
+#ifndef INSTRUMENT_PMA_COPY
+#define INSTRUMENT_PMA_COPY(kernel, halfwords)
+#endif
+
+/* INSTRUMENT_INTERRUPTED_PC(), if defined, is the program counter that the
+ * SysTick exception of the sampling profiler interrupted (see profiler.c);
+ * the firmware build reads it from the exception stack frame instead */
+
+/* the main loop of a polled build has done the application work of an
+ * iteration; the interrupt driven build's main loop is accounted for by the
+ * simulator's stand-in for __WFI() */
+#ifndef INSTRUMENT_MAIN_LOOP
+#define INSTRUMENT_MAIN_LOOP()
+#endif
+
+#endif /* INSTRUMENT_H */
@@ -0,0 +1,91 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* log scale latency histograms, in cpu cycles; each octave of latencies - from
+ * 2^LATENCY_HISTOGRAM_FIRST_OCTAVE cycles up - is split into
+ * LATENCY_HISTOGRAM_STEPS buckets of equal width, so that the resolution of
+ * a bucket is a fixed fraction of the latencies it counts; the first bucket
+ * also counts all shorter latencies, the last one all longer ones; the
+ * firmware keeps the histograms, and the host side tools share the bucket
+ * bounds, for computing percentiles */
+
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <stdint.h>
+
+enum
+{
+	/* 2^8 cycles at 72 mhz is 3.6 us, 2^24 cycles 233 ms */
+	LATENCY_HISTOGRAM_FIRST_OCTAVE	= 8,
+	LATENCY_HISTOGRAM_OCTAVES	= 16,
+	LATENCY_HISTOGRAM_STEP_BITS	= 2,
+	LATENCY_HISTOGRAM_STEPS		= 1 << LATENCY_HISTOGRAM_STEP_BITS,
+	LATENCY_HISTOGRAM_BUCKETS	= LATENCY_HISTOGRAM_OCTAVES * LATENCY_HISTOGRAM_STEPS,
+};
+
+/* the same layout on the firmware and the host side, which reads it from
+ * the device */
+struct latency_histogram
+{
+	uint64_t	total;
+	uint32_t	count;
+	uint32_t	min, max;
+	uint32_t	buckets[LATENCY_HISTOGRAM_BUCKETS];
+};
+
+/* the bucket a latency is counted in */
+static inline unsigned latency_histogram_bucket(uint32_t cycles)
+{
+	unsigned octave;
+
+	if (cycles < 1u << LATENCY_HISTOGRAM_FIRST_OCTAVE)
+		return 0;
+	octave = 31 - __builtin_clz(cycles);
+	if (octave >= LATENCY_HISTOGRAM_FIRST_OCTAVE + LATENCY_HISTOGRAM_OCTAVES)
+		return LATENCY_HISTOGRAM_BUCKETS - 1;
+	/* the steps are the bits below the leading one */
+	return (octave - LATENCY_HISTOGRAM_FIRST_OCTAVE) * LATENCY_HISTOGRAM_STEPS
+		+ (cycles >> (octave - LATENCY_HISTOGRAM_STEP_BITS)) % LATENCY_HISTOGRAM_STEPS;
+}
+
+/* the shortest latency counted in a bucket - but for the first one */
+static inline uint32_t latency_histogram_bucket_start(unsigned bucket)
+{
+	unsigned octave = bucket / LATENCY_HISTOGRAM_STEPS + LATENCY_HISTOGRAM_FIRST_OCTAVE;
+
+	return (uint32_t) (LATENCY_HISTOGRAM_STEPS + bucket % LATENCY_HISTOGRAM_STEPS)
+		<< (octave - LATENCY_HISTOGRAM_STEP_BITS);
+}
+
+static inline void latency_histogram_add(struct latency_histogram * h, uint32_t cycles)
+{
+	if (!h->count || cycles < h->min)
+		h->min = cycles;
+	if (cycles > h->max)
+		h->max = cycles;
+	h->count ++;
+	h->total += cycles;
+	h->buckets[latency_histogram_bucket(cycles)] ++;
+}
+
+#endif /* LATENCY_HISTOGRAM_H */
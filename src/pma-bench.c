@@ -0,0 +1,119 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* packet memory copy kernel benchmark; see pma-bench.h */
+
+#include <string.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/dwt.h>
+#include "pma.h"
+#include "pma-bench.h"
+
+enum
+{
+	/* the packet memory byte offset copied to and from, past the buffer
+	 * descriptor table */
+	BENCH_PMA_ADDR		= 0x100,
+};
+
+struct pma_bench_result pma_bench_results[PMA_BENCH_MAX_RESULTS];
+volatile unsigned pma_bench_result_count;
+
+static const struct
+{
+	const char	* kernel;
+	void		(* write)(uint16_t pma_addr, const void * buf, uint16_t len);
+	void		(* read)(void * buf, uint16_t pma_addr, uint16_t len);
+	/* the offset of the copied data from a word aligned buffer */
+	unsigned	offset;
+}
+bench_cases[] =
+{
+	{ "generic",	pma_write_generic,	pma_read_generic,	0, },
+	{ "generic",	pma_write_generic,	pma_read_generic,	1, },
+	{ "aligned",	pma_write_aligned,	pma_read_aligned,	0, },
+	{ "unaligned",	pma_write_unaligned,	pma_read_unaligned,	1, },
+	{ "dma",	pma_write_dma,		pma_read_dma,		0, },
+	{ "pma_write",	pma_write,		pma_read,		0, },
+	{ "pma_write",	pma_write,		pma_read,		1, },
+};
+
+_Static_assert(sizeof bench_cases / sizeof * bench_cases <= PMA_BENCH_MAX_RESULTS,
+		"too many benchmark cases");
+
+static uint32_t source[PMA_BENCH_PACKET_SIZE / 4 + 1];
+static uint32_t destination[PMA_BENCH_PACKET_SIZE / 4 + 1];
+
+/* the cycles taken by back to back cycle counter reads */
+static uint32_t measurement_overhead(void)
+{
+	uint32_t t = dwt_read_cycle_counter();
+
+	return dwt_read_cycle_counter() - t;
+}
+
+static void run_case(unsigned i, uint32_t overhead)
+{
+	const uint8_t * src = (const uint8_t *) source + bench_cases[i].offset;
+	uint8_t * dst = (uint8_t *) destination + bench_cases[i].offset;
+	uint32_t write_cycles = 0, read_cycles = 0, t;
+	unsigned n;
+
+	memset(destination, 0, sizeof destination);
+	for (n = 0; n < PMA_BENCH_ITERATIONS; n ++)
+	{
+		t = dwt_read_cycle_counter();
+		bench_cases[i].write(BENCH_PMA_ADDR, src, PMA_BENCH_PACKET_SIZE);
+		write_cycles += dwt_read_cycle_counter() - t - overhead;
+		t = dwt_read_cycle_counter();
+		bench_cases[i].read(dst, BENCH_PMA_ADDR, PMA_BENCH_PACKET_SIZE);
+		read_cycles += dwt_read_cycle_counter() - t - overhead;
+	}
+	pma_bench_results[i] = (struct pma_bench_result)
+	{
+		.kernel		= bench_cases[i].kernel,
+		.buffer		= bench_cases[i].offset & 3 ? "unaligned" : "aligned",
+		.write_cycles	= write_cycles / PMA_BENCH_ITERATIONS,
+		.read_cycles	= read_cycles / PMA_BENCH_ITERATIONS,
+		.is_correct	= !memcmp(src, dst, PMA_BENCH_PACKET_SIZE),
+	};
+}
+
+int main(void)
+{
+	unsigned i;
+	uint32_t overhead;
+
+	rcc_clock_setup_in_hse_8mhz_out_72mhz();
+	/* the packet memory is only accessible with the usb peripheral clocked */
+	rcc_periph_clock_enable(RCC_USB);
+	dwt_enable_cycle_counter();
+	for (i = 0; i < sizeof source; i ++)
+		((uint8_t *) source)[i] = i * 7 + 1;
+	overhead = measurement_overhead();
+	for (i = 0; i < sizeof bench_cases / sizeof * bench_cases; i ++)
+		run_case(i, overhead);
+	pma_bench_result_count = i;
+	while (1)
+		__WFI();
+}
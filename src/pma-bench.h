@@ -0,0 +1,60 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* a cycle count benchmark of the packet memory copy kernels (pma.c)
+ *
+ * this is a firmware image of its own - 'make BINARY=pma-bench' - which times
+ * writes and reads of a full speed packet with each kernel, using the dwt
+ * cycle counter, and stores the results in 'pma_bench_results'; read them
+ * with a debugger once 'pma_bench_result_count' is nonzero. the host
+ * simulator runs the same code against its cost model (sim/bench-pma-copy.c) */
+
+#ifndef PMA_BENCH_H
+#define PMA_BENCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+enum
+{
+	PMA_BENCH_PACKET_SIZE		= 64,
+	PMA_BENCH_ITERATIONS		= 16,
+	PMA_BENCH_MAX_RESULTS		= 8,
+};
+
+struct pma_bench_result
+{
+	const char	* kernel;
+	/* the alignment of the firmware buffer copied to or from */
+	const char	* buffer;
+	/* average cycles per packet, less the cycle counter read overhead */
+	uint32_t	write_cycles;
+	uint32_t	read_cycles;
+	/* the data read back matches the data written */
+	bool		is_correct;
+};
+
+extern struct pma_bench_result pma_bench_results[PMA_BENCH_MAX_RESULTS];
+/* the number of results, set once the benchmark has completed */
+extern volatile unsigned pma_bench_result_count;
+
+#endif /* PMA_BENCH_H */
@@ -0,0 +1,301 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* usb packet memory access; see pma.h */
+
+#include <stdbool.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/stm32/st_usbfs.h>
+#include "pma.h"
+#include "instrument.h"
+
+/* use the dma kernels for copies of at least PMA_COPY_DMA_MIN_LENGTH bytes;
+ * on the f103 a dma transfer of a full speed packet is not faster than the
+ * unrolled cpu copies, this only pays off where the cpu could do something
+ * else meanwhile, so it is off by default */
+#ifndef PMA_COPY_USE_DMA
+#define PMA_COPY_USE_DMA		0
+#endif
+
+#ifndef PMA_COPY_DMA_MIN_LENGTH
+#define PMA_COPY_DMA_MIN_LENGTH		32
+#endif
+
+/* the dma1 channel the dma kernels use */
+#ifndef PMA_COPY_DMA_CHANNEL
+#define PMA_COPY_DMA_CHANNEL		DMA_CHANNEL7
+#endif
+
+/* the cpu address of the pma halfword holding byte 'pma_addr' */
+static volatile uint16_t * pma_halfword(uint16_t pma_addr)
+{
+	return (volatile uint16_t *) (USB_PMA_BASE + (pma_addr & ~ 1) * 2);
+}
+
+void pma_write(uint16_t pma_addr, const void * buf, uint16_t len)
+{
+	const uint8_t * p = buf;
+
+	if (!len)
+		return;
+	if (pma_addr & 1)
+	{
+		pma_write_generic(pma_addr ++, p ++, 1);
+		len --;
+	}
+	if (PMA_COPY_USE_DMA && len >= PMA_COPY_DMA_MIN_LENGTH && !((uintptr_t) p & 1))
+		pma_write_dma(pma_addr, p, len);
+	else if ((uintptr_t) p & 3)
+		pma_write_unaligned(pma_addr, p, len);
+	else
+		pma_write_aligned(pma_addr, p, len);
+}
+
+void pma_read(void * buf, uint16_t pma_addr, uint16_t len)
+{
+	uint8_t * p = buf;
+
+	if (!len)
+		return;
+	if (pma_addr & 1)
+	{
+		pma_read_generic(p ++, pma_addr ++, 1);
+		len --;
+	}
+	if (PMA_COPY_USE_DMA && len >= PMA_COPY_DMA_MIN_LENGTH && !((uintptr_t) p & 1))
+		pma_read_dma(p, pma_addr, len);
+	else if ((uintptr_t) p & 3)
+		pma_read_unaligned(p, pma_addr, len);
+	else
+		pma_read_aligned(p, pma_addr, len);
+}
+
+void pma_write_generic(uint16_t pma_addr, const void * buf, uint16_t len)
+{
+	const uint8_t * p = buf;
+	volatile uint16_t * pm = pma_halfword(pma_addr);
+	uint16_t halfwords = (len + (pma_addr & 1) + 1) / 2;
+
+	if (!len)
+		return;
+	if (pma_addr & 1)
+	{
+		/* the lower byte of the first halfword is not ours, keep it */
+		* pm = (* pm & 0xff) | (* p ++ << 8);
+		pm += 2;
+		len --;
+	}
+	for (; len > 1; len -= 2, p += 2, pm += 2)
+		* pm = p[0] | (p[1] << 8);
+	if (len)
+		* pm = * p;
+	INSTRUMENT_PMA_COPY(generic, halfwords);
+}
+
+void pma_read_generic(void * buf, uint16_t pma_addr, uint16_t len)
+{
+	uint8_t * p = buf;
+	const volatile uint16_t * pm = pma_halfword(pma_addr);
+	uint16_t halfwords = (len + (pma_addr & 1) + 1) / 2;
+
+	if (!len)
+		return;
+	if (pma_addr & 1)
+	{
+		* p ++ = * pm >> 8;
+		pm += 2;
+		len --;
+	}
+	for (; len > 1; len -= 2, pm += 2)
+	{
+		uint16_t x = * pm;
+		* p ++ = x;
+		* p ++ = x >> 8;
+	}
+	if (len)
+		* p = * pm;
+	INSTRUMENT_PMA_COPY(generic, halfwords);
+}
+
+/* the unrolled kernels move eight bytes per iteration, and leave the last
+ * (len % 8) bytes to the generic kernels */
+void pma_write_aligned(uint16_t pma_addr, const void * buf, uint16_t len)
+{
+	const uint32_t * p = buf;
+	volatile uint16_t * pm = pma_halfword(pma_addr);
+	uint16_t n;
+
+	for (n = len / 8; n; n --, p += 2, pm += 8)
+	{
+		uint32_t a = p[0], b = p[1];
+		pm[0] = a;
+		pm[2] = a >> 16;
+		pm[4] = b;
+		pm[6] = b >> 16;
+	}
+	INSTRUMENT_PMA_COPY(aligned, len / 8 * 4);
+	pma_write_generic(pma_addr + (len & ~ 7), p, len & 7);
+}
+
+void pma_read_aligned(void * buf, uint16_t pma_addr, uint16_t len)
+{
+	uint32_t * p = buf;
+	const volatile uint16_t * pm = pma_halfword(pma_addr);
+	uint16_t n;
+
+	for (n = len / 8; n; n --, p += 2, pm += 8)
+	{
+		p[0] = pm[0] | (uint32_t) pm[2] << 16;
+		p[1] = pm[4] | (uint32_t) pm[6] << 16;
+	}
+	INSTRUMENT_PMA_COPY(aligned, len / 8 * 4);
+	pma_read_generic(p, pma_addr + (len & ~ 7), len & 7);
+}
+
+void pma_write_unaligned(uint16_t pma_addr, const void * buf, uint16_t len)
+{
+	const uint8_t * p = buf;
+	volatile uint16_t * pm = pma_halfword(pma_addr);
+	uint16_t n;
+
+	for (n = len / 8; n; n --, p += 8, pm += 8)
+	{
+		pm[0] = p[0] | (p[1] << 8);
+		pm[2] = p[2] | (p[3] << 8);
+		pm[4] = p[4] | (p[5] << 8);
+		pm[6] = p[6] | (p[7] << 8);
+	}
+	INSTRUMENT_PMA_COPY(unaligned, len / 8 * 4);
+	pma_write_generic(pma_addr + (len & ~ 7), p, len & 7);
+}
+
+void pma_read_unaligned(void * buf, uint16_t pma_addr, uint16_t len)
+{
+	uint8_t * p = buf;
+	const volatile uint16_t * pm = pma_halfword(pma_addr);
+	uint16_t n;
+
+	for (n = len / 8; n; n --, p += 8, pm += 8)
+	{
+		uint16_t a = pm[0], b = pm[2], c = pm[4], d = pm[6];
+		p[0] = a, p[1] = a >> 8;
+		p[2] = b, p[3] = b >> 8;
+		p[4] = c, p[5] = c >> 8;
+		p[6] = d, p[7] = d >> 8;
+	}
+	INSTRUMENT_PMA_COPY(unaligned, len / 8 * 4);
+	pma_read_generic(p, pma_addr + (len & ~ 7), len & 7);
+}
+
+/* a memory-to-memory transfer of 'halfwords' halfwords between packet memory
+ * and a firmware buffer; the packet memory side is set up as the dma
+ * 'peripheral', accessed in words, so that its address advances by four
+ * bytes per halfword - the dma zero extends the halfwords it writes to
+ * packet memory, and keeps the lower halfword of the words it reads */
+static void pma_dma_transfer(volatile uint16_t * pm, void * buf, uint16_t halfwords, bool is_write)
+{
+	static bool is_dma_clock_enabled;
+	const uint8_t channel = PMA_COPY_DMA_CHANNEL;
+
+	if (!is_dma_clock_enabled)
+	{
+		rcc_periph_clock_enable(RCC_DMA1);
+		is_dma_clock_enabled = true;
+	}
+	dma_channel_reset(DMA1, channel);
+	dma_set_peripheral_address(DMA1, channel, (uintptr_t) pm);
+	dma_set_memory_address(DMA1, channel, (uintptr_t) buf);
+	dma_set_number_of_data(DMA1, channel, halfwords);
+	if (is_write)
+		dma_set_read_from_memory(DMA1, channel);
+	else
+		dma_set_read_from_peripheral(DMA1, channel);
+	dma_set_peripheral_size(DMA1, channel, DMA_CCR_PSIZE_32BIT);
+	dma_set_memory_size(DMA1, channel, DMA_CCR_MSIZE_16BIT);
+	dma_enable_peripheral_increment_mode(DMA1, channel);
+	dma_enable_memory_increment_mode(DMA1, channel);
+	dma_set_priority(DMA1, channel, DMA_CCR_PL_VERY_HIGH);
+	dma_enable_mem2mem_mode(DMA1, channel);
+	dma_enable_channel(DMA1, channel);
+	while (!dma_get_interrupt_flag(DMA1, channel, DMA_TCIF))
+		;
+	dma_disable_channel(DMA1, channel);
+	dma_clear_interrupt_flags(DMA1, channel, DMA_TCIF);
+}
+
+void pma_write_dma(uint16_t pma_addr, const void * buf, uint16_t len)
+{
+	if (len > 1)
+		pma_dma_transfer(pma_halfword(pma_addr), (void *) buf, len / 2, true);
+	if (len & 1)
+		pma_write_generic(pma_addr + len - 1, (const uint8_t *) buf + len - 1, 1);
+}
+
+void pma_read_dma(void * buf, uint16_t pma_addr, uint16_t len)
+{
+	/* a halfword transfer of an odd length would write a byte past the
+	 * buffer end, the last byte is read separately */
+	if (len > 1)
+		pma_dma_transfer(pma_halfword(pma_addr), buf, len / 2, false);
+	if (len & 1)
+		pma_read_generic((uint8_t *) buf + len - 1, pma_addr + len - 1, 1);
+}
+
+void pma_write_from_ringbuf(uint16_t pma_addr, struct ringbuf * r, uint16_t len)
+{
+	const uint8_t * data;
+	uint32_t chunk;
+
+	/* at most two chunks, if the data wraps around the ring buffer end */
+	while (len)
+	{
+		chunk = ringbuf_read_region(r, & data);
+		if (!chunk)
+			break;
+		if (chunk > len)
+			chunk = len;
+		pma_write(pma_addr, data, chunk);
+		ringbuf_commit_read(r, chunk);
+		pma_addr += chunk;
+		len -= chunk;
+	}
+}
+
+void pma_read_to_ringbuf(struct ringbuf * r, uint16_t pma_addr, uint16_t len)
+{
+	uint8_t * data;
+	uint32_t chunk;
+
+	while (len)
+	{
+		chunk = ringbuf_write_region(r, & data);
+		if (!chunk)
+			break;
+		if (chunk > len)
+			chunk = len;
+		pma_read(data, pma_addr, chunk);
+		ringbuf_commit_write(r, chunk);
+		pma_addr += chunk;
+		len -= chunk;
+	}
+}
@@ -0,0 +1,68 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* access to the usb packet memory area (pma) of the stm32f103
+ *
+ * the pma is 512 bytes of 16 bit wide memory, shared by the cpu and the usb
+ * peripheral; the cpu sees it at a 32 bit stride - i.e. pma halfword 'n' is
+ * at cpu address USB_PMA_BASE + 4 * n - and may only access it in halfwords
+ * (or words, of which only the lower halfword is meaningful); the packet
+ * memory addresses used here are pma byte offsets, as in the buffer
+ * descriptor table, and may be odd */
+
+#ifndef PMA_H
+#define PMA_H
+
+#include <stdint.h>
+#include "ringbuf.h"
+
+/* byte copies between a firmware buffer and packet memory; these pick the
+ * fastest of the copy kernels below for the alignment of the buffer */
+void pma_write(uint16_t pma_addr, const void * buf, uint16_t len);
+void pma_read(void * buf, uint16_t pma_addr, uint16_t len);
+
+/* the individual copy kernels, exported for benchmarking (pma-bench.c):
+ *	- 'generic' moves a halfword per iteration, as the libopencm3 st_usbfs
+ *	driver does, and takes any buffer and packet memory address
+ *	- 'aligned' needs a word aligned buffer, which it accesses in words,
+ *	four pma halfwords per (unrolled) iteration
+ *	- 'unaligned' takes any buffer, which it accesses in bytes, four pma
+ *	halfwords per iteration
+ *	- 'dma' needs a halfword aligned buffer, and moves it with a
+ *	memory-to-memory dma transfer, waiting for it to complete
+ * all but the generic kernels need an even packet memory address */
+void pma_write_generic(uint16_t pma_addr, const void * buf, uint16_t len);
+void pma_read_generic(void * buf, uint16_t pma_addr, uint16_t len);
+void pma_write_aligned(uint16_t pma_addr, const void * buf, uint16_t len);
+void pma_read_aligned(void * buf, uint16_t pma_addr, uint16_t len);
+void pma_write_unaligned(uint16_t pma_addr, const void * buf, uint16_t len);
+void pma_read_unaligned(void * buf, uint16_t pma_addr, uint16_t len);
+void pma_write_dma(uint16_t pma_addr, const void * buf, uint16_t len);
+void pma_read_dma(void * buf, uint16_t pma_addr, uint16_t len);
+
+/* moves 'len' bytes from a ring buffer to packet memory, and from packet
+ * memory to a ring buffer, without intermediate copies; the ring buffer must
+ * hold at least, or have room for at least, 'len' bytes */
+void pma_write_from_ringbuf(uint16_t pma_addr, struct ringbuf * r, uint16_t len);
+void pma_read_to_ringbuf(struct ringbuf * r, uint16_t pma_addr, uint16_t len);
+
+#endif /* PMA_H */
@@ -0,0 +1,90 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* a PRBS-31 (x^31 + x^28 + 1) byte stream generator, and a self synchronizing
+ * checker for it, for link integrity tests; the firmware and the host side
+ * test programs share them
+ *
+ * the generator shifts its 31 bit state by a byte at a time - the next 8 bits
+ * only depend on bits of the current state, as the taps are at least 8 bits
+ * apart from the ends - and emits the new bits, most significant bit first;
+ * the checker predicts each byte from the last 4 bytes received, instead of
+ * from a state of its own, so it needs no seed, picks up the stream anywhere,
+ * and recovers by itself from lost or duplicated data; a single bit error is
+ * counted in the byte it is in, and in the up to 3 bytes predicted from it */
+
+#ifndef PRBS_H
+#define PRBS_H
+
+#include <stdint.h>
+
+/* the generator seed; any nonzero state will do */
+enum
+{
+	PRBS_SEED	= 0x7fffffff,
+};
+
+static inline uint8_t prbs_next(uint32_t * state)
+{
+	uint8_t byte = (* state >> 23 ^ * state >> 20) & 0xff;
+
+	* state = * state << 8 | byte;
+	return byte;
+}
+
+static inline void prbs_generate(uint32_t * state, uint8_t * data, uint32_t len)
+{
+	while (len --)
+		* data ++ = prbs_next(state);
+}
+
+struct prbs_checker
+{
+	/* the last bytes received, and how many of them are valid - up to the
+	 * 4 needed to predict the next one */
+	uint32_t	state;
+	uint8_t		sync;
+};
+
+static inline void prbs_checker_reset(struct prbs_checker * c)
+{
+	c->state = c->sync = 0;
+}
+
+/* checks 'len' received bytes; returns the number of bytes found in error */
+static inline uint32_t prbs_check(struct prbs_checker * c, const uint8_t * data, uint32_t len)
+{
+	uint32_t errors = 0, state = c->state;
+
+	for (; len && c->sync < 4; len --, c->sync ++)
+		state = state << 8 | * data ++;
+	while (len --)
+	{
+		errors += prbs_next(& state) != * data;
+		/* carry on from the byte received */
+		state = (state & ~ 0xff) | * data ++;
+	}
+	c->state = state;
+	return errors;
+}
+
+#endif /* PRBS_H */
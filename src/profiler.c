@@ -0,0 +1,116 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* the sampling profiler; see profiler.h */
+
+#include <string.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/cm3/systick.h>
+#include <libopencm3/cm3/nvic.h>
+#include "ringbuf.h"
+#include "profiler.h"
+#include "instrument.h"
+
+/* the ring size, in samples; a power of two */
+#ifndef PROFILER_SAMPLES
+#define PROFILER_SAMPLES	256
+#endif
+
+_Static_assert(RINGBUF_IS_POWER_OF_TWO(PROFILER_SAMPLES), "bad PROFILER_SAMPLES");
+
+/* the SysTick handler is the producer of the ring, and the reader its
+ * consumer; the same scheme as that of the ring buffers (ringbuf.h) */
+static struct
+{
+	uint32_t	period;
+	uint32_t	head, tail;
+	uint32_t	dropped;
+	uint32_t	samples[PROFILER_SAMPLES];
+}
+profiler;
+
+void profiler_sample(uint32_t pc);
+
+void profiler_sample(uint32_t pc)
+{
+	uint32_t head = profiler.head;
+
+	if (head - ringbuf_load(& profiler.tail) == PROFILER_SAMPLES)
+	{
+		profiler.dropped ++;
+		return;
+	}
+	profiler.samples[head & (PROFILER_SAMPLES - 1)] = pc;
+	ringbuf_store(& profiler.head, head + 1);
+}
+
+#ifdef INSTRUMENT_INTERRUPTED_PC
+void sys_tick_handler(void)
+{
+	profiler_sample(INSTRUMENT_INTERRUPTED_PC());
+}
+#else
+/* the interrupted program counter is the seventh word of the exception stack
+ * frame, which the core has pushed on the main stack - the firmware does not
+ * use the process stack */
+void __attribute__((naked)) sys_tick_handler(void)
+{
+	__asm__ volatile (
+		"mrs	r0, msp\n"
+		"ldr	r0, [r0, #24]\n"
+		"b	profiler_sample\n");
+}
+#endif
+
+void profiler_start(uint32_t period)
+{
+	systick_interrupt_disable();
+	systick_counter_disable();
+	profiler.period = period;
+	if (!period)
+		return;
+	/* SysTick preempts the usb interrupt handler, so that usb servicing
+	 * is profiled too */
+	nvic_set_priority(NVIC_SYSTICK_IRQ, 0);
+	nvic_set_priority(NVIC_USB_LP_CAN_RX0_IRQ, 1 << 4);
+	systick_set_clocksource(STK_CSR_CLKSOURCE_AHB);
+	systick_set_reload(period - 1);
+	systick_clear();
+	systick_interrupt_enable();
+	systick_counter_enable();
+}
+
+uint32_t profiler_read(void * buf, uint32_t len)
+{
+	struct profiler_header header =
+		{ .cpu_hz = rcc_ahb_frequency, .period = profiler.period, .dropped = profiler.dropped, };
+	uint32_t * samples = (uint32_t *) ((uint8_t *) buf + sizeof header);
+	uint32_t tail = profiler.tail, n;
+
+	if (len < sizeof header)
+		return 0;
+	memcpy(buf, & header, sizeof header);
+	for (n = 0; tail != ringbuf_load(& profiler.head) && sizeof header + (n + 1) * sizeof * samples <= len; n ++)
+		samples[n] = profiler.samples[tail ++ & (PROFILER_SAMPLES - 1)];
+	ringbuf_store(& profiler.tail, tail);
+	return sizeof header + n * sizeof * samples;
+}
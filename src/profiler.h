@@ -0,0 +1,63 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* a sampling profiler, for finding out where the cycles go; SysTick
+ * interrupts the cpu every 'period' cycles, at a priority above that of
+ * the usb interrupt, and its handler records the program counter it
+ * interrupted in a ring in ram, which the host drains - with a vendor
+ * request of the usb cdc acm firmware (cdcacm-requests.h) - and symbolizes
+ * against the firmware elf file (see host/cdcacm-profile.c)
+ *
+ * the profiler is optional, it is built with 'make PROFILER=1'; it defines
+ * sys_tick_handler(), so SysTick is not available to the application then;
+ * sections that run with interrupts masked are sampled at their end, and
+ * the samples of a ring that is not drained in time are dropped, and
+ * counted
+ *
+ * the data read from the profiler is a 'struct profiler_header', followed by
+ * the samples, oldest first, as 32 bit program counter values; this header
+ * is shared with the host side tools */
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+
+struct profiler_header
+{
+	/* the cpu clock, and the sampling period, in cpu cycles - zero if
+	 * the profiler is stopped */
+	uint32_t	cpu_hz;
+	uint32_t	period;
+	/* the samples not recorded so far because the ring was full */
+	uint32_t	dropped;
+};
+
+/* starts sampling every 'period' cpu cycles, from 2 to 2^24, or stops
+ * sampling, with a zero 'period' */
+void profiler_start(uint32_t period);
+/* moves the oldest samples out of the ring to 'buf', after a 'struct
+ * profiler_header', as many as fit in 'len' bytes; returns the number of
+ * bytes written */
+uint32_t profiler_read(void * buf, uint32_t len);
+
+#endif /* PROFILER_H */
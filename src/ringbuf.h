@@ -0,0 +1,207 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* single producer, single consumer, lock-free byte ring buffers
+ *
+ * one side - e.g. a usb endpoint handler running in interrupt context - only
+ * ever writes to a ring buffer, and the other side - e.g. the application
+ * main loop - only ever reads from it; the writer only updates 'head', and
+ * the reader only updates 'tail', so no locking is needed on a single core
+ * machine, and no interrupts need to be disabled; the indices run freely and
+ * wrap around at 2^32, the buffer size is a power of two, so that an index
+ * is turned into a buffer offset by masking, and the number of used bytes is
+ * always 'head - tail'
+ *
+ * the cortex-m3 has no data cache; the indices are still kept on separate
+ * cache lines, and the buffer storage is meant to be cache line aligned
+ * (see RINGBUF_ALIGNED), so that the layout stays right for cores that have
+ * one, and for word sized and dma transfers to and from the buffer */
+
+#ifndef RINGBUF_H
+#define RINGBUF_H
+
+#include <stdint.h>
+#include <string.h>
+
+#ifndef RINGBUF_CACHE_LINE_SIZE
+#define RINGBUF_CACHE_LINE_SIZE		32
+#endif
+
+#define RINGBUF_ALIGNED			__attribute__((aligned(RINGBUF_CACHE_LINE_SIZE)))
+#define RINGBUF_IS_POWER_OF_TWO(x)	((x) && !((x) & ((x) - 1)))
+
+struct ringbuf
+{
+	/* written by the producer only */
+	uint32_t	head RINGBUF_ALIGNED;
+	/* written by the consumer only */
+	uint32_t	tail RINGBUF_ALIGNED;
+	/* constant after initialization */
+	uint32_t	mask RINGBUF_ALIGNED;
+	uint8_t		* data;
+};
+
+/* the index updates are release stores, and the index reads of the other side
+ * are acquire loads; on the cortex-m3 these compile to plain loads and
+ * stores, and keep the compiler from moving the buffer accesses across the
+ * index updates */
+static inline uint32_t ringbuf_load(const uint32_t * index)
+{
+	return __atomic_load_n(index, __ATOMIC_ACQUIRE);
+}
+
+static inline void ringbuf_store(uint32_t * index, uint32_t value)
+{
+	__atomic_store_n(index, value, __ATOMIC_RELEASE);
+}
+
+/* 'size' must be a power of two */
+static inline void ringbuf_init(struct ringbuf * r, uint8_t * data, uint32_t size)
+{
+	r->head = r->tail = 0;
+	r->mask = size - 1;
+	r->data = data;
+}
+
+/* empties the ring buffer; neither side may access it meanwhile */
+static inline void ringbuf_reset(struct ringbuf * r)
+{
+	r->head = r->tail = 0;
+}
+
+static inline uint32_t ringbuf_size(const struct ringbuf * r)
+{
+	return r->mask + 1;
+}
+
+static inline uint32_t ringbuf_used(const struct ringbuf * r)
+{
+	return ringbuf_load(& r->head) - ringbuf_load(& r->tail);
+}
+
+static inline uint32_t ringbuf_free(const struct ringbuf * r)
+{
+	return ringbuf_size(r) - ringbuf_used(r);
+}
+
+/* producer side; writes as much of 'buf' as fits, returns the number of
+ * bytes written */
+static inline uint32_t ringbuf_write(struct ringbuf * r, const void * buf, uint32_t len)
+{
+	uint32_t head = r->head, offset = head & r->mask, chunk;
+	uint32_t space = ringbuf_size(r) - (head - ringbuf_load(& r->tail));
+
+	if (len > space)
+		len = space;
+	chunk = ringbuf_size(r) - offset;
+	if (chunk > len)
+		chunk = len;
+	memcpy(r->data + offset, buf, chunk);
+	memcpy(r->data, (const uint8_t *) buf + chunk, len - chunk);
+	ringbuf_store(& r->head, head + len);
+	return len;
+}
+
+/* consumer side; reads up to 'len' bytes, returns the number of bytes read */
+static inline uint32_t ringbuf_read(struct ringbuf * r, void * buf, uint32_t len)
+{
+	uint32_t tail = r->tail, offset = tail & r->mask, chunk;
+	uint32_t used = ringbuf_load(& r->head) - tail;
+
+	if (len > used)
+		len = used;
+	chunk = ringbuf_size(r) - offset;
+	if (chunk > len)
+		chunk = len;
+	memcpy(buf, r->data + offset, chunk);
+	memcpy((uint8_t *) buf + chunk, r->data, len - chunk);
+	ringbuf_store(& r->tail, tail + len);
+	return len;
+}
+
+/* zero copy access; the producer gets the free space that is contiguous in
+ * memory, fills in (part of) it, and then commits the bytes written - the
+ * consumer can not see them before that; the free space may be split in two
+ * by the buffer end, and then the second part is returned by a second call,
+ * after the first part is committed */
+static inline uint32_t ringbuf_write_region(struct ringbuf * r, uint8_t ** data)
+{
+	uint32_t head = r->head, offset = head & r->mask;
+	uint32_t space = ringbuf_size(r) - (head - ringbuf_load(& r->tail));
+
+	* data = r->data + offset;
+	return space < ringbuf_size(r) - offset ? space : ringbuf_size(r) - offset;
+}
+
+static inline void ringbuf_commit_write(struct ringbuf * r, uint32_t len)
+{
+	ringbuf_store(& r->head, r->head + len);
+}
+
+/* the same, for the consumer */
+static inline uint32_t ringbuf_read_region(struct ringbuf * r, const uint8_t ** data)
+{
+	uint32_t tail = r->tail, offset = tail & r->mask;
+	uint32_t used = ringbuf_load(& r->head) - tail;
+
+	* data = r->data + offset;
+	return used < ringbuf_size(r) - offset ? used : ringbuf_size(r) - offset;
+}
+
+static inline void ringbuf_commit_read(struct ringbuf * r, uint32_t len)
+{
+	ringbuf_store(& r->tail, r->tail + len);
+}
+
+/* consumer side; the byte at index 'index' - which must be between the tail
+ * and the head - without reading it */
+static inline uint8_t ringbuf_peek(const struct ringbuf * r, uint32_t index)
+{
+	return r->data[index & r->mask];
+}
+
+/* moves up to 'len' bytes from one ring buffer to another, without
+ * intermediate copies; the caller is the consumer of 'from', and the producer
+ * of 'to'; returns the number of bytes moved */
+static inline uint32_t ringbuf_move(struct ringbuf * to, struct ringbuf * from, uint32_t len)
+{
+	const uint8_t * data;
+	uint32_t chunk, moved = 0;
+
+	if (len > ringbuf_used(from))
+		len = ringbuf_used(from);
+	if (len > ringbuf_free(to))
+		len = ringbuf_free(to);
+	/* at most two chunks, if the data wraps around the end of 'from' */
+	while (moved < len)
+	{
+		chunk = ringbuf_read_region(from, & data);
+		if (chunk > len - moved)
+			chunk = len - moved;
+		ringbuf_write(to, data, chunk);
+		ringbuf_commit_read(from, chunk);
+		moved += chunk;
+	}
+	return moved;
+}
+
+#endif /* RINGBUF_H */
@@ -0,0 +1,150 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* transmit coalescing; see tx-coalesce.h */
+
+#include "tx-coalesce.h"
+
+void tx_coalesce_init(struct tx_coalesce * c, uint16_t packet_size, uint8_t max_deadline,
+		struct tx_coalesce_stats * stats)
+{
+	c->packet_size = packet_size;
+	c->max_deadline = max_deadline;
+	c->stats = stats;
+	tx_coalesce_reset(c);
+}
+
+void tx_coalesce_reset(struct tx_coalesce * c)
+{
+	c->flush_mark = c->deadline_mark = c->frame_head = 0;
+	c->flush_count = c->flush_count_done = 0;
+	c->rate = 0;
+	c->deadline = c->age = 0;
+	c->is_deadline_armed = c->is_transfer_open = false;
+	c->stats->deadline = 0;
+}
+
+void tx_coalesce_flush(struct tx_coalesce * c, const struct ringbuf * r)
+{
+	ringbuf_store(& c->flush_mark, r->head);
+	ringbuf_store(& c->flush_count, c->flush_count + 1);
+}
+
+/* true if the ring buffer data at 'tail' was queued before 'mark' */
+static bool is_before(uint32_t tail, uint32_t mark)
+{
+	return (int32_t) (mark - tail) > 0;
+}
+
+/* consumer side; true if the flush mark is armed, which is then returned in
+ * '* mark', along with the flush count it belongs to in '* count' - the count
+ * is read first, so that the mark is at least as recent as the count */
+static bool is_flush_armed(const struct tx_coalesce * c, uint32_t * mark, uint32_t * count)
+{
+	* count = ringbuf_load(& c->flush_count);
+	* mark = ringbuf_load(& c->flush_mark);
+	return * count != c->flush_count_done;
+}
+
+/* true if the data up to 'mark' has been sent from a ring buffer at 'tail',
+ * and the transfer, if it ends right at the mark, terminated */
+static bool is_mark_reached(const struct tx_coalesce * c, uint32_t tail, uint32_t mark)
+{
+	return is_before(mark, tail) || (mark == tail && !c->is_transfer_open);
+}
+
+int32_t tx_coalesce_packet_length(const struct tx_coalesce * c, const struct ringbuf * r)
+{
+	uint32_t used = ringbuf_used(r), flush_mark, flush_count;
+	bool is_flushed = is_flush_armed(c, & flush_mark, & flush_count);
+
+	if (used >= c->packet_size)
+		return c->packet_size;
+	if (used)
+		return !c->deadline || (is_flushed && is_before(r->tail, flush_mark))
+			|| (c->is_deadline_armed && is_before(r->tail, c->deadline_mark)) ? (int32_t) used : -1;
+	/* the ring buffer is empty; if the last packet was a full one, the
+	 * transfer ends here if the data sent so far is due - i.e. an armed
+	 * mark is right at the end of it */
+	if (c->is_transfer_open && (!c->deadline || (is_flushed && flush_mark == r->tail)
+			|| (c->is_deadline_armed && c->deadline_mark == r->tail)))
+		return 0;
+	return -1;
+}
+
+void tx_coalesce_packet_sent(struct tx_coalesce * c, const struct ringbuf * r, uint32_t len)
+{
+	/* the ring buffer position of the packet sent */
+	uint32_t tail = r->tail - len, flush_mark, flush_count;
+	bool is_flushed = is_flush_armed(c, & flush_mark, & flush_count);
+
+	c->stats->packets ++;
+	c->stats->bytes += len;
+	c->age = 0;
+	c->is_transfer_open = len == c->packet_size;
+	if (!c->is_transfer_open)
+	{
+		if (!len)
+			c->stats->zlps ++;
+		else if (is_flushed && is_before(tail, flush_mark))
+			c->stats->flushes ++;
+		else if (c->deadline && c->is_deadline_armed && is_before(tail, c->deadline_mark))
+			c->stats->deadline_flushes ++;
+	}
+
+	/* disarm the marks reached; the count is read before the mark, so a
+	 * flush made since is only counted as done along with the mark read,
+	 * and otherwise left armed for the next packet */
+	if (is_flushed && is_mark_reached(c, r->tail, flush_mark))
+		c->flush_count_done = flush_count;
+	if (c->is_deadline_armed && is_mark_reached(c, r->tail, c->deadline_mark))
+		c->is_deadline_armed = false;
+}
+
+bool tx_coalesce_sof(struct tx_coalesce * c, const struct ringbuf * r)
+{
+	uint32_t head = ringbuf_load(& r->head);
+
+	/* an exponential moving average of the bytes queued per frame, with
+	 * a weight of 1/8 for the last frame */
+	c->rate = c->rate - c->rate / 8 + (head - c->frame_head) * 2;
+	c->frame_head = head;
+	if (c->rate * c->max_deadline < c->packet_size * 16u)
+		c->deadline = 0;
+	else
+		c->deadline = (c->packet_size * 16u + c->rate - 1) / c->rate;
+	c->stats->deadline = c->deadline;
+
+	/* an open transfer waits for its termination just like held back
+	 * data */
+	if (head == r->tail && !c->is_transfer_open)
+	{
+		c->age = 0;
+		return false;
+	}
+	if (++ c->age < c->deadline)
+		return false;
+	c->age = 0;
+	c->deadline_mark = head;
+	c->is_deadline_armed = true;
+	return true;
+}
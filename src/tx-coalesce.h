@@ -0,0 +1,126 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* transmit coalescing for a bulk IN endpoint fed from a ring buffer
+ *
+ * data queued in the ring buffer goes out in full packets as soon as the
+ * endpoint can take them, and a trailing partial packet is held back, so that
+ * small writes get merged into full packets; it is sent once any of these
+ * happens:
+ *	- the producer flushes the ring buffer ('tx_coalesce_flush()')
+ *	- the flush deadline, counted in frames (start of frame interrupts),
+ *	has passed since the data started waiting
+ *	- the deadline is zero
+ * the deadline adapts to the rate at which data is queued: it is the number
+ * of frames a packet takes to fill at that rate, up to the configured
+ * maximum - and zero if a packet would not fill within the maximum anyway,
+ * as then waiting would only add latency
+ *
+ * the data sent up to such a point makes a usb transfer - which the host
+ * only sees complete once it gets a packet shorter than the maximum size; a
+ * transfer that ends on a packet boundary is therefore terminated with a zero
+ * length packet, once it is known to have ended: when the ring buffer has
+ * been drained, and a flush or the deadline says the data sent so far is
+ * due - but not when more data follows, which is then sent in the same
+ * transfer
+ *
+ * 'tx_coalesce_flush()' is called by the producer of the ring buffer, all the
+ * other functions by its consumer, the endpoint handler */
+
+#ifndef TX_COALESCE_H
+#define TX_COALESCE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ringbuf.h"
+
+struct tx_coalesce_stats
+{
+	/* packets sent, and the bytes in them */
+	uint32_t	packets;
+	uint32_t	bytes;
+	/* partial packets sent because of an explicit flush, and because of
+	 * the flush deadline */
+	uint32_t	flushes;
+	uint32_t	deadline_flushes;
+	/* zero length packets sent to terminate transfers */
+	uint32_t	zlps;
+	/* the current flush deadline, in frames */
+	uint32_t	deadline;
+};
+
+struct tx_coalesce
+{
+	/* the marks below are ring buffer positions, compared with the tail
+	 * by their signed difference - which only holds within 2^31 bytes, so
+	 * a mark is disarmed as soon as the data sent has reached it */
+	/* written by the producer only; the ring buffer head at the last
+	 * explicit flush, and the number of flushes */
+	uint32_t			flush_mark;
+	uint32_t			flush_count;
+	/* written by the consumer only; the number of flushes carried out -
+	 * the flush mark is armed while it differs from 'flush_count' */
+	uint32_t			flush_count_done;
+	/* the ring buffer head when the flush deadline last passed */
+	uint32_t			deadline_mark;
+	/* the ring buffer head at the last start of frame, and the average
+	 * number of bytes queued per frame, in 1/16 byte units */
+	uint32_t			frame_head;
+	uint32_t			rate;
+	uint16_t			packet_size;
+	/* the flush deadline, and its maximum, in frames */
+	uint8_t				deadline, max_deadline;
+	/* frames the held back data has been waiting */
+	uint8_t				age;
+	/* set while the deadline mark is armed */
+	bool				is_deadline_armed;
+	/* set while the last packet sent was a full one, i.e. the transfer
+	 * it belongs to has not been terminated yet */
+	bool				is_transfer_open;
+	struct tx_coalesce_stats	* stats;
+};
+
+void tx_coalesce_init(struct tx_coalesce * c, uint16_t packet_size, uint8_t max_deadline,
+		struct tx_coalesce_stats * stats);
+/* forgets all state, along with the ring buffer contents */
+void tx_coalesce_reset(struct tx_coalesce * c);
+
+/* producer side; asks for everything queued so far to be sent without
+ * waiting for more data */
+void tx_coalesce_flush(struct tx_coalesce * c, const struct ringbuf * r);
+
+/* consumer side; the length of the next packet to send from 'r' - zero for a
+ * zero length packet - or -1 if there is nothing to send, or the data is to be
+ * held back - and, once the packet has been passed to the endpoint,
+ * accounting for it */
+int32_t tx_coalesce_packet_length(const struct tx_coalesce * c, const struct ringbuf * r);
+void tx_coalesce_packet_sent(struct tx_coalesce * c, const struct ringbuf * r, uint32_t len);
+/* true if the packet of length 'len' terminates a transfer */
+static inline bool tx_coalesce_is_transfer_end(const struct tx_coalesce * c, uint32_t len)
+{
+	return len < c->packet_size;
+}
+/* called on every start of frame; returns true if held back data (or a zero
+ * length packet) is now due, and the consumer should try sending again */
+bool tx_coalesce_sof(struct tx_coalesce * c, const struct ringbuf * r);
+
+#endif /* TX_COALESCE_H */
@@ -0,0 +1,373 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* bulk endpoints for the stm32 usb full speed peripheral; see usb-bulk.h
+ *
+ * for double buffered endpoints, refer to the rm0008 reference manual,
+ * section 'double-buffered endpoints'; in double buffered mode (EP_KIND set on
+ * a bulk endpoint), the packet buffer the peripheral uses next is selected by
+ * the data toggle bit of the endpoint direction (DTOG_RX for OUT, DTOG_TX for
+ * IN), and the buffer owned by the firmware is selected by the data toggle
+ * bit of the other, unused, direction - which is called SW_BUF in this mode;
+ * the peripheral toggles DTOG on each transfer, the firmware toggles SW_BUF to
+ * pass a buffer to the peripheral, and the peripheral naks while DTOG equals
+ * SW_BUF, i.e. while there is no buffer to use; buffer 0 is described by the
+ * 'tx' entries of the buffer descriptor table, buffer 1 by the 'rx' entries */
+
+#include <libopencm3/stm32/st_usbfs.h>
+#include "usb-bulk.h"
+#include "pma.h"
+#include "instrument.h"
+
+/* libopencm3 only has macros that clear the data toggle bits; these toggle
+ * them, as the double buffered endpoints toggle SW_BUF - writing 1 to a
+ * DTOG bit toggles it, and writing 1 to a CTR bit leaves it unchanged */
+#ifndef USB_TGL_EP_RX_DTOG
+#define USB_TGL_EP_RX_DTOG(EP)						\
+	SET_REG(USB_EP_REG(EP), (GET_REG(USB_EP_REG(EP)) &		\
+		USB_EP_NTOGGLE_MSK) | USB_EP_RX_DTOG			\
+		| USB_EP_RX_CTR | USB_EP_TX_CTR)
+#endif
+#ifndef USB_TGL_EP_TX_DTOG
+#define USB_TGL_EP_TX_DTOG(EP)						\
+	SET_REG(USB_EP_REG(EP), (GET_REG(USB_EP_REG(EP)) &		\
+		USB_EP_NTOGGLE_MSK) | USB_EP_TX_DTOG			\
+		| USB_EP_RX_CTR | USB_EP_TX_CTR)
+#endif
+
+enum
+{
+	USB_BULK_MAX_ENDPOINTS	= 8,
+};
+
+/* the state of each endpoint number; a single buffered IN and OUT endpoint
+ * may share an endpoint number - they each get their callback, indexed by
+ * the direction bit of the endpoint address */
+static struct
+{
+	usbd_endpoint_callback	callback[2];
+	bool			is_double_buffered;
+	/* single buffered OUT endpoints only; set while a received packet
+	 * has not been read */
+	bool			has_packet;
+	/* OUT endpoints only; set while the firmware naks the host */
+	bool			is_nak_set;
+	/* double buffered IN endpoints only; set when a packet has been
+	 * written to the firmware buffer, but the buffer could not yet be
+	 * passed to the peripheral */
+	bool			is_queued;
+}
+bulk_endpoints[USB_BULK_MAX_ENDPOINTS];
+
+static uint16_t buffer_address(uint8_t ep, bool buffer)
+{
+	return buffer ? USB_GET_EP_RX_ADDR(ep) : USB_GET_EP_TX_ADDR(ep);
+}
+
+static void bulk_in_callback(usbd_device * usbd_dev, uint8_t ep)
+{
+	uint16_t epr = * USB_EP_REG(ep);
+
+	/* the driver has already cleared CTR_TX; for a double buffered
+	 * endpoint, pass on a packet queued in the firmware buffer if the
+	 * peripheral is idle - it may not be, if this completion was already
+	 * seen, and a buffer passed on, by 'tx_commit()' before the callback
+	 * got to run; the peripheral then toggles DTOG_TX, and this is called
+	 * again, once it is done with that buffer */
+	if (bulk_endpoints[ep].is_queued && !(epr & USB_EP_TX_DTOG) == !(epr & USB_EP_RX_DTOG))
+	{
+		USB_TGL_EP_RX_DTOG(ep);
+		bulk_endpoints[ep].is_queued = false;
+	}
+	if (bulk_endpoints[ep].callback[1])
+		bulk_endpoints[ep].callback[1](usbd_dev, ep);
+}
+
+static void bulk_out_callback(usbd_device * usbd_dev, uint8_t ep)
+{
+	/* the received packet stays in its buffer until it is read, and a
+	 * single buffered endpoint keeps naking meanwhile */
+	USB_CLR_EP_RX_CTR(ep);
+	if (!bulk_endpoints[ep].is_double_buffered)
+		bulk_endpoints[ep].has_packet = true;
+	/* the driver serves the OUT direction of an endpoint number first; if
+	 * a single buffered IN endpoint sharing it has completed a transfer
+	 * as well, serve that here - under a steady OUT stream, the driver
+	 * would not get to it */
+	if (bulk_endpoints[ep].callback[1] && (* USB_EP_REG(ep) & USB_EP_TX_CTR))
+	{
+		USB_CLR_EP_TX_CTR(ep);
+		bulk_in_callback(usbd_dev, ep);
+	}
+	if (bulk_endpoints[ep].callback[0])
+		bulk_endpoints[ep].callback[0](usbd_dev, ep);
+}
+
+void usb_bulk_ep_setup(usbd_device * usbd_dev, uint8_t addr, uint16_t max_size,
+		bool is_double_buffered, usbd_endpoint_callback callback)
+{
+	uint8_t ep = addr & 0x7f;
+	uint16_t buffer;
+
+	bulk_endpoints[ep].callback[addr >> 7] = callback;
+	bulk_endpoints[ep].is_double_buffered = is_double_buffered;
+	/* leave the state of the other direction alone */
+	if (addr & 0x80)
+		bulk_endpoints[ep].is_queued = false;
+	else
+		bulk_endpoints[ep].has_packet = bulk_endpoints[ep].is_nak_set = false;
+	if (!is_double_buffered)
+	{
+		usbd_ep_setup(usbd_dev, addr, USB_ENDPOINT_ATTR_BULK, max_size,
+				(addr & 0x80) ? bulk_in_callback : bulk_out_callback);
+		return;
+	}
+	/* let the libopencm3 driver allocate packet memory for both buffers,
+	 * and set up the endpoint register; then rearrange the buffer
+	 * descriptors for double buffering */
+	if (addr & 0x80)
+	{
+		usbd_ep_setup(usbd_dev, addr, USB_ENDPOINT_ATTR_BULK, 2 * max_size, bulk_in_callback);
+		buffer = USB_GET_EP_TX_ADDR(ep);
+		USB_SET_EP_RX_ADDR(ep, buffer + max_size);
+		USB_SET_EP_TX_COUNT(ep, 0);
+		USB_SET_EP_RX_COUNT(ep, 0);
+		USB_SET_EP_KIND(ep);
+		/* DTOG_TX == SW_BUF - no packets to send, the firmware owns
+		 * buffer 0 */
+		USB_CLR_EP_RX_DTOG(ep);
+		USB_SET_EP_TX_STAT(ep, USB_EP_TX_STAT_VALID);
+	}
+	else
+	{
+		uint16_t count;
+
+		usbd_ep_setup(usbd_dev, addr, USB_ENDPOINT_ATTR_BULK, 2 * max_size, bulk_out_callback);
+		buffer = USB_GET_EP_RX_ADDR(ep);
+		/* the reception buffer size, in the usual rx count format */
+		count = max_size > 62 ? 0x8000 | (((max_size + 31) / 32 - 1) << 10) : ((max_size + 1) / 2) << 10;
+		USB_SET_EP_TX_ADDR(ep, buffer);
+		USB_SET_EP_TX_COUNT(ep, count);
+		USB_SET_EP_RX_ADDR(ep, buffer + max_size);
+		USB_SET_EP_RX_COUNT(ep, count);
+		USB_SET_EP_KIND(ep);
+		/* DTOG_RX != SW_BUF - the peripheral receives in buffer 0,
+		 * the firmware owns buffer 1 */
+		USB_CLR_EP_TX_DTOG(ep);
+		USB_TGL_EP_TX_DTOG(ep);
+	}
+}
+
+
+/*
+ * transmission
+ */
+
+/* the packet memory address of the buffer to write the next packet to, or
+ * -1 if there is no buffer free */
+static int tx_buffer(uint8_t ep)
+{
+	uint16_t epr = * USB_EP_REG(ep);
+
+	if (!bulk_endpoints[ep].is_double_buffered)
+		return (epr & USB_EP_TX_STAT) == USB_EP_TX_STAT_VALID ? -1 : USB_GET_EP_TX_ADDR(ep);
+	if (bulk_endpoints[ep].is_queued)
+		return -1;
+	return buffer_address(ep, epr & USB_EP_RX_DTOG);
+}
+
+/* passes the buffer returned by 'tx_buffer()', holding a 'len' bytes packet,
+ * to the peripheral */
+static void tx_commit(uint8_t ep, uint16_t len)
+{
+	uint16_t epr = * USB_EP_REG(ep);
+	bool sw_buf = epr & USB_EP_RX_DTOG;
+
+	if (!bulk_endpoints[ep].is_double_buffered)
+	{
+		USB_SET_EP_TX_COUNT(ep, len);
+		USB_SET_EP_TX_STAT(ep, USB_EP_TX_STAT_VALID);
+		return;
+	}
+	if (sw_buf)
+		USB_SET_EP_RX_COUNT(ep, len);
+	else
+		USB_SET_EP_TX_COUNT(ep, len);
+	if (!(epr & USB_EP_TX_DTOG) == !sw_buf)
+		/* the peripheral is idle, pass the buffer on right away */
+		USB_TGL_EP_RX_DTOG(ep);
+	else
+		/* pass the buffer on when the peripheral is done with the
+		 * other one */
+		bulk_endpoints[ep].is_queued = true;
+}
+
+int usb_bulk_ep_write_space(usbd_device * usbd_dev, uint8_t addr)
+{
+	uint8_t ep = addr & 0x7f;
+	uint16_t epr = * USB_EP_REG(ep);
+
+	(void) usbd_dev;
+	if (!bulk_endpoints[ep].is_double_buffered)
+		return (epr & USB_EP_TX_STAT) == USB_EP_TX_STAT_VALID ? 0 : 1;
+	if (bulk_endpoints[ep].is_queued)
+		return 0;
+	/* if DTOG_TX differs from SW_BUF, the peripheral owns a buffer */
+	return (!(epr & USB_EP_TX_DTOG) != !(epr & USB_EP_RX_DTOG)) ? 1 : 2;
+}
+
+int usb_bulk_ep_write_packet(usbd_device * usbd_dev, uint8_t addr, const void * buf, uint16_t len)
+{
+	uint8_t ep = addr & 0x7f;
+	int buffer = tx_buffer(ep);
+
+	(void) usbd_dev;
+	if (buffer < 0)
+		return -1;
+	INSTRUMENT_PACKET();
+	pma_write(buffer, buf, len);
+	tx_commit(ep, len);
+	return len;
+}
+
+int usb_bulk_ep_write_packet_ringbuf(usbd_device * usbd_dev, uint8_t addr, struct ringbuf * r, uint16_t len)
+{
+	uint8_t ep = addr & 0x7f;
+	int buffer = tx_buffer(ep);
+
+	(void) usbd_dev;
+	if (buffer < 0)
+		return -1;
+	INSTRUMENT_PACKET();
+	pma_write_from_ringbuf(buffer, r, len);
+	tx_commit(ep, len);
+	return len;
+}
+
+
+/*
+ * reception
+ */
+
+/* the packet memory address of the next received packet, with its length in
+ * '* len', or -1 if there is no packet */
+static int rx_buffer(uint8_t ep, uint16_t * len)
+{
+	uint16_t epr = * USB_EP_REG(ep);
+	bool buffer;
+
+	if (!bulk_endpoints[ep].is_double_buffered)
+	{
+		if (!bulk_endpoints[ep].has_packet)
+			return -1;
+		* len = USB_GET_EP_RX_COUNT(ep) & 0x3ff;
+		return USB_GET_EP_RX_ADDR(ep);
+	}
+	/* if DTOG_RX differs from SW_BUF, the peripheral owns a buffer that
+	 * it has not yet received a packet in */
+	if (!(epr & USB_EP_RX_DTOG) != !(epr & USB_EP_TX_DTOG))
+		return -1;
+	/* the received packet is in the buffer the peripheral is not going
+	 * to use next */
+	buffer = !(epr & USB_EP_RX_DTOG);
+	* len = (buffer ? USB_GET_EP_RX_COUNT(ep) : USB_GET_EP_TX_COUNT(ep)) & 0x3ff;
+	return buffer_address(ep, buffer);
+}
+
+/* passes the buffer of the packet returned by 'rx_buffer()' back to the
+ * peripheral; for a double buffered endpoint, this is done before the packet
+ * is read - which passes the other buffer to the peripheral, so that it can
+ * receive the next packet while this one is read; for a single buffered
+ * endpoint, only after the packet is read */
+static void rx_release(uint8_t ep)
+{
+	if (bulk_endpoints[ep].is_double_buffered)
+		USB_TGL_EP_TX_DTOG(ep);
+	else
+	{
+		bulk_endpoints[ep].has_packet = false;
+		if (!bulk_endpoints[ep].is_nak_set)
+			USB_SET_EP_RX_STAT(ep, USB_EP_RX_STAT_VALID);
+	}
+}
+
+int usb_bulk_ep_packet_length(usbd_device * usbd_dev, uint8_t addr)
+{
+	uint16_t len;
+
+	(void) usbd_dev;
+	return rx_buffer(addr & 0x7f, & len) < 0 ? -1 : len;
+}
+
+int usb_bulk_ep_read_packet(usbd_device * usbd_dev, uint8_t addr, void * buf, uint16_t len)
+{
+	uint8_t ep = addr & 0x7f;
+	uint16_t packet_len;
+	int buffer = rx_buffer(ep, & packet_len);
+
+	(void) usbd_dev;
+	if (buffer < 0)
+		return -1;
+	INSTRUMENT_PACKET();
+	if (bulk_endpoints[ep].is_double_buffered)
+		rx_release(ep);
+	len = MIN(len, packet_len);
+	pma_read(buf, buffer, len);
+	if (!bulk_endpoints[ep].is_double_buffered)
+		rx_release(ep);
+	return len;
+}
+
+int usb_bulk_ep_read_packet_ringbuf(usbd_device * usbd_dev, uint8_t addr, struct ringbuf * r)
+{
+	uint8_t ep = addr & 0x7f;
+	uint16_t len;
+	int buffer = rx_buffer(ep, & len);
+
+	(void) usbd_dev;
+	if (buffer < 0 || ringbuf_free(r) < len)
+		return -1;
+	INSTRUMENT_PACKET();
+	if (bulk_endpoints[ep].is_double_buffered)
+		rx_release(ep);
+	pma_read_to_ringbuf(r, buffer, len);
+	if (!bulk_endpoints[ep].is_double_buffered)
+		rx_release(ep);
+	return len;
+}
+
+void usb_bulk_ep_nak_set(usbd_device * usbd_dev, uint8_t addr, bool nak)
+{
+	uint8_t ep = addr & 0x7f;
+
+	(void) usbd_dev;
+	bulk_endpoints[ep].is_nak_set = nak;
+	if (nak)
+		USB_SET_EP_RX_STAT(ep, USB_EP_RX_STAT_NAK);
+	else if (bulk_endpoints[ep].is_double_buffered)
+		USB_SET_EP_RX_STAT(ep, USB_EP_RX_STAT_VALID);
+	/* a single buffered endpoint holding a received packet - possibly
+	 * one whose completion has not been handled yet - is re-armed only
+	 * once the packet is read */
+	else if (!bulk_endpoints[ep].has_packet && !(* USB_EP_REG(ep) & USB_EP_RX_CTR))
+		USB_SET_EP_RX_STAT(ep, USB_EP_RX_STAT_VALID);
+}
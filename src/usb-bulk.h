@@ -0,0 +1,79 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* bulk endpoints for the stm32 usb full speed peripheral ('st_usbfs_v1'),
+ * single or double buffered, with packet transfers that go straight between
+ * packet memory and ring buffers (or user buffers)
+ *
+ * the libopencm3 driver copies received packets out of packet memory when
+ * they are read, and has no support for double buffered endpoints; the
+ * endpoints here are set up through the libopencm3 core, after it has
+ * configured the device (i.e. from a set configuration callback), and their
+ * transfer completions are dispatched by the libopencm3 driver to the
+ * registered endpoint callbacks as usual - but packets are transferred by
+ * the functions here, instead of usbd_ep_read_packet()/usbd_ep_write_packet()
+ *
+ * a received packet stays in packet memory until it is read, and it need not
+ * be read from the endpoint callback - the endpoint naks the host meanwhile;
+ * a double buffered endpoint uses both buffer descriptor table entries of an
+ * endpoint register for the two packet buffers of a single direction, so
+ * that the peripheral can transfer a packet from (or to) one buffer, while
+ * the firmware accesses the other one; a double buffered IN endpoint and a
+ * double buffered OUT endpoint therefore can not share an endpoint number */
+
+#ifndef USB_BULK_H
+#define USB_BULK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <libopencm3/usb/usbd.h>
+#include "ringbuf.h"
+
+/* sets up endpoint 'addr' as a bulk endpoint with 'max_size' byte packet
+ * buffers - two of them if 'is_double_buffered' is true; 'callback' is invoked
+ * on each transfer completion */
+void usb_bulk_ep_setup(usbd_device * usbd_dev, uint8_t addr, uint16_t max_size,
+		bool is_double_buffered, usbd_endpoint_callback callback);
+
+/* IN endpoints; the number of packets that can be queued for transmission
+ * right now - up to one or two, depending on the endpoint buffering */
+int usb_bulk_ep_write_space(usbd_device * usbd_dev, uint8_t addr);
+/* queue a packet for transmission, from a buffer, or from the first 'len'
+ * bytes of a ring buffer; return the packet length, or -1 if there is no
+ * packet buffer free */
+int usb_bulk_ep_write_packet(usbd_device * usbd_dev, uint8_t addr, const void * buf, uint16_t len);
+int usb_bulk_ep_write_packet_ringbuf(usbd_device * usbd_dev, uint8_t addr, struct ringbuf * r, uint16_t len);
+
+/* OUT endpoints; the length of the next received packet, or -1 if there is
+ * none */
+int usb_bulk_ep_packet_length(usbd_device * usbd_dev, uint8_t addr);
+/* read the next received packet, into a buffer of 'len' bytes (the excess of
+ * a longer packet is dropped), or into a ring buffer - but only if it fits in
+ * there; return the number of bytes read, or -1 if there is no packet, or it
+ * does not fit in the ring buffer */
+int usb_bulk_ep_read_packet(usbd_device * usbd_dev, uint8_t addr, void * buf, uint16_t len);
+int usb_bulk_ep_read_packet_ringbuf(usbd_device * usbd_dev, uint8_t addr, struct ringbuf * r);
+/* while 'nak' is set, the endpoint naks the host even if it has a free packet
+ * buffer; packets already received can still be read */
+void usb_bulk_ep_nak_set(usbd_device * usbd_dev, uint8_t addr, bool nak);
+
+#endif /* USB_BULK_H */
@@ -86,27 +86,305 @@ THE SOFTWARE.
 
  */
 
+#include <string.h>
 #include <libopencm3/stm32/rcc.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/dwt.h>
+#include <libopencm3/stm32/st_usbfs.h>
 #include <libopencm3/usb/usbstd.h>
 #include <libopencm3/usb/usbd.h>
 #include <libopencm3/usb/cdc.h>
+#include "ringbuf.h"
+#include "usb-bulk.h"
+#include "usb-iso.h"
+#include "usb-trace.h"
+#include "profiler.h"
+#include "tx-coalesce.h"
+#include "prbs.h"
+#include "instrument.h"
+#include "latency-histogram.h"
+#include "cdcacm-stats.h"
+#include "cdcacm-counters.h"
+#include "cdcacm-requests.h"
+
+/* build-time configuration */
+
+/* the number of serial ports (cdc acm functions) of the device, one or two;
+ * each port has interfaces, endpoints, buffers and statistics of its own,
+ * and with two, the device is a composite device, with an interface
+ * association descriptor grouping the two interfaces of each port; the
+ * endpoints of all the ports must fit in the endpoint registers and the
+ * packet memory of the usb peripheral - which is checked below; the packet
+ * memory has no room for a third port, even with the smallest control
+ * endpoint, as each port takes a notification and two data packet buffers */
+#ifndef USB_CDCACM_PORTS
+#define USB_CDCACM_PORTS		1
+#endif
+
+/* when nonzero, the device has a vendor specific interface besides the serial
+ * ports, with a bulk IN and a bulk OUT endpoint of its own; it carries a raw
+ * byte stream, with no line settings and no notifications, which the host
+ * reaches through the generic usb device access of its operating system
+ * (e.g. usbfs on linux, see host/usbraw.h) instead of its serial port driver
+ * and tty layer; the firmware handles it as one more port, after the serial
+ * ports, which has no notification endpoint and no class requests; the
+ * packet memory only has room for it with a single, single buffered, serial
+ * port */
+#ifndef USB_CDCACM_VENDOR_INTERFACE
+#define USB_CDCACM_VENDOR_INTERFACE	0
+#endif
+
+/* when nonzero, the data interface of the first serial port has an alternate
+ * setting (1) with an isochronous IN endpoint beside its bulk endpoints, for
+ * fixed rate data acquisition; the bus reserves time for the endpoint in every
+ * frame, whatever the other traffic on it; the application queues its samples
+ * with cdcacm_iso_write(), and on each start of frame, a packet of up to
+ * USB_CDCACM_ISO_PACKET_SIZE bytes of them is passed to the endpoint, for the
+ * host to collect in the next frame; the packet size must be even, and the
+ * sample buffer size a power of two, at least two packets large; the packet
+ * memory only has room for the isochronous endpoint with a single, single
+ * buffered, serial port, and without the vendor interface */
+#ifndef USB_CDCACM_ISOCHRONOUS
+#define USB_CDCACM_ISOCHRONOUS		0
+#endif
+#ifndef USB_CDCACM_ISO_PACKET_SIZE
+#define USB_CDCACM_ISO_PACKET_SIZE	64
+#endif
+#ifndef USB_CDCACM_ISO_BUFFER_SIZE
+#define USB_CDCACM_ISO_BUFFER_SIZE	1024
+#endif
+
+/* when nonzero, the usb peripheral is serviced from the usb low priority
+ * interrupt, and the main loop is left free for the application; when zero,
+ * the main loop services the usb peripheral by calling usbd_poll() */
+#ifndef USB_CDCACM_USE_INTERRUPT
+#define USB_CDCACM_USE_INTERRUPT	1
+#endif
+
+/* when nonzero, the data IN and OUT endpoints are double buffered, so that the
+ * usb peripheral can transfer a packet while the firmware processes the
+ * previous one; this needs separate endpoint numbers for the data IN and OUT
+ * endpoints, and twice the packet memory for them; when zero, the data
+ * endpoints are single buffered; the packet memory only has room for double
+ * buffering a single port, without the vendor interface and the isochronous
+ * endpoint */
+#ifndef USB_CDCACM_DOUBLE_BUFFERED
+#define USB_CDCACM_DOUBLE_BUFFERED	(USB_CDCACM_PORTS == 1 && !USB_CDCACM_VENDOR_INTERFACE && !USB_CDCACM_ISOCHRONOUS)
+#endif
+
+/* the maximum packet size of the control endpoint, in bytes - 8, 16, 32 or
+ * 64; the larger it is, the fewer transactions the control transfers of
+ * enumeration take, but the packet memory only has room for 64 byte control
+ * packets with a single port */
+#ifndef USB_CDCACM_CONTROL_ENDPOINT_SIZE
+#define USB_CDCACM_CONTROL_ENDPOINT_SIZE	(USB_CDCACM_PORTS == 1 ? 64 : 32)
+#endif
+
+/* sizes, in bytes, of the ring buffers between the data endpoints and the
+ * application, for each port; data received from the host is queued in the
+ * rx buffer, data to be sent to the host is queued in the tx buffer; both
+ * must be powers of two, and at least two packets large */
+#ifndef USB_CDCACM_RX_BUFFER_SIZE
+#define USB_CDCACM_RX_BUFFER_SIZE	1024
+#endif
+#ifndef USB_CDCACM_TX_BUFFER_SIZE
+#define USB_CDCACM_TX_BUFFER_SIZE	1024
+#endif
+
+/* rx buffer flow control watermarks, in bytes; once the data received from
+ * the host fills the rx buffer up to the high watermark, the data OUT
+ * endpoint naks the host, until the application has drained the rx buffer
+ * down to the low watermark; the high watermark must leave room for a packet */
+#ifndef USB_CDCACM_RX_HIGH_WATERMARK
+#define USB_CDCACM_RX_HIGH_WATERMARK	(USB_CDCACM_RX_BUFFER_SIZE - 2 * USB_CDCACM_PACKET_SIZE)
+#endif
+#ifndef USB_CDCACM_RX_LOW_WATERMARK
+#define USB_CDCACM_RX_LOW_WATERMARK	(USB_CDCACM_RX_BUFFER_SIZE / 2)
+#endif
+
+/* the longest time, in milliseconds (frames), that data written to the tx
+ * buffer is held back, to be merged with later writes into full packets; the
+ * time actually used adapts to the rate of the writes (see tx-coalesce.h),
+ * and cdcacm_flush() sends the data right away; zero disables coalescing */
+#ifndef USB_CDCACM_TX_FLUSH_DEADLINE_MS
+#define USB_CDCACM_TX_FLUSH_DEADLINE_MS	4
+#endif
+
+/* the number of latency critical messages that can be queued for the
+ * notification endpoint (see cdcacm_urgent_write()), a power of two, and the
+ * longest such message, in bytes */
+#ifndef USB_CDCACM_URGENT_QUEUE_LENGTH
+#define USB_CDCACM_URGENT_QUEUE_LENGTH	8
+#endif
+#ifndef USB_CDCACM_URGENT_MAX_LENGTH
+#define USB_CDCACM_URGENT_MAX_LENGTH	16
+#endif
+
+/* the test mode of the serial ports (see 'test modes' below) while the host
+ * has not selected one; 0 - loopback, 1 - IN source, 2 - OUT sink, 3 - PRBS
+ * generator and checker, 4 - latency probe */
+#ifndef USB_CDCACM_TEST_MODE
+#define USB_CDCACM_TEST_MODE		0
+#endif
+
+/* the number of received packets the latency probe can track at a time, a
+ * power of two; the packets received while it tracks as many are not
+ * counted */
+#ifndef USB_CDCACM_LATENCY_PROBE_PACKETS
+#define USB_CDCACM_LATENCY_PROBE_PACKETS	32
+#endif
+
+/* the most data a CDCACM_REQ_READ_TRACE vendor request returns, in bytes;
+ * the size of the buffer the usb event trace is read into (see usb-trace.h,
+ * where the trace itself is configured) */
+#ifndef USB_CDCACM_TRACE_READ_SIZE
+#define USB_CDCACM_TRACE_READ_SIZE	512
+#endif
+
+/* whether the sampling profiler (see profiler.h) is built in - 'make
+ * PROFILER=1' - and the most data a CDCACM_REQ_READ_PROFILE vendor request
+ * returns, in bytes */
+#ifndef USB_CDCACM_PROFILER
+#define USB_CDCACM_PROFILER		0
+#endif
+#ifndef USB_CDCACM_PROFILE_READ_SIZE
+#define USB_CDCACM_PROFILE_READ_SIZE	512
+#endif
 
 /* usb cdcacm device configuration */
 enum
 {
-	/*! \todo	for some reason, values smaller than 32
-	 *		(e.g. 8, 16) do not work and the usb device
-	 *		does not enumerate properly; maybe investigate
-	 *		this */
-	USB_CONTROL_ENDPOINT_SIZE			= 32,
-	USB_CDCACM_DATA_IN_ENDPOINT_ADDRESS		= 0x81,
-	USB_CDCACM_DATA_OUT_ENDPOINT_ADDRESS		= 0x1,
-	USB_CDCACM_COMMUNICATION_IN_ENDPOINT_ADDRESS	= 0x82,
+	USB_CONTROL_ENDPOINT_SIZE			= USB_CDCACM_CONTROL_ENDPOINT_SIZE,
 	USB_CDCACM_PACKET_SIZE				= 64,
 	USB_CDCACM_POLLING_INTERVAL_MS			= 1,
-	USB_CDCACM_CONTROL_INTERFACE_NUMBER		= 0,
-	USB_CDCACM_DATA_INTERFACE_NUMBER		= 1,
+	/* the endpoint registers used by each port; the data IN and the
+	 * notification endpoints, and - when double buffered, as a double
+	 * buffered endpoint uses both directions of an endpoint register -
+	 * the data OUT endpoint get one of their own; the data OUT endpoint
+	 * of a single buffered port shares the data IN endpoint register */
+	USB_CDCACM_PORT_ENDPOINTS			= USB_CDCACM_DOUBLE_BUFFERED ? 3 : 2,
+	/* the same, for the data endpoints of the vendor interface, which
+	 * are single buffered */
+	USB_CDCACM_VENDOR_ENDPOINTS			= 1,
+	/* the serial ports, and the vendor interface */
+	USB_CDCACM_ALL_PORTS				= USB_CDCACM_PORTS + USB_CDCACM_VENDOR_INTERFACE,
+	USB_CDCACM_INTERFACES				= 2 * USB_CDCACM_PORTS + USB_CDCACM_VENDOR_INTERFACE,
+	/* abstract control model functional descriptor capabilities; the
+	 * line coding and control line state requests */
+	USB_CDCACM_ACM_CAP_LINE_CODING			= 1 << 1,
+	/* SET_CONTROL_LINE_STATE request wValue bits */
+	USB_CDCACM_CONTROL_LINE_DTR			= 1 << 0,
+	USB_CDCACM_CONTROL_LINE_RTS			= 1 << 1,
+	/* SERIAL_STATE notification bits; the carrier detect (DCD) and data
+	 * set ready (DSR) line states, and the events that are reported once,
+	 * and then cleared */
+	USB_CDCACM_SERIAL_STATE_DCD			= 1 << 0,
+	USB_CDCACM_SERIAL_STATE_DSR			= 1 << 1,
+	USB_CDCACM_SERIAL_STATE_BREAK			= 1 << 2,
+	USB_CDCACM_SERIAL_STATE_RING			= 1 << 3,
+	USB_CDCACM_SERIAL_STATE_FRAMING			= 1 << 4,
+	USB_CDCACM_SERIAL_STATE_PARITY			= 1 << 5,
+	USB_CDCACM_SERIAL_STATE_OVERRUN			= 1 << 6,
+	USB_CDCACM_SERIAL_STATE_EVENTS			= USB_CDCACM_SERIAL_STATE_BREAK | USB_CDCACM_SERIAL_STATE_RING
+							| USB_CDCACM_SERIAL_STATE_FRAMING | USB_CDCACM_SERIAL_STATE_PARITY
+							| USB_CDCACM_SERIAL_STATE_OVERRUN,
+	/* the device class of a composite device with interface association
+	 * descriptors */
+	USB_CDCACM_DEVICE_CLASS_MISCELLANEOUS		= 0xef,
+	USB_CDCACM_DEVICE_SUBCLASS_COMMON		= 0x02,
+	USB_CDCACM_DEVICE_PROTOCOL_IAD			= 0x01,
+	/* usb peripheral resources; the endpoint registers, and the packet
+	 * memory, the start of which holds the buffer descriptor table */
+	USB_ENDPOINT_REGISTERS				= 8,
+	USB_PACKET_MEMORY_SIZE				= 512,
+	USB_BUFFER_DESCRIPTOR_TABLE_SIZE		= 8 * USB_ENDPOINT_REGISTERS,
+};
+
+/* the endpoint addresses and interface numbers of port 'n'; port 0 gets
+ * endpoints 0x81 (data IN), 0x82 (notification) and 0x03 (data OUT, double
+ * buffered) or 0x01 (single buffered), and interfaces 0 and 1 */
+#define USB_CDCACM_DATA_IN_ENDPOINT_ADDRESS(n)		(0x80 | (USB_CDCACM_PORT_ENDPOINTS * (n) + 1))
+#define USB_CDCACM_COMMUNICATION_IN_ENDPOINT_ADDRESS(n)	(0x80 | (USB_CDCACM_PORT_ENDPOINTS * (n) + 2))
+#define USB_CDCACM_DATA_OUT_ENDPOINT_ADDRESS(n)		(USB_CDCACM_PORT_ENDPOINTS * (n) + (USB_CDCACM_DOUBLE_BUFFERED ? 3 : 1))
+#define USB_CDCACM_CONTROL_INTERFACE_NUMBER(n)		(2 * (n))
+#define USB_CDCACM_DATA_INTERFACE_NUMBER(n)		(2 * (n) + 1)
+/* the vendor interface comes after all the serial ports */
+#define USB_CDCACM_VENDOR_IN_ENDPOINT_ADDRESS		(0x80 | (USB_CDCACM_PORT_ENDPOINTS * USB_CDCACM_PORTS + 1))
+#define USB_CDCACM_VENDOR_OUT_ENDPOINT_ADDRESS		(USB_CDCACM_PORT_ENDPOINTS * USB_CDCACM_PORTS + 1)
+#define USB_CDCACM_VENDOR_INTERFACE_NUMBER		(2 * USB_CDCACM_PORTS)
+/* the isochronous endpoint comes after the serial port endpoints */
+#define USB_CDCACM_ISO_IN_ENDPOINT_ADDRESS		(0x80 | (USB_CDCACM_PORT_ENDPOINTS * USB_CDCACM_PORTS + 1))
+
+/* expands 'x(n)' for each port number 'n', and for each but the first, for
+ * the descriptor tables */
+#if USB_CDCACM_PORTS == 1
+#define USB_CDCACM_FOR_EACH_PORT(x)		x(0)
+#define USB_CDCACM_FOR_EACH_FURTHER_PORT(x)
+#elif USB_CDCACM_PORTS == 2
+#define USB_CDCACM_FOR_EACH_PORT(x)		x(0) x(1)
+#define USB_CDCACM_FOR_EACH_FURTHER_PORT(x)	x(1)
+#else
+#error "bad USB_CDCACM_PORTS"
+#endif
+
+_Static_assert(RINGBUF_IS_POWER_OF_TWO(USB_CDCACM_RX_BUFFER_SIZE) && USB_CDCACM_RX_BUFFER_SIZE >= 2 * USB_CDCACM_PACKET_SIZE,
+		"bad USB_CDCACM_RX_BUFFER_SIZE");
+_Static_assert(RINGBUF_IS_POWER_OF_TWO(USB_CDCACM_TX_BUFFER_SIZE) && USB_CDCACM_TX_BUFFER_SIZE >= 2 * USB_CDCACM_PACKET_SIZE,
+		"bad USB_CDCACM_TX_BUFFER_SIZE");
+_Static_assert(USB_CDCACM_RX_LOW_WATERMARK < USB_CDCACM_RX_HIGH_WATERMARK
+		&& USB_CDCACM_RX_HIGH_WATERMARK <= USB_CDCACM_RX_BUFFER_SIZE - USB_CDCACM_PACKET_SIZE,
+		"bad USB_CDCACM_RX_HIGH_WATERMARK or USB_CDCACM_RX_LOW_WATERMARK");
+_Static_assert(RINGBUF_IS_POWER_OF_TWO(USB_CDCACM_URGENT_QUEUE_LENGTH), "bad USB_CDCACM_URGENT_QUEUE_LENGTH");
+_Static_assert(USB_CDCACM_TEST_MODE >= 0 && USB_CDCACM_TEST_MODE <= 4, "bad USB_CDCACM_TEST_MODE");
+_Static_assert(RINGBUF_IS_POWER_OF_TWO(USB_CDCACM_LATENCY_PROBE_PACKETS), "bad USB_CDCACM_LATENCY_PROBE_PACKETS");
+_Static_assert(USB_CDCACM_ALL_PORTS <= (int) CDCACM_COUNTERS_PORTS, "too many ports for the performance counters");
+_Static_assert(USB_CDCACM_TRACE_READ_SIZE % sizeof(uint32_t) == 0
+		&& USB_CDCACM_TRACE_READ_SIZE >= sizeof(struct usb_trace_header) + sizeof(struct usb_trace_event),
+		"bad USB_CDCACM_TRACE_READ_SIZE");
+_Static_assert(USB_CDCACM_PROFILE_READ_SIZE % sizeof(uint32_t) == 0
+		&& USB_CDCACM_PROFILE_READ_SIZE >= sizeof(struct profiler_header) + sizeof(uint32_t),
+		"bad USB_CDCACM_PROFILE_READ_SIZE");
+_Static_assert(sizeof(struct usb_cdc_notification) + USB_CDCACM_URGENT_MAX_LENGTH <= USB_CDCACM_PACKET_SIZE,
+		"bad USB_CDCACM_URGENT_MAX_LENGTH");
+_Static_assert(USB_CONTROL_ENDPOINT_SIZE == 8 || USB_CONTROL_ENDPOINT_SIZE == 16
+		|| USB_CONTROL_ENDPOINT_SIZE == 32 || USB_CONTROL_ENDPOINT_SIZE == 64,
+		"bad USB_CDCACM_CONTROL_ENDPOINT_SIZE");
+_Static_assert(USB_CDCACM_ISO_PACKET_SIZE && !(USB_CDCACM_ISO_PACKET_SIZE & 1) && USB_CDCACM_ISO_PACKET_SIZE <= 1022,
+		"bad USB_CDCACM_ISO_PACKET_SIZE");
+_Static_assert(RINGBUF_IS_POWER_OF_TWO(USB_CDCACM_ISO_BUFFER_SIZE) && USB_CDCACM_ISO_BUFFER_SIZE >= 2 * USB_CDCACM_ISO_PACKET_SIZE,
+		"bad USB_CDCACM_ISO_BUFFER_SIZE");
+/* endpoint register 0 is the control endpoint */
+_Static_assert(1 + USB_CDCACM_PORTS * USB_CDCACM_PORT_ENDPOINTS
+		+ USB_CDCACM_VENDOR_INTERFACE * USB_CDCACM_VENDOR_ENDPOINTS + USB_CDCACM_ISOCHRONOUS <= USB_ENDPOINT_REGISTERS,
+		"USB_CDCACM_PORTS: not enough endpoint registers");
+#if USB_CDCACM_DOUBLE_BUFFERED && USB_CDCACM_PORTS > 1
+#error "USB_CDCACM_DOUBLE_BUFFERED: the packet memory has no room for double buffering more than one port"
+#endif
+#if USB_CDCACM_VENDOR_INTERFACE && (USB_CDCACM_PORTS > 1 || USB_CDCACM_DOUBLE_BUFFERED)
+#error "USB_CDCACM_VENDOR_INTERFACE: the packet memory only has room for the vendor interface with a single, single buffered, serial port"
+#endif
+#if USB_CDCACM_ISOCHRONOUS && (USB_CDCACM_PORTS > 1 || USB_CDCACM_DOUBLE_BUFFERED || USB_CDCACM_VENDOR_INTERFACE)
+#error "USB_CDCACM_ISOCHRONOUS: the packet memory only has room for the isochronous endpoint with a single, single buffered, serial port, and without the vendor interface"
+#endif
+/* the libopencm3 driver allocates packet memory after the buffer descriptor
+ * table; the two control endpoint buffers, and for each port, a notification
+ * endpoint buffer, and one or two buffers for each data endpoint - and a
+ * buffer for each data endpoint of the vendor interface, and the two buffers
+ * of the isochronous endpoint; the rest is first checked with the smallest
+ * (8 byte) control endpoint, so that a control endpoint too large is
+ * reported as such */
+enum
+{
+	USB_PACKET_MEMORY_ENDPOINTS			= USB_CDCACM_PORTS * (USB_CDCACM_PACKET_SIZE
+								+ (USB_CDCACM_DOUBLE_BUFFERED ? 4 : 2) * USB_CDCACM_PACKET_SIZE)
+							+ USB_CDCACM_VENDOR_INTERFACE * 2 * USB_CDCACM_PACKET_SIZE
+							+ USB_CDCACM_ISOCHRONOUS * 2 * USB_CDCACM_ISO_PACKET_SIZE,
 };
+_Static_assert(USB_BUFFER_DESCRIPTOR_TABLE_SIZE + 2 * 8 + USB_PACKET_MEMORY_ENDPOINTS <= USB_PACKET_MEMORY_SIZE,
+		"not enough packet memory for the endpoints of the ports, the vendor interface and the isochronous endpoint");
+_Static_assert(USB_BUFFER_DESCRIPTOR_TABLE_SIZE + 2 * USB_CONTROL_ENDPOINT_SIZE + USB_PACKET_MEMORY_ENDPOINTS <= USB_PACKET_MEMORY_SIZE,
+		"not enough packet memory for a control endpoint this large - USB_CDCACM_CONTROL_ENDPOINT_SIZE has to be reduced");
 
 
 /* usb descriptors */
@@ -115,9 +393,15 @@ static const struct usb_device_descriptor usb_device_descriptor =
 	.bLength		=	USB_DT_DEVICE_SIZE,
 	.bDescriptorType	=	USB_DT_DEVICE,
 	.bcdUSB			=	0x200,
+#if USB_CDCACM_PORTS == 1
 	.bDeviceClass		=	USB_CLASS_VENDOR,
 	.bDeviceSubClass	=	0,
 	.bDeviceProtocol	=	0,
+#else
+	.bDeviceClass		=	USB_CDCACM_DEVICE_CLASS_MISCELLANEOUS,
+	.bDeviceSubClass	=	USB_CDCACM_DEVICE_SUBCLASS_COMMON,
+	.bDeviceProtocol	=	USB_CDCACM_DEVICE_PROTOCOL_IAD,
+#endif
 	.bMaxPacketSize0	=	USB_CONTROL_ENDPOINT_SIZE,
 	.idVendor		=	0x1ad4,
 	.idProduct		=	0xb000,
@@ -128,202 +412,1778 @@ static const struct usb_device_descriptor usb_device_descriptor =
 	.bNumConfigurations	=	1,
 };
 
-/* communications class interface notification endpoint; this interrupt IN endpoint is
- * meant to be used as a notification for communication line state changes to the
- * usb host; it is not really appropriate/useful for a virtual serial port device */
-static const struct usb_endpoint_descriptor usb_cdcacm_communication_endpoint[] = 
+/* the contents of the descriptors of the configuration; each initializes
+ * both the libopencm3 descriptor structures - which the usb core walks for
+ * the interface requests - and the flat configuration descriptor the host
+ * reads (see 'usb_cdcacm_configuration' below), so that the two always
+ * agree */
+#define USB_CDCACM_ENDPOINT_FIELDS(address, attributes, size, interval)				\
+		.bLength			=	USB_DT_ENDPOINT_SIZE,			\
+		.bDescriptorType		=	USB_DT_ENDPOINT,			\
+		.bEndpointAddress		=	address,				\
+		.bmAttributes			=	attributes,				\
+		.wMaxPacketSize			=	size,					\
+		.bInterval			=	interval
+
+/* communications class interface notification endpoint; this interrupt IN endpoint
+ * carries SERIAL_STATE notifications of line state changes and events, and the
+ * urgent messages of the application (see cdcacm_urgent_write()), one per packet;
+ * a notification is sent as soon as one is due and the endpoint is free, and the
+ * host collects it within a polling interval (see cdcacm_notify()) */
+#define USB_CDCACM_COMMUNICATION_ENDPOINT_FIELDS(n)						\
+	USB_CDCACM_ENDPOINT_FIELDS(USB_CDCACM_COMMUNICATION_IN_ENDPOINT_ADDRESS(n),		\
+			USB_ENDPOINT_ATTR_INTERRUPT, USB_CDCACM_PACKET_SIZE, USB_CDCACM_POLLING_INTERVAL_MS)
+#define USB_CDCACM_DATA_IN_ENDPOINT_FIELDS(n)							\
+	USB_CDCACM_ENDPOINT_FIELDS(USB_CDCACM_DATA_IN_ENDPOINT_ADDRESS(n),			\
+			USB_ENDPOINT_ATTR_BULK, USB_CDCACM_PACKET_SIZE, USB_CDCACM_POLLING_INTERVAL_MS)
+#define USB_CDCACM_DATA_OUT_ENDPOINT_FIELDS(n)							\
+	USB_CDCACM_ENDPOINT_FIELDS(USB_CDCACM_DATA_OUT_ENDPOINT_ADDRESS(n),			\
+			USB_ENDPOINT_ATTR_BULK, USB_CDCACM_PACKET_SIZE, USB_CDCACM_POLLING_INTERVAL_MS)
+/* every frame */
+#define USB_CDCACM_ISO_IN_ENDPOINT_FIELDS							\
+	USB_CDCACM_ENDPOINT_FIELDS(USB_CDCACM_ISO_IN_ENDPOINT_ADDRESS,				\
+			USB_ENDPOINT_ATTR_ISOCHRONOUS | USB_ENDPOINT_ATTR_NOSYNC, USB_CDCACM_ISO_PACKET_SIZE, 1)
+#define USB_CDCACM_VENDOR_IN_ENDPOINT_FIELDS							\
+	USB_CDCACM_ENDPOINT_FIELDS(USB_CDCACM_VENDOR_IN_ENDPOINT_ADDRESS,			\
+			USB_ENDPOINT_ATTR_BULK, USB_CDCACM_PACKET_SIZE, USB_CDCACM_POLLING_INTERVAL_MS)
+#define USB_CDCACM_VENDOR_OUT_ENDPOINT_FIELDS							\
+	USB_CDCACM_ENDPOINT_FIELDS(USB_CDCACM_VENDOR_OUT_ENDPOINT_ADDRESS,			\
+			USB_ENDPOINT_ATTR_BULK, USB_CDCACM_PACKET_SIZE, USB_CDCACM_POLLING_INTERVAL_MS)
+
+#define USB_CDCACM_INTERFACE_FIELDS(number, alternate, count, class, subclass)			\
+		.bLength		=	USB_DT_INTERFACE_SIZE,				\
+		.bDescriptorType	=	USB_DT_INTERFACE,				\
+		.bInterfaceNumber	=	number,						\
+		.bAlternateSetting	=	alternate,					\
+		.bNumEndpoints		=	count,						\
+		.bInterfaceClass	=	class,						\
+		.bInterfaceSubClass	=	subclass,					\
+		.bInterfaceProtocol	=	0,						\
+		.iInterface		=	0
+/* one notification IN endpoint */
+#define USB_CDCACM_CONTROL_INTERFACE_FIELDS(n)							\
+	USB_CDCACM_INTERFACE_FIELDS(USB_CDCACM_CONTROL_INTERFACE_NUMBER(n), 0, 1, USB_CLASS_CDC, USB_CDC_SUBCLASS_ACM)
+/* the data interface of port 'n', alternate setting 'alternate', with 'count'
+ * endpoints */
+#define USB_CDCACM_DATA_INTERFACE_FIELDS(n, alternate, count)					\
+	USB_CDCACM_INTERFACE_FIELDS(USB_CDCACM_DATA_INTERFACE_NUMBER(n), alternate, count, USB_CLASS_DATA, 0)
+#define USB_CDCACM_VENDOR_INTERFACE_FIELDS							\
+	USB_CDCACM_INTERFACE_FIELDS(USB_CDCACM_VENDOR_INTERFACE_NUMBER, 0, 2, USB_CLASS_VENDOR, 0)
+
+#define USB_CDCACM_FUNCTIONAL_DESCRIPTORS_FIELDS(n)						\
+		.h =										\
+		{										\
+			.bFunctionLength	= sizeof(struct usb_cdc_header_descriptor),	\
+			.bDescriptorType	= CS_INTERFACE,					\
+			.bDescriptorSubtype	= USB_CDC_TYPE_HEADER,				\
+			.bcdCDC			= 0x110,					\
+		},										\
+		.acm =										\
+		{										\
+			.bFunctionLength	= sizeof(struct usb_cdc_acm_descriptor),	\
+			.bDescriptorType	= CS_INTERFACE,					\
+			.bDescriptorSubtype	= USB_CDC_TYPE_ACM,				\
+			/* the SET_LINE_CODING, GET_LINE_CODING and			\
+			 * SET_CONTROL_LINE_STATE requests, and the SERIAL_STATE	\
+			 * notification */						\
+			.bmCapabilities		= USB_CDCACM_ACM_CAP_LINE_CODING,		\
+		},										\
+		.u =										\
+		{										\
+			.bFunctionLength	= sizeof(struct usb_cdc_union_descriptor),	\
+			.bDescriptorType	= CS_INTERFACE,					\
+			.bDescriptorSubtype	= USB_CDC_TYPE_UNION,				\
+			.bControlInterface	= USB_CDCACM_CONTROL_INTERFACE_NUMBER(n),	\
+			.bSubordinateInterface0	= USB_CDCACM_DATA_INTERFACE_NUMBER(n),		\
+		},										\
+		.c =										\
+		{										\
+			.bFunctionLength	= sizeof(struct usb_cdc_call_management_descriptor),	\
+			.bDescriptorType	= CS_INTERFACE,					\
+			.bDescriptorSubtype	= USB_CDC_TYPE_CALL_MANAGEMENT,			\
+			.bmCapabilities		= 0,	/* no call management cababilities */	\
+			.bDataInterface		= USB_CDCACM_DATA_INTERFACE_NUMBER(n),		\
+		}
+
+/* the interface association descriptors of a composite device, which tell
+ * the host which interfaces make up each port */
+#define USB_CDCACM_INTERFACE_ASSOCIATION_FIELDS(n)						\
+		.bLength		=	USB_DT_INTERFACE_ASSOCIATION_SIZE,		\
+		.bDescriptorType	=	USB_DT_INTERFACE_ASSOCIATION,			\
+		.bFirstInterface	=	USB_CDCACM_CONTROL_INTERFACE_NUMBER(n),		\
+		.bInterfaceCount	=	2,						\
+		.bFunctionClass		=	USB_CLASS_CDC,					\
+		.bFunctionSubClass	=	USB_CDC_SUBCLASS_ACM,				\
+		.bFunctionProtocol	=	0,						\
+		.iFunction		=	0
+
+#define USB_CDCACM_CONFIG_FIELDS								\
+		.bLength		=	USB_DT_CONFIGURATION_SIZE,			\
+		.bDescriptorType	=	USB_DT_CONFIGURATION,				\
+		.bNumInterfaces		=	USB_CDCACM_INTERFACES,				\
+		.bConfigurationValue	=	1,						\
+		.iConfiguration		=	0,						\
+		.bmAttributes		=	USB_CONFIG_ATTR_DEFAULT,			\
+		.bMaxPower		=	50	/* in 2 mA units */
+
+
+/* the libopencm3 descriptor structures */
+#define USB_CDCACM_COMMUNICATION_ENDPOINT(n)	[n] = { USB_CDCACM_COMMUNICATION_ENDPOINT_FIELDS(n), },
+static const struct usb_endpoint_descriptor usb_cdcacm_communication_endpoints[USB_CDCACM_PORTS] =
 {
-	{
-		.bLength			=	USB_DT_ENDPOINT_SIZE,
-		.bDescriptorType		=	USB_DT_ENDPOINT,
-		.bEndpointAddress		=	USB_CDCACM_COMMUNICATION_IN_ENDPOINT_ADDRESS,
-		.bmAttributes			=	USB_ENDPOINT_ATTR_INTERRUPT,
-		.wMaxPacketSize			=	USB_CDCACM_PACKET_SIZE,
-		.bInterval			=	USB_CDCACM_POLLING_INTERVAL_MS,
-	},
+	USB_CDCACM_FOR_EACH_PORT(USB_CDCACM_COMMUNICATION_ENDPOINT)
 };
 
-static const struct usb_endpoint_descriptor usb_cdcacm_data_endpoints[] = 
-{
-	{
-		.bLength			=	USB_DT_ENDPOINT_SIZE,
-		.bDescriptorType		=	USB_DT_ENDPOINT,
-		.bEndpointAddress		=	USB_CDCACM_DATA_IN_ENDPOINT_ADDRESS,
-		.bmAttributes			=	USB_ENDPOINT_ATTR_BULK,
-		.wMaxPacketSize			=	USB_CDCACM_PACKET_SIZE,
-		.bInterval			=	USB_CDCACM_POLLING_INTERVAL_MS,
-	},
-	{
-		.bLength			=	USB_DT_ENDPOINT_SIZE,
-		.bDescriptorType		=	USB_DT_ENDPOINT,
-		.bEndpointAddress		=	USB_CDCACM_DATA_OUT_ENDPOINT_ADDRESS,
-		.bmAttributes			=	USB_ENDPOINT_ATTR_BULK,
-		.wMaxPacketSize			=	USB_CDCACM_PACKET_SIZE,
-		.bInterval			=	USB_CDCACM_POLLING_INTERVAL_MS,
+#define USB_CDCACM_DATA_ENDPOINTS(n)								\
+	[n] =											\
+	{											\
+		{ USB_CDCACM_DATA_IN_ENDPOINT_FIELDS(n), },					\
+		{ USB_CDCACM_DATA_OUT_ENDPOINT_FIELDS(n), },					\
 	},
+static const struct usb_endpoint_descriptor usb_cdcacm_data_endpoints[USB_CDCACM_PORTS][2] =
+{
+	USB_CDCACM_FOR_EACH_PORT(USB_CDCACM_DATA_ENDPOINTS)
 };
 
-static const struct __attribute__((packed))
+static const struct __attribute__((packed)) usb_cdcacm_functional_descriptors
 {
 	struct usb_cdc_header_descriptor		h;
 	struct usb_cdc_acm_descriptor			acm;
 	struct usb_cdc_union_descriptor			u;
 	struct usb_cdc_call_management_descriptor	c;
 }
-usb_cdcacm_functional_descriptors = 
+usb_cdcacm_functional_descriptors[USB_CDCACM_PORTS] =
 {
-	.h =
-	{
-		.bFunctionLength	= sizeof(struct usb_cdc_header_descriptor),
-		.bDescriptorType	= CS_INTERFACE,
-		.bDescriptorSubtype	= USB_CDC_TYPE_HEADER,
-		.bcdCDC			= 0x110,
-	},
-	.acm = 
-	{
-		.bFunctionLength	= sizeof(struct usb_cdc_acm_descriptor),
-		.bDescriptorType	= CS_INTERFACE,
-		.bDescriptorSubtype	= USB_CDC_TYPE_ACM,
-		.bmCapabilities		= 0,	/* no commands supported */
-	},
-	.u =
-	{
-		.bFunctionLength	= sizeof(struct usb_cdc_union_descriptor),
-		.bDescriptorType	= CS_INTERFACE,
-		.bDescriptorSubtype	= USB_CDC_TYPE_UNION,
-		.bControlInterface	= USB_CDCACM_CONTROL_INTERFACE_NUMBER,
-		.bSubordinateInterface0	= USB_CDCACM_DATA_INTERFACE_NUMBER,
-	},
-	.c =
-	{
-		.bFunctionLength	= sizeof(struct usb_cdc_call_management_descriptor),
-		.bDescriptorType	= CS_INTERFACE,
-		.bmCapabilities		= 0,	/* no call management cababilities */
-		.bDataInterface		= USB_CDCACM_DATA_INTERFACE_NUMBER,
-	},
+#define USB_CDCACM_FUNCTIONAL_DESCRIPTORS(n)	[n] = { USB_CDCACM_FUNCTIONAL_DESCRIPTORS_FIELDS(n), },
+	USB_CDCACM_FOR_EACH_PORT(USB_CDCACM_FUNCTIONAL_DESCRIPTORS)
+};
+
+/* the data interface of port 'n', alternate setting 'alternate', with the
+ * 'count' endpoints of 'endpoints' */
+#define USB_CDCACM_DATA_INTERFACE(n, alternate, endpoints, count)				\
+	{											\
+		USB_CDCACM_DATA_INTERFACE_FIELDS(n, alternate, count),				\
+		.endpoint		=	endpoints,					\
+		.extra			=	0,						\
+		.extralen		=	0,						\
+	}
+#define USB_CDCACM_INTERFACES(n)								\
+	[2 * (n)] =										\
+	{											\
+		USB_CDCACM_CONTROL_INTERFACE_FIELDS(n),						\
+		.endpoint		=	& usb_cdcacm_communication_endpoints[n],	\
+		.extra			=	& usb_cdcacm_functional_descriptors[n],		\
+		.extralen		=	sizeof usb_cdcacm_functional_descriptors[n],	\
+	},											\
+	/* two data endpoints, for usb data IN/OUT transfers */				\
+	[2 * (n) + 1] = USB_CDCACM_DATA_INTERFACE(n, 0, usb_cdcacm_data_endpoints[n], 2),
+/* the communications and data interfaces of each port */
+static const struct usb_interface_descriptor cdcacm_interfaces[2 * USB_CDCACM_PORTS] =
+{
+	USB_CDCACM_FOR_EACH_PORT(USB_CDCACM_INTERFACES)
+};
+
+#if USB_CDCACM_ISOCHRONOUS
+/* the alternate settings of the data interface of the first port; the bulk
+ * endpoints alone, and with the isochronous IN endpoint; the isochronous
+ * endpoint only takes bus bandwidth while the host has selected the
+ * alternate setting with it */
+static const struct usb_endpoint_descriptor usb_cdcacm_iso_data_endpoints[] =
+{
+	{ USB_CDCACM_DATA_IN_ENDPOINT_FIELDS(0), },
+	{ USB_CDCACM_DATA_OUT_ENDPOINT_FIELDS(0), },
+	{ USB_CDCACM_ISO_IN_ENDPOINT_FIELDS, },
 };
 
-static const struct usb_interface_descriptor cdcacm_communications_interface =
-{
-	.bLength		=	USB_DT_INTERFACE_SIZE,
-	.bDescriptorType	=	USB_DT_INTERFACE,
-	.bInterfaceNumber	=	USB_CDCACM_CONTROL_INTERFACE_NUMBER,
-	.bAlternateSetting	=	0,
-	.bNumEndpoints		=	1,	/* one notification IN endpoint */
-	.bInterfaceClass	=	USB_CLASS_CDC,
-	.bInterfaceSubClass	=	USB_CDC_SUBCLASS_ACM,
-	.bInterfaceProtocol	=	0,
-	.iInterface		=	0,
-	.endpoint		=	usb_cdcacm_communication_endpoint,
-	.extra			=	& usb_cdcacm_functional_descriptors,
-	.extralen		=	sizeof usb_cdcacm_functional_descriptors,
+static const struct usb_interface_descriptor cdcacm_iso_data_interfaces[] =
+{
+	USB_CDCACM_DATA_INTERFACE(0, 0, usb_cdcacm_data_endpoints[0], 2),
+	USB_CDCACM_DATA_INTERFACE(0, 1, usb_cdcacm_iso_data_endpoints, 3),
+};
+
+/* the alternate setting selected by the host, maintained by the libopencm3
+ * core */
+static uint8_t cdcacm_iso_altsetting;
+
+#define USB_CDCACM_DATA_ALTSETTING_COUNT(n)	((n) ? 1 : 2)
+#define USB_CDCACM_DATA_ALTSETTINGS(n)		((n) ? & cdcacm_interfaces[2 * (n) + 1] : cdcacm_iso_data_interfaces)
+#define USB_CDCACM_DATA_CUR_ALTSETTING(n)	((n) ? 0 : & cdcacm_iso_altsetting)
+#else
+#define USB_CDCACM_DATA_ALTSETTING_COUNT(n)	1
+#define USB_CDCACM_DATA_ALTSETTINGS(n)		(& cdcacm_interfaces[2 * (n) + 1])
+#define USB_CDCACM_DATA_CUR_ALTSETTING(n)	0
+#endif
+
+#if USB_CDCACM_VENDOR_INTERFACE
+static const struct usb_endpoint_descriptor usb_vendor_endpoints[] =
+{
+	{ USB_CDCACM_VENDOR_IN_ENDPOINT_FIELDS, },
+	{ USB_CDCACM_VENDOR_OUT_ENDPOINT_FIELDS, },
 };
-static const struct usb_interface_descriptor cdcacm_data_interface =
-{
-	.bLength		=	USB_DT_INTERFACE_SIZE,
-	.bDescriptorType	=	USB_DT_INTERFACE,
-	.bInterfaceNumber	=	USB_CDCACM_DATA_INTERFACE_NUMBER,
-	.bAlternateSetting	=	0,
-	.bNumEndpoints		=	2,	/* two data endpoints, for usb data IN/OUT transfers */
-	.bInterfaceClass	=	USB_CLASS_DATA,
-	.bInterfaceSubClass	=	0,
-	.bInterfaceProtocol	=	0,
-	.iInterface		=	0,
-	.endpoint		=	usb_cdcacm_data_endpoints,
+
+static const struct usb_interface_descriptor vendor_interface =
+{
+	USB_CDCACM_VENDOR_INTERFACE_FIELDS,
+	.endpoint		=	usb_vendor_endpoints,
 	.extra			=	0,
 	.extralen		=	0,
 };
+#endif
 
-
-static const struct usb_interface usb_interfaces[] =
+#if USB_CDCACM_PORTS > 1
+#define USB_CDCACM_INTERFACE_ASSOCIATION(n)	[n] = { USB_CDCACM_INTERFACE_ASSOCIATION_FIELDS(n), },
+static const struct usb_iface_assoc_descriptor cdcacm_interface_associations[USB_CDCACM_PORTS] =
 {
-	{
-		.num_altsetting	=	1,
-		.altsetting	=	& cdcacm_communications_interface,
+	USB_CDCACM_FOR_EACH_PORT(USB_CDCACM_INTERFACE_ASSOCIATION)
+};
+#define USB_CDCACM_INTERFACE_ASSOCIATION_OF(n)	(& cdcacm_interface_associations[n])
+#else
+#define USB_CDCACM_INTERFACE_ASSOCIATION_OF(n)	0
+#endif
+
+#define USB_CDCACM_USB_INTERFACES(n)								\
+	[2 * (n)] =										\
+	{											\
+		.num_altsetting	=	1,							\
+		.iface_assoc	=	USB_CDCACM_INTERFACE_ASSOCIATION_OF(n),			\
+		.altsetting	=	& cdcacm_interfaces[2 * (n)],				\
+	},											\
+	[2 * (n) + 1] =										\
+	{											\
+		.cur_altsetting	=	USB_CDCACM_DATA_CUR_ALTSETTING(n),			\
+		.num_altsetting	=	USB_CDCACM_DATA_ALTSETTING_COUNT(n),			\
+		.altsetting	=	USB_CDCACM_DATA_ALTSETTINGS(n),				\
 	},
+static const struct usb_interface usb_interfaces[USB_CDCACM_INTERFACES] =
+{
+	USB_CDCACM_FOR_EACH_PORT(USB_CDCACM_USB_INTERFACES)
+#if USB_CDCACM_VENDOR_INTERFACE
+	[USB_CDCACM_VENDOR_INTERFACE_NUMBER] =
 	{
 		.num_altsetting	=	1,
-		.altsetting	=	& cdcacm_data_interface,
+		.altsetting	=	& vendor_interface,
 	},
+#endif
 };
 
 static const struct usb_config_descriptor usb_config_descriptor =
 {
-	.bLength		=	USB_DT_CONFIGURATION_SIZE,
-	.bDescriptorType	=	USB_DT_CONFIGURATION,
-	/* the wTotalLength field below is automatically computed on-the-fly
-	 * by the libopencm3 library before sending the configuration descriptor
-	 * to the host; it is not updated here, so this data structure can be
-	 * defined as 'const' */
-	/* .wTotalLength	= xxx*/
-	.bNumInterfaces		=	2,
-	.bConfigurationValue	=	1,
-	.iConfiguration		=	0,
-	.bmAttributes		=	USB_CONFIG_ATTR_DEFAULT,
-	.bMaxPower		=	50,	/* in 2 mA units */
+	/* the wTotalLength field is left out; the libopencm3 library only
+	 * needs it when it assembles the configuration descriptor, which it
+	 * no longer does (see 'usb_cdcacm_configuration' below) */
+	USB_CDCACM_CONFIG_FIELDS,
 	.interface		=	usb_interfaces,
 };
 
-static const char * usb_strings[] =
+
+/* the configuration descriptor the host reads, as it goes on the wire - all
+ * its descriptors in order, with wTotalLength filled in - in flash; it is
+ * sent from there by 'usbd_cdcacm_descriptor_callback()', instead of being
+ * assembled in the control buffer by the libopencm3 core, from the
+ * structures above, on each request. the descriptors are those of the
+ * libopencm3 structures, without the pointers that link them */
+struct __attribute__((packed)) usb_cdcacm_config_header
 {
+	uint8_t		bLength;
+	uint8_t		bDescriptorType;
+	uint16_t	wTotalLength;
+	uint8_t		bNumInterfaces;
+	uint8_t		bConfigurationValue;
+	uint8_t		iConfiguration;
+	uint8_t		bmAttributes;
+	uint8_t		bMaxPower;
 };
-static uint8_t usb_control_buffer[128];
 
+struct __attribute__((packed)) usb_cdcacm_interface_header
+{
+	uint8_t		bLength;
+	uint8_t		bDescriptorType;
+	uint8_t		bInterfaceNumber;
+	uint8_t		bAlternateSetting;
+	uint8_t		bNumEndpoints;
+	uint8_t		bInterfaceClass;
+	uint8_t		bInterfaceSubClass;
+	uint8_t		bInterfaceProtocol;
+	uint8_t		iInterface;
+};
 
-static enum usbd_request_return_codes usbd_cdcacm_control_callback(usbd_device *usbd_dev,
-		struct usb_setup_data *req, uint8_t **buf, uint16_t *len,
-		usbd_control_complete_callback *complete)
+struct __attribute__((packed)) usb_cdcacm_endpoint_header
 {
-	/* suppress compiler warnings */
-	(void) usbd_dev, (void) req, (void) buf, (void) len, (void) complete;
-#if 0
-	if (req->bmRequestType != (USB_REQ_TYPE_IN | USB_REQ_TYPE_INTERFACE)
-			|| req->bRequest != USB_REQ_GET_DESCRIPTOR
-			|| req->wValue != (USB_DT_REPORT << 8)
-			|| req->wIndex != USB_CDCACM_INTERFACE_NUMBER)
-		return USBD_REQ_NEXT_CALLBACK;
+	uint8_t		bLength;
+	uint8_t		bDescriptorType;
+	uint8_t		bEndpointAddress;
+	uint8_t		bmAttributes;
+	uint16_t	wMaxPacketSize;
+	uint8_t		bInterval;
+};
 
-	buf[0] = (uint8_t *) usb_cdcacm_report_descriptor;
-	len[0] = sizeof usb_cdcacm_report_descriptor;
+/* the descriptors of a port, in the order the libopencm3 core assembles
+ * them; the interface association descriptor of a composite device, the
+ * communications interface, its functional descriptors and notification
+ * endpoint, and the data interface and its endpoints */
+struct __attribute__((packed)) usb_cdcacm_port_configuration
+{
+#if USB_CDCACM_PORTS > 1
+	struct usb_iface_assoc_descriptor		association;
+#endif
+	struct usb_cdcacm_interface_header		control;
+	struct usb_cdcacm_functional_descriptors	functional;
+	struct usb_cdcacm_endpoint_header		notification;
+	struct usb_cdcacm_interface_header		data;
+	struct usb_cdcacm_endpoint_header		data_endpoints[2];
+};
+
+#if USB_CDCACM_PORTS > 1
+#define USB_CDCACM_PORT_ASSOCIATION(n)		.association = { USB_CDCACM_INTERFACE_ASSOCIATION_FIELDS(n), },
+#else
+#define USB_CDCACM_PORT_ASSOCIATION(n)
+#endif
+#define USB_CDCACM_PORT_CONFIGURATION(n)							\
+	{											\
+		USB_CDCACM_PORT_ASSOCIATION(n)							\
+		.control	= { USB_CDCACM_CONTROL_INTERFACE_FIELDS(n), },			\
+		.functional	= { USB_CDCACM_FUNCTIONAL_DESCRIPTORS_FIELDS(n), },		\
+		.notification	= { USB_CDCACM_COMMUNICATION_ENDPOINT_FIELDS(n), },		\
+		.data		= { USB_CDCACM_DATA_INTERFACE_FIELDS(n, 0, 2), },		\
+		.data_endpoints	=								\
+		{										\
+			{ USB_CDCACM_DATA_IN_ENDPOINT_FIELDS(n), },				\
+			{ USB_CDCACM_DATA_OUT_ENDPOINT_FIELDS(n), },				\
+		},										\
+	}
+#define USB_CDCACM_FURTHER_PORT_CONFIGURATION(n)	[(n) - 1] = USB_CDCACM_PORT_CONFIGURATION(n),
+
+/* the alternate setting with the isochronous endpoint follows the first
+ * port, the vendor interface all the ports */
+static const struct __attribute__((packed)) usb_cdcacm_configuration
+{
+	struct usb_cdcacm_config_header		config;
+	struct usb_cdcacm_port_configuration	first_port;
+#if USB_CDCACM_ISOCHRONOUS
+	struct usb_cdcacm_interface_header	iso_data;
+	struct usb_cdcacm_endpoint_header	iso_data_endpoints[3];
+#endif
+#if USB_CDCACM_PORTS > 1
+	struct usb_cdcacm_port_configuration	further_ports[USB_CDCACM_PORTS - 1];
+#endif
+#if USB_CDCACM_VENDOR_INTERFACE
+	struct usb_cdcacm_interface_header	vendor;
+	struct usb_cdcacm_endpoint_header	vendor_endpoints[2];
 #endif
-	return USBD_REQ_HANDLED;
 }
+usb_cdcacm_configuration =
+{
+	.config =
+	{
+		USB_CDCACM_CONFIG_FIELDS,
+		.wTotalLength		=	sizeof(struct usb_cdcacm_configuration),
+	},
+	.first_port = USB_CDCACM_PORT_CONFIGURATION(0),
+#if USB_CDCACM_ISOCHRONOUS
+	.iso_data = { USB_CDCACM_DATA_INTERFACE_FIELDS(0, 1, 3), },
+	.iso_data_endpoints =
+	{
+		{ USB_CDCACM_DATA_IN_ENDPOINT_FIELDS(0), },
+		{ USB_CDCACM_DATA_OUT_ENDPOINT_FIELDS(0), },
+		{ USB_CDCACM_ISO_IN_ENDPOINT_FIELDS, },
+	},
+#endif
+#if USB_CDCACM_PORTS > 1
+	.further_ports =
+	{
+		USB_CDCACM_FOR_EACH_FURTHER_PORT(USB_CDCACM_FURTHER_PORT_CONFIGURATION)
+	},
+#endif
+#if USB_CDCACM_VENDOR_INTERFACE
+	.vendor = { USB_CDCACM_VENDOR_INTERFACE_FIELDS, },
+	.vendor_endpoints =
+	{
+		{ USB_CDCACM_VENDOR_IN_ENDPOINT_FIELDS, },
+		{ USB_CDCACM_VENDOR_OUT_ENDPOINT_FIELDS, },
+	},
+#endif
+};
+
+static const char * usb_strings[] =
+{
+};
+/* the control buffer holds the data stages of the requests the device
+ * receives - SET_LINE_CODING has the largest - and the few bytes of the
+ * standard requests the libopencm3 core answers in it; the configuration
+ * descriptor is sent from flash, and the other requests send their data
+ * from where it is kept */
+static uint8_t usb_control_buffer[16];
+_Static_assert(sizeof usb_control_buffer >= sizeof(struct usb_cdc_line_coding), "usb_control_buffer too small");
+
+
+static usbd_device * usbd_cdcacm_device;
 static volatile bool is_usb_device_configured;
-static void usbd_cdcacm_set_config_callback(usbd_device * usbd_dev, uint16_t wValue)
+
+/* the state of a serial port, or of the vendor interface; the data endpoint handlers run in usb interrupt
+ * context (or from the main loop, when the usb peripheral is polled), and
+ * exchange data with the application through the rx and tx ring buffers;
+ * packets go straight between the endpoint packet memory and the ring
+ * buffers */
+struct cdcacm_port
 {
-	/* suppress compiler warnings */
-	(void) wValue;
+	/* constant after initialization; the endpoint addresses and the
+	 * control interface number of the port, and its statistics; the
+	 * vendor interface has no notification endpoint (its address is 0) */
+	uint8_t			data_in, data_out, notification;
+	uint8_t			control_interface;
+	struct cdcacm_stats	* stats;
+	struct ringbuf		rx, tx;
+	struct tx_coalesce	tx_coalesce;
+	/* set on a usb configuration, until the application has emptied the
+	 * ring buffers and the urgent message queue; neither side of a ring
+	 * buffer may access it while it is reset, so the application does it,
+	 * from the main loop (see cdcacm_reset()), and the endpoint handlers
+	 * leave the port alone - and its data OUT endpoint naks the host -
+	 * until then */
+	volatile bool		is_reset_pending;
+	/* set while the data OUT endpoint naks the host because the rx buffer
+	 * is above its high watermark, and the frames it has done so */
+	bool			is_rx_throttled;
+	uint32_t		rx_throttled_frames;
+	/* set while the driver holds data back from the host, for the nak
+	 * counters (see 'struct cdcacm_endpoint_counters'); received packets
+	 * in the data OUT endpoint, and tx buffer data with the data IN
+	 * endpoint empty */
+	bool			is_data_out_held, is_data_in_held;
+	/* data IN transfer completion tracking; the packets passed to the
+	 * data IN endpoint so far, the cycle counter when the first packet of
+	 * the transfer being sent was, and the transfers whose terminating
+	 * packet has not been acknowledged yet - at most one per packet
+	 * buffer - as the packet count after that packet, and the start time */
+	uint32_t		tx_packets;
+	uint32_t		tx_transfer_start;
+	struct cdcacm_tx_transfer
+	{
+		uint32_t	end_packet;
+		uint32_t	start;
+	}
+	tx_pending[2];
+	uint8_t			tx_pending_count;
+	/* the serial port settings made by the host; the line coding, and
+	 * the DTR and RTS signals ('USB_CDCACM_CONTROL_LINE_xxx' bits) */
+	struct usb_cdc_line_coding	line_coding;
+	uint16_t		control_line_state;
+	/* the serial line state reported to the host in SERIAL_STATE
+	 * notifications ('USB_CDCACM_SERIAL_STATE_xxx' bits); the current
+	 * DCD and DSR states, the events since the last notification, and
+	 * whether a notification is due */
+	uint16_t		serial_state;
+	uint16_t		serial_events;
+	bool			is_serial_state_changed;
+	/* latency critical messages queued by the application, for the
+	 * notification endpoint; the application only updates 'urgent_head',
+	 * and the endpoint handler only 'urgent_tail' - the same scheme as
+	 * that of the ring buffers */
+	uint32_t		urgent_head, urgent_tail;
+	struct cdcacm_urgent_message
+	{
+		uint8_t		code;
+		uint8_t		len;
+		uint16_t	value;
+		uint8_t		data[USB_CDCACM_URGENT_MAX_LENGTH];
+	}
+	urgent_queue[USB_CDCACM_URGENT_QUEUE_LENGTH];
+	/* set while the notification endpoint holds a packet the host has not
+	 * read yet */
+	bool			is_notification_pending;
+	/* the latency probe (see cdcacm_latency_probe_start()); whether it is
+	 * active, the difference of the tx and the rx stream offsets of the
+	 * echoed data, and the packets received and not yet answered - as
+	 * the rx stream offsets they end at, and their arrival times; the
+	 * endpoint handlers only access the packet queue while the probe is
+	 * active */
+	volatile bool		is_latency_probe_active;
+	uint32_t		latency_probe_offset;
+	uint32_t		latency_probe_head, latency_probe_tail;
+	struct cdcacm_arrival
+	{
+		uint32_t	end;
+		uint32_t	time;
+	}
+	latency_probe_arrivals[USB_CDCACM_LATENCY_PROBE_PACKETS];
+};
 
-	usbd_ep_setup(usbd_dev, USB_CDCACM_COMMUNICATION_IN_ENDPOINT_ADDRESS, USB_ENDPOINT_ATTR_INTERRUPT, USB_CDCACM_PACKET_SIZE, 0);
-	usbd_ep_setup(usbd_dev, USB_CDCACM_DATA_IN_ENDPOINT_ADDRESS, USB_ENDPOINT_ATTR_BULK, USB_CDCACM_PACKET_SIZE, 0);
-	usbd_ep_setup(usbd_dev, USB_CDCACM_DATA_OUT_ENDPOINT_ADDRESS, USB_ENDPOINT_ATTR_BULK, USB_CDCACM_PACKET_SIZE, 0);
-	usbd_register_control_callback(usbd_dev,
-			USB_REQ_TYPE_STANDARD | USB_REQ_TYPE_INTERFACE,
-			USB_REQ_TYPE_TYPE | USB_REQ_TYPE_RECIPIENT,
-			usbd_cdcacm_control_callback);
-	is_usb_device_configured = true;
+static struct cdcacm_port cdcacm_ports[USB_CDCACM_ALL_PORTS];
+
+struct cdcacm_stats cdcacm_stats[USB_CDCACM_ALL_PORTS];
+
+struct cdcacm_counters cdcacm_counters;
+
+static uint8_t cdcacm_rx_data[USB_CDCACM_ALL_PORTS][USB_CDCACM_RX_BUFFER_SIZE] RINGBUF_ALIGNED;
+static uint8_t cdcacm_tx_data[USB_CDCACM_ALL_PORTS][USB_CDCACM_TX_BUFFER_SIZE] RINGBUF_ALIGNED;
+
+/* the line coding reported before the host sets one */
+static const struct usb_cdc_line_coding cdcacm_default_line_coding =
+{
+	.dwDTERate	= 115200,
+	.bCharFormat	= USB_CDC_1_STOP_BITS,
+	.bParityType	= USB_CDC_NO_PARITY,
+	.bDataBits	= 8,
+};
+
+/* the port an endpoint, or a control interface, belongs to, or null if there
+ * is none */
+static struct cdcacm_port * cdcacm_port_of_endpoint(uint8_t ep)
+{
+	/* the vendor interface endpoints follow those of the serial ports,
+	 * and map to the port after them */
+	unsigned n = ((ep & 0x7f) - 1) / USB_CDCACM_PORT_ENDPOINTS;
+
+	return (ep & 0x7f) && n < USB_CDCACM_ALL_PORTS ? cdcacm_ports + n : 0;
 }
 
-int main(void)
+static struct cdcacm_port * cdcacm_port_of_interface(uint8_t interface)
 {
-	usbd_device * usbd_dev;
-	rcc_periph_clock_enable(RCC_GPIOA);
-	rcc_clock_setup_in_hse_8mhz_out_72mhz();
-	usbd_dev = usbd_init(& st_usbfs_v1_usb_driver, & usb_device_descriptor, & usb_config_descriptor,
-			usb_strings, sizeof usb_strings / sizeof * usb_strings,
-			usb_control_buffer, sizeof usb_control_buffer);
-	usbd_register_set_config_callback(usbd_dev, usbd_cdcacm_set_config_callback);
-	/* simple loopback test loop */
-	while (1)
+	unsigned n = interface / 2;
+
+	return interface == USB_CDCACM_CONTROL_INTERFACE_NUMBER(n) && n < USB_CDCACM_PORTS ? cdcacm_ports + n : 0;
+}
+
+/* whether a usb configuration has requested a reset of the port, which the
+ * application has not carried out yet (see cdcacm_reset()) */
+static bool cdcacm_is_reset_pending(struct cdcacm_port * port)
+{
+	return __atomic_load_n(& port->is_reset_pending, __ATOMIC_ACQUIRE);
+}
+
+
+/* the communications class interrupt IN (notification) endpoint; it carries
+ * SERIAL_STATE notifications, and latency critical application messages
+ *
+ * the host polls the endpoint every polling interval, whatever the bulk
+ * traffic, so a message passed to the endpoint reaches the host within an
+ * interval - while data written to the tx buffer waits for all the data
+ * queued before it; the application queues such messages with
+ * cdcacm_urgent_write(), and they are sent as vendor specific notifications:
+ * a notification header ('struct usb_cdc_notification', with a vendor request
+ * type) with the application's message code in 'bNotification', its value in
+ * 'wValue' and the message length in 'wLength', followed by the message
+ *
+ * line state changes and events are recorded as they happen, and reported in
+ * a SERIAL_STATE notification; as are the urgent messages, they are sent as
+ * soon as the endpoint is free, and the line state changes that come while
+ * the endpoint holds a packet are merged into the next SERIAL_STATE - so a
+ * burst of them costs a single packet; host drivers (e.g. the linux cdc-acm
+ * driver) only look at the first notification of a transfer, so each packet
+ * carries a single notification, urgent messages first, and the endpoint
+ * sends at most one notification per polling interval
+ *
+ * the endpoint handling runs in usb interrupt context (or from the main loop,
+ * when the usb peripheral is polled) */
+
+/* sets the line states in 'mask' to those in 'state', and records the events
+ * in 'state' */
+static void cdcacm_serial_state(struct cdcacm_port * port, uint16_t mask, uint16_t state)
+{
+	uint16_t serial_state = (port->serial_state & ~mask) | (state & mask & ~USB_CDCACM_SERIAL_STATE_EVENTS);
+
+	if (state & USB_CDCACM_SERIAL_STATE_EVENTS)
+		port->stats->serial_events ++;
+	port->serial_events |= state & USB_CDCACM_SERIAL_STATE_EVENTS;
+	if (serial_state != port->serial_state || port->serial_events)
+		port->is_serial_state_changed = true;
+	port->serial_state = serial_state;
+}
+
+/* assembles a notification in 'packet'; returns its length */
+static uint32_t cdcacm_notification(const struct cdcacm_port * port, uint8_t * packet,
+		uint8_t request_type, uint8_t code, uint16_t value, const void * data, uint16_t data_len)
+{
+	struct usb_cdc_notification notification =
 	{
-		int i = 0;
-		char buf[64];
-		if (is_usb_device_configured && (i = usbd_ep_read_packet(usbd_dev, USB_CDCACM_DATA_OUT_ENDPOINT_ADDRESS, buf, sizeof buf)))
-		{
-			while (!usbd_ep_write_packet(usbd_dev, USB_CDCACM_DATA_IN_ENDPOINT_ADDRESS, buf, i));
-			while (!usbd_ep_write_packet(usbd_dev, USB_CDCACM_DATA_IN_ENDPOINT_ADDRESS, ">>>", 3));
-		}
-		usbd_poll(usbd_dev);
+		.bmRequestType	= USB_REQ_TYPE_IN | request_type | USB_REQ_TYPE_INTERFACE,
+		.bNotification	= code,
+		.wValue		= value,
+		.wIndex		= port->control_interface,
+		.wLength	= data_len,
+	};
+
+	memcpy(packet, & notification, sizeof notification);
+	memcpy(packet + sizeof notification, data, data_len);
+	return sizeof notification + data_len;
+}
+
+/* the performance counters of an endpoint */
+static struct cdcacm_endpoint_counters * cdcacm_endpoint_counters(uint8_t addr)
+{
+	return & cdcacm_counters.endpoints[addr & 0x7f][addr >> 7];
+}
+
+/* counts, and traces, a packet read from an OUT endpoint, or passed to an
+ * IN endpoint */
+static void cdcacm_count_packet(uint8_t addr, uint32_t len)
+{
+	struct cdcacm_endpoint_counters * c = cdcacm_endpoint_counters(addr);
+
+	c->packets ++;
+	c->bytes += len;
+	usb_trace_event(USB_TRACE_PACKET, addr, len);
+}
+
+/* counts a nak event when the driver starts holding data back on an
+ * endpoint, and traces the start and the end of holding it back */
+static void cdcacm_count_held(uint8_t addr, bool * is_held, bool is_holding)
+{
+	if (is_holding == * is_held)
+		return;
+	if (is_holding)
+		cdcacm_endpoint_counters(addr)->naks ++;
+	usb_trace_event(USB_TRACE_NAK, addr, is_holding);
+	* is_held = is_holding;
+}
+
+/* updates the high water mark of a ring buffer */
+static void cdcacm_count_buffer_level(uint32_t * high_water, const struct ringbuf * r)
+{
+	uint32_t used = ringbuf_used(r);
+
+	if (used > * high_water)
+		* high_water = used;
+}
+
+/* sends whatever is due on the notification endpoint, if it is free; called
+ * when the application has queued a message, when the line state changes,
+ * and when the host has read the last packet */
+static void cdcacm_notify(usbd_device * usbd_dev, struct cdcacm_port * port)
+{
+	uint8_t packet[USB_CDCACM_PACKET_SIZE];
+	uint32_t len, tail = port->urgent_tail;
+	uint16_t serial_state = port->serial_state | port->serial_events;
+
+	if (!port->notification || port->is_notification_pending || cdcacm_is_reset_pending(port))
+		return;
+	if (tail != ringbuf_load(& port->urgent_head))
+	{
+		const struct cdcacm_urgent_message * m = port->urgent_queue + (tail & (USB_CDCACM_URGENT_QUEUE_LENGTH - 1));
+
+		len = cdcacm_notification(port, packet, USB_REQ_TYPE_VENDOR, m->code, m->value, m->data, m->len);
+		ringbuf_store(& port->urgent_tail, tail + 1);
+		port->stats->urgent_messages ++;
+	}
+	else if (port->is_serial_state_changed)
+	{
+		len = cdcacm_notification(port, packet, USB_REQ_TYPE_CLASS, USB_CDC_NOTIFY_SERIAL_STATE, 0,
+				& serial_state, sizeof serial_state);
+		port->stats->serial_state_notifications ++;
+		port->serial_events = 0;
+		port->is_serial_state_changed = false;
 	}
+	else
+		return;
+	/* the endpoint is known to be free */
+	usbd_ep_write_packet(usbd_dev, port->notification, packet, len);
+	cdcacm_count_packet(port->notification, len);
+	port->is_notification_pending = true;
+}
+
+/* called by the application to queue a message of up to
+ * USB_CDCACM_URGENT_MAX_LENGTH bytes for the notification endpoint, ahead of
+ * all data in the tx buffer; returns false if the queue is full */
+static bool cdcacm_urgent_write(struct cdcacm_port * port, uint8_t code, uint16_t value, const void * data, uint8_t len)
+{
+	uint32_t head = port->urgent_head;
+	struct cdcacm_urgent_message * m = port->urgent_queue + (head & (USB_CDCACM_URGENT_QUEUE_LENGTH - 1));
+
+	if (head - ringbuf_load(& port->urgent_tail) == USB_CDCACM_URGENT_QUEUE_LENGTH || len > sizeof m->data)
+		return false;
+	m->code = code;
+	m->value = value;
+	m->len = len;
+	memcpy(m->data, data, len);
+	ringbuf_store(& port->urgent_head, head + 1);
+	return true;
+}
+
+
+/* communications class (pstn subclass) requests; host serial port drivers
+ * issue these when a port is opened, and on every change of the port
+ * settings; the requests are looked up in a table, which gives the direction
+ * and data stage length each of them must have - malformed and unknown
+ * requests are stalled right away, so the host does not wait for them */
+
+static enum usbd_request_return_codes cdcacm_set_line_coding(struct cdcacm_port * port,
+		struct usb_setup_data * req, uint8_t ** buf, uint16_t * len)
+{
+	/* the structure is packed, so it can be read from the control buffer
+	 * in place */
+	const struct usb_cdc_line_coding * line_coding = (const struct usb_cdc_line_coding *) * buf;
+
+	(void) req, (void) len;
+	if (!line_coding->dwDTERate || line_coding->bCharFormat > USB_CDC_2_STOP_BITS
+			|| line_coding->bParityType > USB_CDC_SPACE_PARITY
+			|| !((line_coding->bDataBits >= 5 && line_coding->bDataBits <= 8) || line_coding->bDataBits == 16))
+		return USBD_REQ_NOTSUPP;
+	port->line_coding = * line_coding;
+	return USBD_REQ_HANDLED;
+}
+
+static enum usbd_request_return_codes cdcacm_get_line_coding(struct cdcacm_port * port,
+		struct usb_setup_data * req, uint8_t ** buf, uint16_t * len)
+{
+	(void) req;
+	* buf = (uint8_t *) & port->line_coding;
+	if (* len > sizeof port->line_coding)
+		* len = sizeof port->line_coding;
+	return USBD_REQ_HANDLED;
+}
+
+static enum usbd_request_return_codes cdcacm_set_control_line_state(struct cdcacm_port * port,
+		struct usb_setup_data * req, uint8_t ** buf, uint16_t * len)
+{
+	(void) buf, (void) len;
+	port->control_line_state = req->wValue & (USB_CDCACM_CONTROL_LINE_DTR | USB_CDCACM_CONTROL_LINE_RTS);
+	/* the port is wired as a null modem cable to the application - the
+	 * host DTR drives the DCD and DSR lines back to it */
+	cdcacm_serial_state(port, USB_CDCACM_SERIAL_STATE_DCD | USB_CDCACM_SERIAL_STATE_DSR,
+			port->control_line_state & USB_CDCACM_CONTROL_LINE_DTR
+			? USB_CDCACM_SERIAL_STATE_DCD | USB_CDCACM_SERIAL_STATE_DSR : 0);
+	return USBD_REQ_HANDLED;
+}
+
+struct cdcacm_request
+{
+	uint8_t		bRequest;
+	/* USB_REQ_TYPE_IN for a device to host data stage, 0 otherwise */
+	uint8_t		direction;
+	/* the data stage length; exact for host to device requests, the
+	 * minimum for device to host requests */
+	uint16_t	wLength;
+	enum usbd_request_return_codes (* handler)(struct cdcacm_port * port,
+			struct usb_setup_data * req, uint8_t ** buf, uint16_t * len);
+};
+
+static const struct cdcacm_request cdcacm_class_requests[] =
+{
+	{ USB_CDC_REQ_SET_LINE_CODING, 0, sizeof(struct usb_cdc_line_coding), cdcacm_set_line_coding, },
+	{ USB_CDC_REQ_GET_LINE_CODING, USB_REQ_TYPE_IN, 1, cdcacm_get_line_coding, },
+	{ USB_CDC_REQ_SET_CONTROL_LINE_STATE, 0, 0, cdcacm_set_control_line_state, },
+};
+
+/* looks up a request to the control interface of a port in a table of
+ * 'count' requests, and handles it */
+static enum usbd_request_return_codes cdcacm_handle_request(const struct cdcacm_request * requests, unsigned count,
+		struct usb_setup_data * req, uint8_t ** buf, uint16_t * len)
+{
+	struct cdcacm_port * port = cdcacm_port_of_interface(req->wIndex & 0xff);
+	const struct cdcacm_request * r;
+
+	if (!port || (req->wIndex >> 8))
+		return USBD_REQ_NEXT_CALLBACK;
+	for (r = requests; r < requests + count; r ++)
+		if (r->bRequest == req->bRequest)
+			break;
+	if (r == requests + count
+			|| (req->bmRequestType & USB_REQ_TYPE_DIRECTION) != r->direction
+			|| (r->direction ? req->wLength < r->wLength : req->wLength != r->wLength))
+		return USBD_REQ_NOTSUPP;
+	return r->handler(port, req, buf, len);
+}
+
+static enum usbd_request_return_codes usbd_cdcacm_class_request_callback(usbd_device * usbd_dev,
+		struct usb_setup_data * req, uint8_t ** buf, uint16_t * len,
+		usbd_control_complete_callback * complete)
+{
+	(void) usbd_dev, (void) complete;
+	return cdcacm_handle_request(cdcacm_class_requests, sizeof cdcacm_class_requests / sizeof * cdcacm_class_requests,
+			req, buf, len);
+}
+
+/* vendor specific requests (see cdcacm-requests.h), for the host side test
+ * tools; they are handled the same way */
+
+/* the data stage is sent from the histogram as it is updated, so a request
+ * made while the probe is active may see it change between its packets */
+static enum usbd_request_return_codes cdcacm_get_latency_histogram(struct cdcacm_port * port,
+		struct usb_setup_data * req, uint8_t ** buf, uint16_t * len)
+{
+	(void) req;
+	* buf = (uint8_t *) & port->stats->latency;
+	if (* len > sizeof port->stats->latency)
+		* len = sizeof port->stats->latency;
+	return USBD_REQ_HANDLED;
+}
+
+static enum usbd_request_return_codes cdcacm_clear_latency_histogram(struct cdcacm_port * port,
+		struct usb_setup_data * req, uint8_t ** buf, uint16_t * len)
+{
+	(void) req, (void) buf, (void) len;
+	memset(& port->stats->latency, 0, sizeof port->stats->latency);
+	return USBD_REQ_HANDLED;
+}
+
+/* the data stage is sent from a snapshot, so that the counters are consistent
+ * with each other, and the high-water marks and the maxima can be reset for
+ * the next reading right away */
+static enum usbd_request_return_codes cdcacm_get_counters(struct cdcacm_port * port,
+		struct usb_setup_data * req, uint8_t ** buf, uint16_t * len)
+{
+	static struct cdcacm_counters snapshot;
+
+	(void) port, (void) req;
+	cdcacm_counters.cpu_hz = rcc_ahb_frequency;
+	snapshot = cdcacm_counters;
+	memset(cdcacm_counters.rx_high_water, 0, sizeof cdcacm_counters.rx_high_water);
+	memset(cdcacm_counters.tx_high_water, 0, sizeof cdcacm_counters.tx_high_water);
+	cdcacm_counters.max_service_cycles = cdcacm_counters.max_service_latency = 0;
+	* buf = (uint8_t *) & snapshot;
+	if (* len > sizeof snapshot)
+		* len = sizeof snapshot;
+	return USBD_REQ_HANDLED;
 }
 
+static enum usbd_request_return_codes cdcacm_set_trace_mask(struct cdcacm_port * port,
+		struct usb_setup_data * req, uint8_t ** buf, uint16_t * len)
+{
+	(void) port, (void) buf, (void) len;
+	usb_trace_set_mask(req->wValue);
+	return USBD_REQ_HANDLED;
+}
+
+/* the events read are moved out of the trace to a buffer of their own, which
+ * the data stage is sent from */
+static enum usbd_request_return_codes cdcacm_read_trace(struct cdcacm_port * port,
+		struct usb_setup_data * req, uint8_t ** buf, uint16_t * len)
+{
+	static uint32_t data[USB_CDCACM_TRACE_READ_SIZE / sizeof(uint32_t)];
+
+	(void) port, (void) req;
+	* buf = (uint8_t *) data;
+	* len = usb_trace_read(data, * len < sizeof data ? * len : sizeof data);
+	return USBD_REQ_HANDLED;
+}
+
+#if USB_CDCACM_PROFILER
+/* the sampling rate is turned into a SysTick period, which must fit in its
+ * 24 bit counter */
+static enum usbd_request_return_codes cdcacm_set_profiler(struct cdcacm_port * port,
+		struct usb_setup_data * req, uint8_t ** buf, uint16_t * len)
+{
+	uint32_t period = req->wValue ? rcc_ahb_frequency / req->wValue : 0;
+
+	(void) port, (void) buf, (void) len;
+	if (req->wValue && (period < 2 || period > 1 << 24))
+		return USBD_REQ_NOTSUPP;
+	profiler_start(period);
+	return USBD_REQ_HANDLED;
+}
+
+/* as the usb event trace, the samples read are moved to a buffer of their
+ * own */
+static enum usbd_request_return_codes cdcacm_read_profile(struct cdcacm_port * port,
+		struct usb_setup_data * req, uint8_t ** buf, uint16_t * len)
+{
+	static uint32_t data[USB_CDCACM_PROFILE_READ_SIZE / sizeof(uint32_t)];
+
+	(void) port, (void) req;
+	* buf = (uint8_t *) data;
+	* len = profiler_read(data, * len < sizeof data ? * len : sizeof data);
+	return USBD_REQ_HANDLED;
+}
+#endif
+
+static const struct cdcacm_request cdcacm_vendor_requests[] =
+{
+	{ CDCACM_REQ_GET_LATENCY_HISTOGRAM, USB_REQ_TYPE_IN, 1, cdcacm_get_latency_histogram, },
+	{ CDCACM_REQ_CLEAR_LATENCY_HISTOGRAM, 0, 0, cdcacm_clear_latency_histogram, },
+	{ CDCACM_REQ_GET_COUNTERS, USB_REQ_TYPE_IN, 1, cdcacm_get_counters, },
+	{ CDCACM_REQ_SET_TRACE_MASK, 0, 0, cdcacm_set_trace_mask, },
+	{ CDCACM_REQ_READ_TRACE, USB_REQ_TYPE_IN, sizeof(struct usb_trace_header), cdcacm_read_trace, },
+#if USB_CDCACM_PROFILER
+	{ CDCACM_REQ_SET_PROFILER, 0, 0, cdcacm_set_profiler, },
+	{ CDCACM_REQ_READ_PROFILE, USB_REQ_TYPE_IN, sizeof(struct profiler_header), cdcacm_read_profile, },
+#endif
+};
+
+static enum usbd_request_return_codes usbd_cdcacm_vendor_request_callback(usbd_device * usbd_dev,
+		struct usb_setup_data * req, uint8_t ** buf, uint16_t * len,
+		usbd_control_complete_callback * complete)
+{
+	(void) usbd_dev, (void) complete;
+	return cdcacm_handle_request(cdcacm_vendor_requests, sizeof cdcacm_vendor_requests / sizeof * cdcacm_vendor_requests,
+			req, buf, len);
+}
+
+/* the first request of a host to a device at the default address reads the
+ * device descriptor with a 64 byte wLength, to learn the control endpoint
+ * size; the host takes the first packet for a short one, if the control
+ * endpoint is smaller than 64 bytes, and goes on to the status stage at once.
+ * the libopencm3 core naks the status stage until it has sent all the data
+ * stage, and the host times out - so then the device descriptor is cut short
+ * to a single packet, which still holds bMaxPacketSize0; wLength is cut to
+ * the same length, for the core not to end the data stage with a zero length
+ * packet */
+static enum usbd_request_return_codes usbd_cdcacm_device_descriptor(struct usb_setup_data * req,
+		uint8_t ** buf, uint16_t * len)
+{
+	* buf = (uint8_t *) & usb_device_descriptor;
+	if (* len > sizeof usb_device_descriptor)
+		* len = sizeof usb_device_descriptor;
+	if (!(* USB_DADDR_REG & USB_DADDR_ADDR) && * len > USB_CONTROL_ENDPOINT_SIZE)
+		req->wLength = * len = USB_CONTROL_ENDPOINT_SIZE;
+	return USBD_REQ_HANDLED;
+}
+
+/* the device descriptor is sent as above, the configuration descriptor
+ * straight from flash; all the other standard device requests are passed on
+ * to the libopencm3 core */
+static enum usbd_request_return_codes usbd_cdcacm_descriptor_callback(usbd_device * usbd_dev,
+		struct usb_setup_data * req, uint8_t ** buf, uint16_t * len,
+		usbd_control_complete_callback * complete)
+{
+	(void) usbd_dev, (void) complete;
+	if (req->bRequest != USB_REQ_GET_DESCRIPTOR)
+		return USBD_REQ_NEXT_CALLBACK;
+	if (req->wValue == USB_DT_DEVICE << 8)
+		return usbd_cdcacm_device_descriptor(req, buf, len);
+	if (req->wValue >> 8 != USB_DT_CONFIGURATION)
+		return USBD_REQ_NEXT_CALLBACK;
+	/* there is a single configuration */
+	if ((req->wValue & 0xff) != 0)
+		return USBD_REQ_NOTSUPP;
+	* buf = (uint8_t *) & usb_cdcacm_configuration;
+	if (* len > sizeof usb_cdcacm_configuration)
+		* len = sizeof usb_cdcacm_configuration;
+	return USBD_REQ_HANDLED;
+}
+
+/* the libopencm3 core drops the control callbacks on a set configuration
+ * request, so this is registered again from the set configuration callback */
+static void usbd_cdcacm_register_descriptor_callback(usbd_device * usbd_dev)
+{
+	usbd_register_control_callback(usbd_dev,
+			USB_REQ_TYPE_STANDARD | USB_REQ_TYPE_DEVICE,
+			USB_REQ_TYPE_TYPE | USB_REQ_TYPE_RECIPIENT,
+			usbd_cdcacm_descriptor_callback);
+}
+
+/* the latency probe; it measures the time each packet received spends in the
+ * device, from its arrival - when it is read from the data OUT endpoint - to
+ * its answer being passed to the data IN endpoint, in a latency histogram in
+ * the port statistics; the application must answer the received data byte
+ * for byte, in order, as an echo does - the answer to a received byte is
+ * then at a fixed tx stream offset from the byte, and a packet is answered
+ * once the tx stream up to the answer to its last byte is passed to the
+ * endpoint */
+static void cdcacm_latency_probe_arrival(struct cdcacm_port * port)
+{
+	if (!port->is_latency_probe_active
+			|| port->latency_probe_head - port->latency_probe_tail == USB_CDCACM_LATENCY_PROBE_PACKETS)
+		return;
+	port->latency_probe_arrivals[port->latency_probe_head ++ % USB_CDCACM_LATENCY_PROBE_PACKETS] =
+		(struct cdcacm_arrival) { .end = port->rx.head, .time = dwt_read_cycle_counter(), };
+}
+
+static void cdcacm_latency_probe_departure(struct cdcacm_port * port)
+{
+	struct cdcacm_arrival * a;
+
+	if (!port->is_latency_probe_active)
+		return;
+	while (port->latency_probe_head != port->latency_probe_tail)
+	{
+		a = port->latency_probe_arrivals + port->latency_probe_tail % USB_CDCACM_LATENCY_PROBE_PACKETS;
+		if ((int32_t) (port->tx.tail - (a->end + port->latency_probe_offset)) < 0)
+			break;
+		latency_histogram_add(& port->stats->latency, dwt_read_cycle_counter() - a->time);
+		port->latency_probe_tail ++;
+	}
+}
+
+/* called by the application to start the latency probe; from then on, the
+ * next byte it reads from the rx buffer is answered with the next byte it
+ * writes to the tx buffer */
+static void cdcacm_latency_probe_start(struct cdcacm_port * port)
+{
+	port->latency_probe_head = port->latency_probe_tail = 0;
+	port->latency_probe_offset = port->tx.head - port->rx.tail;
+	__atomic_store_n(& port->is_latency_probe_active, true, __ATOMIC_RELEASE);
+}
+
+static void cdcacm_latency_probe_stop(struct cdcacm_port * port)
+{
+	port->is_latency_probe_active = false;
+}
+
+/* moves received packets from the data OUT endpoint to the rx buffer; called
+ * on data OUT transfer completions, and when the application has made room
+ * in the rx buffer; packets that are not read stay in the endpoint, which
+ * naks the host until they are - and once the rx buffer reaches its high
+ * watermark, the endpoint is made to nak the host, and no more packets are
+ * read, until the rx buffer has drained down to its low watermark */
+static void cdcacm_receive(usbd_device * usbd_dev, struct cdcacm_port * port)
+{
+	int len;
+
+	if (cdcacm_is_reset_pending(port))
+		return;
+	if (port->is_rx_throttled)
+	{
+		if (ringbuf_used(& port->rx) > USB_CDCACM_RX_LOW_WATERMARK)
+			return;
+		port->is_rx_throttled = false;
+		usb_bulk_ep_nak_set(usbd_dev, port->data_out, false);
+	}
+	while (ringbuf_used(& port->rx) < USB_CDCACM_RX_HIGH_WATERMARK
+			&& (len = usb_bulk_ep_read_packet_ringbuf(usbd_dev, port->data_out, & port->rx)) >= 0)
+	{
+		cdcacm_count_packet(port->data_out, len);
+		cdcacm_latency_probe_arrival(port);
+	}
+	cdcacm_count_buffer_level(cdcacm_counters.rx_high_water + (port - cdcacm_ports), & port->rx);
+	cdcacm_count_held(port->data_out, & port->is_data_out_held,
+			ringbuf_used(& port->rx) >= USB_CDCACM_RX_HIGH_WATERMARK
+			|| usb_bulk_ep_packet_length(usbd_dev, port->data_out) >= 0);
+	if (ringbuf_used(& port->rx) >= USB_CDCACM_RX_HIGH_WATERMARK)
+	{
+		port->is_rx_throttled = true;
+		port->rx_throttled_frames = 0;
+		port->stats->rx_throttles ++;
+		usb_bulk_ep_nak_set(usbd_dev, port->data_out, true);
+		/* no data is lost, but the host learns the application does
+		 * not keep up without polling the statistics */
+		cdcacm_serial_state(port, USB_CDCACM_SERIAL_STATE_OVERRUN, USB_CDCACM_SERIAL_STATE_OVERRUN);
+	}
+}
+
+/* accounts for the data IN transfers whose terminating packet the host has
+ * acknowledged since the last call */
+static void cdcacm_tx_transfers_complete(usbd_device * usbd_dev, struct cdcacm_port * port)
+{
+	/* the packets the endpoint still holds */
+	uint32_t pending = (USB_CDCACM_DOUBLE_BUFFERED ? 2 : 1) - usb_bulk_ep_write_space(usbd_dev, port->data_in);
+	uint32_t now, cycles;
+
+	while (port->tx_pending_count
+			&& (int32_t) (port->tx_packets - pending - port->tx_pending[0].end_packet) >= 0)
+	{
+		now = dwt_read_cycle_counter();
+		cycles = now - port->tx_pending[0].start;
+		port->stats->tx_transfers ++;
+		port->stats->tx_transfer_cycles += cycles;
+		if (cycles > port->stats->tx_max_transfer_cycles)
+			port->stats->tx_max_transfer_cycles = cycles;
+		port->tx_pending[0] = port->tx_pending[1];
+		port->tx_pending_count --;
+	}
+}
+
+/* moves data from the tx buffer to the data IN endpoint, a packet at a time,
+ * holding back partial packets as the transmit coalescing decides, and
+ * terminating transfers that end on a packet boundary with a zero length
+ * packet; so a transfer of any size goes out as back to back full packets,
+ * and a short one at its end; called on data IN transfer completions, when
+ * the application has queued data in the tx buffer, and when held back data
+ * becomes due */
+static void cdcacm_transmit(usbd_device * usbd_dev, struct cdcacm_port * port)
+{
+	int32_t len;
+
+	if (cdcacm_is_reset_pending(port))
+		return;
+	cdcacm_tx_transfers_complete(usbd_dev, port);
+	cdcacm_count_buffer_level(cdcacm_counters.tx_high_water + (port - cdcacm_ports), & port->tx);
+	while ((len = tx_coalesce_packet_length(& port->tx_coalesce, & port->tx)) >= 0
+			&& usb_bulk_ep_write_packet_ringbuf(usbd_dev, port->data_in, & port->tx, len) >= 0)
+	{
+		if (!port->tx_coalesce.is_transfer_open)
+			port->tx_transfer_start = dwt_read_cycle_counter();
+		tx_coalesce_packet_sent(& port->tx_coalesce, & port->tx, len);
+		cdcacm_count_packet(port->data_in, len);
+		port->tx_packets ++;
+		cdcacm_latency_probe_departure(port);
+		if (!tx_coalesce_is_transfer_end(& port->tx_coalesce, len))
+			continue;
+		/* the endpoint may have completed packets meanwhile; once
+		 * accounted for, each pending transfer holds a packet buffer */
+		cdcacm_tx_transfers_complete(usbd_dev, port);
+		port->tx_pending[port->tx_pending_count ++] = (struct cdcacm_tx_transfer)
+			{ .end_packet = port->tx_packets, .start = port->tx_transfer_start, };
+	}
+	cdcacm_count_held(port->data_in, & port->is_data_in_held, ringbuf_used(& port->tx)
+			&& usb_bulk_ep_write_space(usbd_dev, port->data_in) == (USB_CDCACM_DOUBLE_BUFFERED ? 2 : 1));
+}
+
+/* picks up the ring buffer changes made by the application, on all ports */
+static void cdcacm_service(usbd_device * usbd_dev)
+{
+	struct cdcacm_port * port;
+
+	if (!is_usb_device_configured)
+		return;
+	for (port = cdcacm_ports; port < cdcacm_ports + USB_CDCACM_ALL_PORTS; port ++)
+	{
+		cdcacm_receive(usbd_dev, port);
+		cdcacm_transmit(usbd_dev, port);
+		cdcacm_notify(usbd_dev, port);
+	}
+}
+
+/* services the usb peripheral, and the ring buffers, timing it for the
+ * performance counters */
+static void cdcacm_poll(usbd_device * usbd_dev)
+{
+	uint32_t start = dwt_read_cycle_counter(), cycles;
+
+	usb_trace_event(USB_TRACE_POLL_ENTER, 0, 0);
+	usbd_poll(usbd_dev);
+	cdcacm_service(usbd_dev);
+	usb_trace_event(USB_TRACE_POLL_EXIT, 0, 0);
+	cycles = dwt_read_cycle_counter() - start;
+	cdcacm_counters.services ++;
+	if (cycles > cdcacm_counters.max_service_cycles)
+		cdcacm_counters.max_service_cycles = cycles;
+}
+
+/* the main loop has kept the usb peripheral from being serviced for 'cycles'
+ * cpu cycles */
+static void cdcacm_count_service_latency(uint32_t cycles)
+{
+	if (cycles > cdcacm_counters.max_service_latency)
+		cdcacm_counters.max_service_latency = cycles;
+}
+
+/* called by the application after it has read from an rx buffer, written
+ * to a tx buffer, or queued an urgent message */
+static void cdcacm_kick(void)
+{
+#if USB_CDCACM_USE_INTERRUPT
+	/* the ring buffers are only ever serviced in interrupt context */
+	nvic_set_pending_irq(NVIC_USB_LP_CAN_RX0_IRQ);
+#endif
+}
+
+/* called by the application to have the data written to the tx buffer so far
+ * sent without waiting for more, for latency critical messages */
+static void cdcacm_flush(struct cdcacm_port * port)
+{
+	tx_coalesce_flush(& port->tx_coalesce, & port->tx);
+	cdcacm_kick();
+}
+
+/* called by the application, from the main loop, to carry out the reset of
+ * the port requested by a usb configuration, if any; the data already in the
+ * ring buffers, and the urgent messages queued, are dropped */
+static void cdcacm_reset(struct cdcacm_port * port)
+{
+	if (!cdcacm_is_reset_pending(port))
+		return;
+	ringbuf_reset(& port->rx);
+	ringbuf_reset(& port->tx);
+	tx_coalesce_reset(& port->tx_coalesce);
+	port->urgent_head = port->urgent_tail = 0;
+	port->is_latency_probe_active = false;
+	__atomic_store_n(& port->is_reset_pending, false, __ATOMIC_RELEASE);
+	/* for the endpoint handlers to release the data OUT endpoint */
+	cdcacm_kick();
+}
+
+#if USB_CDCACM_ISOCHRONOUS
+/* the isochronous stream; the application is the producer of the sample
+ * buffer, and the start of frame handler its consumer, which passes one
+ * packet of samples per frame to the endpoint - the host collects it in the
+ * next frame, while the handler writes the following packet to the other
+ * endpoint buffer; the endpoint and the sample buffer are only active while
+ * the host has selected the alternate setting of the data interface with
+ * the endpoint */
+static struct
+{
+	struct ringbuf	samples;
+	volatile bool	is_streaming;
+	/* set when the host has collected the packet written last */
+	bool		is_buffer_free;
+}
+cdcacm_iso;
+
+static uint8_t cdcacm_iso_data[USB_CDCACM_ISO_BUFFER_SIZE] RINGBUF_ALIGNED;
+
+static void cdcacm_iso_sof(usbd_device * usbd_dev)
+{
+	struct cdcacm_stats * stats = cdcacm_stats;
+	uint32_t len = ringbuf_used(& cdcacm_iso.samples);
+
+	if (!cdcacm_iso.is_streaming)
+		return;
+	if (!cdcacm_iso.is_buffer_free)
+	{
+		/* the packet written last is still waiting for the host; the
+		 * samples wait in the buffer */
+		stats->iso_missed_frames ++;
+		return;
+	}
+	if (len < USB_CDCACM_ISO_PACKET_SIZE)
+		stats->iso_underruns ++;
+	else
+		len = USB_CDCACM_ISO_PACKET_SIZE;
+	usb_iso_ep_write_packet_ringbuf(usbd_dev, USB_CDCACM_ISO_IN_ENDPOINT_ADDRESS, & cdcacm_iso.samples, len);
+	cdcacm_count_packet(USB_CDCACM_ISO_IN_ENDPOINT_ADDRESS, len);
+	cdcacm_iso.is_buffer_free = false;
+	stats->iso_packets ++;
+	stats->iso_bytes += len;
+}
+
+static void usbd_cdcacm_iso_callback(usbd_device * usbd_dev, uint8_t ep)
+{
+	(void) usbd_dev;
+	usb_trace_event(USB_TRACE_CTR, ep | 0x80, 0);
+	cdcacm_iso.is_buffer_free = true;
+}
+
+/* called when the host selects an alternate setting of an interface */
+static void usbd_cdcacm_set_altsetting_callback(usbd_device * usbd_dev, uint16_t wIndex, uint16_t wValue)
+{
+	if (wIndex != USB_CDCACM_DATA_INTERFACE_NUMBER(0))
+		return;
+	cdcacm_iso.is_streaming = false;
+	usb_iso_ep_enable(usbd_dev, USB_CDCACM_ISO_IN_ENDPOINT_ADDRESS, wValue == 1);
+	/* the samples queued before the stream starts are stale; the start
+	 * of frame handler is the consumer of the sample buffer */
+	ringbuf_commit_read(& cdcacm_iso.samples, ringbuf_used(& cdcacm_iso.samples));
+	cdcacm_iso.is_buffer_free = true;
+	cdcacm_iso.is_streaming = wValue == 1;
+}
+
+/* called by the application to queue a sample of 'len' bytes for the
+ * isochronous stream; returns false, and drops the sample, if the stream is
+ * not running or the sample buffer is full */
+static bool cdcacm_iso_write(const void * data, uint32_t len)
+{
+	if (!cdcacm_iso.is_streaming)
+		return false;
+	if (ringbuf_free(& cdcacm_iso.samples) < len)
+	{
+		cdcacm_stats[0].iso_overruns ++;
+		return false;
+	}
+	ringbuf_write(& cdcacm_iso.samples, data, len);
+	return true;
+}
+#endif
+
+/* called on every start of frame, i.e. every millisecond */
+static void usbd_cdcacm_sof_callback(void)
+{
+	struct cdcacm_port * port;
+
+	usb_trace_event(USB_TRACE_SOF, 0, * USB_FNR_REG & USB_FNR_FN);
+	if (!is_usb_device_configured)
+		return;
+	for (port = cdcacm_ports; port < cdcacm_ports + USB_CDCACM_ALL_PORTS; port ++)
+	{
+		if (cdcacm_is_reset_pending(port))
+			continue;
+		if (port->is_rx_throttled)
+		{
+			port->stats->rx_throttled_frames ++;
+			if (++ port->rx_throttled_frames > port->stats->rx_max_throttled_frames)
+				port->stats->rx_max_throttled_frames = port->rx_throttled_frames;
+		}
+		if (tx_coalesce_sof(& port->tx_coalesce, & port->tx))
+			cdcacm_transmit(usbd_cdcacm_device, port);
+	}
+#if USB_CDCACM_ISOCHRONOUS
+	cdcacm_iso_sof(usbd_cdcacm_device);
+#endif
+}
+
+static void usbd_cdcacm_data_out_callback(usbd_device * usbd_dev, uint8_t ep)
+{
+	usb_trace_event(USB_TRACE_CTR, ep, usb_bulk_ep_packet_length(usbd_dev, ep) >= 0);
+	cdcacm_receive(usbd_dev, cdcacm_port_of_endpoint(ep));
+}
+
+static void usbd_cdcacm_data_in_callback(usbd_device * usbd_dev, uint8_t ep)
+{
+	/* the endpoint number passed lacks the direction bit */
+	usb_trace_event(USB_TRACE_CTR, ep | 0x80, 0);
+	cdcacm_transmit(usbd_dev, cdcacm_port_of_endpoint(ep));
+}
+
+static void usbd_cdcacm_notification_callback(usbd_device * usbd_dev, uint8_t ep)
+{
+	struct cdcacm_port * port = cdcacm_port_of_endpoint(ep);
+
+	usb_trace_event(USB_TRACE_CTR, ep | 0x80, 0);
+	port->is_notification_pending = false;
+	cdcacm_notify(usbd_dev, port);
+}
+
+static void usbd_cdcacm_set_config_callback(usbd_device * usbd_dev, uint16_t wValue)
+{
+	struct cdcacm_port * port;
+
+	/* suppress compiler warnings */
+	(void) wValue;
+
+	for (port = cdcacm_ports; port < cdcacm_ports + USB_CDCACM_ALL_PORTS; port ++)
+	{
+		/* the ring buffers are reset by the application */
+		port->is_reset_pending = true;
+		port->tx_pending_count = 0;
+		port->line_coding = cdcacm_default_line_coding;
+		port->control_line_state = 0;
+		port->serial_state = port->serial_events = 0;
+		port->is_serial_state_changed = false;
+		port->is_notification_pending = false;
+		if (port->notification)
+			usbd_ep_setup(usbd_dev, port->notification, USB_ENDPOINT_ATTR_INTERRUPT,
+					USB_CDCACM_PACKET_SIZE, usbd_cdcacm_notification_callback);
+		usb_bulk_ep_setup(usbd_dev, port->data_in, USB_CDCACM_PACKET_SIZE,
+				USB_CDCACM_DOUBLE_BUFFERED, usbd_cdcacm_data_in_callback);
+		usb_bulk_ep_setup(usbd_dev, port->data_out, USB_CDCACM_PACKET_SIZE,
+				USB_CDCACM_DOUBLE_BUFFERED, usbd_cdcacm_data_out_callback);
+		/* no data is received until the reset is done; the data OUT
+		 * endpoint is throttled, and released by cdcacm_receive() once
+		 * the reset rx buffer is found below its low watermark */
+		port->is_rx_throttled = true;
+		port->rx_throttled_frames = 0;
+		usb_bulk_ep_nak_set(usbd_dev, port->data_out, true);
+	}
+#if USB_CDCACM_ISOCHRONOUS
+	/* the alternate setting without the isochronous endpoint is selected
+	 * on a configuration */
+	cdcacm_iso.is_streaming = false;
+	usb_iso_in_ep_setup(usbd_dev, USB_CDCACM_ISO_IN_ENDPOINT_ADDRESS, USB_CDCACM_ISO_PACKET_SIZE,
+			usbd_cdcacm_iso_callback);
+#endif
+	usbd_cdcacm_register_descriptor_callback(usbd_dev);
+	usbd_register_control_callback(usbd_dev,
+			USB_REQ_TYPE_CLASS | USB_REQ_TYPE_INTERFACE,
+			USB_REQ_TYPE_TYPE | USB_REQ_TYPE_RECIPIENT,
+			usbd_cdcacm_class_request_callback);
+	usbd_register_control_callback(usbd_dev,
+			USB_REQ_TYPE_VENDOR | USB_REQ_TYPE_INTERFACE,
+			USB_REQ_TYPE_TYPE | USB_REQ_TYPE_RECIPIENT,
+			usbd_cdcacm_vendor_request_callback);
+	is_usb_device_configured = true;
+}
+
+static void usbd_cdcacm_reset_callback(void)
+{
+	usb_trace_event(USB_TRACE_RESET, 0, 0);
+	is_usb_device_configured = false;
+}
+
+#if USB_CDCACM_USE_INTERRUPT
+void usb_lp_can_rx0_isr(void)
+{
+	cdcacm_poll(usbd_cdcacm_device);
+}
+#endif
+
+/* simple loopback test, on each port; all data received from the host is
+ * echoed back to it, and every chunk of echoed data - of up to a packet size -
+ * is followed by a ">>>" marker
+ *
+ * a '!' in the received data is a latency critical request, which is also
+ * acknowledged through the notification endpoint as soon as it is received -
+ * ahead of the echo of all data received before it - with an urgent message
+ * whose value counts the acknowledgements, and which holds the rx stream
+ * offset of the '!' */
+enum
+{
+	LOOPBACK_URGENT_ACK	= 1,
+};
+
+static struct loopback
+{
+	/* the rx stream offset the received data is scanned for requests up
+	 * to, and the requests acknowledged */
+	uint32_t	scan;
+	uint16_t	acks;
+	/* the test mode of the port, see below */
+	uint8_t		mode;
+	/* the PRBS generator state, and the checker */
+	uint32_t	prbs;
+	struct prbs_checker	prbs_checker;
+}
+loopbacks[USB_CDCACM_PORTS];
+
+static bool loopback_can_acknowledge(struct loopback * l, struct cdcacm_port * port)
+{
+	return l->scan != ringbuf_load(& port->rx.head);
+}
+
+static void loopback_acknowledge(struct loopback * l, struct cdcacm_port * port)
+{
+	uint32_t tail = port->rx.tail, head = ringbuf_load(& port->rx.head);
+
+	/* the rx buffer is emptied on a usb reconfiguration */
+	if (l->scan - tail > head - tail)
+		l->scan = tail;
+	if (!loopback_can_acknowledge(l, port))
+		return;
+	for (; l->scan != head; l->scan ++)
+		if (ringbuf_peek(& port->rx, l->scan) == '!')
+		{
+			if (!cdcacm_urgent_write(port, LOOPBACK_URGENT_ACK, l->acks, & l->scan, sizeof l->scan))
+				/* retried on the next round */
+				break;
+			l->acks ++;
+		}
+	cdcacm_kick();
+}
+
+static bool loopback_can_process(struct cdcacm_port * port)
+{
+	return ringbuf_used(& port->rx) && ringbuf_free(& port->tx) >= USB_CDCACM_PACKET_SIZE + 3;
+}
+
+static void loopback_process(struct loopback * l, struct cdcacm_port * port)
+{
+	uint32_t len;
+
+	loopback_acknowledge(l, port);
+	if (!loopback_can_process(port))
+		return;
+	do
+	{
+		len = ringbuf_move(& port->tx, & port->rx, USB_CDCACM_PACKET_SIZE);
+		ringbuf_write(& port->tx, ">>>", 3);
+	}
+	while (loopback_can_process(port));
+	/* a chunk shorter than a packet ends a message from the host - as a
+	 * short packet ends a usb transfer - so once all received data is
+	 * answered, the answer is sent right away; data streamed in full
+	 * packets is left to coalesce */
+	if (len < USB_CDCACM_PACKET_SIZE && !ringbuf_used(& port->rx))
+		cdcacm_flush(port);
+	else
+		cdcacm_kick();
+}
+
+/* test modes, for measuring the throughput of each direction on its own; a
+ * port runs the loopback above, or
+ *	- an IN source, which sends data as fast as the host reads it, with
+ *	no regard to its content - the tx buffer is passed on as it is
+ *	- an OUT sink, which discards all data received
+ *	- a PRBS generator, sending a PRBS-31 stream (see prbs.h), and a
+ *	checker of the stream received - which the host sends from a
+ *	generator of its own - counting the bytes in error
+ *	- a latency probe, which echoes the received data as it is, with no
+ *	markers, sending it right away, while the driver measures the time
+ *	the device takes to answer each packet (see
+ *	cdcacm_latency_probe_start()); the host reads the latency histogram
+ *	with a vendor request (see cdcacm-requests.h)
+ * the host selects a mode by setting one of the baud rates below, which are
+ * of no use for a usb serial port otherwise - e.g. with 'stty 50' - and any
+ * other rate selects the USB_CDCACM_TEST_MODE of the build; the counts of
+ * the bytes generated, received and in error are kept in the port
+ * statistics; a mode change restarts the PRBS generator, and the checker */
+enum
+{
+	TEST_MODE_LOOPBACK,
+	TEST_MODE_SOURCE,
+	TEST_MODE_SINK,
+	TEST_MODE_PRBS,
+	TEST_MODE_LATENCY,
+
+	TEST_MODE_SOURCE_BAUD_RATE	= 50,
+	TEST_MODE_SINK_BAUD_RATE	= 75,
+	TEST_MODE_PRBS_BAUD_RATE	= 110,
+	TEST_MODE_LATENCY_BAUD_RATE	= 134,
+};
+
+static uint8_t test_mode_of_port(struct cdcacm_port * port)
+{
+	switch (port->line_coding.dwDTERate)
+	{
+		case TEST_MODE_SOURCE_BAUD_RATE:
+			return TEST_MODE_SOURCE;
+		case TEST_MODE_SINK_BAUD_RATE:
+			return TEST_MODE_SINK;
+		case TEST_MODE_PRBS_BAUD_RATE:
+			return TEST_MODE_PRBS;
+		case TEST_MODE_LATENCY_BAUD_RATE:
+			return TEST_MODE_LATENCY;
+	}
+	return USB_CDCACM_TEST_MODE;
+}
+
+/* the generators fill the tx buffer in whole packets, so that they go out
+ * right away, as full packets */
+static bool test_can_generate(struct cdcacm_port * port)
+{
+	return ringbuf_free(& port->tx) >= USB_CDCACM_PACKET_SIZE;
+}
+
+static void test_generate(struct loopback * l, struct cdcacm_port * port)
+{
+	uint32_t len = ringbuf_free(& port->tx) / USB_CDCACM_PACKET_SIZE * USB_CDCACM_PACKET_SIZE, chunk;
+	uint8_t * data;
+
+	port->stats->test_tx_bytes += len;
+	if (l->mode == TEST_MODE_SOURCE)
+		ringbuf_commit_write(& port->tx, len);
+	else
+		/* at most two chunks, if the free space wraps around the end of
+		 * the buffer */
+		for (; len; len -= chunk)
+		{
+			chunk = ringbuf_write_region(& port->tx, & data);
+			if (chunk > len)
+				chunk = len;
+			prbs_generate(& l->prbs, data, chunk);
+			ringbuf_commit_write(& port->tx, chunk);
+		}
+	cdcacm_kick();
+}
+
+static void test_consume(struct loopback * l, struct cdcacm_port * port)
+{
+	const uint8_t * data;
+	uint32_t len;
+
+	while ((len = ringbuf_read_region(& port->rx, & data)))
+	{
+		port->stats->test_rx_bytes += len;
+		if (l->mode == TEST_MODE_PRBS)
+			port->stats->prbs_errors += prbs_check(& l->prbs_checker, data, len);
+		ringbuf_commit_read(& port->rx, len);
+	}
+	/* the data OUT endpoint may be naking for lack of room in the rx
+	 * buffer */
+	cdcacm_kick();
+}
+
+static bool test_can_echo(struct cdcacm_port * port)
+{
+	return ringbuf_used(& port->rx) && ringbuf_free(& port->tx);
+}
+
+static void test_echo(struct cdcacm_port * port)
+{
+	ringbuf_move(& port->tx, & port->rx, ringbuf_used(& port->rx));
+	if (!ringbuf_used(& port->rx))
+		cdcacm_flush(port);
+	else
+		cdcacm_kick();
+}
+
+static void test_process(struct loopback * l, struct cdcacm_port * port)
+{
+	uint8_t mode = test_mode_of_port(port);
+
+	if (mode != l->mode)
+	{
+		if (l->mode == TEST_MODE_LATENCY)
+			cdcacm_latency_probe_stop(port);
+		l->mode = mode;
+		l->prbs = PRBS_SEED;
+		prbs_checker_reset(& l->prbs_checker);
+	}
+	if (mode == TEST_MODE_LOOPBACK)
+	{
+		loopback_process(l, port);
+		return;
+	}
+	if (mode == TEST_MODE_LATENCY)
+	{
+		/* the probe is stopped by a usb reconfiguration, which empties
+		 * the ring buffers */
+		if (!port->is_latency_probe_active)
+			cdcacm_latency_probe_start(port);
+		if (test_can_echo(port))
+			test_echo(port);
+		return;
+	}
+	if (mode != TEST_MODE_SINK && test_can_generate(port))
+		test_generate(l, port);
+	if (mode != TEST_MODE_SOURCE && ringbuf_used(& port->rx))
+		test_consume(l, port);
+}
+
+#if USB_CDCACM_VENDOR_INTERFACE
+/* the vendor interface loopback echoes the received data as it is, with no
+ * markers; as on the serial ports, data that does not come in whole packets
+ * ends a message from the host, and once all received data is answered, the
+ * answer is sent right away */
+static bool vendor_loopback_can_process(void)
+{
+	struct cdcacm_port * port = cdcacm_ports + USB_CDCACM_PORTS;
+
+	return ringbuf_used(& port->rx) && ringbuf_free(& port->tx);
+}
+
+static void vendor_loopback_process(void)
+{
+	struct cdcacm_port * port = cdcacm_ports + USB_CDCACM_PORTS;
+	uint32_t len;
+
+	if (!vendor_loopback_can_process())
+		return;
+	len = ringbuf_move(& port->tx, & port->rx, ringbuf_used(& port->rx));
+	if (!ringbuf_used(& port->rx) && len % USB_CDCACM_PACKET_SIZE)
+		cdcacm_flush(port);
+	else
+		cdcacm_kick();
+}
+#endif
+
+#if USB_CDCACM_ISOCHRONOUS
+/* a test source for the isochronous stream, standing in for a sampling
+ * peripheral; while the host streams, it produces 4 byte samples - each
+ * holding the cycle counter value it was due at - at the rate of one packet
+ * per millisecond; it runs from the main loop, which the start of frame
+ * interrupts wake up every millisecond */
+_Static_assert(USB_CDCACM_ISO_PACKET_SIZE % sizeof(uint32_t) == 0, "bad USB_CDCACM_ISO_PACKET_SIZE for the test source");
+
+static struct
+{
+	bool		is_running;
+	uint32_t	next;
+}
+iso_source;
+
+static void iso_source_process(void)
+{
+	uint32_t now = dwt_read_cycle_counter();
+	uint32_t period = rcc_ahb_frequency / 1000 * sizeof(uint32_t) / USB_CDCACM_ISO_PACKET_SIZE;
+
+	if (!cdcacm_iso.is_streaming)
+	{
+		iso_source.is_running = false;
+		return;
+	}
+	if (!iso_source.is_running)
+	{
+		iso_source.next = now;
+		iso_source.is_running = true;
+	}
+	for (; (int32_t) (now - iso_source.next) >= 0; iso_source.next += period)
+		cdcacm_iso_write(& iso_source.next, sizeof iso_source.next);
+}
+#endif
+
+static void loopback_process_all(void)
+{
+	int i;
+
+	for (i = 0; i < USB_CDCACM_ALL_PORTS; i ++)
+		cdcacm_reset(cdcacm_ports + i);
+	for (i = 0; i < USB_CDCACM_PORTS; i ++)
+		test_process(loopbacks + i, cdcacm_ports + i);
+#if USB_CDCACM_VENDOR_INTERFACE
+	vendor_loopback_process();
+#endif
+#if USB_CDCACM_ISOCHRONOUS
+	iso_source_process();
+#endif
+}
+
+#if USB_CDCACM_USE_INTERRUPT
+static bool test_can_process(struct loopback * l, struct cdcacm_port * port)
+{
+	if (test_mode_of_port(port) != l->mode)
+		return true;
+	if (l->mode == TEST_MODE_LOOPBACK)
+		return loopback_can_process(port) || loopback_can_acknowledge(l, port);
+	if (l->mode == TEST_MODE_LATENCY)
+		return !port->is_latency_probe_active || test_can_echo(port);
+	return (l->mode != TEST_MODE_SINK && test_can_generate(port))
+		|| (l->mode != TEST_MODE_SOURCE && ringbuf_used(& port->rx));
+}
+
+static bool loopback_has_work(void)
+{
+	int i;
+
+	for (i = 0; i < USB_CDCACM_ALL_PORTS; i ++)
+		if (cdcacm_is_reset_pending(cdcacm_ports + i))
+			return true;
+	for (i = 0; i < USB_CDCACM_PORTS; i ++)
+		if (test_can_process(loopbacks + i, cdcacm_ports + i))
+			return true;
+#if USB_CDCACM_VENDOR_INTERFACE
+	if (vendor_loopback_can_process())
+		return true;
+#endif
+	return false;
+}
+#endif
+
+int main(void)
+{
+	int i;
+
+	rcc_periph_clock_enable(RCC_GPIOA);
+	rcc_clock_setup_in_hse_8mhz_out_72mhz();
+	/* for the transfer completion latency statistics */
+	dwt_enable_cycle_counter();
+	for (i = 0; i < USB_CDCACM_ALL_PORTS; i ++)
+	{
+		struct cdcacm_port * port = cdcacm_ports + i;
+
+		if (i < USB_CDCACM_PORTS)
+		{
+			port->data_in = USB_CDCACM_DATA_IN_ENDPOINT_ADDRESS(i);
+			port->data_out = USB_CDCACM_DATA_OUT_ENDPOINT_ADDRESS(i);
+			port->notification = USB_CDCACM_COMMUNICATION_IN_ENDPOINT_ADDRESS(i);
+			port->control_interface = USB_CDCACM_CONTROL_INTERFACE_NUMBER(i);
+		}
+		else
+		{
+			port->data_in = USB_CDCACM_VENDOR_IN_ENDPOINT_ADDRESS;
+			port->data_out = USB_CDCACM_VENDOR_OUT_ENDPOINT_ADDRESS;
+			port->notification = 0;
+			port->control_interface = USB_CDCACM_VENDOR_INTERFACE_NUMBER;
+		}
+		port->stats = cdcacm_stats + i;
+		ringbuf_init(& port->rx, cdcacm_rx_data[i], sizeof cdcacm_rx_data[i]);
+		ringbuf_init(& port->tx, cdcacm_tx_data[i], sizeof cdcacm_tx_data[i]);
+		tx_coalesce_init(& port->tx_coalesce, USB_CDCACM_PACKET_SIZE, USB_CDCACM_TX_FLUSH_DEADLINE_MS, & port->stats->tx);
+	}
+	usbd_cdcacm_device = usbd_init(& st_usbfs_v1_usb_driver, & usb_device_descriptor, & usb_config_descriptor,
+			usb_strings, sizeof usb_strings / sizeof * usb_strings,
+			usb_control_buffer, sizeof usb_control_buffer);
+	usbd_cdcacm_register_descriptor_callback(usbd_cdcacm_device);
+	usbd_register_set_config_callback(usbd_cdcacm_device, usbd_cdcacm_set_config_callback);
+	usbd_register_reset_callback(usbd_cdcacm_device, usbd_cdcacm_reset_callback);
+	usbd_register_sof_callback(usbd_cdcacm_device, usbd_cdcacm_sof_callback);
+#if USB_CDCACM_ISOCHRONOUS
+	ringbuf_init(& cdcacm_iso.samples, cdcacm_iso_data, sizeof cdcacm_iso_data);
+	usbd_register_set_altsetting_callback(usbd_cdcacm_device, usbd_cdcacm_set_altsetting_callback);
+#endif
+#if USB_CDCACM_USE_INTERRUPT
+	nvic_enable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
+	/* all usb work is done in the usb interrupt; the main loop is free
+	 * for application code */
+	while (1)
+	{
+		uint32_t masked;
+
+		loopback_process_all();
+		cdcacm_counters.main_loop_iterations ++;
+		/* sleep until there is something to do; interrupts are masked
+		 * while checking, so that an interrupt that makes work for the
+		 * main loop can not be taken between the check and the wait -
+		 * a pending interrupt ends the wait even while masked, and the
+		 * time asleep is not counted as service latency */
+		cm_disable_interrupts();
+		masked = dwt_read_cycle_counter();
+		if (!loopback_has_work())
+		{
+			__WFI();
+			masked = dwt_read_cycle_counter();
+		}
+		cdcacm_count_service_latency(dwt_read_cycle_counter() - masked);
+		cm_enable_interrupts();
+	}
+#else
+	while (1)
+	{
+		uint32_t serviced;
+
+		cdcacm_poll(usbd_cdcacm_device);
+		serviced = dwt_read_cycle_counter();
+		loopback_process_all();
+		INSTRUMENT_MAIN_LOOP();
+		cdcacm_counters.main_loop_iterations ++;
+		cdcacm_count_service_latency(dwt_read_cycle_counter() - serviced);
+	}
+#endif
+}
@@ -0,0 +1,69 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* isochronous IN endpoints for the stm32 usb full speed peripheral; see
+ * usb-iso.h, and the rm0008 reference manual, section 'isochronous
+ * transfers' */
+
+#include <libopencm3/stm32/st_usbfs.h>
+#include "usb-iso.h"
+#include "pma.h"
+#include "instrument.h"
+
+void usb_iso_in_ep_setup(usbd_device * usbd_dev, uint8_t addr, uint16_t max_size,
+		usbd_endpoint_callback callback)
+{
+	uint8_t ep = addr & 0x7f;
+
+	/* let the libopencm3 driver allocate packet memory for both buffers,
+	 * and set up the endpoint register; then describe the second buffer
+	 * with the 'rx' entries of the buffer descriptor table */
+	usbd_ep_setup(usbd_dev, addr, USB_ENDPOINT_ATTR_ISOCHRONOUS, 2 * max_size, callback);
+	USB_SET_EP_RX_ADDR(ep, USB_GET_EP_TX_ADDR(ep) + max_size);
+	usb_iso_ep_enable(usbd_dev, addr, false);
+}
+
+void usb_iso_ep_enable(usbd_device * usbd_dev, uint8_t addr, bool enable)
+{
+	uint8_t ep = addr & 0x7f;
+
+	(void) usbd_dev;
+	USB_SET_EP_TX_COUNT(ep, 0);
+	USB_SET_EP_RX_COUNT(ep, 0);
+	USB_CLR_EP_TX_DTOG(ep);
+	USB_SET_EP_TX_STAT(ep, enable ? USB_EP_TX_STAT_VALID : USB_EP_TX_STAT_DISABLED);
+}
+
+void usb_iso_ep_write_packet_ringbuf(usbd_device * usbd_dev, uint8_t addr, struct ringbuf * r, uint16_t len)
+{
+	uint8_t ep = addr & 0x7f;
+	/* the peripheral sends the buffer selected by DTOG_TX next */
+	bool buffer = !(* USB_EP_REG(ep) & USB_EP_TX_DTOG);
+
+	(void) usbd_dev;
+	INSTRUMENT_PACKET();
+	pma_write_from_ringbuf(buffer ? USB_GET_EP_RX_ADDR(ep) : USB_GET_EP_TX_ADDR(ep), r, len);
+	if (buffer)
+		USB_SET_EP_RX_COUNT(ep, len);
+	else
+		USB_SET_EP_TX_COUNT(ep, len);
+}
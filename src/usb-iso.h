@@ -0,0 +1,60 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* isochronous IN endpoints for the stm32 usb full speed peripheral
+ * ('st_usbfs_v1'), with packet transfers that go straight from ring buffers
+ * to packet memory
+ *
+ * the peripheral always double buffers isochronous endpoints; it sends the
+ * buffer selected by DTOG_TX in reply to the IN token of a frame - whatever
+ * that buffer holds, as there is no handshake, and no nak - and then toggles
+ * DTOG_TX and sets CTR_TX; the firmware writes the packet for a later frame to
+ * the other buffer; buffer 0 is described by the 'tx' entries of the buffer
+ * descriptor table, buffer 1 by the 'rx' entries, as for double buffered bulk
+ * endpoints (see usb-bulk.h)
+ *
+ * the endpoints are set up through the libopencm3 core, from a set
+ * configuration callback, and their transfer completions are dispatched to
+ * the registered endpoint callbacks as usual */
+
+#ifndef USB_ISO_H
+#define USB_ISO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <libopencm3/usb/usbd.h>
+#include "ringbuf.h"
+
+/* sets up endpoint 'addr' as a disabled isochronous IN endpoint with two
+ * 'max_size' byte packet buffers; 'callback' is invoked each time a packet
+ * has been sent */
+void usb_iso_in_ep_setup(usbd_device * usbd_dev, uint8_t addr, uint16_t max_size,
+		usbd_endpoint_callback callback);
+/* enables or disables the endpoint; a disabled endpoint does not respond to
+ * the host, an enabled one starts out sending zero length packets */
+void usb_iso_ep_enable(usbd_device * usbd_dev, uint8_t addr, bool enable);
+/* writes a packet from the first 'len' bytes of a ring buffer to the buffer
+ * the peripheral is not going to send next - replacing the packet written
+ * there before, if the peripheral has not sent the other buffer since */
+void usb_iso_ep_write_packet_ringbuf(usbd_device * usbd_dev, uint8_t addr, struct ringbuf * r, uint16_t len);
+
+#endif /* USB_ISO_H */
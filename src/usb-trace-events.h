@@ -0,0 +1,79 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* the records of the usb event trace (see usb-trace.h), as the host side
+ * tools read them from the device - with the CDCACM_REQ_READ_TRACE vendor
+ * request (cdcacm-requests.h) of the usb cdc acm firmware */
+
+#ifndef USB_TRACE_EVENTS_H
+#define USB_TRACE_EVENTS_H
+
+#include <stdint.h>
+
+/* the event types; a trace mask has bit (1 << type) set for each type
+ * recorded */
+enum
+{
+	/* usb bus reset */
+	USB_TRACE_RESET		= 0,
+	/* start of frame; 'value' is the frame number */
+	USB_TRACE_SOF		= 1,
+	/* transfer completion (CTR) on endpoint 'ep' - a packet has been
+	 * received on an OUT endpoint, or sent from an IN endpoint; the
+	 * driver reads the packets of an OUT endpoint as it finds them, so it
+	 * may have read the packet before the completion is handled - 'value'
+	 * is 1 if the endpoint still holds a packet, 0 if not */
+	USB_TRACE_CTR		= 2,
+	/* the driver has read a 'value' byte packet from an OUT endpoint, or
+	 * passed one to an IN endpoint */
+	USB_TRACE_PACKET	= 3,
+	/* the driver has started ('value' 1), or stopped ('value' 0), holding
+	 * data back from the host on an endpoint, which naks the host
+	 * meanwhile (see 'struct cdcacm_endpoint_counters') */
+	USB_TRACE_NAK		= 4,
+	/* the usb peripheral is being serviced - from the usb interrupt, or
+	 * the main loop of a polled build - and is done */
+	USB_TRACE_POLL_ENTER	= 5,
+	USB_TRACE_POLL_EXIT	= 6,
+	USB_TRACE_TYPES,
+};
+
+struct usb_trace_event
+{
+	/* the cpu cycle counter */
+	uint32_t	time;
+	uint8_t		type;
+	uint8_t		ep;
+	uint16_t	value;
+};
+
+/* the data read from the trace; as many events as fit in the transfer, or
+ * as there are, follow the header, oldest first */
+struct usb_trace_header
+{
+	/* the cpu clock, the unit of the event times */
+	uint32_t	cpu_hz;
+	/* the events not recorded so far because the trace was full */
+	uint32_t	dropped;
+};
+
+#endif /* USB_TRACE_EVENTS_H */
@@ -0,0 +1,49 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* the usb event trace; see usb-trace.h */
+
+#include <string.h>
+#include <libopencm3/stm32/rcc.h>
+#include "usb-trace.h"
+
+struct usb_trace usb_trace;
+
+void usb_trace_set_mask(uint32_t mask)
+{
+	usb_trace.mask = mask & ((1 << USB_TRACE_TYPES) - 1);
+}
+
+uint32_t usb_trace_read(void * buf, uint32_t len)
+{
+	struct usb_trace * t = & usb_trace;
+	struct usb_trace_header header = { .cpu_hz = rcc_ahb_frequency, .dropped = t->dropped, };
+	struct usb_trace_event * e = (struct usb_trace_event *) ((uint8_t *) buf + sizeof header);
+	uint32_t n;
+
+	if (len < sizeof header)
+		return 0;
+	memcpy(buf, & header, sizeof header);
+	for (n = 0; t->tail != t->head && sizeof header + (n + 1) * sizeof * e <= len; n ++)
+		e[n] = t->events[t->tail ++ & (USB_TRACE_EVENTS - 1)];
+	return sizeof header + n * sizeof * e;
+}
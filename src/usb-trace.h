@@ -0,0 +1,84 @@
+/*
+Copyright (c) 2016 Stoyan Shopov (stoyan.shopov@gmail.com)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* a usb event trace, for finding out where the time goes when throughput
+ * drops - whether the host stopped polling, the device held the host off,
+ * or the firmware was busy elsewhere; events are recorded with a cycle
+ * counter timestamp in a ring in ram, at the cost of a few cycles each, and
+ * the host drains the ring through a vendor request; the event types are
+ * in usb-trace-events.h, which the host side tools share
+ *
+ * all events are recorded, and the ring is drained, from the usb interrupt
+ * (or from the main loop, when the usb peripheral is polled), so no locking
+ * is needed; when the ring is full, new events are dropped and counted - so
+ * the trace has a gap, rather than a missing beginning; the trace mask
+ * selects the event types recorded, and is clear - tracing is off - at
+ * startup */
+
+#ifndef USB_TRACE_H
+#define USB_TRACE_H
+
+#include <stdint.h>
+#include <libopencm3/cm3/dwt.h>
+#include "ringbuf.h"
+#include "usb-trace-events.h"
+
+/* the trace ring size, in events; a power of two */
+#ifndef USB_TRACE_EVENTS
+#define USB_TRACE_EVENTS	256
+#endif
+
+_Static_assert(RINGBUF_IS_POWER_OF_TWO(USB_TRACE_EVENTS), "bad USB_TRACE_EVENTS");
+
+struct usb_trace
+{
+	uint32_t		mask;
+	uint32_t		head, tail;
+	uint32_t		dropped;
+	struct usb_trace_event	events[USB_TRACE_EVENTS];
+};
+
+extern struct usb_trace usb_trace;
+
+static inline void usb_trace_event(uint8_t type, uint8_t ep, uint16_t value)
+{
+	struct usb_trace * t = & usb_trace;
+
+	if (!(t->mask & 1 << type))
+		return;
+	if (t->head - t->tail == USB_TRACE_EVENTS)
+	{
+		t->dropped ++;
+		return;
+	}
+	t->events[t->head ++ & (USB_TRACE_EVENTS - 1)] = (struct usb_trace_event)
+		{ .time = dwt_read_cycle_counter(), .type = type, .ep = ep, .value = value, };
+}
+
+/* selects the event types recorded ('1 << USB_TRACE_xxx' bits) */
+void usb_trace_set_mask(uint32_t mask);
+/* moves the oldest events out of the trace to 'buf', after a 'struct
+ * usb_trace_header', as many as fit in 'len' bytes; returns the number of
+ * bytes written */
+uint32_t usb_trace_read(void * buf, uint32_t len);
+
+#endif /* USB_TRACE_H */